@@ -0,0 +1,298 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Bulk fetching benchmark (make bench-batch)
+ * The same URLs are fetched through both backends of batch.h from a capsule that's served on the loopback interface
+ * by other threads. Every request opens its own connection, so a tiny page is mostly the TLS handshake while
+ * a larger one is mostly receiving. Both backends take turns for TOTAL_ROUNDS rounds, so that whatever else is going
+ * on in the machine hits them alike, and the spread of the requests per second and of the CPU time that the
+ * fetching thread spent on every request is printed as JSON lines, followed by the latency percentiles
+ * Finally, the tiny page is fetched by more and more workers (see workers.h) to see how close to linear it scales
+ * Usage: bench-batch [scale], where scale multiplies the amount of requests
+ */
+
+#include "bench.h"
+#include "../src/batch.h"
+#include "../src/server.h"
+#include "../src/astrology.h"
+#include "../src/common.h"
+#include "../src/workers.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PORT 1972
+#define CONCURRENCY 64
+#define MEDIUM_PAGE_SIZE (64 * 1024)
+
+// A single round varies by tens of percent on a busy machine, so only the spread of several means anything
+#define TOTAL_ROUNDS 5
+
+static const char tiny_page[] = "# Tiny\nA page that fits into a single packet.\n=> /tiny Itself\n";
+
+// The capsule runs as many servers as there are cores, so that it doesn't hold the workers back
+static struct
+{
+    gemini_server_t *servers;
+    size_t total_servers;
+    DYN_ARRAY(char) medium_page;
+} capsule;
+
+// The same scenario through the same backend, over every round
+typedef struct
+{
+    const char *name;
+    size_t expected_length, total_requests;
+    bool allow_io_uring;
+
+    size_t total_failures;
+    bench_samples_t latencies, requests_per_second, cpu_per_request;
+} batch_scenario_t;
+
+static void on_capsule_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    char *path = url + get_hostname_length(url);
+
+    if (!strcmp(path, "/medium"))
+        gemini_server_respond(server, client, "20 text/gemini", capsule.medium_page,
+                              DYN_ARRAY_LENGTH(capsule.medium_page), NULL, NULL);
+    else
+        gemini_server_respond(server, client, "20 text/gemini", tiny_page, sizeof(tiny_page) - 1, NULL, NULL);
+}
+
+static void* run_capsule(void *data)
+{
+    gemini_server_run(data);
+    return NULL;
+}
+
+static void on_response(gemini_request_t *request, void *data)
+{
+    batch_scenario_t *scenario = data;
+
+    if (request->error != GEMINI_OK || !request->content ||
+        DYN_ARRAY_LENGTH(request->content) != scenario->expected_length)
+    {
+        scenario->total_failures++;
+        return;
+    }
+
+    scenario->latencies = bench_samples_add(scenario->latencies, request->finished_at - request->started_at);
+}
+
+// The workers report from several threads at once
+static void on_parallel_response(gemini_request_t *request, void *data)
+{
+    atomic_size_t *total_failures = data;
+
+    if (request->error != GEMINI_OK || !request->content)
+        atomic_fetch_add(total_failures, 1);
+}
+
+// Only the fetching thread is accounted for, the capsule runs on its own
+static uint64_t get_thread_cpu_time(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+    return time.tv_sec * 1000000ull + time.tv_nsec / 1000;
+}
+
+static const char* get_backend_name(batch_backend_e backend)
+{
+    return backend == BATCH_IO_URING ? "io_uring" : "epoll";
+}
+
+// Returns false if io_uring was asked for but isn't available
+static bool measure_backend(SSL_CTX *ctx, batch_scenario_t *scenario)
+{
+    char url[64];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d/%s", BENCH_PORT, scenario->name);
+
+    char *urls[scenario->total_requests];
+    for (size_t i = 0; i < scenario->total_requests; i++)
+        urls[i] = url;
+
+    batch_t batch;
+    batch_create(&batch, ctx, NULL, CONCURRENCY, scenario->allow_io_uring);
+
+    // The fallback kicks in if io_uring is disabled, there's no point in measuring epoll twice then
+    if (scenario->allow_io_uring && batch.backend != BATCH_IO_URING)
+    {
+        batch_destroy(&batch);
+        return false;
+    }
+
+    uint64_t cpu_before = get_thread_cpu_time();
+    uint64_t start = get_monotonic_time();
+
+    batch_fetch(&batch, urls, scenario->total_requests, on_response, scenario);
+
+    uint64_t elapsed = get_monotonic_time() - start;
+    uint64_t cpu_time = get_thread_cpu_time() - cpu_before;
+    batch_destroy(&batch);
+
+    scenario->requests_per_second = bench_samples_add(scenario->requests_per_second,
+                                                      scenario->total_requests * 1000000 / MAX(elapsed, 1));
+    scenario->cpu_per_request = bench_samples_add(scenario->cpu_per_request, cpu_time / scenario->total_requests);
+    return true;
+}
+
+// Returns false if any of the responses didn't arrive in one piece
+static bool report_scenario(batch_scenario_t *scenario)
+{
+    // Skipped altogether, io_uring isn't available
+    if (!DYN_ARRAY_LENGTH(scenario->requests_per_second))
+        return true;
+
+    char benchmark[64];
+    snprintf(benchmark, sizeof(benchmark), "%s/%s", scenario->name,
+             get_backend_name(scenario->allow_io_uring ? BATCH_IO_URING : BATCH_EPOLL));
+
+    printf("{\"suite\":\"batch\",\"benchmark\":\"%s\",\"requests\":%zu,\"concurrency\":%d,\"rounds\":%zu,"
+           "\"failures\":%zu}\n", benchmark, scenario->total_requests, CONCURRENCY,
+           DYN_ARRAY_LENGTH(scenario->requests_per_second), scenario->total_failures);
+
+    bench_report("batch", benchmark, "requests_per_second", "1/s", scenario->requests_per_second);
+    bench_report("batch", benchmark, "cpu_per_request", "us", scenario->cpu_per_request);
+    bench_report("batch", benchmark, "latency", "us", scenario->latencies);
+
+    if (scenario->total_failures)
+        fprintf(stderr, "{bench} %zu requests of %s failed\n", scenario->total_failures, benchmark);
+
+    dyn_array_destroy(scenario->requests_per_second);
+    dyn_array_destroy(scenario->cpu_per_request);
+    dyn_array_destroy(scenario->latencies);
+
+    return scenario->total_failures == 0;
+}
+
+// Returns the requests per second
+static double measure_workers(size_t total_workers, size_t total_requests, bool *has_succeeded)
+{
+    // A single host would all end up in the same worker, so the URLs are spread over a thousand of them
+    // They're all 127.0.0.1, just spelled with a different amount of leading zeros (inet_aton reads them as octal)
+    char (*hosts)[64] = malloc(total_requests * sizeof(*hosts));
+    char **urls = malloc(total_requests * sizeof(char*));
+
+    for (size_t i = 0; i < total_requests; i++)
+    {
+        int zeros[3] = {i % 10, i / 10 % 10, i / 100 % 10};
+
+        snprintf(hosts[i], sizeof(hosts[i]), "gemini://%0*o.%0*d.%0*d.1:%d/tiny",
+                 zeros[0] + 4, 0177, zeros[1] + 1, 0, zeros[2] + 1, 0, BENCH_PORT);
+        urls[i] = hosts[i];
+    }
+
+    atomic_size_t total_failures;
+    atomic_init(&total_failures, 0);
+
+    uint64_t start = get_monotonic_time();
+    batch_fetch_in_parallel(urls, total_requests, total_workers, CONCURRENCY, true,
+                            on_parallel_response, &total_failures);
+    double seconds = (get_monotonic_time() - start) / 1e6;
+
+    if (atomic_load(&total_failures))
+    {
+        fprintf(stderr, "{bench} %zu requests with %zu workers failed\n", atomic_load(&total_failures), total_workers);
+        *has_succeeded = false;
+    }
+
+    free(urls);
+    free(hosts);
+    return total_requests / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    size_t scale = argc > 1 ? MAX(atoi(argv[1]), 1) : 1;
+
+    // Not pinned to a single core like the other benchmarks, the workers spread over every core on their own
+    capsule.medium_page = bench_generate_gemtext(MEDIUM_PAGE_SIZE);
+    capsule.total_servers = workers_get_total();
+    capsule.servers = calloc(capsule.total_servers, sizeof(gemini_server_t));
+
+    for (size_t i = 0; i < capsule.total_servers; i++)
+    {
+        if (i == 0)
+            gemini_server_create(&capsule.servers[i], BENCH_PORT, on_capsule_request, NULL);
+        else
+            gemini_server_create_sibling(&capsule.servers[i], &capsule.servers[0], on_capsule_request, NULL);
+
+        pthread_t capsule_thread;
+        pthread_create(&capsule_thread, NULL, run_capsule, &capsule.servers[i]);
+    }
+
+    SSL_CTX *ctx = astrology_create_ssl_context();
+    bool has_succeeded = true;
+
+    // Every round goes through every scenario with io_uring first and epoll second
+    batch_scenario_t scenarios[] = {
+        {"tiny", sizeof(tiny_page) - 1, 2000 * scale, true},
+        {"tiny", sizeof(tiny_page) - 1, 2000 * scale, false},
+        {"medium", DYN_ARRAY_LENGTH(capsule.medium_page), 500 * scale, true},
+        {"medium", DYN_ARRAY_LENGTH(capsule.medium_page), 500 * scale, false}
+    };
+    size_t total_scenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+    bool has_io_uring = true;
+
+    for (size_t i = 0; i < total_scenarios; i++)
+    {
+        scenarios[i].latencies = bench_samples_create(scenarios[i].total_requests * TOTAL_ROUNDS);
+        scenarios[i].requests_per_second = bench_samples_create(TOTAL_ROUNDS);
+        scenarios[i].cpu_per_request = bench_samples_create(TOTAL_ROUNDS);
+    }
+
+    for (int round = 0; round < TOTAL_ROUNDS; round++)
+        for (size_t i = 0; i < total_scenarios; i++)
+            if (has_io_uring || !scenarios[i].allow_io_uring)
+                has_io_uring &= measure_backend(ctx, &scenarios[i]);
+
+    if (!has_io_uring)
+        fprintf(stderr, "{bench} io_uring isn't available, only epoll is measured\n");
+
+    for (size_t i = 0; i < total_scenarios; i++)
+        has_succeeded &= report_scenario(&scenarios[i]);
+
+    // The workers double up to one per core, the last step always uses every core
+    double single_worker = 0;
+    size_t workers = 1;
+
+    for (;;)
+    {
+        double requests_per_second = measure_workers(workers, 2000 * scale, &has_succeeded);
+        single_worker = workers == 1 ? requests_per_second : single_worker;
+
+        printf("{\"suite\":\"batch\",\"benchmark\":\"tiny/workers\",\"workers\":%zu,\"requests\":%zu,"
+               "\"requests_per_second\":%.0f,\"speedup\":%.2f,\"efficiency\":%.2f}\n",
+               workers, 2000 * scale, requests_per_second, requests_per_second / single_worker,
+               requests_per_second / single_worker / workers);
+        fflush(stdout);
+
+        if (workers == capsule.total_servers)
+            break;
+
+        workers = MIN(workers * 2, capsule.total_servers);
+    }
+
+    // The capsule threads run forever, exiting takes them down as well
+    SSL_CTX_free(ctx);
+    return has_succeeded ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Needed for sched_setaffinity
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include <sched.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bench_samples_t bench_samples_create(size_t expected_runs)
+{
+    return dyn_array_create(expected_runs, sizeof(uint64_t));
+}
+
+bench_samples_t bench_samples_add(bench_samples_t samples, uint64_t sample)
+{
+    samples = dyn_array_prepare_new_item(samples);
+    DYN_ARRAY_GET_LAST(samples) = sample;
+
+    return samples;
+}
+
+static int compare_samples(const void *first, const void *second)
+{
+    uint64_t a = *(const uint64_t*) first, b = *(const uint64_t*) second;
+    return (a > b) - (a < b);
+}
+
+// Nearest-rank percentile, the samples must already be sorted
+static uint64_t get_percentile(bench_samples_t samples, double percentile)
+{
+    size_t total = DYN_ARRAY_LENGTH(samples);
+    size_t rank = (size_t) ceil(percentile / 100 * total);
+
+    return samples[rank ? rank - 1 : 0];
+}
+
+void bench_report(const char *suite, const char *benchmark, const char *metric, const char *unit,
+                  bench_samples_t samples)
+{
+    size_t total = DYN_ARRAY_LENGTH(samples);
+    if (!total)
+        return;
+
+    qsort(samples, total, sizeof(uint64_t), compare_samples);
+
+    double sum = 0, squared_sum = 0;
+    for (size_t i = 0; i < total; i++)
+    {
+        sum += samples[i];
+        squared_sum += (double) samples[i] * samples[i];
+    }
+
+    double mean = sum / total;
+    double deviation = sqrt(fmax(squared_sum / total - mean * mean, 0));
+
+    printf("{\"suite\":\"%s\",\"benchmark\":\"%s\",\"metric\":\"%s\",\"unit\":\"%s\",\"runs\":%zu,"
+           "\"min\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu,\"mean\":%.1f,\"stddev\":%.1f}\n",
+           suite, benchmark, metric, unit, total,
+           (unsigned long long) samples[0],
+           (unsigned long long) get_percentile(samples, 50),
+           (unsigned long long) get_percentile(samples, 90),
+           (unsigned long long) get_percentile(samples, 99),
+           (unsigned long long) samples[total - 1],
+           mean, deviation);
+
+    fflush(stdout);
+    DYN_ARRAY_LENGTH(samples) = 0;
+}
+
+void bench_pin_to_cpu(void)
+{
+    // Whichever core the benchmark started on is as good as any other
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        fprintf(stderr, "{bench} failed to pin to cpu %d, results might be noisy\n", cpu);
+}
+
+static uint64_t get_time_in_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void bench_run(const char *suite, const char *benchmark, bench_function_t function, void *data,
+               size_t batch, size_t total_samples)
+{
+    for (size_t i = 0; i < batch * (total_samples / 10 + 1); i++)
+        function(data);
+
+    bench_samples_t samples = bench_samples_create(total_samples);
+
+    for (size_t i = 0; i < total_samples; i++)
+    {
+        uint64_t start = get_time_in_nanoseconds();
+
+        for (size_t j = 0; j < batch; j++)
+            function(data);
+
+        samples = bench_samples_add(samples, (get_time_in_nanoseconds() - start) / batch);
+    }
+
+    bench_report(suite, benchmark, "call", "ns", samples);
+    dyn_array_destroy(samples);
+}
+
+DYN_ARRAY(char) bench_append_text(DYN_ARRAY(char) text, const char *line)
+{
+    size_t length = strlen(line);
+    size_t offset = DYN_ARRAY_LENGTH(text);
+
+    text = dyn_array_resize_to_fit(text, offset + length);
+    memcpy(text + offset, line, length);
+    DYN_ARRAY_LENGTH(text) = offset + length;
+
+    return text;
+}
+
+DYN_ARRAY(char) bench_generate_gemtext(size_t size)
+{
+    DYN_ARRAY(char) text = dyn_array_create(size + 4096, sizeof(char));
+    char line[256];
+
+    for (size_t i = 0; DYN_ARRAY_LENGTH(text) < size; i++)
+    {
+        switch (i % 16)
+        {
+        case 0: snprintf(line, sizeof(line), "# Section %zu\n", i); break;
+        case 1: snprintf(line, sizeof(line), "## Subsection %zu\n", i); break;
+        case 4: snprintf(line, sizeof(line), "=> gemini://example.org/posts/%zu.gmi Post number %zu\n", i, i); break;
+        case 5: snprintf(line, sizeof(line), "=> ../relative/%zu.gmi\n", i); break;
+        case 7: snprintf(line, sizeof(line), "* List item number %zu\n", i); break;
+        case 8: snprintf(line, sizeof(line), "> A quote that goes on for a little while, number %zu\n", i); break;
+        case 10: snprintf(line, sizeof(line), "```\n    preformatted %zu\n```\n", i); break;
+        case 12: snprintf(line, sizeof(line), "\n"); break;
+        default:
+            snprintf(line, sizeof(line), "Paragraph %zu is made of ordinary prose, long enough to need "
+                     "wrapping on most terminals, the way that blog posts usually look.\n", i);
+            break;
+        }
+
+        text = bench_append_text(text, line);
+    }
+
+    return text;
+}
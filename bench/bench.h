@@ -0,0 +1,54 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/*
+ * The pieces shared by all of the benchmark programs (make bench, make bench-e2e)
+ * Every result is printed as a single JSON object per line, so that runs can be diffed or fed to scripts:
+ * {"suite":"e2e","benchmark":"tiny","metric":"ttfb","unit":"us","runs":2000,"min":..,"p50":..,...}
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../src/dynamic_array.h"
+
+typedef DYN_ARRAY(uint64_t) bench_samples_t;
+
+bench_samples_t bench_samples_create(size_t expected_runs);
+bench_samples_t bench_samples_add(bench_samples_t samples, uint64_t sample);
+
+// Sorts the samples and prints their summary, the samples are emptied afterwards so they can be reused
+void bench_report(const char *suite, const char *benchmark, const char *metric, const char *unit,
+                  bench_samples_t samples);
+
+// Keeps the benchmark on a single core, so that migrations and frequency differences don't add noise
+void bench_pin_to_cpu(void);
+
+// Runs the function batch times per sample and reports the time of a single call in nanoseconds
+// A tenth of the samples are run beforehand and thrown away, so that caches and branch predictors are warm
+typedef void (*bench_function_t) (void *data);
+void bench_run(const char *suite, const char *benchmark, bench_function_t function, void *data,
+               size_t batch, size_t total_samples);
+
+// Gemtext with all kinds of elements, in roughly the proportions that real capsules have
+DYN_ARRAY(char) bench_generate_gemtext(size_t size);
+DYN_ARRAY(char) bench_append_text(DYN_ARRAY(char) text, const char *line);
+
+#endif
@@ -0,0 +1,322 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * End-to-end benchmark (make bench-e2e)
+ * A synthetic capsule is served on the loopback interface from a second thread, while the main thread
+ * fetches it through the same code paths that the browser uses. Nothing ever leaves the machine
+ * Usage: bench-e2e [scale], where scale multiplies the amount of runs of every scenario
+ */
+
+#include "bench.h"
+#include "../src/gemini.h"
+#include "../src/server.h"
+#include "../src/astrology.h"
+#include "../src/common.h"
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_PORT 1967
+#define LARGE_PAGE_SIZE (10 * 1024 * 1024)
+#define REDIRECT_CHAIN_LENGTH 5
+
+// How long the "user" takes to answer an input prompt, enough for the server's session tickets to arrive
+#define TYPING_DELAY_US 20000
+
+// Drip-fed bodies arrive in small chunks, with a pause between each one of them
+#define DRIP_BODY_SIZE (64 * 1024)
+#define DRIP_CHUNK_SIZE 1024
+#define DRIP_INTERVAL_US 2000
+
+static const char tiny_page[] = "# Tiny\nA page that fits into a single packet.\n=> /tiny Itself\n";
+
+static struct
+{
+    gemini_server_t server;
+    DYN_ARRAY(char) large_page;
+    DYN_ARRAY(char) drip_body;
+} capsule;
+
+// A body that is released a chunk at a time, driven by a timer
+typedef struct
+{
+    server_watcher_t watcher;
+    int timer;
+
+    // Becomes NULL once the server is done with the client
+    server_client_t *client;
+    size_t bytes_released;
+} drip_t;
+
+static void on_drip_tick(gemini_server_t *server, void *data)
+{
+    drip_t *drip = data;
+
+    uint64_t expirations;
+    while (read(drip->timer, &expirations, sizeof(expirations)) > 0);
+
+    if (!drip->client)
+    {
+        gemini_server_unwatch(server, drip->timer);
+        close(drip->timer);
+        free(drip);
+        return;
+    }
+
+    drip->bytes_released = MIN(drip->bytes_released + DRIP_CHUNK_SIZE, DYN_ARRAY_LENGTH(capsule.drip_body));
+    gemini_server_stream_body(server, drip->client, capsule.drip_body, drip->bytes_released,
+                              drip->bytes_released == DYN_ARRAY_LENGTH(capsule.drip_body));
+}
+
+// Called by the server once the connection is closed, the next tick will clean up
+static void on_drip_released(void *data)
+{
+    drip_t *drip = data;
+    drip->client = NULL;
+}
+
+static void start_drip(gemini_server_t *server, server_client_t *client)
+{
+    drip_t *drip = malloc(sizeof(drip_t));
+    drip->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    drip->client = client;
+    drip->bytes_released = 0;
+    drip->watcher.callback = on_drip_tick;
+    drip->watcher.data = drip;
+
+    struct itimerspec interval = {
+        .it_value.tv_nsec = DRIP_INTERVAL_US * 1000,
+        .it_interval.tv_nsec = DRIP_INTERVAL_US * 1000
+    };
+    timerfd_settime(drip->timer, 0, &interval, NULL);
+
+    gemini_server_watch(server, drip->timer, &drip->watcher);
+    gemini_server_respond_streaming(server, client, "20 text/gemini", capsule.drip_body, 0, on_drip_released, drip);
+}
+
+static void on_capsule_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    char *path = url + get_hostname_length(url);
+    char *query = strchr(path, '?');
+
+    if (!strcmp(path, "/tiny"))
+    {
+        gemini_server_respond(server, client, "20 text/gemini", tiny_page, sizeof(tiny_page) - 1, NULL, NULL);
+    }
+    else if (!strcmp(path, "/large"))
+    {
+        gemini_server_respond(server, client, "20 text/gemini", capsule.large_page,
+                              DYN_ARRAY_LENGTH(capsule.large_page), NULL, NULL);
+    }
+    else if (!strncmp(path, "/redirect/", 10))
+    {
+        // Every hop is relative, so the client has to join the links as well
+        int remaining_hops = atoi(path + 10);
+        char header[64];
+
+        if (remaining_hops > 0)
+            snprintf(header, sizeof(header), "31 /redirect/%d", remaining_hops - 1);
+        else
+            snprintf(header, sizeof(header), "31 /tiny");
+
+        gemini_server_respond(server, client, header, NULL, 0, NULL, NULL);
+    }
+    else if (!strncmp(path, "/input", 6))
+    {
+        if (query)
+            gemini_server_respond(server, client, "20 text/gemini", tiny_page, sizeof(tiny_page) - 1, NULL, NULL);
+        else
+            gemini_server_respond(server, client, "10 Search for something", NULL, 0, NULL, NULL);
+    }
+    else if (!strcmp(path, "/drip"))
+    {
+        start_drip(server, client);
+    }
+    else
+    {
+        gemini_server_respond(server, client, "51 Not found", NULL, 0, NULL, NULL);
+    }
+}
+
+static void* run_capsule(void *data)
+{
+    gemini_server_run(&capsule.server);
+    return NULL;
+}
+
+// Answers status 1 prompts right away, as if the user typed something instantly
+static size_t answer_input(char *buffer, char *prompt, size_t max_length)
+{
+    return snprintf(buffer, max_length, "benchmark");
+}
+
+// Answers status 1 prompts like a person would, after the preconnection has been sitting idle for a while
+static size_t answer_input_slowly(char *buffer, char *prompt, size_t max_length)
+{
+    usleep(TYPING_DELAY_US);
+    return snprintf(buffer, max_length, "benchmark");
+}
+
+/*
+ * Goes through a single request phase by phase
+ * Everything is measured from the start of the request, in microseconds
+ */
+static void measure_phases(SSL_CTX *ctx, const char *scenario, size_t runs)
+{
+    bench_samples_t connect = bench_samples_create(runs), handshake = bench_samples_create(runs);
+    bench_samples_t ttfb = bench_samples_create(runs), load = bench_samples_create(runs);
+    bench_samples_t parse = bench_samples_create(runs);
+
+    char url[128];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d/%s", BENCH_PORT, scenario);
+
+    for (size_t i = 0; i < runs; i++)
+    {
+        gemini_request_t request;
+        gemini_request_start(&request, ctx, url);
+        gemini_request_wait(&request, GEMINI_REQUEST_DONE);
+
+        if (request.error != GEMINI_OK || request.status[0] != '2')
+        {
+            fprintf(stderr, "{bench} %s failed (status %s)\n", url, request.status);
+            gemini_request_destroy(&request);
+            continue;
+        }
+
+        uint64_t parse_start = get_monotonic_time();
+        gemini_document_t *document = gemini_document_from_request(&request);
+        uint64_t parse_end = get_monotonic_time();
+
+        connect = bench_samples_add(connect, request.connected_at - request.started_at);
+        handshake = bench_samples_add(handshake, request.handshaked_at - request.connected_at);
+        ttfb = bench_samples_add(ttfb, request.header_received_at - request.started_at);
+        load = bench_samples_add(load, request.finished_at - request.started_at);
+        parse = bench_samples_add(parse, parse_end - parse_start);
+
+        gemini_document_destroy(document);
+        gemini_request_destroy(&request);
+    }
+
+    bench_report("e2e", scenario, "connect", "us", connect);
+    bench_report("e2e", scenario, "handshake", "us", handshake);
+    bench_report("e2e", scenario, "ttfb", "us", ttfb);
+    bench_report("e2e", scenario, "load", "us", load);
+    bench_report("e2e", scenario, "parse", "us", parse);
+
+    dyn_array_destroy(connect);
+    dyn_array_destroy(handshake);
+    dyn_array_destroy(ttfb);
+    dyn_array_destroy(load);
+    dyn_array_destroy(parse);
+}
+
+// Redirections and input prompts take several requests, so only the whole journey is measured
+static void measure_fetch(SSL_CTX *ctx, const char *scenario, const char *path, size_t runs)
+{
+    bench_samples_t total = bench_samples_create(runs);
+
+    char url[128];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d%s", BENCH_PORT, path);
+
+    for (size_t i = 0; i < runs; i++)
+    {
+        uint64_t start = get_monotonic_time();
+        gemini_document_t *document = gemini_fetch_document(ctx, url, answer_input, NULL);
+        uint64_t end = get_monotonic_time();
+
+        if (document->error == GEMINI_OK && document->content)
+            total = bench_samples_add(total, end - start);
+        else
+            fprintf(stderr, "{bench} %s failed\n", url);
+
+        gemini_document_destroy(document);
+    }
+
+    bench_report("e2e", scenario, "total", "us", total);
+    dyn_array_destroy(total);
+}
+
+/*
+ * Checks that the connection made while the user was typing is actually the one the query is sent over
+ * The capsule speaks TLS 1.3, so the idle connection has received the session tickets by then
+ * A reused connection has all of its phases moved to the moment of sending, a fresh one took time to handshake
+ */
+static void measure_preconnection(SSL_CTX *ctx, size_t runs)
+{
+    bench_samples_t total = bench_samples_create(runs), reused = bench_samples_create(runs);
+
+    char url[128];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d/input", BENCH_PORT);
+
+    for (size_t i = 0; i < runs; i++)
+    {
+        uint64_t start = get_monotonic_time();
+        gemini_document_t *document = gemini_fetch_document(ctx, url, answer_input_slowly, NULL);
+        uint64_t end = get_monotonic_time();
+
+        if (document->error == GEMINI_OK && document->content)
+        {
+            total = bench_samples_add(total, end - start - TYPING_DELAY_US);
+            reused = bench_samples_add(reused, document->timings.handshaked_at == document->timings.connected_at);
+        }
+        else
+            fprintf(stderr, "{bench} %s failed\n", url);
+
+        gemini_document_destroy(document);
+    }
+
+    // Anything but 1 everywhere means that some of the preconnections were thrown away
+    bench_report("e2e", "input_typed", "total", "us", total);
+    bench_report("e2e", "input_typed", "reused", "bool", reused);
+
+    dyn_array_destroy(total);
+    dyn_array_destroy(reused);
+}
+
+int main(int argc, char **argv)
+{
+    size_t scale = argc > 1 ? MAX(atoi(argv[1]), 1) : 1;
+
+    capsule.large_page = bench_generate_gemtext(LARGE_PAGE_SIZE);
+    capsule.drip_body = bench_generate_gemtext(DRIP_BODY_SIZE);
+    DYN_ARRAY_LENGTH(capsule.drip_body) = DRIP_BODY_SIZE;
+
+    gemini_server_create(&capsule.server, BENCH_PORT, on_capsule_request, NULL);
+
+    pthread_t capsule_thread;
+    pthread_create(&capsule_thread, NULL, run_capsule, NULL);
+
+    SSL_CTX *ctx = astrology_create_ssl_context();
+
+    char redirect_path[32];
+    snprintf(redirect_path, sizeof(redirect_path), "/redirect/%d", REDIRECT_CHAIN_LENGTH - 1);
+
+    measure_phases(ctx, "tiny", 2000 * scale);
+    measure_phases(ctx, "large", 20 * scale);
+    measure_phases(ctx, "drip", 10 * scale);
+    measure_fetch(ctx, "redirect_chain", redirect_path, 500 * scale);
+    measure_fetch(ctx, "input", "/input", 1000 * scale);
+    measure_preconnection(ctx, 50 * scale);
+
+    // The capsule thread runs forever, exiting takes it down as well
+    SSL_CTX_free(ctx);
+    return 0;
+}
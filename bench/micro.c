@@ -0,0 +1,272 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the hot functions (make bench)
+ * Every benchmark runs on a single pinned core, with a warm-up, and reports the time of a single call
+ */
+
+#include "bench.h"
+#include "../src/gemini.h"
+#include "../src/common.h"
+#include "../src/doubly_linked.h"
+#include "../src/viewer.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOTAL_SAMPLES 200
+
+// A corpus document, along with everything needed to parse or render it
+typedef struct
+{
+    const char *name;
+    gemini_document_t document;
+    WINDOW *window;
+} corpus_entry_t;
+
+static void parse_gemtext(void *data)
+{
+    gemini_document_t *document = data;
+
+    gemini_document_parse_gemtext(document);
+    dyn_array_destroy(document->elements);
+}
+
+static void parse_text(void *data)
+{
+    gemini_document_t *document = data;
+
+    gemini_document_parse_text(document);
+    dyn_array_destroy(document->elements);
+}
+
+typedef struct
+{
+    gemini_document_t *document;
+
+    // Both versions take turns, each update receives a fresh copy of the other one like a reload would
+    DYN_ARRAY(char) versions[2];
+    int next_version;
+} reload_t;
+
+static void update_document(void *data)
+{
+    reload_t *reload = data;
+    DYN_ARRAY(char) version = reload->versions[reload->next_version];
+    size_t length = DYN_ARRAY_LENGTH(version);
+
+    gemini_document_t *newer = gemini_document_create(reload->document->url);
+    newer->content = dyn_array_create(length + 1, sizeof(char));
+    memcpy(newer->content, version, length + 1);
+    DYN_ARRAY_LENGTH(newer->content) = length;
+
+    gemini_document_diff_t diff;
+    gemini_document_update(reload->document, newer, &diff);
+    reload->next_version ^= 1;
+}
+
+// The realistic document, either exactly the same or with a line in the middle that keeps changing
+static void bench_reload(const char *name, DYN_ARRAY(char) content, bool has_changes)
+{
+    size_t length = DYN_ARRAY_LENGTH(content);
+    reload_t reload = {.document = gemini_document_create("gemini://example.org/")};
+
+    for (int i = 0; i < 2; i++)
+    {
+        reload.versions[i] = dyn_array_create(length + 1, sizeof(char));
+        memcpy(reload.versions[i], content, length + 1);
+        DYN_ARRAY_LENGTH(reload.versions[i]) = length;
+    }
+
+    if (has_changes)
+    {
+        char *line = memchr(reload.versions[1] + length / 2, '\n', length / 2);
+        line[1] = line[1] == 'x' ? 'y' : 'x';
+    }
+
+    reload.document->content = dyn_array_create(length + 1, sizeof(char));
+    memcpy(reload.document->content, content, length + 1);
+    DYN_ARRAY_LENGTH(reload.document->content) = length;
+    gemini_document_parse_gemtext(reload.document);
+
+    bench_run("micro", name, update_document, &reload, 1, TOTAL_SAMPLES);
+
+    gemini_document_destroy(reload.document);
+    dyn_array_destroy(reload.versions[0]);
+    dyn_array_destroy(reload.versions[1]);
+}
+
+// Starts from the smallest possible array, so every doubling is part of the measurement
+static void grow_dynamic_array(void *data)
+{
+    size_t total_items = *(size_t*) data;
+    DYN_ARRAY(size_t) array = dyn_array_create(1, sizeof(size_t));
+
+    for (size_t i = 0; i < total_items; i++)
+    {
+        array = dyn_array_prepare_new_item(array);
+        DYN_ARRAY_GET_LAST(array) = i;
+    }
+
+    dyn_array_destroy(array);
+}
+
+// Mimics browsing: pages keep getting pushed past the history limit, with the occasional step back
+static void churn_doubly_linked(void *data)
+{
+    doubly_linked_t *list = data;
+
+    for (int i = 0; i < 64; i++)
+    {
+        doubly_linked_insert_first(list, malloc(16));
+
+        if (i % 4 == 3)
+            doubly_linked_delete_head(list);
+    }
+}
+
+static char *relative_links[][2] = {
+    {"gemini://example.org/posts/2024/entry.gmi", "/about.gmi"},
+    {"gemini://example.org/posts/2024/entry.gmi", "other-entry.gmi"},
+    {"gemini://example.org/posts/2024/", "../index.gmi"},
+    {"gemini://example.org", "/"},
+    {"gemini://a.very.long.hostname.example.org:1965/some/deeply/nested/directory/structure/page.gmi",
+     "sibling/page.gmi"}
+};
+
+static void join_relative_links(void *data)
+{
+    for (size_t i = 0; i < sizeof(relative_links) / sizeof(relative_links[0]); i++)
+        free(join_relative_link_to_url(relative_links[i][0], relative_links[i][1]));
+}
+
+typedef struct
+{
+    WINDOW *window;
+    char *text;
+    size_t length;
+} word_wrap_t;
+
+static void wrap_words(void *data)
+{
+    word_wrap_t *wrap = data;
+    viewer_print_text_with_word_breaks(wrap->window, 0, wrap->text, wrap->length);
+}
+
+// A full screen worth of the document, starting from the top
+static void render_screen(void *data)
+{
+    corpus_entry_t *entry = data;
+
+    werase(entry->window);
+    viewer_render_document(entry->window, &entry->document, 0);
+}
+
+static void corpus_add(corpus_entry_t *entry, const char *name, DYN_ARRAY(char) content, WINDOW *window)
+{
+    entry->name = name;
+    entry->document.content = content;
+    entry->document.elements = NULL;
+    entry->window = window;
+}
+
+// Turns a name like parse_gemtext and a corpus entry into parse_gemtext/realistic_64k
+static const char* get_benchmark_name(char *buffer, size_t size, const char *function, const char *corpus)
+{
+    snprintf(buffer, size, "%s/%s", function, corpus);
+    return buffer;
+}
+
+int main(void)
+{
+    bench_pin_to_cpu();
+
+    // Nothing is ever shown, ncurses just writes into the void at a fixed size
+    FILE *terminal = fopen("/dev/null", "r+");
+    SCREEN *screen = newterm("xterm", terminal, terminal);
+    if (!screen)
+    {
+        fprintf(stderr, "{bench} failed to initialize ncurses\n");
+        return 1;
+    }
+
+    set_term(screen);
+    resizeterm(30, 90);
+    WINDOW *window = newwin(28, 90, 2, 0);
+
+    // A generated document without a single new line, one that's nothing but links and two realistic ones
+    DYN_ARRAY(char) single_line = dyn_array_create(64 * 1024, sizeof(char));
+    while (DYN_ARRAY_LENGTH(single_line) < 64 * 1024)
+        single_line = bench_append_text(single_line, "words without any line break ");
+
+    DYN_ARRAY(char) links_only = dyn_array_create(1024 * 1024, sizeof(char));
+    while (DYN_ARRAY_LENGTH(links_only) < 1024 * 1024)
+        links_only = bench_append_text(links_only, "=> gemini://example.org/a/link.gmi A link\n");
+
+    corpus_entry_t corpus[4];
+    corpus_add(&corpus[0], "realistic_64k", bench_generate_gemtext(64 * 1024), window);
+    corpus_add(&corpus[1], "realistic_1m", bench_generate_gemtext(1024 * 1024), window);
+    corpus_add(&corpus[2], "links_1m", links_only, window);
+    corpus_add(&corpus[3], "single_line_64k", single_line, window);
+
+    char name[128];
+    for (int i = 0; i < 4; i++)
+    {
+        gemini_document_t *document = &corpus[i].document;
+        size_t batch = MAX(1, (256 * 1024) / DYN_ARRAY_LENGTH(document->content));
+
+        bench_run("micro", get_benchmark_name(name, sizeof(name), "parse_gemtext", corpus[i].name),
+                  parse_gemtext, document, batch, TOTAL_SAMPLES);
+        bench_run("micro", get_benchmark_name(name, sizeof(name), "parse_text", corpus[i].name),
+                  parse_text, document, batch, TOTAL_SAMPLES);
+
+        // The documents need to be parsed for real before they can be rendered
+        gemini_document_parse_gemtext(document);
+        bench_run("micro", get_benchmark_name(name, sizeof(name), "render_screen", corpus[i].name),
+                  render_screen, &corpus[i], 10, TOTAL_SAMPLES);
+    }
+
+    // Copying the body in is part of both, as it would be when it's received
+    bench_reload("update_unchanged/realistic_1m", corpus[1].document.content, false);
+    bench_reload("update_one_line/realistic_1m", corpus[1].document.content, true);
+
+    size_t total_items = 100000;
+    bench_run("micro", "dyn_array_growth/100k", grow_dynamic_array, &total_items, 1, TOTAL_SAMPLES);
+
+    doubly_linked_t history;
+    doubly_linked_create(&history, 20, free);
+    bench_run("micro", "doubly_linked_churn/64", churn_doubly_linked, &history, 100, TOTAL_SAMPLES);
+    doubly_linked_destroy(&history);
+
+    bench_run("micro", "join_relative_link_to_url/5", join_relative_links, NULL, 1000, TOTAL_SAMPLES);
+
+    // A long paragraph gets wrapped onto a pad, so that it never runs out of rows
+    static char paragraph[4096];
+    for (size_t i = 0; i < sizeof(paragraph) - 1; i++)
+        paragraph[i] = (i % 7 == 6) ? ' ' : 'a' + i % 26;
+
+    word_wrap_t wrap = {.window = newpad(100, 90), .text = paragraph, .length = sizeof(paragraph) - 1};
+    bench_run("micro", "print_text_with_word_breaks/4k", wrap_words, &wrap, 100, TOTAL_SAMPLES);
+
+    endwin();
+    delscreen(screen);
+    fclose(terminal);
+
+    return 0;
+}
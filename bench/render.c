@@ -0,0 +1,330 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Headless rendering benchmark (make bench-render)
+ * ncurses draws onto a pseudo-terminal of a fixed size, whose other end is drained and counted after every frame
+ * Scripted key sequences are typed into the terminal and read back through getch, then handled the same way
+ * that the frontend handles them. For each frame, the time it took, the input-to-paint latency
+ * and the amount of bytes that would have reached the terminal are reported
+ */
+
+#include "bench.h"
+#include "../src/gemini.h"
+#include "../src/common.h"
+#include "../src/config.h"
+#include "../src/viewer.h"
+#include "../src/latency.h"
+#include <ncurses.h>
+#include <pty.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCREEN_HEIGHT 30
+#define SCREEN_WIDTH 100
+
+// Mirrors the state that the frontend keeps around
+static struct
+{
+    WINDOW *status_bar;
+    WINDOW *document_viewer;
+    int total_elements_on_view;
+
+    gemini_document_t *documents[2];
+    int current_document;
+    int scroll_offset;
+
+    // The other end of the pseudo-terminal, everything ncurses writes comes out of here
+    // A second thread keeps draining it, otherwise a large frame could fill the buffer and block
+    int terminal;
+    pthread_mutex_t terminal_lock;
+    size_t total_bytes;
+
+    input_latency_t input_latency;
+} frontend;
+
+typedef struct
+{
+    const char *name;
+
+    // Every character is a key press, a single frame
+    char keys[2048];
+} scenario_t;
+
+// Special keys that are not part of config.h
+#define RESIZE_KEY 'r'
+
+static void read_terminal(void)
+{
+    char buffer[65536];
+    ssize_t bytes_read;
+
+    pthread_mutex_lock(&frontend.terminal_lock);
+
+    while ((bytes_read = read(frontend.terminal, buffer, sizeof(buffer))) > 0)
+        frontend.total_bytes += bytes_read;
+
+    pthread_mutex_unlock(&frontend.terminal_lock);
+}
+
+static void* keep_draining_terminal(void *data)
+{
+    struct pollfd terminal = {.fd = frontend.terminal, .events = POLLIN};
+
+    for (;;)
+    {
+        poll(&terminal, 1, -1);
+        read_terminal();
+    }
+
+    return NULL;
+}
+
+// Returns how many bytes ncurses has written since the last call
+// Once wrefresh returns, everything it wrote is already waiting inside the pseudo-terminal
+static size_t drain_terminal(void)
+{
+    read_terminal();
+
+    pthread_mutex_lock(&frontend.terminal_lock);
+    size_t total_bytes = frontend.total_bytes;
+    frontend.total_bytes = 0;
+    pthread_mutex_unlock(&frontend.terminal_lock);
+
+    return total_bytes;
+}
+
+static gemini_document_t* create_document(DYN_ARRAY(char) content)
+{
+    gemini_document_t *document = gemini_document_create("gemini://localhost/");
+    document->content = content;
+    gemini_document_parse_gemtext(document);
+
+    return document;
+}
+
+// The same steps as in the frontend's refresh_document_viewer and set_status
+static void refresh_document_viewer(void)
+{
+    werase(frontend.document_viewer);
+    frontend.total_elements_on_view = viewer_render_document(frontend.document_viewer,
+                                                             frontend.documents[frontend.current_document],
+                                                             frontend.scroll_offset);
+    wrefresh(frontend.document_viewer);
+    input_latency_frame_painted(&frontend.input_latency);
+}
+
+static void set_status(const char *status)
+{
+    werase(frontend.status_bar);
+    mvwprintw(frontend.status_bar, 0, 0, "%s", status);
+    wrefresh(frontend.status_bar);
+    input_latency_frame_painted(&frontend.input_latency);
+}
+
+static void scroll_to(int new_offset)
+{
+    size_t total_elements = DYN_ARRAY_LENGTH(frontend.documents[frontend.current_document]->elements);
+
+    if (new_offset == frontend.scroll_offset || new_offset < 0 || new_offset > (int) total_elements - 1)
+        return;
+
+    frontend.scroll_offset = new_offset;
+    refresh_document_viewer();
+}
+
+// Alternates between a few common terminal sizes
+static void resize(int step)
+{
+    static const int sizes[][2] = {{SCREEN_HEIGHT, SCREEN_WIDTH}, {50, 160}, {24, 80}, {40, 60}};
+    int height = sizes[step % 4][0], width = sizes[step % 4][1];
+
+    resizeterm(height, width);
+
+    int viewer_x = VIEWER_WIDTH < width ? (width - VIEWER_WIDTH) / 2 : 0;
+    int viewer_width = MIN(width, VIEWER_WIDTH);
+
+    wresize(frontend.document_viewer, height - 2, viewer_width);
+    wresize(frontend.status_bar, 1, viewer_width);
+    mvwin(frontend.document_viewer, 2, viewer_x);
+    mvwin(frontend.status_bar, 0, viewer_x);
+    refresh();
+
+    set_status("{browsing} gemini://localhost/");
+    refresh_document_viewer();
+}
+
+static void handle_key(char key, int frame)
+{
+    switch (key)
+    {
+    case MOVE_DOWN_KEY: scroll_to(frontend.scroll_offset + 1); break;
+    case MOVE_UP_KEY: scroll_to(frontend.scroll_offset - 1); break;
+    case PAGE_DOWN_KEY: scroll_to(frontend.scroll_offset + frontend.total_elements_on_view); break;
+    case GO_TO_START_KEY: scroll_to(0); break;
+
+    // Going back and forth between two documents, as if a link was followed and then the user went back
+    case GO_BACK_KEY:
+        frontend.current_document = !frontend.current_document;
+        frontend.scroll_offset = 0;
+        set_status("{browsing} gemini://localhost/");
+        refresh_document_viewer();
+        break;
+
+    case RESIZE_KEY: resize(frame); break;
+    }
+}
+
+// Resizes only redraw the page, just like scrolling does
+static input_kind_e get_input_kind(char key)
+{
+    return key == GO_BACK_KEY ? INPUT_NAVIGATION : INPUT_SCROLL;
+}
+
+static void run_scenario(scenario_t *scenario)
+{
+    size_t total_frames = strlen(scenario->keys);
+    bench_samples_t frame_times = bench_samples_create(total_frames);
+    bench_samples_t input_to_paint = bench_samples_create(total_frames);
+    bench_samples_t frame_bytes = bench_samples_create(total_frames);
+
+    // Every scenario starts from the top of the first document, on a screen of the default size
+    frontend.current_document = 0;
+    frontend.scroll_offset = 0;
+    resize(0);
+    drain_terminal();
+
+    for (size_t i = 0; i < total_frames; i++)
+    {
+        // The key goes through the terminal, exactly like a real key press would
+        write(frontend.terminal, &scenario->keys[i], 1);
+        // Resizing the terminal queues up a KEY_RESIZE as well, but the resize has already been handled
+        int key;
+        while ((key = getch()) == KEY_RESIZE);
+        input_latency_key_received(&frontend.input_latency, get_input_kind(key));
+
+        uint64_t start = get_monotonic_time();
+        handle_key(key, i);
+        uint64_t end = get_monotonic_time();
+
+        // Keys that didn't paint anything (e.g. scrolling past the end) have no latency to speak of
+        bool has_painted = frontend.input_latency.painted_at != 0;
+        uint64_t latency = input_latency_finish_key(&frontend.input_latency);
+
+        frame_times = bench_samples_add(frame_times, end - start);
+        if (has_painted)
+            input_to_paint = bench_samples_add(input_to_paint, latency);
+        frame_bytes = bench_samples_add(frame_bytes, drain_terminal());
+    }
+
+    bench_report("render", scenario->name, "frame_time", "us", frame_times);
+    bench_report("render", scenario->name, "input_to_paint", "us", input_to_paint);
+    bench_report("render", scenario->name, "frame_bytes", "bytes", frame_bytes);
+
+    dyn_array_destroy(frame_times);
+    dyn_array_destroy(input_to_paint);
+    dyn_array_destroy(frame_bytes);
+}
+
+static void fill_keys(scenario_t *scenario, const char *name, const char *pattern, size_t total_keys)
+{
+    scenario->name = name;
+
+    size_t pattern_length = strlen(pattern);
+    total_keys = MIN(total_keys, sizeof(scenario->keys) - 1);
+
+    for (size_t i = 0; i < total_keys; i++)
+        scenario->keys[i] = pattern[i % pattern_length];
+
+    scenario->keys[total_keys] = 0;
+}
+
+int main(void)
+{
+    bench_pin_to_cpu();
+
+    int master, slave;
+    struct winsize size = {.ws_row = SCREEN_HEIGHT, .ws_col = SCREEN_WIDTH};
+
+    if (openpty(&master, &slave, NULL, NULL, &size) != 0)
+    {
+        fprintf(stderr, "{bench} failed to open a pseudo-terminal\n");
+        return 1;
+    }
+
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    frontend.terminal = master;
+    pthread_mutex_init(&frontend.terminal_lock, NULL);
+
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, keep_draining_terminal, NULL);
+
+    FILE *terminal = fdopen(slave, "r+");
+    SCREEN *screen = newterm("xterm-256color", terminal, terminal);
+    if (!screen)
+    {
+        fprintf(stderr, "{bench} failed to initialize ncurses\n");
+        return 1;
+    }
+
+    set_term(screen);
+    start_color();
+    init_pair(COLOR_LINK, COLOR_BLUE, COLOR_BLACK);
+    init_pair(COLOR_LIST_ITEM, COLOR_GREEN, COLOR_BLACK);
+    cbreak();
+    noecho();
+    curs_set(0);
+
+    frontend.document_viewer = newwin(SCREEN_HEIGHT - 2, VIEWER_WIDTH, 2, 0);
+    frontend.status_bar = newwin(1, VIEWER_WIDTH, 0, 0);
+
+    frontend.documents[0] = create_document(bench_generate_gemtext(10 * 1024 * 1024));
+    frontend.documents[1] = create_document(bench_generate_gemtext(64 * 1024));
+
+    scenario_t scenario;
+    char keys[2] = {0};
+
+    keys[0] = MOVE_DOWN_KEY;
+    fill_keys(&scenario, "j_spam", keys, 2000);
+    run_scenario(&scenario);
+
+    keys[0] = PAGE_DOWN_KEY;
+    fill_keys(&scenario, "page_down", keys, 1000);
+    run_scenario(&scenario);
+
+    keys[0] = RESIZE_KEY;
+    fill_keys(&scenario, "resize_storm", keys, 500);
+    run_scenario(&scenario);
+
+    // Scroll a little, go back, scroll a little on the other page and go back again
+    char go_back[] = {MOVE_DOWN_KEY, MOVE_DOWN_KEY, MOVE_DOWN_KEY, GO_BACK_KEY, 0};
+    fill_keys(&scenario, "go_back", go_back, 2000);
+    run_scenario(&scenario);
+
+    // The draining thread is still blocked on the terminal, exiting takes it down
+    endwin();
+
+    gemini_document_destroy(frontend.documents[0]);
+    gemini_document_destroy(frontend.documents[1]);
+
+    return 0;
+}
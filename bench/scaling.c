@@ -0,0 +1,360 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Guards against superlinear behaviour on hostile documents (make bench-scaling)
+ * Every document is generated at two sizes, a quarter of MAX_SIZE and MAX_SIZE itself, and then
+ * fetched, parsed, laid out and searched. Going four times larger must not cost much more than four times
+ * as much time and memory, while laying out a single screen must not depend on the size of the document at all
+ * The program exits with a failure if any stage grows faster than that
+ */
+
+#include "bench.h"
+#include "../src/gemini.h"
+#include "../src/server.h"
+#include "../src/astrology.h"
+#include "../src/common.h"
+#include "../src/viewer.h"
+#include <ncurses.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_PORT 1968
+#define MAX_SIZE (50 * 1024 * 1024)
+#define TOTAL_RUNS 5
+
+// Four times the input may cost at most this many times more (quadratic growth would be 16)
+#define LINEAR_LIMIT 6.0
+#define MEMORY_LIMIT 5.0
+
+// Laying out a single screen should cost the same, no matter how long the document is
+#define CONSTANT_LIMIT 2.0
+
+// Measurements below this are mostly noise, so they're given some slack (in microseconds)
+#define TIME_SLACK 500
+
+typedef DYN_ARRAY(char) (*corpus_generator_t) (size_t size);
+
+static struct
+{
+    gemini_server_t server;
+
+    // Whatever is being fetched at the moment
+    DYN_ARRAY(char) body;
+} capsule;
+
+static bool has_failed = false;
+
+static DYN_ARRAY(char) repeat_pattern(const char *prefix, const char *pattern, size_t size)
+{
+    DYN_ARRAY(char) text = dyn_array_create(size + 1, sizeof(char));
+    size_t prefix_length = strlen(prefix), pattern_length = strlen(pattern);
+
+    memcpy(text, prefix, prefix_length);
+    for (size_t i = prefix_length; i < size; i++)
+        text[i] = pattern[(i - prefix_length) % pattern_length];
+
+    text[size] = 0;
+    DYN_ARRAY_LENGTH(text) = size;
+    return text;
+}
+
+// A single paragraph that never ends
+static DYN_ARRAY(char) generate_single_line(size_t size)
+{
+    return repeat_pattern("", "words that go on and on ", size);
+}
+
+// A single word, it can't even be wrapped at spaces
+static DYN_ARRAY(char) generate_single_word(size_t size)
+{
+    return repeat_pattern("", "a", size);
+}
+
+// A preformatted block that's opened but never closed
+static DYN_ARRAY(char) generate_unterminated_fence(size_t size)
+{
+    return repeat_pattern("```\n", "    code that never ends\n", size);
+}
+
+static DYN_ARRAY(char) generate_blank_lines(size_t size)
+{
+    return repeat_pattern("", "\n", size);
+}
+
+static void on_capsule_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    gemini_server_respond(server, client, "20 text/gemini", capsule.body, DYN_ARRAY_LENGTH(capsule.body), NULL, NULL);
+}
+
+static void* run_capsule(void *data)
+{
+    gemini_server_run(&capsule.server);
+    return NULL;
+}
+
+// The amount of memory that's currently allocated, large blocks are mapped separately
+static size_t get_heap_usage(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Both sizes should start with nothing in the caches, otherwise the small one would fit and look unfairly fast
+static void evict_caches(void)
+{
+    static char *scratch = NULL;
+    static int pass = 0;
+
+    if (!scratch)
+        scratch = malloc(MAX_SIZE);
+
+    memset(scratch, pass++, MAX_SIZE);
+}
+
+typedef struct
+{
+    uint64_t time;
+    size_t memory;
+} measurement_t;
+
+typedef struct
+{
+    SSL_CTX *ctx;
+    WINDOW *window;
+    gemini_document_t *document;
+} stage_context_t;
+
+typedef measurement_t (*stage_t) (stage_context_t *context);
+
+static measurement_t fetch(stage_context_t *context)
+{
+    char url[64];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d/", BENCH_PORT);
+
+    gemini_request_t request;
+    gemini_request_start(&request, context->ctx, url);
+    gemini_request_wait(&request, GEMINI_REQUEST_DONE);
+
+    measurement_t result = {
+        .time = request.finished_at - request.started_at,
+        .memory = request.content ? *DYN_ARRAY_GET_ATTRIBUTE(request.content, DYN_ARRAY_CAPACITY) : 0
+    };
+
+    if (!request.content || DYN_ARRAY_LENGTH(request.content) != DYN_ARRAY_LENGTH(capsule.body))
+    {
+        fprintf(stderr, "{bench} the fetched body is incomplete\n");
+        has_failed = true;
+    }
+
+    gemini_request_destroy(&request);
+    return result;
+}
+
+static measurement_t parse(stage_context_t *context, void (*parser) (gemini_document_t*))
+{
+    size_t heap_before = get_heap_usage();
+    uint64_t start = get_monotonic_time();
+
+    parser(context->document);
+
+    measurement_t result = {
+        .time = get_monotonic_time() - start,
+        .memory = get_heap_usage() - heap_before
+    };
+
+    dyn_array_destroy(context->document->elements);
+    context->document->elements = NULL;
+
+    return result;
+}
+
+static measurement_t parse_gemtext(stage_context_t *context)
+{
+    return parse(context, gemini_document_parse_gemtext);
+}
+
+static measurement_t parse_text(stage_context_t *context)
+{
+    return parse(context, gemini_document_parse_text);
+}
+
+// Both of these need parsed elements, so the document is parsed beforehand without being measured
+static measurement_t layout(stage_context_t *context)
+{
+    gemini_document_parse_gemtext(context->document);
+
+    uint64_t start = get_monotonic_time();
+    werase(context->window);
+    viewer_render_document(context->window, context->document, 0);
+    measurement_t result = {.time = get_monotonic_time() - start};
+
+    dyn_array_destroy(context->document->elements);
+    context->document->elements = NULL;
+
+    return result;
+}
+
+// Tabs through every link until it's back at the first one, which walks over the whole document
+// whether it has any links or not (without any, the first search already wraps all the way around)
+static measurement_t search(stage_context_t *context)
+{
+    gemini_document_parse_gemtext(context->document);
+
+    uint64_t start = get_monotonic_time();
+    size_t first_link = gemini_document_find_next_link(context->document, 0);
+    size_t link = first_link;
+
+    do
+        link = gemini_document_find_next_link(context->document, link);
+    while (link != first_link);
+
+    measurement_t result = {.time = get_monotonic_time() - start};
+
+    dyn_array_destroy(context->document->elements);
+    context->document->elements = NULL;
+
+    return result;
+}
+
+// The best of a few runs, so that a single hiccup doesn't fail the whole suite
+static measurement_t measure(stage_t stage, stage_context_t *context)
+{
+    measurement_t best = {.time = UINT64_MAX};
+
+    for (int i = 0; i < TOTAL_RUNS; i++)
+    {
+        evict_caches();
+        measurement_t result = stage(context);
+        best.time = MIN(best.time, result.time);
+        best.memory = result.memory;
+    }
+
+    return best;
+}
+
+static void check_ratio(const char *benchmark, const char *metric, double small, double large,
+                        double limit, double slack)
+{
+    double ratio = large / MAX(small, 1);
+    bool has_passed = large <= small * limit + slack;
+
+    printf("{\"suite\":\"scaling\",\"benchmark\":\"%s\",\"metric\":\"%s\",\"small\":%.0f,\"large\":%.0f,"
+           "\"ratio\":%.2f,\"limit\":%.1f,\"passed\":%s}\n",
+           benchmark, metric, small, large, ratio, limit, has_passed ? "true" : "false");
+    fflush(stdout);
+
+    if (!has_passed)
+        has_failed = true;
+}
+
+typedef struct
+{
+    const char *name;
+    stage_t stage;
+
+    // Either LINEAR_LIMIT or CONSTANT_LIMIT
+    double time_limit;
+    bool has_memory;
+} stage_description_t;
+
+static stage_description_t stages[] = {
+    {"fetch", fetch, LINEAR_LIMIT, true},
+    {"parse_gemtext", parse_gemtext, LINEAR_LIMIT, true},
+    {"parse_text", parse_text, LINEAR_LIMIT, true},
+    {"layout", layout, CONSTANT_LIMIT, false},
+    {"search", search, LINEAR_LIMIT, false}
+};
+
+static void run_corpus(const char *name, corpus_generator_t generator, stage_context_t *context)
+{
+    size_t total_stages = sizeof(stages) / sizeof(stages[0]);
+    measurement_t results[2][total_stages];
+    size_t sizes[2] = {MAX_SIZE / 4, MAX_SIZE};
+
+    for (int i = 0; i < 2; i++)
+    {
+        // The server thread only reads the body while the request is in flight
+        capsule.body = generator(sizes[i]);
+
+        gemini_document_t document = {.content = capsule.body};
+        context->document = &document;
+
+        for (size_t j = 0; j < total_stages; j++)
+            results[i][j] = measure(stages[j].stage, context);
+
+        dyn_array_destroy(capsule.body);
+    }
+
+    char benchmark[128];
+    for (size_t j = 0; j < total_stages; j++)
+    {
+        snprintf(benchmark, sizeof(benchmark), "%s/%s", name, stages[j].name);
+        check_ratio(benchmark, "time_us", results[0][j].time, results[1][j].time, stages[j].time_limit, TIME_SLACK);
+
+        if (stages[j].has_memory)
+            check_ratio(benchmark, "memory_bytes", results[0][j].memory, results[1][j].memory, MEMORY_LIMIT, 4096);
+    }
+}
+
+int main(void)
+{
+    bench_pin_to_cpu();
+
+    // glibc keeps raising its threshold for mapping blocks up to 32 MB, which means the smaller arrays would get
+    // reused from the heap while the larger ones are always mapped and faulted in from scratch
+    // A fixed threshold makes both sizes pay for fresh pages
+    mallopt(M_MMAP_THRESHOLD, 1024 * 1024);
+
+    gemini_server_create(&capsule.server, BENCH_PORT, on_capsule_request, NULL);
+
+    pthread_t capsule_thread;
+    pthread_create(&capsule_thread, NULL, run_capsule, NULL);
+
+    FILE *terminal = fopen("/dev/null", "r+");
+    SCREEN *screen = newterm("xterm", terminal, terminal);
+    if (!screen)
+    {
+        fprintf(stderr, "{bench} failed to initialize ncurses\n");
+        return 1;
+    }
+
+    set_term(screen);
+    resizeterm(30, 90);
+
+    stage_context_t context = {
+        .ctx = astrology_create_ssl_context(),
+        .window = newwin(28, 90, 2, 0)
+    };
+
+    run_corpus("single_line", generate_single_line, &context);
+    run_corpus("single_word", generate_single_word, &context);
+    run_corpus("unterminated_fence", generate_unterminated_fence, &context);
+    run_corpus("blank_lines", generate_blank_lines, &context);
+    run_corpus("realistic", bench_generate_gemtext, &context);
+
+    endwin();
+    SSL_CTX_free(context.ctx);
+
+    if (has_failed)
+        fprintf(stderr, "{bench} some stages grow faster than linearly\n");
+
+    return has_failed ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Start-up benchmark (make bench-startup)
+ * The real executable is launched on a pseudo-terminal again and again, pointed at a page that's served locally
+ * Every run starts from an empty directory, so there's no session to restore and no statistics to load
+ * Two moments are timed from the fork onwards: the first frame (the status bar says that it's loading)
+ * and the first paint of the page itself. The program then quits and the next run begins
+ * Usage: bench-startup <executable> [scale], where scale multiplies the amount of runs
+ */
+
+#include "bench.h"
+#include "../src/server.h"
+#include "../src/common.h"
+#include <sys/wait.h>
+#include <pty.h>
+#include <poll.h>
+#include <pthread.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_PORT 1969
+#define SCREEN_HEIGHT 30
+#define SCREEN_WIDTH 100
+
+// Neither of them can show up on the screen by accident
+#define FIRST_FRAME_MARKER "{loading}"
+#define PAGE_MARKER "Horoscope"
+
+// A run that takes longer than this (in microseconds) has gone wrong
+#define RUN_TIMEOUT 10000000
+
+static const char page[] = "# " PAGE_MARKER "\nA page that fits into a single packet.\n=> /elsewhere Elsewhere\n";
+
+static gemini_server_t server;
+
+static void on_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    gemini_server_respond(server, client, "20 text/gemini", page, sizeof(page) - 1, NULL, NULL);
+}
+
+static void* run_server(void *data)
+{
+    gemini_server_run(&server);
+    return NULL;
+}
+
+// The files that the browser leaves behind would turn the next run into a restored session
+static void clean_directory(const char *directory)
+{
+    static const char *files[] = {"session", "stats", "bookmarks"};
+    char path[512];
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", directory, files[i]);
+        unlink(path);
+    }
+}
+
+// Reads whatever the terminal has, returns false once the child has gone away or the run took too long
+static bool read_terminal(int master, char *output, size_t *length, size_t capacity, uint64_t deadline)
+{
+    uint64_t now = get_monotonic_time();
+    if (now >= deadline)
+        return false;
+
+    struct pollfd descriptor = {.fd = master, .events = POLLIN};
+    if (poll(&descriptor, 1, (deadline - now) / 1000 + 1) <= 0)
+        return false;
+
+    // Only the latest bytes matter, the markers are searched for near the end
+    if (*length > capacity / 2)
+    {
+        memmove(output, output + *length - capacity / 4, capacity / 4);
+        *length = capacity / 4;
+    }
+
+    ssize_t bytes_read = read(master, output + *length, capacity - *length - 1);
+    if (bytes_read <= 0)
+        return false;
+
+    *length += bytes_read;
+    output[*length] = 0;
+
+    return true;
+}
+
+static bool run_once(const char *executable, const char *directory, const char *url,
+                     uint64_t *first_frame, uint64_t *page_paint)
+{
+    clean_directory(directory);
+
+    int master;
+    struct winsize size = {.ws_row = SCREEN_HEIGHT, .ws_col = SCREEN_WIDTH};
+    uint64_t start = get_monotonic_time();
+
+    pid_t child = forkpty(&master, NULL, NULL, &size);
+    if (child < 0)
+        return false;
+
+    if (child == 0)
+    {
+        // The remote control socket lives here too, so that a running instance doesn't take the URL over
+        if (chdir(directory) != 0)
+            _exit(1);
+
+        setenv("TERM", "xterm-256color", 1);
+        setenv("XDG_RUNTIME_DIR", directory, 1);
+
+        execl(executable, executable, url, (char*) NULL);
+        _exit(1);
+    }
+
+    char output[65536];
+    size_t length = 0;
+    uint64_t deadline = start + RUN_TIMEOUT;
+    *first_frame = *page_paint = 0;
+
+    while (!*page_paint && read_terminal(master, output, &length, sizeof(output), deadline))
+    {
+        uint64_t now = get_monotonic_time();
+
+        if (!*first_frame && strstr(output, FIRST_FRAME_MARKER))
+            *first_frame = now - start;
+
+        if (strstr(output, PAGE_MARKER))
+            *page_paint = now - start;
+    }
+
+    // Quit the way a user would, then wait until everything has been written out
+    write(master, "q", 1);
+    while (read_terminal(master, output, &length, sizeof(output), get_monotonic_time() + RUN_TIMEOUT));
+
+    int status;
+    if (waitpid(child, &status, WNOHANG) == 0)
+    {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+    }
+
+    close(master);
+    return *first_frame && *page_paint;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "{bench} usage: bench-startup <executable> [scale]\n");
+        return 1;
+    }
+
+    // The browser runs from inside the temporary directory, so the path can't be relative
+    char executable[PATH_MAX];
+    if (!realpath(argv[1], executable))
+    {
+        fprintf(stderr, "{bench} failed to find %s\n", argv[1]);
+        return 1;
+    }
+
+    size_t scale = argc > 2 ? MAX(atoi(argv[2]), 1) : 1;
+    size_t total_runs = 50 * scale;
+
+    char directory[] = "/tmp/astrology-startup-XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        fprintf(stderr, "{bench} failed to create a temporary directory\n");
+        return 1;
+    }
+
+    gemini_server_create(&server, BENCH_PORT, on_request, NULL);
+
+    pthread_t server_thread;
+    pthread_create(&server_thread, NULL, run_server, NULL);
+
+    char url[64];
+    snprintf(url, sizeof(url), "gemini://127.0.0.1:%d/", BENCH_PORT);
+
+    bench_samples_t first_frames = bench_samples_create(total_runs);
+    bench_samples_t page_paints = bench_samples_create(total_runs);
+
+    for (size_t i = 0; i < total_runs; i++)
+    {
+        uint64_t first_frame, page_paint;
+        if (!run_once(executable, directory, url, &first_frame, &page_paint))
+        {
+            fprintf(stderr, "{bench} the page never showed up on the screen\n");
+            return 1;
+        }
+
+        first_frames = bench_samples_add(first_frames, first_frame);
+        page_paints = bench_samples_add(page_paints, page_paint);
+    }
+
+    bench_report("startup", "local_page", "first_frame", "us", first_frames);
+    bench_report("startup", "local_page", "page_paint", "us", page_paints);
+
+    clean_directory(directory);
+    rmdir(directory);
+
+    // The server thread runs forever, exiting takes it down as well
+    return 0;
+}
@@ -0,0 +1,382 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "archive.h"
+#include "common.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// "ASTA", "ASTR" and "ASTI" when read as little endian
+#define ARCHIVE_MAGIC 0x41545341
+#define RECORD_MAGIC 0x52545341
+#define TRAILER_MAGIC 0x49545341
+#define ARCHIVE_VERSION 1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+} archive_header_t;
+
+// Followed by the URL, the response header and the body, then padded to a multiple of eight bytes
+typedef struct
+{
+    uint32_t magic;
+    uint32_t url_length;
+    uint32_t header_length;
+    uint32_t padding;
+    uint64_t body_length;
+
+    uint64_t connected_after, handshaked_after, header_received_after, finished_after;
+} archive_record_header_t;
+
+typedef struct
+{
+    uint64_t index_offset;
+    uint64_t total_records;
+    uint32_t magic;
+    uint32_t version;
+} archive_trailer_t;
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static uint64_t get_elapsed_time(gemini_request_t *request, uint64_t timestamp)
+{
+    return timestamp ? timestamp - request->started_at : 0;
+}
+
+// Returns the offset where the records end, the index is only valid when a trailer exists
+static uint64_t get_records_end(const char *mapping, size_t mapping_size, const archive_trailer_t **trailer)
+{
+    *trailer = NULL;
+
+    if (mapping_size < sizeof(archive_header_t) + sizeof(archive_trailer_t))
+        return mapping_size;
+
+    const archive_trailer_t *candidate = (const archive_trailer_t*) (mapping + mapping_size - sizeof(archive_trailer_t));
+    size_t index_size = mapping_size - sizeof(archive_trailer_t) - candidate->index_offset;
+
+    if (candidate->magic != TRAILER_MAGIC || candidate->version != ARCHIVE_VERSION ||
+        candidate->index_offset < sizeof(archive_header_t) ||
+        candidate->index_offset > mapping_size - sizeof(archive_trailer_t) ||
+        candidate->index_offset % sizeof(uint64_t) ||
+        index_size != candidate->total_records * sizeof(archive_index_entry_t))
+    {
+        return mapping_size;
+    }
+
+    *trailer = candidate;
+    return candidate->index_offset;
+}
+
+// Walks over the records one by one and stops at the first one that is incomplete or corrupted
+// Returns the offset right after the last valid record
+static uint64_t scan_records(const char *mapping, uint64_t records_end, DYN_ARRAY(archive_index_entry_t) *index)
+{
+    uint64_t offset = sizeof(archive_header_t);
+
+    while (offset + sizeof(archive_record_header_t) <= records_end)
+    {
+        const archive_record_header_t *record = (const archive_record_header_t*) (mapping + offset);
+        uint64_t data_size = (uint64_t) record->url_length + record->header_length + record->body_length;
+
+        if (record->magic != RECORD_MAGIC ||
+            data_size > records_end - offset - sizeof(archive_record_header_t))
+        {
+            break;
+        }
+
+        *index = dyn_array_prepare_new_item(*index);
+        DYN_ARRAY_GET_LAST(*index) = (archive_index_entry_t) {
+            .hash = hash_bytes(mapping + offset + sizeof(archive_record_header_t), record->url_length),
+            .offset = offset
+        };
+
+        offset = MIN(align_offset(offset + sizeof(archive_record_header_t) + data_size), records_end);
+    }
+
+    return offset;
+}
+
+archive_t* archive_open(const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return NULL;
+
+    struct stat file_info;
+    fstat(fd, &file_info);
+
+    archive_t *archive = malloc(sizeof(archive_t));
+    archive->index = dyn_array_create(64, sizeof(archive_index_entry_t));
+
+    uint64_t append_offset = sizeof(archive_header_t);
+
+    if (file_info.st_size > 0)
+    {
+        char *mapping = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        const archive_header_t *header = (const archive_header_t*) mapping;
+
+        if (mapping == MAP_FAILED || file_info.st_size < sizeof(archive_header_t) ||
+            header->magic != ARCHIVE_MAGIC || header->version != ARCHIVE_VERSION)
+        {
+            // Never overwrite something that's not an archive
+            if (mapping != MAP_FAILED)
+                munmap(mapping, file_info.st_size);
+
+            dyn_array_destroy(archive->index);
+            free(archive);
+            close(fd);
+            return NULL;
+        }
+
+        // The old index (and anything that was only partially written) gets replaced by the new records
+        // Rebuilding the index by scanning is cheap, only the record headers are ever touched
+        const archive_trailer_t *trailer;
+        uint64_t records_end = get_records_end(mapping, file_info.st_size, &trailer);
+        append_offset = scan_records(mapping, records_end, &archive->index);
+
+        munmap(mapping, file_info.st_size);
+    }
+
+    if (ftruncate(fd, append_offset) != 0)
+    {
+        dyn_array_destroy(archive->index);
+        free(archive);
+        close(fd);
+        return NULL;
+    }
+
+    archive->file = fdopen(fd, "r+b");
+
+    if (file_info.st_size == 0)
+    {
+        archive_header_t header = {.magic = ARCHIVE_MAGIC, .version = ARCHIVE_VERSION};
+        fwrite(&header, sizeof(header), 1, archive->file);
+    }
+
+    fseek(archive->file, append_offset, SEEK_SET);
+    return archive;
+}
+
+static void pad_file(FILE *file, uint64_t offset)
+{
+    static const char zeros[8];
+    fwrite(zeros, 1, align_offset(offset) - offset, file);
+}
+
+void archive_record(archive_t *archive, gemini_request_t *request)
+{
+    // Failed connections have no response to replay
+    if (!request->status[0])
+        return;
+
+    char header[sizeof(request->header)];
+    int header_length = snprintf(header, sizeof(header), "%s %s", request->status, request->meta ? request->meta : "");
+    header_length = MIN(header_length, sizeof(header) - 1);
+
+    archive_record_header_t record = {
+        .magic = RECORD_MAGIC,
+        .url_length = strlen(request->url),
+        .header_length = header_length,
+        .body_length = request->content ? DYN_ARRAY_LENGTH(request->content) : 0,
+
+        .connected_after = get_elapsed_time(request, request->connected_at),
+        .handshaked_after = get_elapsed_time(request, request->handshaked_at),
+        .header_received_after = get_elapsed_time(request, request->header_received_at),
+        .finished_after = get_elapsed_time(request, request->finished_at)
+    };
+
+    uint64_t offset = ftell(archive->file);
+
+    fwrite(&record, sizeof(record), 1, archive->file);
+    fwrite(request->url, 1, record.url_length, archive->file);
+    fwrite(header, 1, record.header_length, archive->file);
+
+    if (record.body_length)
+        fwrite(request->content, 1, record.body_length, archive->file);
+
+    pad_file(archive->file, ftell(archive->file));
+
+    archive->index = dyn_array_prepare_new_item(archive->index);
+    DYN_ARRAY_GET_LAST(archive->index) = (archive_index_entry_t) {
+        .hash = hash_bytes(request->url, record.url_length),
+        .offset = offset
+    };
+}
+
+// Sorting by offset as well keeps the records of the same URL in chronological order
+static int compare_index_entries(const void *first, const void *second)
+{
+    const archive_index_entry_t *a = first, *b = second;
+
+    if (a->hash != b->hash)
+        return a->hash < b->hash ? -1 : 1;
+
+    return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+void archive_close(archive_t *archive)
+{
+    size_t total_records = DYN_ARRAY_LENGTH(archive->index);
+    qsort(archive->index, total_records, sizeof(archive_index_entry_t), compare_index_entries);
+
+    archive_trailer_t trailer = {
+        .index_offset = ftell(archive->file),
+        .total_records = total_records,
+        .magic = TRAILER_MAGIC,
+        .version = ARCHIVE_VERSION
+    };
+
+    fwrite(archive->index, sizeof(archive_index_entry_t), total_records, archive->file);
+    fwrite(&trailer, sizeof(trailer), 1, archive->file);
+    fclose(archive->file);
+
+    dyn_array_destroy(archive->index);
+    free(archive);
+}
+
+bool archive_reader_open(archive_reader_t *reader, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_info;
+    fstat(fd, &file_info);
+
+    reader->mapping_size = file_info.st_size;
+    reader->mapping = reader->mapping_size ? mmap(NULL, reader->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (reader->mapping == MAP_FAILED)
+        return false;
+
+    const archive_header_t *header = (const archive_header_t*) reader->mapping;
+    if (reader->mapping_size < sizeof(archive_header_t) ||
+        header->magic != ARCHIVE_MAGIC || header->version != ARCHIVE_VERSION)
+    {
+        munmap(reader->mapping, reader->mapping_size);
+        return false;
+    }
+
+    const archive_trailer_t *trailer;
+    uint64_t records_end = get_records_end(reader->mapping, reader->mapping_size, &trailer);
+
+    if (trailer)
+    {
+        reader->index = (archive_index_entry_t*) (reader->mapping + trailer->index_offset);
+        reader->total_records = trailer->total_records;
+        reader->is_index_allocated = false;
+    }
+    else
+    {
+        // The archive was never closed properly, so its index has to be rebuilt
+        DYN_ARRAY(archive_index_entry_t) index = dyn_array_create(64, sizeof(archive_index_entry_t));
+        scan_records(reader->mapping, records_end, &index);
+
+        reader->total_records = DYN_ARRAY_LENGTH(index);
+        reader->index = malloc(MAX(reader->total_records, 1) * sizeof(archive_index_entry_t));
+        reader->is_index_allocated = true;
+
+        memcpy(reader->index, index, reader->total_records * sizeof(archive_index_entry_t));
+        qsort(reader->index, reader->total_records, sizeof(archive_index_entry_t), compare_index_entries);
+        dyn_array_destroy(index);
+    }
+
+    return true;
+}
+
+// Returns false if the index points to something that's not a valid record
+static bool read_record(archive_reader_t *reader, uint64_t offset, archive_record_t *record)
+{
+    if (offset % sizeof(uint64_t) || reader->mapping_size < sizeof(archive_record_header_t) ||
+        offset > reader->mapping_size - sizeof(archive_record_header_t))
+        return false;
+
+    const archive_record_header_t *header = (const archive_record_header_t*) (reader->mapping + offset);
+    uint64_t data_size = (uint64_t) header->url_length + header->header_length + header->body_length;
+
+    if (header->magic != RECORD_MAGIC ||
+        data_size > reader->mapping_size - offset - sizeof(archive_record_header_t))
+    {
+        return false;
+    }
+
+    record->url = reader->mapping + offset + sizeof(archive_record_header_t);
+    record->url_length = header->url_length;
+    record->header = record->url + record->url_length;
+    record->header_length = header->header_length;
+    record->body = record->header + record->header_length;
+    record->body_length = header->body_length;
+
+    record->connected_after = header->connected_after;
+    record->handshaked_after = header->handshaked_after;
+    record->header_received_after = header->header_received_after;
+    record->finished_after = header->finished_after;
+
+    return true;
+}
+
+bool archive_reader_lookup(archive_reader_t *reader, const char *url, archive_record_t *record)
+{
+    size_t url_length = strlen(url);
+    uint64_t hash = hash_bytes(url, url_length);
+
+    // Find the first entry with the given hash
+    size_t low = 0, high = reader->total_records;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (reader->index[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    size_t end = low;
+    while (end < reader->total_records && reader->index[end].hash == hash)
+        end++;
+
+    // Going backwards, so that the latest record is found first
+    while (end-- > low)
+    {
+        if (read_record(reader, reader->index[end].offset, record) &&
+            record->url_length == url_length && !memcmp(record->url, url, url_length))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void archive_reader_close(archive_reader_t *reader)
+{
+    if (reader->is_index_allocated)
+        free(reader->index);
+
+    munmap(reader->mapping, reader->mapping_size);
+}
@@ -0,0 +1,96 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+/*
+ * A WARC-like archive of gemini responses, used for offline browsing and reproducible benchmarks
+ *
+ * The file starts with a small header, followed by the records in the order they were made:
+ * a fixed-size record header (lengths and timings), the URL, the response header and the body
+ * When the archive is closed, an index of (URL hash, record offset) pairs sorted by hash is appended,
+ * followed by a trailer that points to it. Readers map the file and binary search the index
+ * An archive without a valid trailer (e.g. the program crashed) is still readable, it just gets scanned
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "gemini.h"
+#include "dynamic_array.h"
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t offset;
+} archive_index_entry_t;
+
+struct archive_t
+{
+    FILE *file;
+
+    // The index is kept in memory and only written out once the archive gets closed
+    DYN_ARRAY(archive_index_entry_t) index;
+};
+
+// A single response, all pointers point straight into the mapping of the archive
+typedef struct
+{
+    const char *url;
+    size_t url_length;
+
+    // Without the final \r\n
+    const char *header;
+    size_t header_length;
+
+    const char *body;
+    size_t body_length;
+
+    // Relative to the start of the request, in microseconds
+    uint64_t connected_after, handshaked_after, header_received_after, finished_after;
+} archive_record_t;
+
+typedef struct
+{
+    char *mapping;
+    size_t mapping_size;
+
+    // Either points inside the mapping or to a heap-allocated index that was rebuilt by scanning
+    archive_index_entry_t *index;
+    size_t total_records;
+    bool is_index_allocated;
+} archive_reader_t;
+
+// Records are appended to the archive if it already exists
+archive_t* archive_open(const char *path);
+
+// Stores a completed request, the body will be missing if it was never collected (e.g. it wasn't text)
+void archive_record(archive_t *archive, gemini_request_t *request);
+
+// Writes the index and closes the file
+void archive_close(archive_t *archive);
+
+bool archive_reader_open(archive_reader_t *reader, const char *path);
+
+// The most recent record of the URL wins
+bool archive_reader_lookup(archive_reader_t *reader, const char *url, archive_record_t *record);
+
+void archive_reader_close(archive_reader_t *reader);
+
+#endif
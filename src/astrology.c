@@ -0,0 +1,67 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "astrology.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+SSL_CTX* astrology_create_ssl_context(void)
+{
+    // OpenSSL initializes itself since 1.1.0, so there's nothing global to set up here
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+
+    // Most capsules use self-signed certificates, verification is up to the embedder
+    if (ctx)
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+    return ctx;
+}
+
+void astrology_fetch(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                     const dyn_array_allocator_t *allocator, int max_redirects, int timeout)
+{
+    // The redirections are all part of the same fetch, so they share its deadline
+    uint64_t deadline = timeout > 0 ? get_monotonic_time() + timeout * 1000000ULL : 0;
+
+    gemini_request_start_with_allocator(request, ctx, gemini_url, allocator);
+    request->deadline = deadline;
+    gemini_request_wait(request, GEMINI_REQUEST_DONE);
+
+    while (request->status[0] == '3' && max_redirects-- > 0)
+    {
+        // The next URL is built on the stack, since the request is about to be reused
+        char next_url[sizeof(request->url)];
+
+        if (has_protocol_scheme(request->meta))
+        {
+            snprintf(next_url, sizeof(next_url), "%s", request->meta);
+        }
+        else
+        {
+            char *joined_url = join_relative_link_to_url(request->url, request->meta);
+            snprintf(next_url, sizeof(next_url), "%s", joined_url);
+            free(joined_url);
+        }
+
+        gemini_request_destroy(request);
+        gemini_request_start_with_allocator(request, ctx, next_url, allocator);
+        request->deadline = deadline;
+        gemini_request_wait(request, GEMINI_REQUEST_DONE);
+    }
+}
@@ -0,0 +1,52 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASTROLOGY_H
+#define _ASTROLOGY_H
+
+/*
+ * The public interface of libastrology (make library)
+ * Everything here is reentrant: there is no global state and no ncurses, all of the state lives
+ * inside the structures that the caller passes in. Body memory comes from the caller's allocator
+ *
+ *     gemini_request_t request;
+ *     astrology_fetch(&request, ctx, "gemini://geminiprotocol.net/", NULL, 5, 30);
+ *
+ *     gemtext_line_t elements[256];
+ *     size_t total = gemtext_parse_lines(request.content, DYN_ARRAY_LENGTH(request.content), elements, 256);
+ *
+ *     gemini_request_destroy(&request);
+ */
+
+#include <stdbool.h>
+#include <openssl/ssl.h>
+#include "gemini.h"
+#include "dynamic_array.h"
+
+// A client context with sane defaults, each thread may use its own or share one
+SSL_CTX* astrology_create_ssl_context(void);
+
+/*
+ * Performs a blocking request and follows up to max_redirects redirections
+ * Input requests (status 1x) are not answered, the caller gets them back to decide what to do
+ * If the whole fetch takes more than timeout seconds (unless it's 0), it fails with GEMINI_SERVER_CONNECTION_FAILURE
+ * The request must always be destroyed afterwards, even if it failed
+ */
+void astrology_fetch(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                     const dyn_array_allocator_t *allocator, int max_redirects, int timeout);
+
+#endif
@@ -0,0 +1,856 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "batch.h"
+#include "astrology.h"
+#include "common.h"
+#include "config.h"
+#include "workers.h"
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Stored in the lowest bits of every submission's user data, the rest is the index of the slot
+typedef enum
+{
+    BATCH_CONNECT,
+    BATCH_SEND,
+    BATCH_RECEIVE,
+    // These two don't belong to any slot, nor do they count as being in flight
+    BATCH_CANCEL,
+    BATCH_RESOLVED
+} batch_operation_e;
+
+#define OPERATION_BITS 3
+
+// Whatever batch_fetch is working through
+typedef struct
+{
+    char **urls;
+    size_t total_urls, next_url, total_active;
+
+    // The hosts of the URLs up to this one have already been handed to the resolver
+    size_t next_lookup;
+
+    batch_callback_t callback;
+    void *data;
+} batch_job_t;
+
+static unsigned round_to_power_of_two(size_t value)
+{
+    unsigned result = 1;
+    while (result < value)
+        result <<= 1;
+
+    return result;
+}
+
+// Hands a buffer back to the kernel, so that another receive can pick it
+static void ring_provide_buffer(batch_ring_t *ring, unsigned short id)
+{
+    unsigned short tail = ring->buffer_ring->tail;
+
+    // The tail overlaps the reserved field of the first entry, so that one must be left alone
+    struct io_uring_buf *buffer = &ring->buffer_ring->bufs[tail & (ring->total_buffers - 1)];
+    buffer->addr = (uintptr_t) (ring->buffers + (size_t) id * BATCH_BUFFER_SIZE);
+    buffer->len = BATCH_BUFFER_SIZE;
+    buffer->bid = id;
+
+    __atomic_store_n(&ring->buffer_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_destroy(batch_ring_t *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->rings)
+        munmap(ring->rings, ring->rings_size);
+
+    if (ring->buffer_ring)
+        munmap(ring->buffer_ring, ring->total_buffers * sizeof(struct io_uring_buf));
+
+    free(ring->buffers);
+    close(ring->fd);
+}
+
+// There's no liburing dependency, the ring is set up through the raw system calls
+static bool ring_create(batch_ring_t *ring, unsigned entries, unsigned total_buffers)
+{
+    *ring = (batch_ring_t) {.total_buffers = total_buffers};
+
+    // Only this thread ever submits, and completions don't need to interrupt it since it waits for them anyway
+    struct io_uring_params params = {.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER};
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    // Kernels older than 6.0 don't know about those flags
+    if (ring->fd < 0 && errno == EINVAL)
+    {
+        params = (struct io_uring_params) {0};
+        ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    // Either way, it may well be disabled (see /proc/sys/kernel/io_uring_disabled) or filtered out by seccomp
+    if (ring->fd < 0)
+        return false;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring_destroy(ring);
+        return false;
+    }
+
+    ring->rings_size = MAX(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                           params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQ_RING);
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+
+    ring->buffer_ring = mmap(NULL, total_buffers * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED || ring->buffer_ring == MAP_FAILED)
+    {
+        ring->rings = ring->rings == MAP_FAILED ? NULL : ring->rings;
+        ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+        ring->buffer_ring = ring->buffer_ring == MAP_FAILED ? NULL : ring->buffer_ring;
+
+        ring_destroy(ring);
+        return false;
+    }
+
+    char *rings = ring->rings;
+    ring->sq_head = (unsigned*) (rings + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (rings + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (rings + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (rings + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+
+    ring->cq_head = (unsigned*) (rings + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (rings + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (rings + params.cq_off.cqes);
+
+    // Provided buffer rings only exist since 5.19, older kernels get epoll instead
+    struct io_uring_buf_reg registration = {
+        .ring_addr = (uintptr_t) ring->buffer_ring,
+        .ring_entries = total_buffers,
+        .bgid = 0
+    };
+
+    ring->buffers = malloc((size_t) total_buffers * BATCH_BUFFER_SIZE);
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        ring_destroy(ring);
+        return false;
+    }
+
+    for (unsigned i = 0; i < total_buffers; i++)
+        ring_provide_buffer(ring, i);
+
+    return true;
+}
+
+// Submits everything that was queued and, if asked to, waits for at least one completion or until the timeout
+// The timeout (in microseconds) goes through the extended arguments, which every kernel with buffer rings has
+static void ring_enter(batch_ring_t *ring, bool should_wait, uint64_t timeout)
+{
+    struct timespec timespec = {.tv_sec = timeout / 1000000, .tv_nsec = timeout % 1000000 * 1000};
+    struct io_uring_getevents_arg arguments = {.ts = (uintptr_t) &timespec};
+
+    for (;;)
+    {
+        int result = syscall(__NR_io_uring_enter, ring->fd, ring->total_queued, should_wait ? 1 : 0,
+                             should_wait ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0,
+                             should_wait ? &arguments : NULL, should_wait ? sizeof(arguments) : 0);
+
+        if (result >= 0)
+        {
+            ring->total_queued -= result;
+            return;
+        }
+
+        if (errno != EINTR)
+            return;
+    }
+}
+
+// The submission is copied into the ring, nothing reaches the kernel until the next ring_enter
+static void ring_queue(batch_ring_t *ring, struct io_uring_sqe *submission)
+{
+    unsigned tail = *ring->sq_tail;
+
+    // There's room for several operations per slot, so this only happens if a lot was queued in one go
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        ring_enter(ring, false, 0);
+
+    unsigned index = tail & *ring->sq_mask;
+    ring->sqes[index] = *submission;
+    ring->sq_array[index] = index;
+    ring->total_queued++;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void queue_operation(batch_t *batch, batch_slot_t *slot, struct io_uring_sqe *submission,
+                            batch_operation_e operation)
+{
+    submission->fd = slot->request.connection;
+    submission->user_data = (uint64_t) (slot - batch->slots) << OPERATION_BITS | operation;
+
+    ring_queue(&batch->ring, submission);
+    slot->in_flight++;
+}
+
+// Cancelled operations complete with -ECANCELED, and the slot is done with once the last of them has
+static void queue_cancel(batch_t *batch, batch_slot_t *slot)
+{
+    struct io_uring_sqe submission = {
+        .opcode = IORING_OP_ASYNC_CANCEL,
+        .fd = slot->request.connection,
+        .cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL,
+        .user_data = BATCH_CANCEL
+    };
+
+    ring_queue(&batch->ring, &submission);
+}
+
+// Wakes the loop up once the resolver has something, it has to be queued again every time it does
+static void queue_resolver_poll(batch_t *batch)
+{
+    struct io_uring_sqe submission = {
+        .opcode = IORING_OP_POLL_ADD,
+        .fd = batch->resolver.notification,
+        .poll32_events = POLLIN,
+        .user_data = BATCH_RESOLVED
+    };
+
+    ring_queue(&batch->ring, &submission);
+    batch->is_watching_resolver = true;
+}
+
+static void queue_send(batch_t *batch, batch_slot_t *slot, unsigned char flags)
+{
+    struct io_uring_sqe submission = {
+        .opcode = IORING_OP_SEND,
+        .flags = flags,
+        .addr = (uintptr_t) (slot->outgoing + slot->outgoing_sent),
+        .len = slot->outgoing_length - slot->outgoing_sent,
+        .msg_flags = MSG_NOSIGNAL
+    };
+
+    queue_operation(batch, slot, &submission, BATCH_SEND);
+    slot->is_sending = true;
+}
+
+// The kernel picks a buffer once data arrives, instead of every idle connection holding on to one
+static void queue_receive(batch_t *batch, batch_slot_t *slot, unsigned char flags)
+{
+    struct io_uring_sqe submission = {
+        .opcode = IORING_OP_RECV,
+        .flags = flags | IOSQE_BUFFER_SELECT,
+        .buf_group = 0
+    };
+
+    queue_operation(batch, slot, &submission, BATCH_RECEIVE);
+    slot->is_receiving = true;
+}
+
+// Sends whatever TLS has written since the last time, one send per slot is in flight at most
+static void flush_outgoing(batch_t *batch, batch_slot_t *slot, unsigned char flags)
+{
+    if (slot->is_sending)
+        return;
+
+    int length = BIO_read(SSL_get_wbio(slot->request.ssl), slot->outgoing, sizeof(slot->outgoing));
+    if (length <= 0)
+        return;
+
+    slot->outgoing_length = length;
+    slot->outgoing_sent = 0;
+    queue_send(batch, slot, flags);
+}
+
+// Starts the request once its host has been looked up, returns false if it has already failed
+// A NULL address means that the host couldn't be resolved
+static bool connect_slot(batch_t *batch, batch_slot_t *slot, const resolver_address_t *address)
+{
+    gemini_request_t *request = &slot->request;
+
+    if (batch->backend == BATCH_EPOLL)
+    {
+        gemini_request_start_with_address(request, batch->ctx, slot->url, batch->allocator,
+                                          address ? &address->address : NULL, address ? address->length : 0);
+
+        // The lookup is part of the request, even though it happened before it was started
+        request->started_at = slot->started_at;
+        if (request->phase == GEMINI_REQUEST_DONE)
+            return false;
+
+        // Just like the server, every socket is drained completely whenever it becomes ready
+        struct epoll_event event = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLET,
+            .data.u64 = slot - batch->slots
+        };
+
+        epoll_ctl(batch->epoll, EPOLL_CTL_ADD, request->connection, &event);
+        return true;
+    }
+
+    // The kernel reads the address whenever it gets to the connection, by then the cache might have moved on
+    if (address)
+    {
+        slot->address = address->address;
+        slot->address_length = address->length;
+    }
+
+    gemini_request_start_detached(request, batch->ctx, slot->url, batch->allocator,
+                                  address ? &slot->address : NULL);
+
+    request->started_at = slot->started_at;
+    if (request->phase == GEMINI_REQUEST_DONE)
+        return false;
+
+    // Connecting, sending the ClientHello and waiting for the answer are linked, so they cost a single submission
+    struct io_uring_sqe submission = {
+        .opcode = IORING_OP_CONNECT,
+        .flags = IOSQE_IO_LINK,
+        .addr = (uintptr_t) &slot->address,
+        .off = slot->address_length
+    };
+
+    queue_operation(batch, slot, &submission, BATCH_CONNECT);
+    flush_outgoing(batch, slot, IOSQE_IO_LINK);
+    queue_receive(batch, slot, 0);
+    return true;
+}
+
+// The hosts of the next few URLs are looked up while the slots are still busy, so that they're known by then
+static void look_ahead(batch_t *batch, batch_job_t *job)
+{
+    bool is_pending;
+
+    while (job->next_lookup < MIN(job->next_url + batch->concurrency, job->total_urls))
+        resolver_lookup(&batch->resolver, job->urls[job->next_lookup++], &is_pending);
+}
+
+// Returns false if the request has already failed (e.g. the host is known not to resolve)
+static bool start_slot(batch_t *batch, batch_slot_t *slot, char *url)
+{
+    slot->url = url;
+    slot->in_flight = 0;
+    slot->is_receiving = slot->is_sending = slot->has_hung_up = false;
+    slot->started_at = get_monotonic_time();
+    slot->deadline = slot->started_at + BATCH_TIMEOUT * 1000000ULL;
+
+    const resolver_address_t *address = resolver_lookup(&batch->resolver, url, &slot->is_resolving);
+    return slot->is_resolving || connect_slot(batch, slot, address);
+}
+
+// Keeps the slot busy with the next URLs, the ones that fail right away are reported immediately
+static void fill_slot(batch_t *batch, batch_slot_t *slot, batch_job_t *job)
+{
+    while (job->next_url < job->total_urls)
+    {
+        look_ahead(batch, job);
+
+        if (start_slot(batch, slot, job->urls[job->next_url++]))
+        {
+            slot->is_active = true;
+            job->total_active++;
+            return;
+        }
+
+        job->callback(&slot->request, job->data);
+        gemini_request_destroy(&slot->request);
+    }
+}
+
+static void complete_slot(batch_t *batch, batch_slot_t *slot, batch_job_t *job)
+{
+    slot->is_active = false;
+    job->total_active--;
+
+    job->callback(&slot->request, job->data);
+    gemini_request_destroy(&slot->request);
+
+    fill_slot(batch, slot, job);
+}
+
+// Slots that were waiting for their hosts can connect now, or fail if the host couldn't be resolved
+static void resume_resolving_slots(batch_t *batch, batch_job_t *job)
+{
+    if (!resolver_collect(&batch->resolver))
+        return;
+
+    for (size_t i = 0; i < batch->concurrency; i++)
+    {
+        batch_slot_t *slot = &batch->slots[i];
+        if (!slot->is_active || !slot->is_resolving)
+            continue;
+
+        const resolver_address_t *address = resolver_lookup(&batch->resolver, slot->url, &slot->is_resolving);
+        if (!slot->is_resolving && !connect_slot(batch, slot, address))
+            complete_slot(batch, slot, job);
+    }
+}
+
+// Gives up on the requests that took too long, returns the earliest deadline of the rest (or 0 if there is none)
+static uint64_t expire_slots(batch_t *batch, batch_job_t *job)
+{
+    uint64_t now = get_monotonic_time();
+
+    for (size_t i = 0; i < batch->concurrency; i++)
+    {
+        batch_slot_t *slot = &batch->slots[i];
+
+        // Requests that are already done are only waiting for the kernel to let go of them
+        if (!slot->is_active || slot->deadline > now ||
+            (!slot->is_resolving && slot->request.phase == GEMINI_REQUEST_DONE))
+            continue;
+
+        if (slot->is_resolving)
+        {
+            slot->is_resolving = false;
+            connect_slot(batch, slot, NULL);
+            complete_slot(batch, slot, job);
+            continue;
+        }
+
+        gemini_request_finish(&slot->request, GEMINI_SERVER_CONNECTION_FAILURE);
+
+        if (batch->backend == BATCH_IO_URING && slot->in_flight > 0)
+            queue_cancel(batch, slot);
+        else
+            complete_slot(batch, slot, job);
+    }
+
+    uint64_t next_deadline = 0;
+    for (size_t i = 0; i < batch->concurrency; i++)
+    {
+        batch_slot_t *slot = &batch->slots[i];
+
+        if (slot->is_active && (slot->is_resolving || slot->request.phase != GEMINI_REQUEST_DONE) &&
+            (!next_deadline || slot->deadline < next_deadline))
+            next_deadline = slot->deadline;
+    }
+
+    return next_deadline;
+}
+
+// How long the loop may sleep before it has to check the deadlines again (in microseconds)
+static uint64_t get_timeout(uint64_t next_deadline)
+{
+    uint64_t now = get_monotonic_time();
+
+    // Nothing that can expire is in flight, so only a completion can wake the loop up
+    if (!next_deadline)
+        return BATCH_TIMEOUT * 1000000ULL;
+
+    return next_deadline > now ? next_deadline - now : 0;
+}
+
+static void handle_receive(batch_t *batch, batch_slot_t *slot, struct io_uring_cqe *completion)
+{
+    gemini_request_t *request = &slot->request;
+    slot->is_receiving = false;
+
+    // The data is copied into the TLS buffer right away, so the kernel gets the buffer back immediately
+    if (completion->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned short id = completion->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (completion->res > 0)
+            BIO_write(SSL_get_rbio(request->ssl), batch->ring.buffers + (size_t) id * BATCH_BUFFER_SIZE,
+                      completion->res);
+
+        ring_provide_buffer(&batch->ring, id);
+    }
+
+    if (request->phase == GEMINI_REQUEST_DONE)
+        return;
+
+    // Either every buffer was taken or the link was broken by a short send, neither means that anything is wrong
+    if (completion->res == -ENOBUFS || completion->res == -ECANCELED)
+    {
+        queue_receive(batch, slot, 0);
+        return;
+    }
+
+    // Errors are left for TLS to run into, exactly like it would on a socket that was closed
+    if (completion->res <= 0)
+    {
+        slot->has_hung_up = true;
+        BIO_set_mem_eof_return(SSL_get_rbio(request->ssl), 0);
+    }
+
+    gemini_request_advance(request);
+    flush_outgoing(batch, slot, 0);
+
+    if (request->phase == GEMINI_REQUEST_DONE)
+        return;
+
+    if (slot->has_hung_up)
+        gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+    else
+        queue_receive(batch, slot, 0);
+}
+
+static void handle_completion(batch_t *batch, struct io_uring_cqe *completion, batch_job_t *job)
+{
+    batch_operation_e operation = completion->user_data & ((1 << OPERATION_BITS) - 1);
+
+    // Whatever was cancelled shows up in the slot's own completions
+    if (operation == BATCH_CANCEL)
+        return;
+
+    if (operation == BATCH_RESOLVED)
+    {
+        resume_resolving_slots(batch, job);
+        queue_resolver_poll(batch);
+        return;
+    }
+
+    batch_slot_t *slot = &batch->slots[completion->user_data >> OPERATION_BITS];
+    gemini_request_t *request = &slot->request;
+    slot->in_flight--;
+
+    switch (operation)
+    {
+    case BATCH_CONNECT:
+        // A connection that timed out has already failed, which is what got it cancelled
+        if (request->phase == GEMINI_REQUEST_DONE)
+            break;
+
+        if (completion->res < 0)
+            gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+        else
+            gemini_request_connected(request);
+        break;
+
+    case BATCH_SEND:
+        slot->is_sending = false;
+
+        if (completion->res < 0)
+        {
+            // A broken connection shows up in the receive as well, so it's only a failure if nothing else is pending
+            if (completion->res != -ECANCELED && request->phase != GEMINI_REQUEST_DONE)
+                gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+
+            break;
+        }
+
+        slot->outgoing_sent += completion->res;
+        if (slot->outgoing_sent < slot->outgoing_length)
+            queue_send(batch, slot, 0);
+        else if (request->phase != GEMINI_REQUEST_DONE)
+            flush_outgoing(batch, slot, 0);
+        break;
+
+    case BATCH_RECEIVE:
+        handle_receive(batch, slot, completion);
+        break;
+
+    default:
+        break;
+    }
+
+    if (request->phase != GEMINI_REQUEST_DONE)
+        return;
+
+    // A receive that's still waiting would keep the slot busy forever, shutting the socket down wakes it up
+    if (slot->in_flight > 0)
+    {
+        if (slot->is_receiving)
+            shutdown(request->connection, SHUT_RDWR);
+
+        return;
+    }
+
+    complete_slot(batch, slot, job);
+}
+
+static void fetch_with_io_uring(batch_t *batch, batch_job_t *job)
+{
+    batch_ring_t *ring = &batch->ring;
+    uint64_t next_deadline = 0;
+
+    if (!batch->is_watching_resolver)
+        queue_resolver_poll(batch);
+
+    while (job->total_active > 0)
+    {
+        // Everything that was queued since the last time goes out together with the wait
+        ring_enter(ring, true, get_timeout(next_deadline));
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail)
+        {
+            // Handling a completion may queue more submissions, but it never touches the completion queue
+            struct io_uring_cqe completion = ring->cqes[head & *ring->cq_mask];
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+            handle_completion(batch, &completion, job);
+        }
+
+        next_deadline = expire_slots(batch, job);
+    }
+}
+
+static void fetch_with_epoll(batch_t *batch, batch_job_t *job)
+{
+    struct epoll_event events[batch->concurrency + 1];
+    uint64_t next_deadline = 0;
+
+    while (job->total_active > 0)
+    {
+        // Rounded up, so that the loop doesn't spin for the last millisecond before a deadline
+        int timeout = (get_timeout(next_deadline) + 999) / 1000;
+        int total_events = epoll_wait(batch->epoll, events, batch->concurrency + 1, timeout);
+
+        for (int i = 0; i < total_events; i++)
+        {
+            // The resolver's notification comes right after the slots
+            if (events[i].data.u64 == batch->concurrency)
+            {
+                resume_resolving_slots(batch, job);
+                continue;
+            }
+
+            batch_slot_t *slot = &batch->slots[events[i].data.u64];
+
+            // Closing the socket takes it out of the interest list as well
+            if (slot->is_active && !slot->is_resolving && gemini_request_advance(&slot->request))
+                complete_slot(batch, slot, job);
+        }
+
+        next_deadline = expire_slots(batch, job);
+    }
+}
+
+void batch_create(batch_t *batch, SSL_CTX *ctx, const dyn_array_allocator_t *allocator, size_t concurrency,
+                  bool allow_io_uring)
+{
+    batch->ctx = ctx;
+    batch->allocator = allocator;
+    batch->concurrency = concurrency;
+    batch->slots = calloc(concurrency, sizeof(batch_slot_t));
+    batch->epoll = -1;
+    batch->is_watching_resolver = false;
+    resolver_create(&batch->resolver);
+
+    // A connect, a send, a receive and a cancellation may be queued for every slot at the same time
+    unsigned entries = round_to_power_of_two(concurrency * 4);
+    unsigned total_buffers = round_to_power_of_two(concurrency);
+
+    if (allow_io_uring && ring_create(&batch->ring, entries, total_buffers))
+    {
+        batch->backend = BATCH_IO_URING;
+        return;
+    }
+
+    batch->backend = BATCH_EPOLL;
+    batch->epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.u64 = concurrency
+    };
+
+    epoll_ctl(batch->epoll, EPOLL_CTL_ADD, batch->resolver.notification, &event);
+}
+
+void batch_fetch(batch_t *batch, char **urls, size_t total_urls, batch_callback_t callback, void *data)
+{
+    batch_job_t job = {
+        .urls = urls,
+        .total_urls = total_urls,
+        .callback = callback,
+        .data = data
+    };
+
+    for (size_t i = 0; i < batch->concurrency && job.next_url < total_urls; i++)
+        fill_slot(batch, &batch->slots[i], &job);
+
+    if (batch->backend == BATCH_IO_URING)
+        fetch_with_io_uring(batch, &job);
+    else
+        fetch_with_epoll(batch, &job);
+}
+
+void batch_destroy(batch_t *batch)
+{
+    if (batch->backend == BATCH_IO_URING)
+        ring_destroy(&batch->ring);
+    else
+        close(batch->epoll);
+
+    resolver_destroy(&batch->resolver);
+    free(batch->slots);
+}
+
+typedef struct
+{
+    // Every worker gets its own list of URLs
+    DYN_ARRAY(char*) *shares;
+    size_t concurrency;
+    bool allow_io_uring;
+
+    batch_callback_t callback;
+    void *data;
+} batch_parallel_job_t;
+
+static void fetch_share(size_t index, void *data)
+{
+    batch_parallel_job_t *job = data;
+    DYN_ARRAY(char*) urls = job->shares[index];
+
+    // Nothing about TLS is shared between workers, not even the context
+    SSL_CTX *ctx = astrology_create_ssl_context();
+    batch_t batch;
+
+    batch_create(&batch, ctx, NULL, job->concurrency, job->allow_io_uring);
+    batch_fetch(&batch, urls, DYN_ARRAY_LENGTH(urls), job->callback, job->data);
+    batch_destroy(&batch);
+
+    SSL_CTX_free(ctx);
+}
+
+void batch_fetch_in_parallel(char **urls, size_t total_urls, size_t total_workers, size_t concurrency,
+                             bool allow_io_uring, batch_callback_t callback, void *data)
+{
+    batch_parallel_job_t job = {
+        .shares = malloc(total_workers * sizeof(DYN_ARRAY(char*))),
+        .concurrency = concurrency,
+        .allow_io_uring = allow_io_uring,
+        .callback = callback,
+        .data = data
+    };
+
+    for (size_t i = 0; i < total_workers; i++)
+        job.shares[i] = dyn_array_create(total_urls / total_workers + 16, sizeof(char*));
+
+    for (size_t i = 0; i < total_urls; i++)
+    {
+        size_t owner = workers_get_owner(urls[i], total_workers);
+
+        job.shares[owner] = dyn_array_prepare_new_item(job.shares[owner]);
+        DYN_ARRAY_GET_LAST(job.shares[owner]) = urls[i];
+    }
+
+    workers_run(total_workers, fetch_share, &job);
+
+    for (size_t i = 0; i < total_workers; i++)
+        dyn_array_destroy(job.shares[i]);
+
+    free(job.shares);
+}
+
+static char *error_names[TOTAL_GEMINI_ERRORS] = {
+    [GEMINI_OK] = "ok",
+    [GEMINI_TEMPORARY_FAILURE] = "temporary_failure",
+    [GEMINI_PERMANENT_FAILURE] = "permanent_failure",
+    [GEMINI_CLIENT_CERTIFICATE_REQUIRED] = "certificate_required",
+    [GEMINI_IP_RESOLVE_FAILURE] = "resolve_failure",
+    [GEMINI_SERVER_CONNECTION_FAILURE] = "connection_failure",
+    [GEMINI_TLS_HANDSHAKE_FAILURE] = "handshake_failure",
+    [GEMINI_NOT_TEXT] = "not_text",
+    [GEMINI_HEADER_PARSING_FAILURE] = "header_failure",
+    [GEMINI_CERTIFICATE_NOT_TRUSTED] = "certificate_not_trusted",
+    [GEMINI_CERTIFICATE_CHANGED] = "certificate_changed",
+    [GEMINI_LOCAL_FILE_FAILURE] = "local_file_failure"
+};
+
+// Prints <status> <body bytes> <milliseconds> <url> <meta>, failures without a header show the error instead
+static void print_response(gemini_request_t *request, void *data)
+{
+    // Every line is written by a single call, so lines of different workers never get mixed up
+    atomic_size_t *total_failures = data;
+    double milliseconds = (request->finished_at - request->started_at) / 1000.0;
+
+    if (!request->status[0])
+    {
+        printf("-- 0 %.1f %s %s\n", milliseconds, request->url, error_names[request->error]);
+        atomic_fetch_add(total_failures, 1);
+        return;
+    }
+
+    printf("%s %zu %.1f %s %s\n", request->status, request->content ? DYN_ARRAY_LENGTH(request->content) : 0,
+           milliseconds, request->url, request->meta);
+}
+
+int batch_run(int argc, char **argv)
+{
+    bool allow_io_uring = !(argc == 1 && !strcmp(argv[0], "--epoll"));
+    if (argc > 1 || (argc == 1 && allow_io_uring))
+    {
+        fprintf(stderr, "usage: astrology --fetch [--epoll] < urls\n");
+        return EXIT_FAILURE;
+    }
+
+    atomic_size_t total_failures;
+    atomic_init(&total_failures, 0);
+
+    DYN_ARRAY(char*) urls = dyn_array_create(64, sizeof(char*));
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+
+    while ((line_length = getline(&line, &line_capacity, stdin)) > 0)
+    {
+        while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r'))
+            line[--line_length] = 0;
+
+        if (line_length == 0)
+            continue;
+
+        // Anything else would have to be parsed before it can even be handed to a worker
+        if (strncmp(line, "gemini://", 9) || line_length > 1024)
+        {
+            printf("-- 0 0.0 %s invalid_url\n", line);
+            atomic_fetch_add(&total_failures, 1);
+            continue;
+        }
+
+        urls = dyn_array_prepare_new_item(urls);
+        DYN_ARRAY_GET_LAST(urls) = strdup(line);
+    }
+
+    free(line);
+
+    batch_fetch_in_parallel(urls, DYN_ARRAY_LENGTH(urls), workers_get_total(), BATCH_CONCURRENCY, allow_io_uring,
+                            print_response, &total_failures);
+
+    for (size_t i = 0; i < DYN_ARRAY_LENGTH(urls); i++)
+        free(urls[i]);
+
+    dyn_array_destroy(urls);
+    return atomic_load(&total_failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
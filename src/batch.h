@@ -0,0 +1,134 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "gemini.h"
+#include "resolver.h"
+
+// TLS records are at most 16 KB long, so a single receive never needs more than that
+#define BATCH_BUFFER_SIZE 16384
+
+typedef enum
+{
+    // Connecting, sending and receiving are queued up and submitted together, once per loop
+    BATCH_IO_URING,
+    // Every socket is waited on and then read from and written to one system call at a time
+    BATCH_EPOLL
+} batch_backend_e;
+
+// Gets called once per URL, the content can be taken away from the request, which is destroyed right after
+typedef void (*batch_callback_t) (gemini_request_t *request, void *data);
+
+// What io_uring needs to share with the kernel, it's mapped into both of them
+typedef struct
+{
+    int fd;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries, total_queued;
+
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *rings;
+    size_t rings_size, sqes_size;
+
+    // The kernel picks one of these for every receive, so that idle connections don't hold on to any memory
+    struct io_uring_buf_ring *buffer_ring;
+    char *buffers;
+    unsigned total_buffers;
+} batch_ring_t;
+
+typedef struct
+{
+    gemini_request_t request;
+    bool is_active;
+
+    // The request is only started once the host has been resolved, until then only the URL is known
+    char *url;
+    bool is_resolving;
+
+    // When the URL was picked up and when it's given up on, no matter what it's waiting for (in microseconds)
+    uint64_t started_at, deadline;
+
+    // Only used by io_uring, the connection is made by the kernel
+    struct sockaddr_storage address;
+    socklen_t address_length;
+
+    // A slot can only be reused once the kernel is done with every operation
+    int in_flight;
+    bool is_receiving, is_sending, has_hung_up;
+
+    // What TLS wants to send, it has to stay put until the kernel has sent it
+    char outgoing[BATCH_BUFFER_SIZE];
+    size_t outgoing_length, outgoing_sent;
+} batch_slot_t;
+
+/*
+ * Fetches lots of URLs at once without following redirections, e.g. for crawling (astrology --fetch)
+ * io_uring is used whenever the kernel supports provided buffer rings (5.19) and allows it, epoll otherwise
+ * Either way, a single thread keeps up to the given amount of requests in flight, and none of them for longer
+ * than BATCH_TIMEOUT seconds. Hosts are resolved by the resolver's own threads, so the loop never waits for them
+ */
+typedef struct
+{
+    batch_backend_e backend;
+    SSL_CTX *ctx;
+    const dyn_array_allocator_t *allocator;
+
+    batch_slot_t *slots;
+    size_t concurrency;
+
+    int epoll;
+    batch_ring_t ring;
+
+    // Only the hosts of this batch's URLs end up in here, they're looked up ahead of the slots that need them
+    resolver_t resolver;
+    bool is_watching_resolver;
+} batch_t;
+
+// Falls back to epoll if io_uring isn't available, or if it isn't wanted in the first place
+void batch_create(batch_t *batch, SSL_CTX *ctx, const dyn_array_allocator_t *allocator, size_t concurrency,
+                  bool allow_io_uring);
+
+// Blocks until every URL has been fetched, the callback runs in the same thread
+void batch_fetch(batch_t *batch, char **urls, size_t total_urls, batch_callback_t callback, void *data);
+
+void batch_destroy(batch_t *batch);
+
+/*
+ * Splits the URLs between shared-nothing workers by the hash of their hosts (see workers.h)
+ * Every worker fetches its share through a batch of its own, with its own TLS context
+ * The callback runs on the workers' threads, so it may be called from several of them at the same time
+ */
+void batch_fetch_in_parallel(char **urls, size_t total_urls, size_t total_workers, size_t concurrency,
+                             bool allow_io_uring, batch_callback_t callback, void *data);
+
+/*
+ * Fetches the URLs of the standard input (one per line) on every core and prints a line for each response
+ * astrology --fetch [--epoll] < urls
+ * Returns the exit status of the program
+ */
+int batch_run(int argc, char **argv);
+
+#endif
@@ -16,8 +16,13 @@
  */
 
 #include "browser.h"
+#include "session.h"
+#include "archive.h"
+#include "memory.h"
+#include "local.h"
 #include "common.h"
 #include <ctype.h>
+#include <malloc.h>
 #include <unistd.h>
 
 // Some global, statically allocated strings for the implementation of some simple error handling
@@ -25,6 +30,9 @@ static char *error_format = "# Astrology: Gemini Request Failed\n> Error Details
     " If the error persists and does not occur on any other Gemini client, please report it!"
     " As of now, you can just revert to the previous history entry and continue browsing.";
 
+static char *unknown_page_format = "# Astrology: Unknown Page\n> There is no internal page called %s\n"
+    "=> about:stats Statistics\n=> about:memory Memory\n";
+
 static char *gemini_error_mappings[TOTAL_GEMINI_ERRORS] = {
     [GEMINI_IP_RESOLVE_FAILURE] = "Failed to resolve the IP address of the server.",
     [GEMINI_SERVER_CONNECTION_FAILURE] = "Failed to establish a simple TCP connection with the server.",
@@ -34,6 +42,10 @@ static char *gemini_error_mappings[TOTAL_GEMINI_ERRORS] = {
     [GEMINI_TLS_HANDSHAKE_FAILURE] = "The TLS handshake failed, is the server down?",
     [GEMINI_NOT_TEXT] = "The server returned something that is neither gemtext nor raw text, cannot render!",
     [GEMINI_HEADER_PARSING_FAILURE] = "Failed to parse the server's response header. Is the server properly implemented?",
+    [GEMINI_CERTIFICATE_NOT_TRUSTED] = "The server's certificate could not be verified against the trust store.",
+    [GEMINI_CERTIFICATE_CHANGED] = "The server's certificate has changed since the first visit, although the old one "
+                                   "has not expired yet! If that's expected, run astrology --forget <host>.",
+    [GEMINI_LOCAL_FILE_FAILURE] = "The local file or directory could not be opened.",
 };
 
 // Will be passed as an item deallocator into the generic doubly linked list instance
@@ -45,7 +57,59 @@ static void page_deallocator(void *data)
     free(page);
 }
 
-void gemini_browser_create(gemini_browser_t *browser, gemini_input_callback_t input_callback)
+/*
+ * Loading OpenSSL's algorithms and the trust store takes a few milliseconds (a lot more with a CA bundle)
+ * It's done here instead, while the main thread sets up the terminal and paints the first frame
+ * There's no need to initialize the library explicitly, it happens on its own once the context is created
+ */
+static void* create_ssl_context(void *data)
+{
+    gemini_browser_t *browser = data;
+
+    // The latest TLS method will be used
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+        return NULL;
+
+#ifdef WITH_SSL_CERT
+    // If WITH_SSL_CERT is defined then load the CA certificates for verification
+    bool is_loaded = access(CERTIFICATION_DIRECTORY, R_OK) == 0 ?
+        SSL_CTX_load_verify_locations(ctx, NULL, CERTIFICATION_DIRECTORY) :
+        SSL_CTX_load_verify_locations(ctx, CERTIFICATION_PATH, NULL);
+
+    if (!is_loaded)
+    {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    known_hosts_verify_context(&browser->known_hosts, ctx, true);
+#else
+    known_hosts_verify_context(&browser->known_hosts, ctx, false);
+#endif
+
+    return ctx;
+}
+
+SSL_CTX* gemini_browser_get_ssl_context(gemini_browser_t *browser)
+{
+    if (browser->is_ssl_ready)
+        return browser->ssl_ctx;
+
+    void *ctx;
+    pthread_join(browser->ssl_thread, &ctx);
+
+    if (!ctx)
+        exit_with_failure("failed to initialize TLS client context");
+
+    browser->ssl_ctx = ctx;
+    browser->is_ssl_ready = true;
+
+    return browser->ssl_ctx;
+}
+
+void gemini_browser_create(gemini_browser_t *browser, gemini_input_callback_t input_callback,
+                           gemini_progress_callback_t progress_callback)
 {
     // Load in the booksmarks into memory
     // Ensure that the file actually exists
@@ -76,68 +140,471 @@ void gemini_browser_create(gemini_browser_t *browser, gemini_input_callback_t in
     }
     
     // The SSL context will describe how future SSL connection will be created
-    // The latest TLS method will be used
-    SSL_load_error_strings();
-    SSL_library_init();
-    OpenSSL_add_all_algorithms();
+    browser->ssl_ctx = NULL;
+    browser->is_ssl_ready = false;
+    known_hosts_open(&browser->known_hosts, KNOWN_HOSTS_PATH);
 
-    browser->ssl_ctx = SSL_CTX_new(TLS_client_method());
-    if (!browser->ssl_ctx)
-        exit_with_failure("failed to initialize TLS client context");
+    if (pthread_create(&browser->ssl_thread, NULL, create_ssl_context, browser) != 0)
+    {
+        browser->ssl_ctx = create_ssl_context(browser);
+        browser->is_ssl_ready = true;
 
-#ifdef WITH_SSL_CERT
-        // If WITH_SSL_CERT is defined then load the CA certificates for verification
-    
-    if (!SSL_CTX_load_verify_locations(browser->ssl_ctx, CERTIFICATION_PATH, NULL))
-        exit_with_failure("failed to load CA certificates");
-    
-    // Set the verification mode to for a valid certificate
-    SSL_CTX_set_verify(browser->ssl_ctx, SSL_VERIFY_PEER, NULL);
-    
-#endif
+        if (!browser->ssl_ctx)
+            exit_with_failure("failed to initialize TLS client context");
+    }
 
     // Initializing the pages doubly linked list that will act as a history recorder
     doubly_linked_create(&browser->pages, MAX_HISTORY_LENGTH, page_deallocator);
 
     browser->input_callback = input_callback;
+    browser->progress_callback = progress_callback;
+    browser->is_revalidating = false;
+    browser->archive = NULL;
+
+    gemini_stats_create(&browser->stats, STATS_PATH);
+    warmup_create(&browser->warmup);
+
+    pressure_monitor_create(&browser->pressure);
+    browser->total_sheddings = browser->shed_elements = browser->shed_pages = browser->shed_bytes = 0;
+    session_restore(browser, SESSION_PATH);
+}
+
+/*
+ * Check if any errors were encountered
+ * The program will notify the user by inserting the notice into the document
+ * The frontend is not required to take any further action
+ */
+static void insert_error_notice(gemini_document_t *document)
+{
+    char *error_message = gemini_error_mappings[document->error];
+    
+    size_t error_buffer_length = strlen(error_format) - strlen("%s") + strlen(error_message);
+    document->content = dyn_array_create_with_allocator(error_buffer_length + 1, sizeof(char), document->allocator);
+
+    sprintf(document->content, error_format, error_message);
+    document->content[error_buffer_length] = 0;
+    *DYN_ARRAY_GET_ATTRIBUTE(document->content, DYN_ARRAY_LENGTH) = error_buffer_length;
+    
+    gemini_document_parse_gemtext(document);
+}
+
+static bool is_internal_url(const char *url)
+{
+    return !strncmp(url, "about:", 6);
+}
+
+// The bytes that an array occupies on the heap, header included
+static size_t get_array_size(dyn_array_t array)
+{
+    if (!array)
+        return 0;
+
+    return DYN_ARRAY_HEADER_SIZE * sizeof(size_t) +
+        *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_CAPACITY) * *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ITEM_SIZE);
+}
+
+static DYN_ARRAY(char) create_memory_page(gemini_browser_t *browser)
+{
+    char live[16], peak[16], content[16], elements[16];
+
+    DYN_ARRAY(char) page = dyn_array_create(4096, sizeof(char));
+    format_bytes(live, sizeof(live), memory_get_resident_bytes());
+
+    page = append_format(page, "# Memory\nThe process has %s resident right now. "
+                         "Peaks are the highest amount that was ever live at once\n", live);
+
+    page = append_format(page, "```\n%-12s%12s%12s%14s\n", "subsystem", "live", "peak", "allocations");
+    for (int i = 0; i < TOTAL_MEMORY_SUBSYSTEMS; i++)
+    {
+        memory_usage_t usage;
+        memory_get_usage(i, &usage);
+
+        format_bytes(live, sizeof(live), usage.live_bytes);
+        format_bytes(peak, sizeof(peak), usage.peak_bytes);
+
+        // Estimated subsystems never count their allocations
+        if (i == MEMORY_NCURSES)
+            page = append_format(page, "%-12s%12s%12s%14s\n", memory_get_subsystem_name(i), live, peak, "estimated");
+        else
+            page = append_format(page, "%-12s%12s%12s%14zu\n", memory_get_subsystem_name(i), live, peak,
+                                 usage.total_allocations);
+    }
+
+    // The monitor only remembers what it read the last time
+    pressure_monitor_t *pressure = &browser->pressure;
+    pressure_monitor_get_level(pressure);
+    page = append_format(page, "```\n\n## Pressure\n");
+
+    if (pressure->cgroup_limit)
+    {
+        format_bytes(live, sizeof(live), pressure->cgroup_usage);
+        format_bytes(peak, sizeof(peak), pressure->cgroup_limit);
+        page = append_format(page, "The cgroup uses %s out of %s, not counting the inactive page cache. ", live, peak);
+    }
+
+    format_bytes(live, sizeof(live), browser->shed_bytes);
+    page = append_format(page, "Tasks stalled on memory for %.2f%% (some) and %.2f%% (full) of the last ten seconds\n"
+                         "```\n%-22s%10zu\n%-22s%10zu\n%-22s%10zu\n%-22s%10s\n",
+                         pressure->stall_some, pressure->stall_full,
+                         "times under pressure", browser->total_sheddings,
+                         "element tables dropped", browser->shed_elements,
+                         "pages dropped", browser->shed_pages,
+                         "freed", live);
+
+    page = append_format(page, "```\n\n## History\nThe newest page comes first. "
+                         "Pages restored from a snapshot are mapped instead, only what's touched is resident\n");
+    page = append_format(page, "```\n%12s%12s  %s\n", "content", "elements", "url");
+
+    for (doubly_node_t *node = browser->pages.head; node; node = node->previous)
+    {
+        gemini_document_t *document = ((gemini_page_t*) node->data)->document;
+
+        if (document->mapping)
+        {
+            format_bytes(content, sizeof(content), document->mapping_size);
+            snprintf(elements, sizeof(elements), "mapped");
+        }
+        else
+        {
+            format_bytes(content, sizeof(content), get_array_size(document->content));
+            format_bytes(elements, sizeof(elements), get_array_size(document->elements));
+        }
+
+        page = append_format(page, "%12s%12s  %s\n", content, elements, document->url);
+    }
+
+    return append_format(page, "```\n");
+}
+
+// Internal pages are generated every time they're visited, so they're always up to date
+// They're left unparsed, so that reloading one can go through gemini_document_update
+static gemini_document_t* create_internal_document(gemini_browser_t *browser, char *url)
+{
+    gemini_document_t *document = gemini_document_create(url);
+    document->allocator = memory_get_allocator(MEMORY_DOCUMENTS);
+
+    if (!strcmp(url, "about:stats"))
+    {
+        document->content = gemini_stats_create_page(&browser->stats);
+    }
+    else if (!strcmp(url, "about:memory"))
+    {
+        document->content = create_memory_page(browser);
+    }
+    else
+    {
+        size_t length = snprintf(NULL, 0, unknown_page_format, url);
+        document->content = dyn_array_create(length + 1, sizeof(char));
+
+        sprintf(document->content, unknown_page_format, url);
+        DYN_ARRAY_LENGTH(document->content) = length;
+    }
+
+    return document;
+}
+
+// Everything that goes over the network ends up in the statistics
+static gemini_document_t* fetch_document(gemini_browser_t *browser, char *url)
+{
+    if (is_internal_url(url))
+    {
+        gemini_document_t *document = create_internal_document(browser, url);
+        gemini_document_parse_gemtext(document);
+
+        return document;
+    }
+
+    // The fetch itself has already been recorded, when it happened in the background
+    gemini_document_t *warm_document = warmup_take(&browser->warmup, url);
+    if (warm_document)
+    {
+        gemini_stats_record_hit(&browser->stats, warm_document->url);
+        return warm_document;
+    }
+
+    // Local files never touch the network, so they're left out of the statistics
+    if (local_is_file_url(url))
+    {
+        gemini_document_t *document = local_document_open(url, memory_get_allocator(MEMORY_DOCUMENTS));
+        if (document->error != GEMINI_OK)
+            insert_error_notice(document);
+
+        return document;
+    }
+
+    // The context is only needed once the host is known, so the very first lookup overlaps with setting it up
+    // Whatever is left of that is then counted as part of the lookup
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    uint64_t started_at = get_monotonic_time();
+    bool is_resolved = gemini_resolve_hostname(url, &address, &address_length);
+
+    gemini_document_t *document = gemini_fetch_document_with_address(gemini_browser_get_ssl_context(browser), url,
+                                                                     browser->input_callback, browser->archive,
+                                                                     memory_get_allocator(MEMORY_DOCUMENTS),
+                                                                     browser->progress_callback,
+                                                                     is_resolved ? &address : NULL, address_length,
+                                                                     started_at);
+    gemini_stats_record_fetch(&browser->stats, document->url, &document->timings);
+
+    if (document->error != GEMINI_OK)
+        insert_error_notice(document);
+
+    return document;
 }
 
 void gemini_browser_load_document(gemini_browser_t *browser, char *gemini_url)
 {
+    // Whatever was being revalidated is not going to be the current page anymore
+    gemini_browser_cancel_revalidation(browser);
+
     gemini_page_t *page = malloc(sizeof(gemini_page_t));
 
     page->scroll_offset = 0;
-    page->document = gemini_fetch_document(browser->ssl_ctx, gemini_url, browser->input_callback);
+    page->document = fetch_document(browser, gemini_url);
+
+    doubly_linked_insert_first(&browser->pages, page);
+    gemini_browser_relieve_memory_pressure(browser);
+}
+
+static size_t get_documents_usage(void)
+{
+    memory_usage_t usage;
+    memory_get_usage(MEMORY_DOCUMENTS, &usage);
+
+    return usage.live_bytes;
+}
+
+void gemini_browser_relieve_memory_pressure(gemini_browser_t *browser)
+{
+    pressure_level_e level = pressure_monitor_get_level(&browser->pressure);
+    if (level == PRESSURE_NONE)
+        return;
 
-    /*
-     * Check if any errors were encountered
-     * The program will notify the user by inserting the notice into the document
-     * The frontend is not required to take any further action
-     */
-    if (page->document->error != GEMINI_OK)
+    size_t usage_before = get_documents_usage();
+    browser->total_sheddings++;
+
+    // Pages that haven't even been visited yet are the first to go
+    warmup_clear(&browser->warmup);
+
+    // The bodies are still around, so the elements can be parsed again without going over the network
+    // Mapped pages are left alone, their pages are backed by the snapshot and the kernel can drop them anyway
+    for (doubly_node_t *node = browser->pages.head->previous; node; node = node->previous)
     {
-        char *error_message = gemini_error_mappings[page->document->error];
-        
-        size_t error_buffer_length = strlen(error_format) - strlen("%s") + strlen(error_message);
-        page->document->content = dyn_array_create(error_buffer_length + 1, sizeof(char));
+        gemini_document_t *document = ((gemini_page_t*) node->data)->document;
 
-        sprintf(page->document->content, error_format, error_message);
-        page->document->content[error_buffer_length] = 0;
-        *DYN_ARRAY_GET_ATTRIBUTE(page->document->content, DYN_ARRAY_LENGTH) = error_buffer_length;
-        
-        gemini_document_parse_gemtext(page->document);
+        if (!document->mapping && document->content && document->elements)
+        {
+            dyn_array_destroy(document->elements);
+            document->elements = NULL;
+            browser->shed_elements++;
+        }
     }
 
-    doubly_linked_insert_first(&browser->pages, page);
+    malloc_trim(0);
+    level = pressure_monitor_get_level(&browser->pressure);
+
+    // Whole pages have to be fetched again, so only as many as needed are dropped, starting from the oldest one
+    for (doubly_node_t *node = browser->pages.tail; level == PRESSURE_CRITICAL && node != browser->pages.head;
+         node = node->next)
+    {
+        gemini_page_t *page = node->data;
+        if (!page->document->content)
+            continue;
+
+        gemini_document_t *placeholder = gemini_document_create(page->document->url);
+        gemini_document_destroy(page->document);
+        page->document = placeholder;
+        browser->shed_pages++;
+
+        malloc_trim(0);
+        level = pressure_monitor_get_level(&browser->pressure);
+    }
+
+    size_t usage_after = get_documents_usage();
+    browser->shed_bytes += usage_before > usage_after ? usage_before - usage_after : 0;
+}
+
+bool gemini_browser_rebuild_history(gemini_browser_t *browser, uint64_t deadline)
+{
+    // The page on the screen is the one being read, so it's finished no matter what
+    gemini_document_t *current = browser->pages.head ? ((gemini_page_t*) browser->pages.head->data)->document : NULL;
+    if (current && current->content && current->is_partially_parsed && !gemini_document_parse_until(current, deadline))
+        return false;
+
+    // It would only be dropped again, the pages will be parsed once they're visited anyway
+    if (pressure_monitor_get_level(&browser->pressure) != PRESSURE_NONE)
+        return true;
+
+    // The newest pages are the likeliest to be visited again
+    // Even a single page might take longer than a whole slice, so it's parsed a few lines at a time
+    for (doubly_node_t *node = browser->pages.head; node; node = node->previous)
+    {
+        gemini_document_t *document = ((gemini_page_t*) node->data)->document;
+        bool needs_parsing = !document->elements || document->is_partially_parsed;
+
+        if (document->content && needs_parsing && !gemini_document_parse_until(document, deadline))
+            return false;
+    }
+
+    return true;
 }
 
 void gemini_browser_go_back(gemini_browser_t *browser)
 {
+    gemini_browser_cancel_revalidation(browser);
     doubly_linked_delete_head(&browser->pages);
+    gemini_browser_ensure_page_is_loaded(browser);
+}
+
+void gemini_browser_ensure_page_is_loaded(gemini_browser_t *browser)
+{
+    gemini_page_t *page = browser->pages.head->data;
+
+    // Internal pages are not worth keeping around, they're cheaper to generate again
+    if (page->document->content && !is_internal_url(page->document->url))
+    {
+        // Memory pressure might have taken the elements away, but the body is still there
+        if (!page->document->elements)
+            gemini_document_parse(page->document);
+
+        if (!local_is_file_url(page->document->url))
+            gemini_stats_record_hit(&browser->stats, page->document->url);
+
+        return;
+    }
+
+    gemini_document_t *placeholder = page->document;
+    page->document = fetch_document(browser, placeholder->url);
+    gemini_document_destroy(placeholder);
+    gemini_browser_relieve_memory_pressure(browser);
+
+    // The page might have shrunk since the last time it was visited
+    size_t total_elements = DYN_ARRAY_LENGTH(page->document->elements);
+    page->scroll_offset = MIN(page->scroll_offset, total_elements ? total_elements - 1 : 0);
+}
+
+// Swaps the current page for a newer version of itself, while the scroll offset stays on the same element
+static bool update_current_page(gemini_browser_t *browser, gemini_document_t *newer)
+{
+    gemini_page_t *page = browser->pages.head->data;
+
+    if (newer->error != GEMINI_OK || !newer->content)
+    {
+        gemini_document_destroy(newer);
+        return false;
+    }
+
+    if (!gemini_document_update(page->document, newer, &browser->last_update))
+        return false;
+
+    size_t total_elements = DYN_ARRAY_LENGTH(page->document->elements);
+    size_t scroll_offset = gemini_document_diff_translate(&browser->last_update, page->scroll_offset);
+    page->scroll_offset = MIN(scroll_offset, total_elements ? total_elements - 1 : 0);
+
+    return true;
+}
+
+void gemini_browser_revalidate(gemini_browser_t *browser)
+{
+    gemini_browser_cancel_revalidation(browser);
+
+    gemini_page_t *page = browser->pages.head->data;
+    // Nothing to ask a server about, local files are read from the page cache anyway
+    if (is_internal_url(page->document->url) || local_is_file_url(page->document->url))
+        return;
+
+    gemini_request_start_with_allocator(&browser->revalidation, gemini_browser_get_ssl_context(browser),
+                                        page->document->url, memory_get_allocator(MEMORY_DOCUMENTS));
+    browser->is_revalidating = true;
+}
+
+bool gemini_browser_advance_revalidation(gemini_browser_t *browser)
+{
+    if (!browser->is_revalidating || !gemini_request_advance(&browser->revalidation))
+        return false;
+
+    browser->is_revalidating = false;
+    gemini_request_t *request = &browser->revalidation;
+    bool has_changed = false;
+
+    gemini_timings_t timings;
+    gemini_request_get_timings(request, &timings);
+    gemini_stats_record_fetch(&browser->stats, request->url, &timings);
+
+    // Only successful responses are taken into account, anything else would need the user's attention
+    // In that case, just keep showing the old version
+    if (request->status[0] == '2' && request->error == GEMINI_OK && request->content)
+        has_changed = update_current_page(browser, gemini_document_receive(request));
+
+    gemini_request_destroy(request);
+    return has_changed;
+}
+
+bool gemini_browser_reload(gemini_browser_t *browser)
+{
+    gemini_browser_cancel_revalidation(browser);
+    char *url = ((gemini_page_t*) browser->pages.head->data)->document->url;
+
+    if (is_internal_url(url))
+        return update_current_page(browser, create_internal_document(browser, url));
+
+    if (local_is_file_url(url))
+        return update_current_page(browser, local_document_map(url, memory_get_allocator(MEMORY_DOCUMENTS)));
+
+    gemini_browser_revalidate(browser);
+    return false;
+}
+
+void gemini_browser_cancel_revalidation(gemini_browser_t *browser)
+{
+    if (!browser->is_revalidating)
+        return;
+
+    gemini_request_destroy(&browser->revalidation);
+    browser->is_revalidating = false;
+}
+
+void gemini_browser_start_warmup(gemini_browser_t *browser)
+{
+    // Recordings should only contain what was actually visited, and there's no memory to spare under pressure
+    if (browser->archive || pressure_monitor_get_level(&browser->pressure) != PRESSURE_NONE)
+        return;
+
+    // The current page is already there
+    char *current_url = ((gemini_page_t*) browser->pages.head->data)->document->url;
+
+    for (int i = 0; i < 9; i++)
+        if (browser->bookmarks[i][0] && strcmp(browser->bookmarks[i], current_url))
+            warmup_add(&browser->warmup, browser->bookmarks[i]);
+
+    if (strcmp(HOME_URL, current_url))
+        warmup_add(&browser->warmup, HOME_URL);
+
+    warmup_start(&browser->warmup, gemini_browser_get_ssl_context(browser), memory_get_allocator(MEMORY_DOCUMENTS));
+}
+
+static void record_warmup_fetch(void *data, const char *url, gemini_timings_t *timings)
+{
+    gemini_browser_t *browser = data;
+    gemini_stats_record_fetch(&browser->stats, url, timings);
+}
+
+void gemini_browser_advance_warmup(gemini_browser_t *browser, struct pollfd *descriptors)
+{
+    warmup_advance(&browser->warmup, descriptors, record_warmup_fetch, browser);
 }
 
 void browser_destroy(gemini_browser_t *browser)
 {
+    gemini_browser_cancel_revalidation(browser);
+    warmup_destroy(&browser->warmup);
+    session_save(browser, SESSION_PATH);
+
+    gemini_stats_save(&browser->stats, STATS_PATH);
+    gemini_stats_destroy(&browser->stats);
+    pressure_monitor_destroy(&browser->pressure);
+
     // Just save the modified bookmarks into the file again
     FILE *bookmarks_file = fopen("bookmarks", "w");
     if (!bookmarks_file)
@@ -155,8 +622,13 @@ void browser_destroy(gemini_browser_t *browser)
     }
 
     fclose(bookmarks_file);
+
+    if (browser->archive)
+        archive_close(browser->archive);
+
     doubly_linked_destroy(&browser->pages);
-    SSL_CTX_free(browser->ssl_ctx);
+    SSL_CTX_free(gemini_browser_get_ssl_context(browser));
+    known_hosts_close(&browser->known_hosts);
 }
 
 void gemini_browser_get_link_under_cursor(gemini_browser_t *browser, browser_link_t *link)
@@ -165,7 +637,9 @@ void gemini_browser_get_link_under_cursor(gemini_browser_t *browser, browser_lin
     static char *scheme_mappings[TOTAL_SCHEMES] = {
         [LINK_SCHEME_GEMINI] = "gemini://",
         [LINK_SCHEME_HTTP] = "http://",
-        [LINK_SCHEME_HTTPS] = "https://"
+        [LINK_SCHEME_HTTPS] = "https://",
+        [LINK_SCHEME_ABOUT] = "about:",
+        [LINK_SCHEME_FILE] = "file://"
     };
 
     gemini_page_t *page = browser->pages.head->data;
@@ -21,9 +21,14 @@
 #include "gemini.h"
 #include "config.h"
 #include "doubly_linked.h"
+#include "stats.h"
+#include "pressure.h"
+#include "known_hosts.h"
+#include "warmup.h"
 #include <stddef.h>
 #include <stdbool.h>
 #include <openssl/ssl.h>
+#include <pthread.h>
 
 typedef struct
 {
@@ -34,18 +39,85 @@ typedef struct
 typedef struct
 {
     // The same context will be used throughout all gemini connections
+    // It's created on a thread of its own, so always go through gemini_browser_get_ssl_context
     SSL_CTX *ssl_ctx;
+    pthread_t ssl_thread;
+    bool is_ssl_ready;
+
+    // Certificates are pinned on the first visit of every host, which is all the verification there is
+    // unless WITH_SSL_CERT is defined, in which case it only saves pinned hosts from verifying the whole chain
+    known_hosts_t known_hosts;
 
     doubly_linked_t pages;
     gemini_input_callback_t input_callback;
+    gemini_progress_callback_t progress_callback;
     char bookmarks[9][1024];
+
+    // Every response is recorded here if set (astrology --record)
+    archive_t *archive;
+
+    // A background request that checks whether the current page is still up to date
+    gemini_request_t revalidation;
+    bool is_revalidating;
+
+    // What the latest update of the current page has changed, so that the frontend can tell whether it's on screen
+    gemini_document_diff_t last_update;
+
+    gemini_stats_t stats;
+
+    // The bookmarks and the home page, fetched ahead of time so that opening them costs nothing
+    warmup_t warmup;
+
+    // What memory pressure has taken away from the history so far, for about:memory
+    pressure_monitor_t pressure;
+    size_t total_sheddings, shed_elements, shed_pages, shed_bytes;
 } gemini_browser_t;
 
 // This function must be called before any document has been loaded
-void gemini_browser_create(gemini_browser_t *browser, gemini_input_callback_t input_callback);
+// The previous session will be restored, so there might be some pages already
+// The progress callback is called throughout every fetch (it may be NULL)
+void gemini_browser_create(gemini_browser_t *browser, gemini_input_callback_t input_callback,
+                           gemini_progress_callback_t progress_callback);
 
+// Waits for the TLS context if it's still being created, which only happens before the first fetch
+SSL_CTX* gemini_browser_get_ssl_context(gemini_browser_t *browser);
+
+// Internal pages (e.g. about:stats) are generated on the spot, anything else is fetched
 void gemini_browser_load_document(gemini_browser_t *browser, char *gemini_url);
 void gemini_browser_go_back(gemini_browser_t *browser);
+
+// Pages restored from a previous session only keep their URL, so they are fetched again once visited
+void gemini_browser_ensure_page_is_loaded(gemini_browser_t *browser);
+
+/*
+ * Lets go of the history if the cgroup is close to its memory limit or tasks are stalling on memory
+ * Element tables go first (they're parsed again once visited), then whole pages starting from the oldest
+ * The current page is always kept. It's called after every fetch, the frontend should also call it whenever
+ * the pressure monitor's trigger fires
+ */
+void gemini_browser_relieve_memory_pressure(gemini_browser_t *browser);
+
+// Parses the element tables that memory pressure took away again, once the pressure is gone
+// Stops at the deadline (in monotonic microseconds) and returns true once there's nothing left to do
+bool gemini_browser_rebuild_history(gemini_browser_t *browser, uint64_t deadline);
+
+// Starts refetching the current page in the background
+// The browser never blocks on it, it's up to the frontend to wait on the connection and advance it
+void gemini_browser_revalidate(gemini_browser_t *browser);
+
+// Returns true if the current page was updated because its content has changed (see last_update)
+bool gemini_browser_advance_revalidation(gemini_browser_t *browser);
+void gemini_browser_cancel_revalidation(gemini_browser_t *browser);
+
+// Starts fetching the bookmarks and the home page in the background, it should be called once the first page is shown
+// Like revalidations, the frontend has to wait on their descriptors (see warmup_fill_descriptors) and advance them
+void gemini_browser_start_warmup(gemini_browser_t *browser);
+void gemini_browser_advance_warmup(gemini_browser_t *browser, struct pollfd *descriptors);
+
+// Fetches the current page again. Internal pages and local files are updated right away,
+// in which case true is returned if they have changed, while anything else is revalidated in the background
+bool gemini_browser_reload(gemini_browser_t *browser);
+
 void browser_destroy(gemini_browser_t *browser);
 
 // A friendly API to access different forms of links parsed by the browser
@@ -54,6 +126,10 @@ typedef enum
     LINK_SCHEME_GEMINI,
     LINK_SCHEME_HTTP,
     LINK_SCHEME_HTTPS,
+    // Internal pages, such as about:stats
+    LINK_SCHEME_ABOUT,
+    // Files and directories on the local file system
+    LINK_SCHEME_FILE,
     TOTAL_SCHEMES,
     
     LINK_SCHEME_INVALID
@@ -0,0 +1,180 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cache.h"
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t hash_key(const char *key)
+{
+    return hash_bytes(key, strlen(key));
+}
+
+void gemini_cache_create(gemini_cache_t *cache, size_t max_bytes, uint64_t lifetime)
+{
+    // The amount of buckets will stay fixed, chains are expected to be short anyway
+    cache->total_buckets = 256;
+    cache->buckets = calloc(cache->total_buckets, sizeof(cache_entry_t*));
+
+    cache->newest = cache->oldest = NULL;
+    cache->length = cache->total_bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->lifetime = lifetime;
+
+    cache->hits = cache->misses = cache->evictions = 0;
+}
+
+void cache_entry_acquire(cache_entry_t *entry)
+{
+    entry->references++;
+}
+
+void cache_entry_release(cache_entry_t *entry)
+{
+    // The data only goes away once it's both out of the cache and nobody is using it
+    if (--entry->references > 0 || !entry->is_evicted)
+        return;
+
+    entry->deallocator(entry->data);
+    free(entry->key);
+    free(entry);
+}
+
+static void unlink_from_recency_list(gemini_cache_t *cache, cache_entry_t *entry)
+{
+    if (entry->newer) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+
+    if (entry->older) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+}
+
+static void link_as_newest(gemini_cache_t *cache, cache_entry_t *entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+
+    if (cache->newest) cache->newest->newer = entry;
+    else cache->oldest = entry;
+
+    cache->newest = entry;
+}
+
+static void evict_entry(gemini_cache_t *cache, cache_entry_t *entry)
+{
+    // First, detach the entry from its bucket's chain
+    cache_entry_t **link = &cache->buckets[hash_key(entry->key) % cache->total_buckets];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+
+    unlink_from_recency_list(cache, entry);
+    cache->length--;
+    cache->total_bytes -= entry->size;
+
+    // The cache itself holds a reference, drop it
+    entry->is_evicted = true;
+    cache_entry_release(entry);
+}
+
+static cache_entry_t* find_entry(gemini_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry = cache->buckets[hash_key(key) % cache->total_buckets];
+
+    while (entry && strcmp(entry->key, key))
+        entry = entry->chain;
+
+    return entry;
+}
+
+cache_entry_t* gemini_cache_lookup(gemini_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry = find_entry(cache, key);
+
+    // Stale entries are useless, just get rid of them right away
+    if (entry && entry->expires_at < get_monotonic_time())
+    {
+        evict_entry(cache, entry);
+        entry = NULL;
+    }
+
+    if (!entry)
+    {
+        cache->misses++;
+        return NULL;
+    }
+
+    // Move it to the front so that it's the last one to be evicted
+    unlink_from_recency_list(cache, entry);
+    link_as_newest(cache, entry);
+
+    cache->hits++;
+    return entry;
+}
+
+cache_entry_t* gemini_cache_insert(gemini_cache_t *cache, const char *key, void *data, size_t size,
+                                   item_deallocator_t deallocator)
+{
+    // Newer data always wins, even if it won't fit
+    gemini_cache_remove(cache, key);
+
+    // It would throw everything else away and still not fit
+    if (size > cache->max_bytes)
+        return NULL;
+
+    // Make some space by throwing away whatever hasn't been used for the longest time
+    while (cache->oldest && cache->total_bytes + size > cache->max_bytes)
+    {
+        evict_entry(cache, cache->oldest);
+        cache->evictions++;
+    }
+
+    cache_entry_t *entry = malloc(sizeof(cache_entry_t));
+    entry->key = strdup(key);
+    entry->data = data;
+    entry->size = size;
+    entry->expires_at = get_monotonic_time() + cache->lifetime;
+    entry->references = 1;
+    entry->is_evicted = false;
+    entry->deallocator = deallocator;
+
+    size_t bucket = hash_key(key) % cache->total_buckets;
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+
+    link_as_newest(cache, entry);
+    cache->length++;
+    cache->total_bytes += size;
+
+    return entry;
+}
+
+void gemini_cache_remove(gemini_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry = find_entry(cache, key);
+
+    if (entry)
+        evict_entry(cache, entry);
+}
+
+void gemini_cache_destroy(gemini_cache_t *cache)
+{
+    while (cache->oldest)
+        evict_entry(cache, cache->oldest);
+
+    free(cache->buckets);
+}
@@ -0,0 +1,80 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "doubly_linked.h"
+
+typedef struct cache_entry_t
+{
+    char *key;
+    void *data;
+    size_t size;
+
+    // Entries are never handed out after they've expired, but they might still be referenced
+    uint64_t expires_at;
+    size_t references;
+    bool is_evicted;
+
+    // Intrusive links for both the hash table bucket and the least-recently-used list
+    struct cache_entry_t *chain;
+    struct cache_entry_t *newer, *older;
+
+    item_deallocator_t deallocator;
+} cache_entry_t;
+
+typedef struct
+{
+    cache_entry_t **buckets;
+    size_t total_buckets;
+
+    // The most recently used entry is at the front and the first to be evicted is at the back
+    cache_entry_t *newest, *oldest;
+
+    size_t length;
+    size_t total_bytes, max_bytes;
+    uint64_t lifetime;
+
+    size_t hits, misses, evictions;
+} gemini_cache_t;
+
+// The lifetime is expressed in microseconds
+void gemini_cache_create(gemini_cache_t *cache, size_t max_bytes, uint64_t lifetime);
+
+// Returns NULL if there is no fresh entry for the given key
+// The entry is only guaranteed to stay alive until the next insertion, unless it's acquired
+cache_entry_t* gemini_cache_lookup(gemini_cache_t *cache, const char *key);
+
+// The cache takes ownership of the data, which will be released through the deallocator
+// Older entries will be evicted until everything fits into the memory budget
+// Data that's larger than the whole budget is turned down with NULL, and then it still belongs to the caller
+cache_entry_t* gemini_cache_insert(gemini_cache_t *cache, const char *key, void *data, size_t size,
+                                   item_deallocator_t deallocator);
+
+void gemini_cache_remove(gemini_cache_t *cache, const char *key);
+
+// Keeps an entry's data alive even after it gets evicted
+void cache_entry_acquire(cache_entry_t *entry);
+void cache_entry_release(cache_entry_t *entry);
+
+void gemini_cache_destroy(gemini_cache_t *cache);
+
+#endif
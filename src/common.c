@@ -16,11 +16,12 @@
  */
 
 #include "common.h"
+#include "dynamic_array.h"
+#include <stdarg.h>
 #include <stdio.h>
-#include <ncurses.h>
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 // The length is supplied to so that the user can provide only a portion of the string
 char* join_strings_together(char *first, size_t first_len, char *second, size_t second_len)
@@ -107,17 +108,58 @@ char* join_relative_link_to_url(char *current_url, char *link)
     }
 }
 
-void exit_with_failure(const char *format, ...)
+uint64_t get_monotonic_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t hash_bytes(const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+char* append_format(char *text, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    endwin();
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    // One more for the NULL byte, which is not part of the length
+    size_t offset = DYN_ARRAY_LENGTH(text);
+    text = dyn_array_resize_to_fit(text, offset + length + 1);
+
+    va_start(args, format);
+    vsnprintf(text + offset, length + 1, format, args);
+    va_end(args);
 
-    // Just print out the error message with a fancy format
-    fprintf(stderr, "{astrology error}: ");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
+    DYN_ARRAY_LENGTH(text) = offset + length;
+    return text;
+}
+
+void format_bytes(char *buffer, size_t size, size_t bytes)
+{
+    static const char *units[] = {"B", "KiB", "MiB", "GiB"};
+    double value = bytes;
+    int unit = 0;
+
+    while (value >= 1024 && unit < 3)
+    {
+        value /= 1024;
+        unit++;
+    }
 
-    // Terminate the execution of the program
-    exit(EXIT_FAILURE);
+    snprintf(buffer, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
 }
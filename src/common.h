@@ -20,6 +20,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // A collection of some handy macros
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -39,6 +40,18 @@ char* get_hostname_with_scheme(char *url);
 bool has_protocol_scheme(char *url);
 char* join_relative_link_to_url(char *current_url, char *link);
 
+// Returns the time in microseconds since some arbitrary point, only useful for measuring durations
+uint64_t get_monotonic_time(void);
+
+// FNV-1a, it's tiny and good enough for URLs and hostnames
+uint64_t hash_bytes(const void *data, size_t length);
+
+// Appends to a dynamic array of characters (which is kept NULL-terminated) and returns it, it might have moved
+char* append_format(char *text, const char *format, ...);
+
+// Writes the amount in a human readable unit, e.g. 1.5 MiB
+void format_bytes(char *buffer, size_t size, size_t bytes);
+
 void exit_with_failure(const char *format, ...);
 
 #endif
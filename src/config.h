@@ -31,18 +31,110 @@
 #define SEARCH_ENGINE_KEY 's'
 #define NEXT_LINK_KEY 'n'
 #define GO_TO_HOST_KEY 'h'
+#define SHOW_LATENCY_KEY 'L'
+#define RELOAD_KEY 'r'
+#define WATCH_KEY 'w'
+
+// A watched page is reloaded this often (in seconds), it's only repainted if what's on the screen has changed
+#define WATCH_INTERVAL 10
+
+// Keys should reach the screen within a single frame at 60 Hz (in microseconds)
+#define INPUT_LATENCY_GOAL 16000
+
+// Deferred work runs between keys in slices this long (in microseconds), a key never waits for more than that
+#define IDLE_SLICE 2000
+
+// While a page is loading, its progress is redrawn at most this often (in microseconds)
+#define PROGRESS_REFRESH_INTERVAL 250000
 
 #define MAX_HISTORY_LENGTH 20
 #define VIEWER_WIDTH 90
 // Please make sure to insert a space right after the program
 #define WEB_BROWSER_COMMAND "firefox "
 #define HOME_URL "gemini://geminiprotocol.net/"
+// The bookmarks and the home page are fetched in the background after start-up, this many at a time
+// Nothing is fetched if the default route goes through an interface that starts with one of these (metered)
+// The pages are kept for WARMUP_LIFETIME seconds, as long as they all fit into WARMUP_CACHE_SIZE
+// Each page (redirections included) is given up on after WARMUP_TIMEOUT seconds, or once it outgrows the cache
+#define WARMUP_CONCURRENCY 2
+#define WARMUP_METERED_INTERFACES "ppp", "wwan", "usb", "rmnet"
+#define WARMUP_CACHE_SIZE (8 * 1024 * 1024)
+#define WARMUP_LIFETIME (10 * 60)
+#define WARMUP_TIMEOUT 30
+// Local files up to this size are read into memory, larger ones are mapped (file://)
+// Opening one only parses as many lines as fit into this much time (in microseconds), the rest is parsed when idle
+#define LOCAL_COPY_SIZE (1024 * 1024)
+#define LOCAL_PARSE_BUDGET 5000
+// The history and the current page are stored here on exit and restored on startup
+#define SESSION_PATH "session"
+// Per-host latencies and hit rates (about:stats) are kept here across sessions
+#define STATS_PATH "stats"
+// The certificate of every host is pinned here on the first visit
+// Pins last until the certificate expires, or this many seconds when it has already expired or has no readable date
+#define KNOWN_HOSTS_PATH "known_hosts"
+#define KNOWN_HOSTS_FALLBACK_TTL (90 * 24 * 60 * 60)
+
+// Uncomment the line below to append the memory usage (about:memory) to a log every MEMORY_LOG_INTERVAL seconds
+//#define MEMORY_LOG_PATH "memory.log"
+#define MEMORY_LOG_INTERVAL 60
+
+// Pages in the history let go of their memory once the cgroup has used this much of its limit (in percent)
+// or once tasks have stalled on memory for this much of the last ten seconds (in percent, as in /proc/pressure)
+// Moderate pressure looks at some of the tasks stalling and only drops what can be rebuilt without the network
+// Critical pressure looks at all of them stalling at once and drops whole pages
+#define PRESSURE_MODERATE_USAGE 80
+#define PRESSURE_CRITICAL_USAGE 90
+#define PRESSURE_MODERATE_STALL 10.0
+#define PRESSURE_CRITICAL_STALL 10.0
+
+// Configuration of the caching proxy (astrology --serve)
+// Other gemini clients should then use localhost:SERVE_PORT as their proxy
+#define SERVE_PORT 1965
+#define SERVER_CERTIFICATE_PATH "server.pem"
+#define PROXY_CACHE_SIZE (64 * 1024 * 1024)
+// Expressed in seconds
+#define PROXY_CACHE_LIFETIME (10 * 60)
+// Clients get SERVE_CLIENT_TIMEOUT seconds to send their request, and as long again for every part of the response
+// The origin capsules get PROXY_UPSTREAM_TIMEOUT seconds for the whole response, the clients are then told off
+#define SERVE_CLIENT_TIMEOUT 10
+#define PROXY_UPSTREAM_TIMEOUT 30
 
+// Archives recorded with astrology --record are served here by astrology --replay
+#define REPLAY_PORT 1966
+
+// astrology --fetch keeps this many requests in flight at once, in every worker
+// Each of them is given up on after BATCH_TIMEOUT seconds, whichever phase it's stuck in
+#define BATCH_CONCURRENCY 64
+#define BATCH_TIMEOUT 30
+
+// astrology --fetch and --serve run this many shared-nothing workers, 0 means one per core
+#define WORKER_THREADS 0
+// Every worker remembers the addresses of its hosts for RESOLVER_LIFETIME seconds, within RESOLVER_CACHE_SIZE bytes
+#define RESOLVER_LIFETIME (5 * 60)
+#define RESOLVER_CACHE_SIZE (512 * 1024)
+// Hosts that couldn't be resolved are only remembered for RESOLVER_FAILURE_LIFETIME seconds
+// Lookups block, so each worker leaves them to at most RESOLVER_THREADS threads of its own
+#define RESOLVER_FAILURE_LIFETIME 30
+#define RESOLVER_THREADS 4
+
+
+// Uncomment the line below to compile the trace scopes in
+// Pressing DUMP_TRACE_KEY then writes the latest TRACE_BUFFER_SIZE events of each thread to TRACE_PATH
+//#define WITH_TRACING
+
+#ifdef WITH_TRACING
+#define DUMP_TRACE_KEY 'T'
+#define TRACE_PATH "trace.json"
+#define TRACE_BUFFER_SIZE 16384
+#endif
 
 // Uncomment the line below to enable tls certification 
 //#define WITH_SSL_CERT
 
 #ifdef WITH_SSL_CERT
+// A hashed directory (see openssl rehash) is preferred, only the certificates that servers chain up to get parsed
+// The bundle is parsed as a whole instead, which takes tens of milliseconds, so it's only used without the directory
+#define CERTIFICATION_DIRECTORY "/etc/ssl/certs"
 #define CERTIFICATION_PATH "/etc/ssl/cert.pem"
 #endif
 
@@ -0,0 +1,638 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Needed for memrchr
+#define _GNU_SOURCE
+#include "convert.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Large enough so that the conversion is bound by the disk rather than by system calls
+#define CONVERT_BUFFER_SIZE (1 << 20)
+
+static char *format_names[TOTAL_CONVERT_FORMATS] = {
+    [CONVERT_ANSI] = "ansi",
+    [CONVERT_HTML] = "html",
+    [CONVERT_JSON] = "json"
+};
+
+static char *format_extensions[TOTAL_CONVERT_FORMATS] = {
+    [CONVERT_ANSI] = ".ansi",
+    [CONVERT_HTML] = ".html",
+    [CONVERT_JSON] = ".jsonl"
+};
+
+static char *element_type_names[] = {
+    [GEMTEXT_PARAGRAPH] = "paragraph",
+    [GEMTEXT_PREFORMATTED] = "preformatted",
+    [GEMTEXT_LINK] = "link",
+    [GEMTEXT_HEADING_ONE] = "heading1",
+    [GEMTEXT_HEADING_TWO] = "heading2",
+    [GEMTEXT_HEADING_THREE] = "heading3",
+    [GEMTEXT_BLOCKQUOTE] = "blockquote",
+    [GEMTEXT_LIST_ITEM] = "list_item"
+};
+
+// The same styles that the ncurses frontend uses
+static char *ansi_styles[] = {
+    [GEMTEXT_PARAGRAPH] = "",
+    [GEMTEXT_PREFORMATTED] = "",
+    [GEMTEXT_LINK] = "\x1b[3;34m",
+    [GEMTEXT_HEADING_ONE] = "\x1b[1m",
+    [GEMTEXT_HEADING_TWO] = "\x1b[1m",
+    [GEMTEXT_HEADING_THREE] = "\x1b[1m",
+    [GEMTEXT_BLOCKQUOTE] = "\x1b[2m",
+    [GEMTEXT_LIST_ITEM] = "\x1b[32m"
+};
+
+convert_format_e convert_get_format(const char *name)
+{
+    for (int i = 0; i < TOTAL_CONVERT_FORMATS; i++)
+        if (!strcmp(name, format_names[i]))
+            return i;
+
+    return CONVERT_INVALID;
+}
+
+static void write_everything(convert_output_t *output, const char *data, size_t length)
+{
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        ssize_t bytes_written = write(output->fd, data + offset, length - offset);
+        if (bytes_written <= 0)
+        {
+            output->has_failed = true;
+            break;
+        }
+
+        offset += bytes_written;
+    }
+}
+
+static void output_flush(convert_output_t *output)
+{
+    write_everything(output, output->buffer, output->length);
+    output->length = 0;
+}
+
+static void output_write(convert_output_t *output, const char *data, size_t length)
+{
+    if (output->length + length > CONVERT_BUFFER_SIZE)
+    {
+        output_flush(output);
+
+        // Huge chunks are better off skipping the buffer entirely
+        if (length > CONVERT_BUFFER_SIZE)
+        {
+            write_everything(output, data, length);
+            return;
+        }
+    }
+
+    memcpy(output->buffer + output->length, data, length);
+    output->length += length;
+}
+
+#define OUTPUT_LITERAL(output, literal) output_write(output, literal, sizeof(literal) - 1)
+
+// Copies runs of ordinary characters at once and only stops for the ones that need escaping
+static void output_write_escaped(convert_output_t *output, convert_format_e format, const char *text, size_t length)
+{
+    size_t run_start = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = text[i];
+        char escape[8];
+        size_t escape_length = 0;
+
+        if (format == CONVERT_HTML)
+        {
+            switch (c)
+            {
+            case '<': escape_length = 4; memcpy(escape, "&lt;", 4); break;
+            case '>': escape_length = 4; memcpy(escape, "&gt;", 4); break;
+            case '&': escape_length = 5; memcpy(escape, "&amp;", 5); break;
+            case '"': escape_length = 6; memcpy(escape, "&quot;", 6); break;
+            }
+        }
+        else if (format == CONVERT_ANSI && ((c < 0x20 && c != '\t') || c == 0x7f))
+        {
+            // Control characters (most importantly ESC) are shown in caret notation so that
+            // documents can't smuggle their own escape sequences into the terminal
+            escape_length = 2;
+            escape[0] = '^';
+            escape[1] = c ^ 0x40;
+        }
+        else if (format == CONVERT_JSON && (c == '"' || c == '\\' || c < 0x20))
+        {
+            escape_length = c == '"' || c == '\\' ? 2 : 6;
+
+            if (escape_length == 2)
+            {
+                escape[0] = '\\';
+                escape[1] = c;
+            }
+            else
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+        }
+
+        if (escape_length)
+        {
+            output_write(output, text + run_start, i - run_start);
+            output_write(output, escape, escape_length);
+            run_start = i + 1;
+        }
+    }
+
+    output_write(output, text + run_start, length - run_start);
+}
+
+// Splits a link line (=> URL LABEL) into its two parts, the label is empty if it's missing
+static void split_link(const char *text, size_t length, const char **url, size_t *url_length,
+                       const char **label, size_t *label_length)
+{
+    size_t i = 2;
+    while (i < length && isspace(text[i])) i++;
+
+    *url = text + i;
+    while (i < length && !isspace(text[i])) i++;
+    *url_length = text + i - *url;
+
+    while (i < length && isspace(text[i])) i++;
+    *label = text + i;
+    *label_length = length - i;
+}
+
+// Skips the prefix of the element (e.g. ## or *) along with the spaces that follow
+static size_t get_prefix_length(gemtext_line_e type, const char *text, size_t length)
+{
+    size_t prefix_length = 0;
+
+    switch (type)
+    {
+    case GEMTEXT_HEADING_ONE: prefix_length = 1; break;
+    case GEMTEXT_HEADING_TWO: prefix_length = 2; break;
+    case GEMTEXT_HEADING_THREE: prefix_length = 3; break;
+    case GEMTEXT_BLOCKQUOTE:
+    case GEMTEXT_LIST_ITEM: prefix_length = 1; break;
+    default: return 0;
+    }
+
+    while (prefix_length < length && isspace(text[prefix_length])) prefix_length++;
+    return MIN(prefix_length, length);
+}
+
+// Only lets through relative URLs and the schemes that are safe to follow from a web page
+static bool is_url_safe_for_html(const char *url, size_t length)
+{
+    size_t scheme_length = 0;
+    while (scheme_length < length && !strchr(":/?#", url[scheme_length])) scheme_length++;
+
+    // Without a colon before the path, the query or the fragment, it's a relative URL
+    if (scheme_length == length || url[scheme_length] != ':')
+        return true;
+
+    return (scheme_length == 6 && !strncasecmp(url, "gemini", 6))
+        || (scheme_length == 4 && !strncasecmp(url, "http", 4))
+        || (scheme_length == 5 && !strncasecmp(url, "https", 5));
+}
+
+static void convert_element_to_ansi(convert_output_t *output, gemtext_line_e type, const char *text, size_t length)
+{
+    char *style = ansi_styles[type];
+
+    if (style[0])
+    {
+        output_write(output, style, strlen(style));
+        output_write_escaped(output, CONVERT_ANSI, text, length);
+        OUTPUT_LITERAL(output, "\x1b[0m\n");
+    }
+    else
+    {
+        output_write_escaped(output, CONVERT_ANSI, text, length);
+        OUTPUT_LITERAL(output, "\n");
+    }
+}
+
+static void convert_element_to_json(convert_output_t *output, gemtext_line_e type, const char *text, size_t length)
+{
+    OUTPUT_LITERAL(output, "{\"type\":\"");
+    output_write(output, element_type_names[type], strlen(element_type_names[type]));
+    OUTPUT_LITERAL(output, "\",\"text\":\"");
+    output_write_escaped(output, CONVERT_JSON, text, length);
+
+    if (type == GEMTEXT_LINK)
+    {
+        const char *url, *label;
+        size_t url_length, label_length;
+        split_link(text, length, &url, &url_length, &label, &label_length);
+
+        OUTPUT_LITERAL(output, "\",\"url\":\"");
+        output_write_escaped(output, CONVERT_JSON, url, url_length);
+        OUTPUT_LITERAL(output, "\",\"label\":\"");
+        output_write_escaped(output, CONVERT_JSON, label, label_length);
+    }
+
+    OUTPUT_LITERAL(output, "\"}\n");
+}
+
+static void convert_element_to_html(convert_output_t *output, gemtext_line_e type, const char *text, size_t length)
+{
+    size_t prefix_length = get_prefix_length(type, text, length);
+    const char *body = text + prefix_length;
+    size_t body_length = length - prefix_length;
+
+    switch (type)
+    {
+    case GEMTEXT_LINK:
+    {
+        const char *url, *label;
+        size_t url_length, label_length;
+        split_link(text, length, &url, &url_length, &label, &label_length);
+
+        // Links without a label just show the URL itself
+        if (!label_length)
+        {
+            label = url;
+            label_length = url_length;
+        }
+
+        // Links with other schemes (e.g. javascript:) keep their label but can't be followed
+        if (is_url_safe_for_html(url, url_length))
+        {
+            OUTPUT_LITERAL(output, "<p><a href=\"");
+            output_write_escaped(output, CONVERT_HTML, url, url_length);
+            OUTPUT_LITERAL(output, "\">");
+        }
+        else
+            OUTPUT_LITERAL(output, "<p><a>");
+
+        output_write_escaped(output, CONVERT_HTML, label, label_length);
+        OUTPUT_LITERAL(output, "</a></p>\n");
+        return;
+    }
+
+    case GEMTEXT_PREFORMATTED:
+        output_write_escaped(output, CONVERT_HTML, text, length);
+        OUTPUT_LITERAL(output, "\n");
+        return;
+
+    case GEMTEXT_HEADING_ONE: OUTPUT_LITERAL(output, "<h1>"); break;
+    case GEMTEXT_HEADING_TWO: OUTPUT_LITERAL(output, "<h2>"); break;
+    case GEMTEXT_HEADING_THREE: OUTPUT_LITERAL(output, "<h3>"); break;
+    case GEMTEXT_BLOCKQUOTE: OUTPUT_LITERAL(output, "<blockquote>"); break;
+    case GEMTEXT_LIST_ITEM: OUTPUT_LITERAL(output, "<li>"); break;
+    case GEMTEXT_PARAGRAPH: OUTPUT_LITERAL(output, "<p>"); break;
+    }
+
+    output_write_escaped(output, CONVERT_HTML, body, body_length);
+
+    switch (type)
+    {
+    case GEMTEXT_HEADING_ONE: OUTPUT_LITERAL(output, "</h1>\n"); break;
+    case GEMTEXT_HEADING_TWO: OUTPUT_LITERAL(output, "</h2>\n"); break;
+    case GEMTEXT_HEADING_THREE: OUTPUT_LITERAL(output, "</h3>\n"); break;
+    case GEMTEXT_BLOCKQUOTE: OUTPUT_LITERAL(output, "</blockquote>\n"); break;
+    case GEMTEXT_LIST_ITEM: OUTPUT_LITERAL(output, "</li>\n"); break;
+    default: OUTPUT_LITERAL(output, "</p>\n"); break;
+    }
+}
+
+// Whatever has to be carried over from one piece of a document to the next one
+typedef struct
+{
+    // The parser's, whether the last line was inside a preformatted block
+    bool has_entered_preformatted;
+
+    // HTML needs to group consecutive list items and preformatted lines together
+    bool is_inside_list, is_inside_preformatted;
+} convert_state_t;
+
+static void convert_begin(convert_output_t *output, convert_format_e format, convert_state_t *state)
+{
+    *state = (convert_state_t) {false, false, false};
+
+    if (format == CONVERT_HTML)
+        OUTPUT_LITERAL(output, "<!DOCTYPE html>\n<meta charset=\"utf-8\">\n");
+}
+
+static void convert_elements(convert_output_t *output, convert_format_e format, convert_state_t *state,
+                             const char *content, gemtext_line_t *elements, size_t total_elements)
+{
+    bool is_inside_list = state->is_inside_list;
+    bool is_inside_preformatted = state->is_inside_preformatted;
+
+    for (size_t i = 0; i < total_elements; i++)
+    {
+        gemtext_line_t *element = &elements[i];
+        const char *text = content + element->start;
+
+        // The end is inclusive and might point to the line's final new line character
+        size_t length = element->end + 1 > element->start ? element->end + 1 - element->start : 0;
+        while (length && (text[length - 1] == '\n' || text[length - 1] == '\r')) length--;
+
+        switch (format)
+        {
+        case CONVERT_ANSI: convert_element_to_ansi(output, element->type, text, length); break;
+        case CONVERT_JSON: convert_element_to_json(output, element->type, text, length); break;
+
+        case CONVERT_HTML:
+        {
+            if (is_inside_list && element->type != GEMTEXT_LIST_ITEM)
+            {
+                OUTPUT_LITERAL(output, "</ul>\n");
+                is_inside_list = false;
+            }
+
+            // The fences themselves are not part of the preformatted block
+            if (element->type == GEMTEXT_PREFORMATTED && length >= 3 && !strncmp(text, "```", 3))
+            {
+                if (is_inside_preformatted) OUTPUT_LITERAL(output, "</pre>\n");
+                else OUTPUT_LITERAL(output, "<pre>\n");
+
+                is_inside_preformatted = !is_inside_preformatted;
+                continue;
+            }
+
+            if (element->type == GEMTEXT_LIST_ITEM && !is_inside_list)
+            {
+                OUTPUT_LITERAL(output, "<ul>\n");
+                is_inside_list = true;
+            }
+
+            convert_element_to_html(output, element->type, text, length);
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    state->is_inside_list = is_inside_list;
+    state->is_inside_preformatted = is_inside_preformatted;
+}
+
+static void convert_end(convert_output_t *output, convert_state_t *state)
+{
+    // Blocks that were never closed by the document itself
+    if (state->is_inside_list) OUTPUT_LITERAL(output, "</ul>\n");
+    if (state->is_inside_preformatted) OUTPUT_LITERAL(output, "</pre>\n");
+}
+
+void convert_document(convert_output_t *output, convert_format_e format,
+                      const char *content, gemtext_line_t *elements, size_t total_elements)
+{
+    convert_state_t state;
+
+    convert_begin(output, format, &state);
+    convert_elements(output, format, &state, content, elements, total_elements);
+    convert_end(output, &state);
+}
+
+// Everything that a single thread needs, allocated once and reused for every file
+typedef struct
+{
+    convert_output_t output;
+    DYN_ARRAY(gemtext_line_t) elements;
+} convert_worker_t;
+
+static void convert_worker_create(convert_worker_t *worker)
+{
+    worker->output.buffer = malloc(CONVERT_BUFFER_SIZE);
+    worker->output.length = 0;
+    worker->output.has_failed = false;
+    worker->elements = dyn_array_create(4096, sizeof(gemtext_line_t));
+}
+
+static void convert_worker_destroy(convert_worker_t *worker)
+{
+    free(worker->output.buffer);
+    dyn_array_destroy(worker->elements);
+}
+
+// The content must end right after a new line, unless it's the last piece of the document
+static void convert_lines(convert_worker_t *worker, convert_format_e format, convert_state_t *state,
+                          const char *content, size_t length)
+{
+    size_t capacity = *DYN_ARRAY_GET_ATTRIBUTE(worker->elements, DYN_ARRAY_CAPACITY);
+    bool has_entered_preformatted = state->has_entered_preformatted;
+    size_t total_elements = gemtext_parse_more_lines(content, length, &state->has_entered_preformatted,
+                                                     worker->elements, capacity);
+
+    // The array only grows when a piece is larger than all of the previous ones
+    if (total_elements > capacity)
+    {
+        worker->elements = dyn_array_resize_to_fit(worker->elements, total_elements);
+        gemtext_parse_more_lines(content, length, &has_entered_preformatted, worker->elements, total_elements);
+    }
+
+    convert_elements(&worker->output, format, state, content, worker->elements, total_elements);
+}
+
+static void convert_buffer(convert_worker_t *worker, convert_format_e format, const char *content, size_t length)
+{
+    convert_state_t state;
+
+    convert_begin(&worker->output, format, &state);
+    convert_lines(worker, format, &state, content, length);
+    convert_end(&worker->output, &state);
+    output_flush(&worker->output);
+}
+
+// The file is mapped instead of read, so its pages never need to be copied
+static bool convert_file(convert_worker_t *worker, convert_format_e format, const char *path, int output_fd)
+{
+    int input = open(path, O_RDONLY);
+    if (input < 0)
+    {
+        fprintf(stderr, "{astrology error}: failed to open %s\n", path);
+        return false;
+    }
+
+    struct stat file_info;
+    fstat(input, &file_info);
+
+    char *content = NULL;
+    if (file_info.st_size > 0)
+    {
+        content = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, input, 0);
+        if (content == MAP_FAILED)
+        {
+            close(input);
+            fprintf(stderr, "{astrology error}: failed to map %s\n", path);
+            return false;
+        }
+
+        madvise(content, file_info.st_size, MADV_SEQUENTIAL);
+    }
+
+    close(input);
+
+    worker->output.fd = output_fd;
+    worker->output.has_failed = false;
+    convert_buffer(worker, format, content, file_info.st_size);
+
+    if (content)
+        munmap(content, file_info.st_size);
+
+    return !worker->output.has_failed;
+}
+
+/*
+ * Pipes can't be mapped and might never end, so every read is converted as soon as it arrives
+ * Only complete lines are, whatever comes after the last new line waits for the rest of its line
+ * The buffer only grows beyond CONVERT_BUFFER_SIZE for a line that's longer than that
+ */
+static bool convert_standard_input(convert_worker_t *worker, convert_format_e format)
+{
+    DYN_ARRAY(char) content = dyn_array_create(CONVERT_BUFFER_SIZE, sizeof(char));
+    convert_state_t state;
+
+    worker->output.fd = STDOUT_FILENO;
+    convert_begin(&worker->output, format, &state);
+
+    for (;;)
+    {
+        content = dyn_array_resize_to_fit(content, DYN_ARRAY_LENGTH(content) + CONVERT_BUFFER_SIZE);
+
+        ssize_t bytes_read = read(STDIN_FILENO, content + DYN_ARRAY_LENGTH(content), CONVERT_BUFFER_SIZE);
+        if (bytes_read <= 0)
+            break;
+
+        DYN_ARRAY_LENGTH(content) += bytes_read;
+
+        char *last_new_line = memrchr(content, '\n', DYN_ARRAY_LENGTH(content));
+        if (!last_new_line)
+            continue;
+
+        size_t complete_length = last_new_line + 1 - content;
+        convert_lines(worker, format, &state, content, complete_length);
+        output_flush(&worker->output);
+
+        DYN_ARRAY_LENGTH(content) -= complete_length;
+        memmove(content, content + complete_length, DYN_ARRAY_LENGTH(content));
+    }
+
+    // The last line doesn't need a new line of its own
+    convert_lines(worker, format, &state, content, DYN_ARRAY_LENGTH(content));
+    convert_end(&worker->output, &state);
+    output_flush(&worker->output);
+
+    dyn_array_destroy(content);
+    return !worker->output.has_failed;
+}
+
+// Shared between all of the threads, the files are handed out one at a time
+typedef struct
+{
+    char **paths;
+    size_t total_paths;
+    convert_format_e format;
+
+    atomic_size_t next_path;
+    atomic_size_t total_failures;
+} convert_job_t;
+
+static void* convert_files_in_parallel(void *data)
+{
+    convert_job_t *job = data;
+    convert_worker_t worker;
+    convert_worker_create(&worker);
+
+    size_t index;
+    while ((index = atomic_fetch_add(&job->next_path, 1)) < job->total_paths)
+    {
+        char *path = job->paths[index];
+        char *extension = format_extensions[job->format];
+        char *output_path = join_strings_together(path, strlen(path), extension, strlen(extension));
+
+        int output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (output_fd < 0 || !convert_file(&worker, job->format, path, output_fd))
+            atomic_fetch_add(&job->total_failures, 1);
+
+        if (output_fd >= 0)
+            close(output_fd);
+
+        free(output_path);
+    }
+
+    convert_worker_destroy(&worker);
+    return NULL;
+}
+
+int convert_run(int argc, char **argv)
+{
+    convert_format_e format = argc > 0 ? convert_get_format(argv[0]) : CONVERT_INVALID;
+    if (format == CONVERT_INVALID)
+    {
+        fprintf(stderr, "usage: astrology --convert <ansi|html|json> [files...]\n");
+        return EXIT_FAILURE;
+    }
+
+    char **paths = argv + 1;
+    size_t total_paths = argc - 1;
+
+    // A single input goes straight to the standard output
+    if (total_paths <= 1)
+    {
+        convert_worker_t worker;
+        convert_worker_create(&worker);
+
+        bool has_succeeded = total_paths == 0 ? convert_standard_input(&worker, format) :
+            convert_file(&worker, format, paths[0], STDOUT_FILENO);
+
+        convert_worker_destroy(&worker);
+        return has_succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    convert_job_t job = {
+        .paths = paths,
+        .total_paths = total_paths,
+        .format = format
+    };
+
+    atomic_init(&job.next_path, 0);
+    atomic_init(&job.total_failures, 0);
+
+    // One thread per core, but there's no point in having more threads than files
+    long total_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t total_threads = MIN((size_t) MAX(total_cores, 1), total_paths);
+    pthread_t threads[total_threads];
+
+    for (size_t i = 0; i < total_threads; i++)
+        pthread_create(&threads[i], NULL, convert_files_in_parallel, &job);
+
+    for (size_t i = 0; i < total_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    return atomic_load(&job.total_failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONVERT_H
+#define _CONVERT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gemini.h"
+
+typedef enum
+{
+    CONVERT_ANSI,
+    CONVERT_HTML,
+    CONVERT_JSON,
+    TOTAL_CONVERT_FORMATS,
+
+    CONVERT_INVALID
+} convert_format_e;
+
+// Collects the output in large chunks, so that every element doesn't result in a system call
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t length;
+    bool has_failed;
+} convert_output_t;
+
+/*
+ * Converts gemtext into ANSI-styled text, HTML or JSON lines (one record per element)
+ * astrology --convert <ansi|html|json> [files...]
+ * Standard input is used if there are no files. A single file is written to the standard output,
+ * while many files are converted in parallel, each one into a sibling file with a new extension
+ * Returns the exit status of the program
+ */
+int convert_run(int argc, char **argv);
+
+convert_format_e convert_get_format(const char *name);
+
+// Writes the elements in the given format, no memory is allocated
+void convert_document(convert_output_t *output, convert_format_e format,
+                      const char *content, gemtext_line_t *elements, size_t total_elements);
+
+#endif
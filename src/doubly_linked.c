@@ -33,6 +33,7 @@ void doubly_linked_insert_first(doubly_linked_t *list, void *data)
 {
     doubly_node_t *new_node = malloc(sizeof(doubly_node_t));
     new_node->data = data;
+    new_node->next = new_node->previous = NULL;
     
     // If both the head and tail are empty, make them both point to the new item
     if (list->length == 0)
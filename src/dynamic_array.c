@@ -21,13 +21,21 @@
 #include "common.h"
 
 dyn_array_t dyn_array_create(size_t initial_capacity, size_t item_size)
+{
+    return dyn_array_create_with_allocator(initial_capacity, item_size, NULL);
+}
+
+dyn_array_t dyn_array_create_with_allocator(size_t initial_capacity, size_t item_size,
+                                            const dyn_array_allocator_t *allocator)
 {
     // Allocate enough space for both the header and the actual data
-    size_t *array = malloc(DYN_ARRAY_HEADER_SIZE * sizeof(size_t) + item_size * initial_capacity);
+    size_t total_size = DYN_ARRAY_HEADER_SIZE * sizeof(size_t) + item_size * initial_capacity;
+    size_t *array = allocator ? allocator->allocate(total_size, allocator->userdata) : malloc(total_size);
 
     array[DYN_ARRAY_LENGTH] = 0;
     array[DYN_ARRAY_CAPACITY] = initial_capacity;
     array[DYN_ARRAY_ITEM_SIZE] = item_size;
+    array[DYN_ARRAY_ALLOCATOR] = (size_t) allocator;
 
     // Hide the header and return the data pointer
     // The API will be almost identical to that of an ordinary array
@@ -43,8 +51,12 @@ dyn_array_t dyn_array_resize_to_fit(dyn_array_t array, size_t total_items)
         *capacity = MAX(total_items, *capacity * 2);
         
         size_t *actual_array = (size_t*) array - DYN_ARRAY_HEADER_SIZE;
-        actual_array = realloc(actual_array, DYN_ARRAY_HEADER_SIZE * sizeof(size_t) +
-                               *capacity * *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ITEM_SIZE));
+        size_t total_size = DYN_ARRAY_HEADER_SIZE * sizeof(size_t) +
+            *capacity * *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ITEM_SIZE);
+
+        const dyn_array_allocator_t *allocator = (void*) *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ALLOCATOR);
+        actual_array = allocator ? allocator->reallocate(actual_array, total_size, allocator->userdata) :
+            realloc(actual_array, total_size);
         
         // Point back to the start of the actual data
         return actual_array + DYN_ARRAY_HEADER_SIZE;
@@ -61,7 +73,12 @@ dyn_array_t dyn_array_prepare_new_item(dyn_array_t array)
 
 void dyn_array_destroy(dyn_array_t array)
 {
+    const dyn_array_allocator_t *allocator = (void*) *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ALLOCATOR);
+
     // Just clear up the initially allocated memory
     // Make sure to call free at the actual start, not the API-friendly position
-    free(array - DYN_ARRAY_HEADER_SIZE * sizeof(size_t));
+    if (allocator)
+        allocator->release((size_t*) array - DYN_ARRAY_HEADER_SIZE, allocator->userdata);
+    else
+        free((size_t*) array - DYN_ARRAY_HEADER_SIZE);
 }
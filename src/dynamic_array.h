@@ -25,22 +25,37 @@ typedef enum
     DYN_ARRAY_LENGTH,
     DYN_ARRAY_CAPACITY,
     DYN_ARRAY_ITEM_SIZE,
+    // A pointer to a dyn_array_allocator_t, or zero if the standard library should be used
+    DYN_ARRAY_ALLOCATOR,
     DYN_ARRAY_HEADER_SIZE
 } dyn_array_attribute_e;
 
 typedef void* dyn_array_t;
 
+// Lets the embedders of the library decide where the memory comes from
+typedef struct
+{
+    void* (*allocate) (size_t size, void *userdata);
+    void* (*reallocate) (void *pointer, size_t size, void *userdata);
+    void (*release) (void *pointer, void *userdata);
+    void *userdata;
+} dyn_array_allocator_t;
+
 // Will return a pointer for both read and write operations
 #define DYN_ARRAY_GET_ATTRIBUTE(array, attr) ((size_t*) array - DYN_ARRAY_HEADER_SIZE + attr)
 
 #define DYN_ARRAY_LENGTH(array) *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_LENGTH)
-#define DYN_ARRAY_GET_LAST(array) array[DYN_ARRAY_LENGTH(array) - 1];
+#define DYN_ARRAY_GET_LAST(array) (array)[DYN_ARRAY_LENGTH(array) - 1]
 
 // Just so there exists some form of differentiation between ordinary and dynamic arrays
 #define DYN_ARRAY(type) type*
 
 dyn_array_t dyn_array_create(size_t initial_capacity, size_t item_size);
 
+// The allocator must outlive the array, since it will be used for resizing and destroying it
+dyn_array_t dyn_array_create_with_allocator(size_t initial_capacity, size_t item_size,
+                                            const dyn_array_allocator_t *allocator);
+
 // Prepares the addition of items into the array by allocating enough memory
 // Will resize if needed, so a reassignment is needed
 dyn_array_t dyn_array_resize_to_fit(dyn_array_t array, size_t total_items);
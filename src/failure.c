@@ -0,0 +1,38 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ncurses.h>
+
+// Kept apart from the rest of the helpers, so that the library doesn't depend on ncurses
+void exit_with_failure(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    endwin();
+
+    // Just print out the error message with a fancy format
+    fprintf(stderr, "{astrology error}: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+
+    // Terminate the execution of the program
+    exit(EXIT_FAILURE);
+}
@@ -18,15 +18,64 @@
 #include "gemini.h"
 #include "common.h"
 #include "dynamic_array.h"
+#include "archive.h"
+#include "trace.h"
+#include <openssl/err.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <errno.h>
 #include <netdb.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-// Returns the file descriptor of the connection's socket
-static int create_ordinary_tcp_connection(const char *hostname, gemini_error_e *status)
+/*
+ * Copies the host out of the URL and splits it from its port, which is set to NULL if there is none
+ * Only a single colon, or one right after the closing bracket of an IPv6 literal, starts a port
+ * The brackets are dropped as well, so "[::1]:1965" becomes "::1" and "1965" while a bare "::1" has no port at all
+ */
+static char* split_host(const char *gemini_url, char *buffer, size_t buffer_size, char **port)
 {
+    size_t hostname_length = get_hostname_length((char*) gemini_url);
+    snprintf(buffer, buffer_size, "%.*s", (int) MIN(hostname_length - 9, buffer_size - 1), gemini_url + 9);
+
+    char *host = buffer;
+    *port = NULL;
+
+    if (*host == '[')
+    {
+        char *bracket = strchr(host, ']');
+        if (!bracket)
+            return host;
+
+        *bracket = 0;
+        if (bracket[1] == ':')
+            *port = bracket + 2;
+
+        return host + 1;
+    }
+
+    char *colon = strchr(host, ':');
+    if (colon && colon == strrchr(host, ':'))
+    {
+        *colon = 0;
+        *port = colon + 1;
+    }
+
+    return host;
+}
+
+// The port is optional and defaults to 1965
+bool gemini_resolve_hostname(const char *gemini_url, struct sockaddr_storage *address, socklen_t *address_length)
+{
+    TRACE_SCOPE("resolve");
+
     struct addrinfo dns_hints = {
         // Use IPv4 or IPv6, whatever is available
         .ai_family = AF_UNSPEC,
@@ -36,102 +85,608 @@ static int create_ordinary_tcp_connection(const char *hostname, gemini_error_e *
     // Collecting the IP address of the server
     // A linked list will be returned resulting from DNS lookup process
     struct addrinfo *server_info;
-    
-    if (getaddrinfo(hostname, "1965", &dns_hints, &server_info) != 0)
+
+    // Only the hostname is kept, without the scheme
+    char buffer[1024];
+    char *port;
+    char *host = split_host(gemini_url, buffer, sizeof(buffer), &port);
+
+    if (getaddrinfo(host, port && *port ? port : "1965", &dns_hints, &server_info) != 0)
+        return false;
+
+    // Only the first address is ever tried
+    memcpy(address, server_info->ai_addr, server_info->ai_addrlen);
+    *address_length = server_info->ai_addrlen;
+
+    freeaddrinfo(server_info);
+    return true;
+}
+
+// Returns the file descriptor of the connection's socket
+// The socket is non-blocking, so the connection will most probably still be in progress
+static int create_ordinary_tcp_connection(const struct sockaddr_storage *address, socklen_t address_length,
+                                          gemini_error_e *status)
+{
+    TRACE_SCOPE("connect");
+
+    // Create a TCP connection
+    int connection = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    if (connection < 0)
     {
-        *status = GEMINI_IP_RESOLVE_FAILURE;
+        *status = GEMINI_SERVER_CONNECTION_FAILURE;
         return -1;
     }
 
-    // Create a TCP connection
-    int connection = socket(server_info->ai_family, SOCK_STREAM, IPPROTO_TCP);
-    if (socket < 0)
-        exit_with_failure("failed to initialize TCP socket");
-
-    // Attempt to connect and clear up all memory
-    if (connect(connection, (struct sockaddr*) server_info->ai_addr, server_info->ai_addrlen) != 0)
+    if (connect(connection, (struct sockaddr*) address, address_length) != 0 && errno != EINPROGRESS)
     {
         *status = GEMINI_SERVER_CONNECTION_FAILURE;
+        close(connection);
         return -1;
     }
 
     *status = GEMINI_OK;
-    freeaddrinfo(server_info);
     return connection;
 }
 
-static void gemini_document_collect_content(gemini_document_t *document, SSL *ssl)
+void gemini_request_start(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url)
 {
-    size_t chunk_size = 1024;
-    
-    // First, just read of all the content into a dynamic array
-    // It will make parsing considerably easier
-    document->content = dyn_array_create(chunk_size, sizeof(char));
+    gemini_request_start_with_allocator(request, ctx, gemini_url, NULL);
+}
+
+static void initialize_request(gemini_request_t *request, char *gemini_url, const dyn_array_allocator_t *allocator)
+{
+    request->allocator = allocator;
+    request->ssl = NULL;
+    request->connection = -1;
+    request->content = NULL;
+    request->meta = NULL;
+    request->status[0] = request->status[1] = request->status[2] = 0;
+    request->header_length = request->bytes_sent = 0;
+    request->resolved_at = request->connected_at = request->handshaked_at = 0;
+    request->header_received_at = request->finished_at = 0;
+    request->deadline = 0;
+    request->max_content_length = 0;
+    request->progress_callback = NULL;
+    request->is_url_pending = false;
+    request->is_detached = false;
+    request->started_at = get_monotonic_time();
+    request->phase = GEMINI_REQUEST_CONNECTING;
+    snprintf(request->url, sizeof(request->url), "%s", gemini_url);
+}
+
+// Creates the TLS connection and queues the request line
+static void attach_tls(gemini_request_t *request, SSL_CTX *ctx)
+{
+    request->ssl = SSL_new(ctx);
+
+    // No need to allocate anything, the hostname always fits inside the URL buffer
+    char buffer[sizeof(request->url)];
+    char *port;
+    snprintf(request->host, sizeof(request->host), "%s", split_host(request->url, buffer, sizeof(buffer), &port));
+
+    // Servers that host several capsules need the name to pick a certificate, the port is not part of it
+    // Addresses are never sent as a name though, so whoever checks the certificate finds the host in the app data
+    struct in6_addr literal;
+    bool is_literal = inet_pton(AF_INET, request->host, &literal) == 1 ||
+        inet_pton(AF_INET6, request->host, &literal) == 1;
+
+    if (!is_literal)
+        SSL_set_tlsext_host_name(request->ssl, request->host);
+
+    SSL_set_app_data(request->ssl, request->host);
+
+    // The client needs to request a gemini page from the server.
+    // A scheme should be included and the request shall be terminated with a carriage return followed by a newline
+    request->header_length = snprintf(request->header, sizeof(request->header), "%s\r\n", request->url);
+}
+
+// A missing address means that the hostname couldn't be resolved
+static void connect_request(gemini_request_t *request, SSL_CTX *ctx,
+                            const struct sockaddr_storage *address, socklen_t address_length)
+{
+    if (!address)
+    {
+        gemini_request_finish(request, GEMINI_IP_RESOLVE_FAILURE);
+        return;
+    }
+
+    // The lookup blocks but connecting doesn't, so this is pretty much when the address was resolved
+    request->resolved_at = get_monotonic_time();
+    request->connection = create_ordinary_tcp_connection(address, address_length, &request->error);
+
+    // Quit early if an error was encountered during the simple socket connection
+    if (request->error != GEMINI_OK)
+    {
+        gemini_request_finish(request, request->error);
+        return;
+    }
+
+    // Create a new TLS connection using the provided context
+    attach_tls(request, ctx);
+    SSL_set_fd(request->ssl, request->connection);
+}
+
+void gemini_request_start_with_allocator(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                         const dyn_array_allocator_t *allocator)
+{
+    initialize_request(request, gemini_url, allocator);
+
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    bool is_resolved = gemini_resolve_hostname(request->url, &address, &address_length);
+
+    connect_request(request, ctx, is_resolved ? &address : NULL, address_length);
+}
+
+void gemini_request_start_with_address(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                       const dyn_array_allocator_t *allocator,
+                                       const struct sockaddr_storage *address, socklen_t address_length)
+{
+    initialize_request(request, gemini_url, allocator);
+    connect_request(request, ctx, address, address_length);
+}
+
+void gemini_request_start_detached(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                   const dyn_array_allocator_t *allocator, const struct sockaddr_storage *address)
+{
+    initialize_request(request, gemini_url, allocator);
+    request->is_detached = true;
+
+    if (!address)
+    {
+        gemini_request_finish(request, GEMINI_IP_RESOLVE_FAILURE);
+        return;
+    }
+
+    request->resolved_at = get_monotonic_time();
+
+    // Whoever drives the request never blocks on the socket itself, so it's left blocking
+    request->connection = socket(address->ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (request->connection < 0)
+    {
+        gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+        return;
+    }
+
+    attach_tls(request, ctx);
+
+    // Reading from an empty buffer has to look like a socket that would block, not like one that was closed
+    BIO *incoming = BIO_new(BIO_s_mem());
+    BIO *outgoing = BIO_new(BIO_s_mem());
+
+    BIO_set_mem_eof_return(incoming, -1);
+    SSL_set_bio(request->ssl, incoming, outgoing);
+
+    // Writes the ClientHello, it doesn't need the connection so it can be sent right along with it
+    SSL_connect(request->ssl);
+}
+
+void gemini_request_connected(gemini_request_t *request)
+{
+    request->connected_at = get_monotonic_time();
+    request->phase = GEMINI_REQUEST_HANDSHAKING;
+}
+
+void gemini_request_finish(gemini_request_t *request, gemini_error_e error)
+{
+    request->error = error;
+    request->phase = GEMINI_REQUEST_DONE;
+    request->finished_at = get_monotonic_time();
+}
+
+void gemini_request_preconnect(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                               const dyn_array_allocator_t *allocator)
+{
+    gemini_request_start_with_allocator(request, ctx, gemini_url, allocator);
+    request->is_url_pending = true;
+}
+
+void gemini_request_send(gemini_request_t *request, char *gemini_url)
+{
+    snprintf(request->url, sizeof(request->url), "%s", gemini_url);
+    request->header_length = snprintf(request->header, sizeof(request->header), "%s\r\n", gemini_url);
+    request->bytes_sent = 0;
+    request->is_url_pending = false;
+
+    uint64_t *timestamps[] = {&request->started_at, &request->resolved_at, &request->connected_at,
+                              &request->handshaked_at};
+    uint64_t now = get_monotonic_time();
+
+    for (size_t i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]); i++)
+        if (*timestamps[i])
+            *timestamps[i] = now;
+}
+
+// Returns true if the TLS operation just needs to be retried once the socket is ready
+static bool should_retry_ssl_operation(gemini_request_t *request, int result)
+{
+    int error = SSL_get_error(request->ssl, result);
+    return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+}
+
+/*
+ * Splits the received header into the status and meta fields
+ * Whatever came after the header was actually part of the body, so move it there
+ */
+static void gemini_request_parse_header(gemini_request_t *request, char *header_end)
+{
+    size_t header_length = header_end - request->header;
+    size_t extra_bytes = request->header_length - header_length;
+    request->header_received_at = get_monotonic_time();
+
+    // Gemini server headers are of the form: <2 bytes: STATUS><SPACE><1024 bytes: META>\r\n
+    // If not even a status was received, something went wrong
+    if (header_length < 4 || !isdigit(request->header[0]) || !isdigit(request->header[1]))
+    {
+        gemini_request_finish(request, GEMINI_HEADER_PARSING_FAILURE);
+        return;
+    }
+
+    request->status[0] = request->header[0];
+    request->status[1] = request->header[1];
+
+    if (request->status[0] == '2')
+    {
+        // The leftovers are copied over so that no content gets skipped by accident
+        request->content = dyn_array_create_with_allocator(MAX(extra_bytes + 1, 16384), sizeof(char),
+                                                           request->allocator);
+        memcpy(request->content, header_end, extra_bytes);
+        DYN_ARRAY_LENGTH(request->content) = extra_bytes;
+    }
+
+    // Only keep the header itself inside the buffer, the meta string ends right before the carriage return
+    request->header_length = header_length;
+    request->header[header_length - 2] = 0;
+    request->meta = request->header + (request->header[2] == ' ' ? 3 : 2);
+
+    switch (request->status[0])
+    {
+    case '4': gemini_request_finish(request, GEMINI_TEMPORARY_FAILURE); return;
+    case '5': gemini_request_finish(request, GEMINI_PERMANENT_FAILURE); return;
+    case '6': gemini_request_finish(request, GEMINI_CLIENT_CERTIFICATE_REQUIRED); return;
+    }
+
+    // Only successful responses are followed by a body
+    if (request->status[0] != '2')
+    {
+        gemini_request_finish(request, GEMINI_OK);
+        return;
+    }
+
+    request->phase = GEMINI_REQUEST_READING_BODY;
+}
+
+static bool gemini_request_read_header(gemini_request_t *request)
+{
+    TRACE_SCOPE("read_header");
+
+    for (;;)
+    {
+        int bytes_read = SSL_read(request->ssl, request->header + request->header_length,
+                                  sizeof(request->header) - 1 - request->header_length);
+
+        if (bytes_read <= 0)
+        {
+            if (should_retry_ssl_operation(request, bytes_read))
+                return false;
+
+            // The connection was closed before the whole header arrived
+            gemini_request_finish(request, GEMINI_HEADER_PARSING_FAILURE);
+            return true;
+        }
+
+        size_t previous_length = request->header_length;
+        request->header_length += bytes_read;
+        request->header[request->header_length] = 0;
+
+        // Start the search one character early in case the carriage return was received on the previous read
+        char *header_end = strstr(request->header + (previous_length ? previous_length - 1 : 0), "\r\n");
+        if (header_end)
+        {
+            gemini_request_parse_header(request, header_end + 2);
+            return true;
+        }
+
+        // The header is way too long, the server must be misbehaving
+        if (request->header_length >= sizeof(request->header) - 1)
+        {
+            gemini_request_finish(request, GEMINI_HEADER_PARSING_FAILURE);
+            return true;
+        }
+    }
+}
+
+// Reads all of the available content into the dynamic array
+static void gemini_document_collect_content(gemini_request_t *request)
+{
+    TRACE_SCOPE("collect_content");
+
+    size_t chunk_size = 16384;
     
     for (;;)
     {
-        size_t length = DYN_ARRAY_LENGTH(document->content);
-        size_t remaining_space = *DYN_ARRAY_GET_ATTRIBUTE(document->content, DYN_ARRAY_CAPACITY) - length;
+        size_t length = DYN_ARRAY_LENGTH(request->content);
+        if (request->max_content_length && length >= request->max_content_length)
+            return;
+
+        size_t remaining_space = *DYN_ARRAY_GET_ATTRIBUTE(request->content, DYN_ARRAY_CAPACITY) - length;
 
-        if (remaining_space < chunk_size)
+        // Always leave some space for the NULL byte at the end
+        if (remaining_space < chunk_size + 1)
         {
             // This is really similar to how Golang works
-            document->content = dyn_array_resize_to_fit(document->content, length + chunk_size);
+            request->content = dyn_array_resize_to_fit(request->content, length + chunk_size + 1);
         }
 
         // This is more complicated but certainly faster that creating an intermediate buffer
-        int bytes_read = SSL_read(ssl, document->content + length, chunk_size);
+        int bytes_read = SSL_read(request->ssl, request->content + length, chunk_size);
         if (bytes_read <= 0)
+        {
+            if (should_retry_ssl_operation(request, bytes_read))
+                return;
+
             break;
+        }
  
-        *DYN_ARRAY_GET_ATTRIBUTE(document->content, DYN_ARRAY_LENGTH) += bytes_read;
+        DYN_ARRAY_LENGTH(request->content) += bytes_read;
     }
 
-    document->content[DYN_ARRAY_LENGTH(document->content)] = 0;
+    request->content[DYN_ARRAY_LENGTH(request->content)] = 0;
+    gemini_request_finish(request, GEMINI_OK);
 }
 
-/*
- * Raw text content will be parsed into a fake list of preformatted gemtext elements
- * The frontend will be simplified too, because it won't need to distinguish them apart!
- */
-static void gemini_document_parse_text(gemini_document_t *document)
+bool gemini_request_advance(gemini_request_t *request)
 {
-    // Count the total line breaks, much faster than resizing the dynamic array
-    size_t total_lines = 0;
+    // The error queue is shared by every connection of the thread, so whatever another request left behind
+    // there would turn a harmless SSL_ERROR_WANT_READ of this one into a failure
+    ERR_clear_error();
 
-    for (int i = 0; i < DYN_ARRAY_LENGTH(document->content); i++)
-        if (document->content[i] == '\n')
-            total_lines++;
+    switch (request->phase)
+    {
+    case GEMINI_REQUEST_CONNECTING:
+    {
+        // Only whoever connects a detached request knows when it's done
+        if (request->is_detached)
+            return false;
 
-    document->elements = dyn_array_create(total_lines, sizeof(gemtext_line_t));
-    size_t offset = 0;
-    
-    for (size_t i = 0; i < total_lines; i++)
+        // Figure out whether the non-blocking connection has been established
+        struct pollfd descriptor = { .fd = request->connection, .events = POLLOUT };
+        if (poll(&descriptor, 1, 0) == 0)
+            return false;
+
+        int socket_error = 0;
+        socklen_t error_length = sizeof(socket_error);
+        getsockopt(request->connection, SOL_SOCKET, SO_ERROR, &socket_error, &error_length);
+
+        if (socket_error != 0)
+        {
+            gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+            return true;
+        }
+
+        request->connected_at = get_monotonic_time();
+        request->phase = GEMINI_REQUEST_HANDSHAKING;
+    }
+    // Fall through
+
+    case GEMINI_REQUEST_HANDSHAKING:
     {
-        document->elements = dyn_array_prepare_new_item(document->elements);
-        gemtext_line_t *new_item = &DYN_ARRAY_GET_LAST(document->elements);
+        TRACE_SCOPE("tls_handshake");
+        int result = SSL_connect(request->ssl);
+        if (result != 1)
+        {
+            if (should_retry_ssl_operation(request, result))
+                return false;
 
-        new_item->start = offset;
-        new_item->type = GEMTEXT_PREFORMATTED;
+            // The verification result stays X509_V_OK unless it was the certificate that got turned down
+            long verification = SSL_get_verify_result(request->ssl);
+
+            if (verification == X509_V_ERR_CERT_REJECTED)
+                gemini_request_finish(request, GEMINI_CERTIFICATE_CHANGED);
+            else if (verification != X509_V_OK)
+                gemini_request_finish(request, GEMINI_CERTIFICATE_NOT_TRUSTED);
+            else
+                gemini_request_finish(request, GEMINI_TLS_HANDSHAKE_FAILURE);
+
+            return true;
+        }
+
+        // Whether the certificate is trusted or not is up to the context (e.g. known_hosts.h)
+        request->handshaked_at = get_monotonic_time();
+        request->phase = GEMINI_REQUEST_SENDING;
+    }
+    // Fall through
+
+    case GEMINI_REQUEST_SENDING:
+        if (request->is_url_pending)
+            return false;
 
-        if (i != total_lines - 1)
+        while (request->bytes_sent < request->header_length)
         {
-            // Find the next new line position and perform a simple subtraction to calculate the substring's end
-            char *next_new_line = strchr(document->content + offset, '\n');
+            int bytes_written = SSL_write(request->ssl, request->header + request->bytes_sent,
+                                          request->header_length - request->bytes_sent);
+            if (bytes_written <= 0)
+            {
+                if (should_retry_ssl_operation(request, bytes_written))
+                    return false;
 
-            new_item->end = (next_new_line - document->content);
-            offset = new_item->end + 1;
+                gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+                return true;
+            }
+
+            request->bytes_sent += bytes_written;
         }
-        else
-            new_item->end = DYN_ARRAY_LENGTH(document->content);
+
+        // Reuse the buffer for the server's response header
+        request->header_length = 0;
+        request->phase = GEMINI_REQUEST_READING_HEADER;
+        // Fall through
+
+    case GEMINI_REQUEST_READING_HEADER:
+        if (!gemini_request_read_header(request))
+            return false;
+
+        if (request->phase == GEMINI_REQUEST_DONE)
+            return true;
+        // Fall through
+
+    case GEMINI_REQUEST_READING_BODY:
+        gemini_document_collect_content(request);
+        return request->phase == GEMINI_REQUEST_DONE;
+
+    case GEMINI_REQUEST_DONE:
+        return true;
     }
+
+    return true;
+}
+
+short gemini_request_get_poll_events(gemini_request_t *request)
+{
+    // TLS may need to write while reading (and vice versa), so wait for whatever is asked
+    if (request->phase == GEMINI_REQUEST_CONNECTING || (request->ssl && SSL_want_write(request->ssl)))
+        return POLLOUT;
+
+    return POLLIN;
+}
+
+void gemini_request_wait(gemini_request_t *request, gemini_request_phase_e phase)
+{
+    while (request->phase < phase && !gemini_request_advance(request))
+    {
+        uint64_t now = get_monotonic_time();
+        if (request->deadline && request->deadline <= now)
+        {
+            gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+            break;
+        }
+
+        // Simply sleep until the socket is ready again
+        // Whoever is watching the progress is woken up every now and then, even if the server has gone quiet
+        if (request->progress_callback)
+            request->progress_callback(request);
+
+        // Rounded up, so that the loop doesn't spin for the last millisecond before the deadline
+        int timeout = request->progress_callback ? GEMINI_PROGRESS_INTERVAL : -1;
+        if (request->deadline)
+        {
+            int remaining = (request->deadline - now + 999) / 1000;
+            timeout = timeout < 0 ? remaining : MIN(timeout, remaining);
+        }
+
+        struct pollfd descriptor = { .fd = request->connection, .events = gemini_request_get_poll_events(request) };
+        poll(&descriptor, 1, timeout);
+    }
+
+    if (request->progress_callback)
+        request->progress_callback(request);
+}
+
+void gemini_request_close(gemini_request_t *request)
+{
+    if (request->ssl)
+    {
+        // Only say goodbye properly if the handshake was actually completed
+        if (request->handshaked_at)
+            SSL_shutdown(request->ssl);
+
+        SSL_free(request->ssl);
+        request->ssl = NULL;
+    }
+
+    if (request->connection >= 0)
+    {
+        close(request->connection);
+        request->connection = -1;
+    }
+}
+
+void gemini_request_get_timings(gemini_request_t *request, gemini_timings_t *timings)
+{
+    *timings = (gemini_timings_t) {
+        .started_at = request->started_at,
+        .resolved_at = request->resolved_at,
+        .connected_at = request->connected_at,
+        .handshaked_at = request->handshaked_at,
+        .header_received_at = request->header_received_at,
+        .finished_at = request->finished_at
+    };
+}
+
+void gemini_request_destroy(gemini_request_t *request)
+{
+    gemini_request_close(request);
+
+    if (request->content)
+        dyn_array_destroy(request->content);
+}
+
+// Every line of plain text becomes an element, so this is exactly how many elements it's going to have
+static size_t count_lines(const char *content, size_t length)
+{
+    size_t total_lines = 1;
+    const char *end = content + length;
+
+    for (const char *c = content; (c = memchr(c, '\n', end - c)); c++)
+        total_lines++;
+
+    return total_lines;
+}
+
+/*
+ * Every line keeps its new line character, so that even empty lines are never zero-sized
+ * The last line doesn't need to end with one, a body without any new lines is still a line
+ * Parses the line at the offset and moves it to the next one, returns false if there are no lines left
+ */
+static inline bool parse_plain_line(const char *content, size_t length, size_t *offset, gemtext_line_t *item)
+{
+    if (*offset >= length)
+        return false;
+
+    const char *next_new_line = memchr(content + *offset, '\n', length - *offset);
+
+    item->type = GEMTEXT_PREFORMATTED;
+    item->start = *offset;
+    item->end = next_new_line ? next_new_line - content : length - 1;
+
+    *offset = item->end + 1;
+    return true;
+}
+
+size_t gemtext_parse_plain_lines(const char *content, size_t length, gemtext_line_t *elements, size_t max_elements)
+{
+    size_t total_lines = 0;
+    size_t offset = 0;
+    gemtext_line_t scratch_item;
+
+    while (parse_plain_line(content, length, &offset,
+                            total_lines < max_elements ? &elements[total_lines] : &scratch_item))
+        total_lines++;
+
+    return total_lines;
+}
+
+/*
+ * Raw text content will be parsed into a fake list of preformatted gemtext elements
+ * The frontend will be simplified too, because it won't need to distinguish them apart!
+ */
+void gemini_document_parse_text(gemini_document_t *document)
+{
+    TRACE_SCOPE("parse_text");
+
+    size_t length = DYN_ARRAY_LENGTH(document->content);
+    size_t capacity = count_lines(document->content, length);
+
+    document->elements = dyn_array_create_with_allocator(capacity, sizeof(gemtext_line_t), document->allocator);
+    DYN_ARRAY_LENGTH(document->elements) = gemtext_parse_plain_lines(document->content, length,
+                                                                     document->elements, capacity);
 }
 
 /*
  * Assigns a type to the current line based on its prefix characters
  * Will gracefully handle the cases in which some tokens appear right at the end of the buffer
  */
-static gemtext_line_e get_gemtext_type_from_line(char *line)
+static gemtext_line_e get_gemtext_type_from_line(const char *line, size_t remaining)
 {
     switch (line[0])
     {
@@ -140,233 +695,645 @@ static gemtext_line_e get_gemtext_type_from_line(char *line)
 
     case '#':
         // Collect the level of the heading and avoid an out-of-bounds runtime error
-        if (line[1] && line[2] == '#') return GEMTEXT_HEADING_THREE;
-        if (line[1] == '#') return GEMTEXT_HEADING_TWO;
+        if (remaining > 2 && line[1] == '#' && line[2] == '#') return GEMTEXT_HEADING_THREE;
+        if (remaining > 1 && line[1] == '#') return GEMTEXT_HEADING_TWO;
 
         return GEMTEXT_HEADING_ONE;
     }
 
-    if (!strncmp("=>", line, 2))  return GEMTEXT_LINK;
-    if (!strncmp("```", line, 3)) return GEMTEXT_PREFORMATTED;
+    if (remaining >= 2 && !strncmp("=>", line, 2))  return GEMTEXT_LINK;
+    if (remaining >= 3 && !strncmp("```", line, 3)) return GEMTEXT_PREFORMATTED;
 
     // If nothing special was recognized, it must be a plain paragraph
     return GEMTEXT_PARAGRAPH;
 }
 
+// Parses the line at the offset and moves it to the next one, returns false if there are no lines left
+// Whether a preformatted block has been entered is all the state there is, so parsing can resume anywhere
+static inline bool parse_gemtext_line(const char *content, size_t content_length, size_t *offset,
+                                      bool *has_entered_preformatted, gemtext_line_t *new_item)
+{
+    // Skip all trailing new line characters if we are not inside a preformatted block
+    if (!*has_entered_preformatted)
+        while (*offset < content_length && isspace(content[*offset])) (*offset)++;
+
+    if (*offset >= content_length)
+        return false;
+
+    new_item->start = *offset;
+    new_item->type = get_gemtext_type_from_line(content + *offset, content_length - *offset);
+
+    if (new_item->type == GEMTEXT_PREFORMATTED)
+        *has_entered_preformatted = !*has_entered_preformatted;
+
+    // If we're still inside a preformatted block, overwrite whatever type was detected
+    else if (*has_entered_preformatted)
+        new_item->type = GEMTEXT_PREFORMATTED;
+
+    // Advance until either a new line or the end of the buffer has been reached
+    const char *new_line = memchr(content + *offset, '\n', content_length - *offset);
+    new_item->end = new_line ? new_line - content : content_length - 1;
+
+    // If we've reached the end of the buffer, finish
+    if (new_item->end == content_length - 1)
+    {
+        *offset = content_length;
+        return true;
+    }
+
+    new_item->end--;
+    *offset = new_item->end + 2;
+    return true;
+}
+
+size_t gemtext_parse_more_lines(const char *content, size_t content_length, bool *has_entered_preformatted,
+                                gemtext_line_t *elements, size_t max_elements)
+{
+    size_t offset = 0;
+    size_t total_elements = 0;
+    gemtext_line_t scratch_item;
+
+    // Keep on counting even when the caller's buffer is full, so that they know how much space is needed
+    while (parse_gemtext_line(content, content_length, &offset, has_entered_preformatted,
+                              total_elements < max_elements ? &elements[total_elements] : &scratch_item))
+        total_elements++;
+
+    return total_elements;
+}
+
+size_t gemtext_parse_lines(const char *content, size_t content_length, gemtext_line_t *elements, size_t max_elements)
+{
+    bool has_entered_preformatted = false;
+    return gemtext_parse_more_lines(content, content_length, &has_entered_preformatted, elements, max_elements);
+}
+
 void gemini_document_parse_gemtext(gemini_document_t *document)
 {
-    // Parsing each line of the output into an array of gemtext elements
-    document->elements = dyn_array_create(20, sizeof(gemtext_line_t));
-    
+    TRACE_SCOPE("parse_gemtext");
+
+    // Blank lines never become elements, so counting the new lines up front could reserve far more than needed
+    // (a body that's nothing but new lines would reserve 24 bytes for every byte). The table grows as it's filled
+    size_t length = DYN_ARRAY_LENGTH(document->content);
     size_t offset = 0;
-    size_t content_length = DYN_ARRAY_LENGTH(document->content);
     bool has_entered_preformatted = false;
+    gemtext_line_t item;
+
+    document->elements = dyn_array_create_with_allocator(MAX(length / 64, 16), sizeof(gemtext_line_t),
+                                                         document->allocator);
+
+    while (parse_gemtext_line(document->content, length, &offset, &has_entered_preformatted, &item))
+    {
+        document->elements = dyn_array_prepare_new_item(document->elements);
+        DYN_ARRAY_GET_LAST(document->elements) = item;
+    }
+}
+
+size_t gemini_document_find_next_link(gemini_document_t *document, size_t start)
+{
+    gemtext_line_t *elements = document->elements;
+    size_t index = start + 1;
     
-    while (offset < content_length)
+    // Start with a forward search
+    while (index < DYN_ARRAY_LENGTH(elements) && elements[index].type != GEMTEXT_LINK) index++;
+    
+    // If nothing was found, wrap around from the start of the document
+    if (index >= DYN_ARRAY_LENGTH(elements))
     {
-        // Skip all trailing new line characters if we are not inside a preformatted block
-        if (!has_entered_preformatted)
-        {
-            while (isspace(document->content[offset])) offset++;
-            if (offset > content_length - 1) break;
-        }
+        index = 0;
+        while (index != start && elements[index].type != GEMTEXT_LINK) index++;
+    }
 
-        document->elements = dyn_array_prepare_new_item(document->elements);
-        gemtext_line_t *new_item = &DYN_ARRAY_GET_LAST(document->elements);
+    return index;
+}
 
-        new_item->start = offset;
-        new_item->type = get_gemtext_type_from_line(document->content + offset);
+// Swaps the bodies of both documents, so that destroying the newer one takes the old body along with it
+static void adopt_body(gemini_document_t *document, gemini_document_t *newer, DYN_ARRAY(gemtext_line_t) elements)
+{
+    gemini_document_t old = *document;
 
-        if (new_item->type == GEMTEXT_PREFORMATTED)
-            has_entered_preformatted = !has_entered_preformatted;
+    document->content = newer->content;
+    document->elements = elements;
+    document->mapping = newer->mapping;
+    document->mapping_size = newer->mapping_size;
+    document->error = newer->error;
+    document->timings = newer->timings;
+    document->is_plain_text = newer->is_plain_text;
+    document->is_partially_parsed = false;
+    document->timings.parsed_at = get_monotonic_time();
 
-        // If we're still inside a preformatted block, overwrite whatever type was detected
-        else if (has_entered_preformatted)
-            new_item->type = GEMTEXT_PREFORMATTED;
-        
-        // Advance until either a new line or the end of the buffer has been reached
-        new_item->end = offset;
-        while (new_item->end != content_length - 1 && document->content[new_item->end] != '\n') new_item->end++;
+    if (elements != newer->elements && newer->elements)
+        dyn_array_destroy(newer->elements);
 
-        // If we've reached the end of the buffer, finish
-        if (new_item->end == content_length - 1)
-            break;
+    newer->content = old.content;
+    newer->elements = old.elements;
+    newer->mapping = old.mapping;
+    newer->mapping_size = old.mapping_size;
+
+    gemini_document_destroy(newer);
+}
+
+// Where the new line character that ends an element is, for either kind of parser
+static size_t get_line_end(gemini_document_t *document, size_t index)
+{
+    return document->elements[index].end + !document->is_plain_text;
+}
+
+// Inside or outside a preformatted block, right after the given amount of elements
+static bool is_preformatted_after(gemini_document_t *document, size_t total_elements)
+{
+    bool is_toggled = false;
+
+    // Only the toggles themselves can't tell, every other element's type says whether it's inside a block or not
+    for (size_t i = total_elements; i > 0; i--)
+    {
+        gemtext_line_t *element = &document->elements[i - 1];
+        bool is_toggle = !strncmp(document->content + element->start, "```", 3);
 
-        new_item->end--;
-        offset = new_item->end + 2;
+        if (!is_toggle)
+            return (element->type == GEMTEXT_PREFORMATTED) != is_toggled;
+
+        is_toggled = !is_toggled;
     }
+
+    return is_toggled;
 }
 
-gemini_document_t* gemini_fetch_document(SSL_CTX *ctx, char *gemini_url, gemini_input_callback_t input_callback)
+// memcmp is a lot faster than comparing a character at a time, so it goes through whole blocks while it can
+#define COMPARISON_BLOCK 4096
+
+static size_t get_common_prefix(const char *first, const char *second, size_t length)
 {
-    // Create a new TLS connection using the provided context
-    SSL *ssl = SSL_new(ctx);
-    gemini_error_e error;
+    size_t prefix = 0;
 
-    char *hostname = get_hostname_with_scheme(gemini_url);
-    int connection = create_ordinary_tcp_connection(hostname + 9, &error);
-    free(hostname);
+    while (prefix + COMPARISON_BLOCK <= length && !memcmp(first + prefix, second + prefix, COMPARISON_BLOCK))
+        prefix += COMPARISON_BLOCK;
 
-    // Quit early if an error was encountered during the simple socket connection
-    if (error != GEMINI_OK)
-        goto fetch_failed;
+    while (prefix < length && first[prefix] == second[prefix])
+        prefix++;
 
-    SSL_set_fd(ssl, connection);
+    return prefix;
+}
 
-    if (SSL_connect(ssl) != 1)
+// Both strings end at the given pointers
+static size_t get_common_suffix(const char *first_end, const char *second_end, size_t length)
+{
+    size_t suffix = 0;
+
+    while (suffix + COMPARISON_BLOCK <= length &&
+           !memcmp(first_end - suffix - COMPARISON_BLOCK, second_end - suffix - COMPARISON_BLOCK, COMPARISON_BLOCK))
+        suffix += COMPARISON_BLOCK;
+
+    while (suffix < length && first_end[-(ptrdiff_t) suffix - 1] == second_end[-(ptrdiff_t) suffix - 1])
+        suffix++;
+
+    return suffix;
+}
+
+bool gemini_document_update(gemini_document_t *document, gemini_document_t *newer, gemini_document_diff_t *diff)
+{
+    TRACE_SCOPE("update_document");
+
+    char *old_content = document->content, *new_content = newer->content;
+    size_t old_length = DYN_ARRAY_LENGTH(old_content), new_length = DYN_ARRAY_LENGTH(new_content);
+    size_t old_total = document->elements ? DYN_ARRAY_LENGTH(document->elements) : 0;
+
+    *diff = (gemini_document_diff_t) {old_total, old_total, old_total};
+
+    if (old_length == new_length && document->is_plain_text == newer->is_plain_text &&
+        !memcmp(old_content, new_content, new_length))
     {
-        error = GEMINI_TLS_HANDSHAKE_FAILURE;
-        goto fetch_failed;
+        gemini_document_destroy(newer);
+        return false;
     }
 
-#ifdef WITH_SSL_CERT
+    // Nothing can be reused without the old elements, or if the document is to be parsed differently
+    if (!document->elements || document->is_partially_parsed || document->is_plain_text != newer->is_plain_text)
+    {
+        gemini_document_parse(newer);
+        *diff = (gemini_document_diff_t) {0, old_total, DYN_ARRAY_LENGTH(newer->elements)};
 
-    // Certificate verification
-    if (SSL_get_verify_result(ssl) != X509_V_OK) {
-        error = GEMINI_TLS_HANDSHAKE_FAILURE;
-        goto fetch_failed;
+        adopt_body(document, newer, newer->elements);
+        return true;
     }
 
-#endif
+    size_t prefix = get_common_prefix(old_content, new_content, MIN(old_length, new_length));
+    size_t suffix = get_common_suffix(old_content + old_length, new_content + new_length,
+                                      MIN(old_length, new_length) - prefix);
 
-        // I might implement TOFU certificates in the future
-    
-    // 1029 is the maximum size of the server response header (plus a NULL byte)
-    // This buffer will be used for both auxiliary input and output storage
-    char io_buffer[1030];
-    
-    // The client needs to request a gemini page from the server.
-    // A scheme should be included and the request shall be terminated with a carriage return followed by a newline
-    sprintf(io_buffer, "%s\r\n", gemini_url);
-    size_t url_len = strlen(gemini_url);
-    SSL_write(ssl, io_buffer, url_len + 2);
-    
-    // Read and parse the server's response header
-    // Gemini server headers are of the form: <2 bytes: STATUS><SPACE><1024 bytes: META>\r\n
-    size_t header_length = 0;
-    for (;;)
+    // Lines that end (new line included) inside the common prefix stay the same, the elements are sorted
+    // Gemtext is the exception when that new line is the last character, it becomes part of the element
+    size_t limit = document->is_plain_text ? prefix : MIN(prefix, new_length - 1);
+    size_t low = 0, high = old_total;
+    while (low < high)
     {
-        int bytes_read = SSL_read(ssl, io_buffer + header_length, 1);
-        if (!bytes_read)
-            break;
-        
-        header_length++;
+        size_t middle = (low + high) / 2;
 
-        // Check if we've reached the end of the buffer
-        // I'm doing this one character at a time so I don't skip some content by accident
-        if (header_length >= 2 && io_buffer[header_length - 2] == '\r' && io_buffer[header_length - 1] == '\n')
-        {
-            io_buffer[header_length] = 0;
-            break;
-        }
+        if (get_line_end(document, middle) < limit)
+            low = middle + 1;
+        else
+            high = middle;
     }
-    
-    // If not even a status was received, something went wrong
-    if (header_length < 4)
+
+    // The last line might not end with a new line at all, in which case something could have been appended to it
+    size_t kept = low;
+    if (kept && old_content[get_line_end(document, kept - 1)] != '\n')
+        kept--;
+
+    DYN_ARRAY(gemtext_line_t) elements = dyn_array_create_with_allocator(old_total + 16, sizeof(gemtext_line_t),
+                                                                        document->allocator);
+    memcpy(elements, document->elements, kept * sizeof(gemtext_line_t));
+    DYN_ARRAY_LENGTH(elements) = kept;
+
+    size_t offset = kept ? get_line_end(document, kept - 1) + 1 : 0;
+    bool has_entered_preformatted = !document->is_plain_text && is_preformatted_after(document, kept);
+    ptrdiff_t shift = (ptrdiff_t) new_length - (ptrdiff_t) old_length;
+
+    diff->first_changed = kept;
+    gemtext_line_t item;
+
+    while (document->is_plain_text ? parse_plain_line(new_content, new_length, &offset, &item) :
+           parse_gemtext_line(new_content, new_length, &offset, &has_entered_preformatted, &item))
     {
-        error = GEMINI_HEADER_PARSING_FAILURE;
-        goto fetch_failed;
+        elements = dyn_array_prepare_new_item(elements);
+        DYN_ARRAY_GET_LAST(elements) = item;
+
+        // Once a line starts inside the common suffix, the rest of the document is the same as before
+        // Unless the old version had no line there, or was in a different state of preformatting
+        if (item.start < new_length - suffix)
+            continue;
+
+        size_t old_start = item.start - shift;
+        low = kept, high = old_total;
+
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+
+            if (document->elements[middle].start < old_start)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        // A toggle's type doesn't say which side of the block the parser is on
+        if (low == old_total || document->elements[low].start != old_start ||
+            document->elements[low].type != item.type ||
+            (!document->is_plain_text && !strncmp(new_content + item.start, "```", 3)))
+            continue;
+
+        size_t remaining = old_total - low - 1;
+        diff->old_unchanged = low;
+        diff->new_unchanged = DYN_ARRAY_LENGTH(elements) - 1;
+
+        elements = dyn_array_resize_to_fit(elements, DYN_ARRAY_LENGTH(elements) + remaining);
+        for (size_t i = 0; i < remaining; i++)
+        {
+            gemtext_line_t *shifted = &elements[DYN_ARRAY_LENGTH(elements) + i];
+            *shifted = document->elements[low + 1 + i];
+            shifted->start += shift;
+            shifted->end += shift;
+        }
+
+        DYN_ARRAY_LENGTH(elements) += remaining;
+        break;
     }
 
-    char status[2];
-    char meta[1024];
-    sscanf(io_buffer, "%2s %s\r\n", status, meta);
-    
-    switch (status[0])
+    if (diff->old_unchanged == old_total)
+        diff->new_unchanged = DYN_ARRAY_LENGTH(elements);
+
+    adopt_body(document, newer, elements);
+    return true;
+}
+
+size_t gemini_document_diff_translate(const gemini_document_diff_t *diff, size_t index)
+{
+    if (index < diff->first_changed)
+        return index;
+
+    if (index >= diff->old_unchanged)
+        return index - diff->old_unchanged + diff->new_unchanged;
+
+    // Somewhere inside of what has changed, the closest thing is the start of it
+    return diff->first_changed;
+}
+
+gemini_document_t* gemini_fetch_document(SSL_CTX *ctx, char *gemini_url, gemini_input_callback_t input_callback,
+                                         archive_t *archive)
+{
+    return gemini_fetch_document_with_allocator(ctx, gemini_url, input_callback, archive, NULL);
+}
+
+gemini_document_t* gemini_fetch_document_with_allocator(SSL_CTX *ctx, char *gemini_url,
+                                                        gemini_input_callback_t input_callback, archive_t *archive,
+                                                        const dyn_array_allocator_t *allocator)
+{
+    return gemini_fetch_document_with_progress(ctx, gemini_url, input_callback, archive, allocator, NULL);
+}
+
+typedef struct
+{
+    gemini_request_t *request;
+    SSL_CTX *ctx;
+    char *url;
+    const dyn_array_allocator_t *allocator;
+} preconnection_t;
+
+// Runs while the user is still typing the input, nothing else touches the request in the meantime
+static void* preconnect(void *data)
+{
+    preconnection_t *preconnection = data;
+
+    gemini_request_preconnect(preconnection->request, preconnection->ctx, preconnection->url,
+                              preconnection->allocator);
+
+    // Otherwise a handshake that never ends would keep the UI waiting once the input has been typed
+    preconnection->request->deadline = preconnection->request->started_at + GEMINI_PRECONNECT_TIMEOUT * 1000000ULL;
+    gemini_request_wait(preconnection->request, GEMINI_REQUEST_SENDING);
+
+    return NULL;
+}
+
+// Servers don't say anything before the request, but TLS 1.3 ones do send their session tickets after the handshake
+// So the socket being readable means nothing, peeking lets OpenSSL consume the tickets and see what's behind them
+// Only running out of data (and not reaching the end of the stream, nor getting any content) means it's still open
+static bool is_preconnection_alive(gemini_request_t *request)
+{
+    if (request->phase != GEMINI_REQUEST_SENDING)
+        return false;
+
+    char byte;
+    ERR_clear_error();
+
+    int result = SSL_peek(request->ssl, &byte, 1);
+    return result <= 0 && SSL_get_error(request->ssl, result) == SSL_ERROR_WANT_READ;
+}
+
+// Follows whatever a started request ends up asking for (input, redirections) and turns it into a document
+static gemini_document_t* complete_fetch(gemini_request_t *request, SSL_CTX *ctx,
+                                         gemini_input_callback_t input_callback, archive_t *archive,
+                                         const dyn_array_allocator_t *allocator,
+                                         gemini_progress_callback_t progress_callback)
+{
+    char *gemini_url = request->url;
+    request->progress_callback = progress_callback;
+
+    // There's no need to collect the content yet, the body might not even be text
+    // Unless it's being archived, in which case the whole response is needed
+    gemini_request_wait(request, archive ? GEMINI_REQUEST_DONE : GEMINI_REQUEST_READING_BODY);
+
+    if (archive)
+        archive_record(archive, request);
+
+    switch (request->status[0])
     {
     case '1':
+    {
         // The result query (e.g. ?search%20query) will be glued to the initial URL and the request will be repeated
+        // A new connection is presumably required
+        // I tried using the already existing one but the server would not accept my input,
+        // nor would it send any data back
+        gemini_request_close(request);
+
+        // The new connection doesn't need the query until the handshake is over, so it's set up while the user types
+        gemini_request_t retry;
+        preconnection_t preconnection = {&retry, ctx, gemini_url, allocator};
+
+        pthread_t connector;
+        bool has_connector = pthread_create(&connector, NULL, preconnect, &preconnection) == 0;
+
+        char io_buffer[1030];
+        size_t url_len = strlen(gemini_url);
+
         strncpy(io_buffer, gemini_url, url_len);
         size_t offset = url_len;
         io_buffer[offset++] = '?';
         
         // Out of the 1024 total bytes, 2 will be occupied by \r\n
-        offset += input_callback(io_buffer + offset, meta, 1021 - offset);
+        offset += input_callback(io_buffer + offset, request->meta, 1021 - offset);
         io_buffer[offset] = 0;
 
-        // A new connection is presumably required
-        // I tried using the already existing one but the server would not accept my input,
-        // nor would it send any data back
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        close(connection);
+        gemini_request_destroy(request);
 
-        return gemini_fetch_document(ctx, io_buffer, input_callback);
+        if (!has_connector)
+            return gemini_fetch_document_with_progress(ctx, io_buffer, input_callback, archive, allocator,
+                                                       progress_callback);
+
+        // The server might have given up on the connection while the user was typing, in which case it's done again
+        pthread_join(connector, NULL);
+        bool is_alive = is_preconnection_alive(&retry);
+
+        if (is_alive)
+        {
+            gemini_request_send(&retry, io_buffer);
+            retry.deadline = 0;
+            retry.progress_callback = progress_callback;
+            gemini_request_wait(&retry, GEMINI_REQUEST_READING_BODY);
+        }
+
+        if (!is_alive || (!retry.header_received_at && retry.error != GEMINI_OK))
+        {
+            gemini_request_destroy(&retry);
+            return gemini_fetch_document_with_progress(ctx, io_buffer, input_callback, archive, allocator,
+                                                       progress_callback);
+        }
+
+        return complete_fetch(&retry, ctx, input_callback, archive, allocator, progress_callback);
+    }
         
     case '3':
+    {
         // If the server has requested a redirection, recursively call this function
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        close(connection);
+        gemini_request_close(request);
+        gemini_document_t *document;
         
         // If the URL is absolute, just go there
-        if (has_protocol_scheme(meta))
-            return gemini_fetch_document(ctx, meta, input_callback);
+        if (has_protocol_scheme(request->meta))
+            document = gemini_fetch_document_with_progress(ctx, request->meta, input_callback, archive, allocator,
+                                                           progress_callback);
         else
         {
-            char *new_url = join_relative_link_to_url(gemini_url, meta);
-            gemini_document_t *document = gemini_fetch_document(ctx, new_url, input_callback);
+            char *new_url = join_relative_link_to_url(gemini_url, request->meta);
+            document = gemini_fetch_document_with_progress(ctx, new_url, input_callback, archive, allocator,
+                                                           progress_callback);
             
             free(new_url);
-            return document;
         }
-        
-    case '4':
-        // Identical requests may succeed in the future, so the user can retry
-        error = GEMINI_TEMPORARY_FAILURE;
-        goto fetch_failed;
-
-    case '5':
-        // Something is seriously wrong with the server
-        error = GEMINI_PERMANENT_FAILURE;
-        goto fetch_failed;
 
-    case '6':
-        // As of now, I'm considering this an error
-        // The program cannot currently handle client certificates
-        error = GEMINI_CLIENT_CERTIFICATE_REQUIRED;
-        goto fetch_failed;
+        gemini_request_destroy(request);
+        return document;
+    }
     }
 
-fetch_failed:
+    gemini_document_t *document = gemini_document_from_request(request);
+    gemini_request_destroy(request);
+
+    return document;
+}
+
+gemini_document_t* gemini_fetch_document_with_progress(SSL_CTX *ctx, char *gemini_url,
+                                                       gemini_input_callback_t input_callback, archive_t *archive,
+                                                       const dyn_array_allocator_t *allocator,
+                                                       gemini_progress_callback_t progress_callback)
+{
+    gemini_request_t request;
+    gemini_request_start_with_allocator(&request, ctx, gemini_url, allocator);
+
+    return complete_fetch(&request, ctx, input_callback, archive, allocator, progress_callback);
+}
+
+gemini_document_t* gemini_fetch_document_with_address(SSL_CTX *ctx, char *gemini_url,
+                                                      gemini_input_callback_t input_callback, archive_t *archive,
+                                                      const dyn_array_allocator_t *allocator,
+                                                      gemini_progress_callback_t progress_callback,
+                                                      const struct sockaddr_storage *address, socklen_t address_length,
+                                                      uint64_t started_at)
+{
+    gemini_request_t request;
+    gemini_request_start_with_address(&request, ctx, gemini_url, allocator, address, address_length);
+    request.started_at = started_at;
+
+    return complete_fetch(&request, ctx, input_callback, archive, allocator, progress_callback);
+}
+
+gemini_document_t* gemini_document_create(char *gemini_url)
+{
     gemini_document_t *document = malloc(sizeof(gemini_document_t));
-    document->error = error;
+    document->error = GEMINI_OK;
     document->url = strdup(gemini_url);
+    document->content = NULL;
+    document->elements = NULL;
+    document->mapping = NULL;
+    document->mapping_size = 0;
+    document->timings = (gemini_timings_t) {0};
+    document->allocator = NULL;
+    document->is_plain_text = false;
+    document->is_partially_parsed = document->is_inside_preformatted = false;
+    document->parsed_length = 0;
+
+    return document;
+}
+
+gemini_document_t* gemini_document_receive(gemini_request_t *request)
+{
+    gemini_document_t *document = gemini_document_create(request->url);
+    document->error = request->error;
+    document->allocator = request->allocator;
+    gemini_request_get_timings(request, &document->timings);
     
     // If the status starts with a two, fetch the content
-    if (status[0] == '2' && document->error == GEMINI_OK)
+    if (request->status[0] == '2' && document->error == GEMINI_OK)
     {
         // If the result is text, collect its content
         // If <META> is an empty string, text/gemini is assumed
-        bool is_gemini = (header_length < 6 || !strncmp(meta, "text/gemini", 9));
-        bool is_text = !strncmp(meta, "text", 4);
+        bool is_gemini = (!request->meta[0] || !strncmp(request->meta, "text/gemini", 11));
+        bool is_text = is_gemini || !strncmp(request->meta, "text", 4);
 
         if (is_text)
         {
-            gemini_document_collect_content(document, ssl);
+            gemini_request_wait(request, GEMINI_REQUEST_DONE);
+            document->timings.finished_at = request->finished_at;
 
-            if (is_gemini)
-                gemini_document_parse_gemtext(document);
-            else
-                // If it's text but not gemtext, just handle it like a large preformatted block!
-                gemini_document_parse_text(document);
+            // Steal the collected content from the request
+            document->content = request->content;
+            request->content = NULL;
+
+            // If it's text but not gemtext, just handle it like a large preformatted block!
+            document->is_plain_text = !is_gemini;
         }
         else
         {
             document->error = GEMINI_NOT_TEXT;
         }
     }
-        
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
-    close(connection);
 
     return document;
 }
 
+gemini_document_t* gemini_document_from_request(gemini_request_t *request)
+{
+    gemini_document_t *document = gemini_document_receive(request);
+
+    if (document->content)
+    {
+        gemini_document_parse(document);
+        document->timings.parsed_at = get_monotonic_time();
+    }
+
+    return document;
+}
+
+void gemini_document_parse(gemini_document_t *document)
+{
+    if (document->is_plain_text)
+        gemini_document_parse_text(document);
+    else
+        gemini_document_parse_gemtext(document);
+
+    document->parsed_length = DYN_ARRAY_LENGTH(document->content);
+    document->is_partially_parsed = false;
+}
+
+// Looking at the clock for every line would cost more than the lines themselves
+#define LINES_BETWEEN_DEADLINE_CHECKS 1024
+
+bool gemini_document_parse_until(gemini_document_t *document, uint64_t deadline)
+{
+    TRACE_SCOPE("parse_until");
+
+    // Starting over, either for the first time or because the elements were dropped since
+    if (!document->elements)
+    {
+        document->elements = dyn_array_create_with_allocator(1024, sizeof(gemtext_line_t), document->allocator);
+        document->parsed_length = 0;
+        document->is_inside_preformatted = false;
+    }
+
+    const char *content = document->content;
+    size_t length = DYN_ARRAY_LENGTH(document->content), offset = document->parsed_length;
+    gemtext_line_t item;
+
+    for (size_t lines = 1; document->is_plain_text ? parse_plain_line(content, length, &offset, &item) :
+         parse_gemtext_line(content, length, &offset, &document->is_inside_preformatted, &item); lines++)
+    {
+        document->elements = dyn_array_prepare_new_item(document->elements);
+        DYN_ARRAY_GET_LAST(document->elements) = item;
+
+        if (lines % LINES_BETWEEN_DEADLINE_CHECKS == 0 && offset < length && get_monotonic_time() >= deadline)
+        {
+            document->parsed_length = offset;
+            document->is_partially_parsed = true;
+            return false;
+        }
+    }
+
+    document->parsed_length = length;
+    document->is_partially_parsed = false;
+    return true;
+}
+
 void gemini_document_destroy(gemini_document_t *document)
 {
-    dyn_array_destroy(document->content);
-    dyn_array_destroy(document->elements);
+    // Mapped documents don't own their arrays, they live inside the mapping
+    // Local files are the exception, only their content is mapped while the elements are parsed into the heap
+    if (document->mapping)
+    {
+        char *mapping = document->mapping;
+        char *elements = (char*) document->elements;
+
+        if (elements && (elements < mapping || elements >= mapping + document->mapping_size))
+            dyn_array_destroy(document->elements);
+
+        munmap(document->mapping, document->mapping_size);
+    }
+    else
+    {
+        if (document->content)
+            dyn_array_destroy(document->content);
+
+        if (document->elements)
+            dyn_array_destroy(document->elements);
+    }
+
     free(document->url);
+    free(document);
 }
@@ -19,9 +19,19 @@
 #define _GEMINI_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
 #include <openssl/ssl.h>
 #include "dynamic_array.h"
 
+// While waiting for a request, its progress callback runs at least this often (in milliseconds)
+#define GEMINI_PROGRESS_INTERVAL 100
+
+// Connecting ahead of an input prompt's answer is given up on after this many seconds
+// Whoever answered the prompt waits for it to get there, so it must never take much longer than typing would
+#define GEMINI_PRECONNECT_TIMEOUT 10
+
 typedef enum
 {
     GEMTEXT_PARAGRAPH,
@@ -46,6 +56,13 @@ typedef enum
     GEMINI_TLS_HANDSHAKE_FAILURE,
     GEMINI_NOT_TEXT,
     GEMINI_HEADER_PARSING_FAILURE,
+
+    // The handshake went fine, but the certificate was turned down
+    GEMINI_CERTIFICATE_NOT_TRUSTED,
+    // Doesn't match the certificate that was pinned on the first visit (see known_hosts.h)
+    GEMINI_CERTIFICATE_CHANGED,
+    // A file:// URL that doesn't exist or can't be read
+    GEMINI_LOCAL_FILE_FAILURE,
     // Is this even a word?
     TOTAL_GEMINI_ERRORS
 } gemini_error_e;
@@ -58,6 +75,15 @@ typedef struct
     size_t start, end;
 } gemtext_line_t;
 
+// Monotonic timestamps (in microseconds) of when each phase of a response was reached, zero if it never was
+typedef struct
+{
+    uint64_t started_at, resolved_at, connected_at, handshaked_at, header_received_at, finished_at;
+
+    // Only set for documents, once the body has been parsed
+    uint64_t parsed_at;
+} gemini_timings_t;
+
 typedef struct
 {
     DYN_ARRAY(char) content;
@@ -65,13 +91,236 @@ typedef struct
 
     char *url;
     gemini_error_e error;
+
+    // Set if both arrays live inside a memory mapping (e.g. a restored session) instead of the heap
+    void *mapping;
+    size_t mapping_size;
+
+    // Those of the final response, after every redirection. All zero if the document was never fetched
+    gemini_timings_t timings;
+
+    // The elements are allocated through it, the content through the request's (usually the same one)
+    const dyn_array_allocator_t *allocator;
+
+    // Plain text is parsed differently, which matters if the elements ever have to be built again
+    bool is_plain_text;
+
+    // Set while only the first lines have elements, gemini_document_parse_until picks up where it stopped
+    bool is_partially_parsed, is_inside_preformatted;
+    size_t parsed_length;
 } gemini_document_t;
 
+// What an update has changed, the elements before first_changed and from the unchanged ones onwards are the same
+typedef struct
+{
+    size_t first_changed;
+
+    // Where the untouched elements at the end of the document start, in the old and in the new table
+    size_t old_unchanged, new_unchanged;
+} gemini_document_diff_t;
+
+// Defined in archive.h, the protocol code only needs to know that it exists
+typedef struct archive_t archive_t;
+
 typedef size_t (*gemini_input_callback_t) (char *buffer, char *prompt, size_t max_length);
 
+// The stages that a single request goes through, in order
+typedef enum
+{
+    GEMINI_REQUEST_CONNECTING,
+    GEMINI_REQUEST_HANDSHAKING,
+    GEMINI_REQUEST_SENDING,
+    GEMINI_REQUEST_READING_HEADER,
+    GEMINI_REQUEST_READING_BODY,
+    GEMINI_REQUEST_DONE
+} gemini_request_phase_e;
+
+/*
+ * A single, non-blocking request/response exchange with a gemini server
+ * It doesn't follow redirections nor does it interpret the body, it just collects the raw response
+ * This way both the interactive browser and event-loop based code (e.g. the proxy) can share it
+ */
+typedef struct gemini_request_t
+{
+    SSL *ssl;
+    int connection;
+
+    gemini_request_phase_e phase;
+    gemini_error_e error;
+
+    // A request line can be at most 1024 bytes long
+    char url[1025];
+
+    // The URL's host without the port (nor the brackets of an IPv6 literal), it's also the SSL object's app data
+    // Hostnames are at most 253 characters long, anything longer could never be resolved anyway
+    char host[256];
+
+    // 1029 is the maximum size of the server response header (plus a NULL byte)
+    // The buffer will first hold the outgoing request and then the response header
+    char header[1030];
+    size_t header_length;
+    size_t bytes_sent;
+
+    // Preconnected requests stop right after the handshake, until they're given the URL to send
+    bool is_url_pending;
+
+    // Detached requests are connected by someone else, and TLS goes through memory buffers instead of the socket
+    bool is_detached;
+
+    // Both point inside the header buffer once it has been received
+    char status[3];
+    char *meta;
+
+    // Will only be allocated when the response has a body, using the given allocator (if there is one)
+    DYN_ARRAY(char) content;
+    const dyn_array_allocator_t *allocator;
+
+    // Reading the body pauses once it's this long (zero means never), it's up to the caller to give up then
+    size_t max_content_length;
+
+    // Monotonic timestamps (in microseconds) of when each phase was reached
+    uint64_t started_at, resolved_at, connected_at, handshaked_at, header_received_at, finished_at;
+
+    // Waiting gives up with GEMINI_SERVER_CONNECTION_FAILURE once this monotonic timestamp has passed, zero means never
+    uint64_t deadline;
+
+    // Called while waiting for the request, whenever it has advanced or GEMINI_PROGRESS_INTERVAL has passed
+    void (*progress_callback) (struct gemini_request_t *request);
+} gemini_request_t;
+
+typedef void (*gemini_progress_callback_t) (gemini_request_t *request);
+
+// Resolves the hostname and initiates the connection, without ever blocking on the socket
+void gemini_request_start(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url);
+void gemini_request_start_with_allocator(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                         const dyn_array_allocator_t *allocator);
+
+// Same as above, but the request is only sent once gemini_request_send provides the URL
+// Only the hostname of this URL matters, and the other one has to be on the same host
+void gemini_request_preconnect(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                               const dyn_array_allocator_t *allocator);
+
+// The phases that were reached ahead of time are moved to now, only the rest is what anyone waits for
+void gemini_request_send(gemini_request_t *request, char *gemini_url);
+
+// Looks up the address of the URL's host, returns false if it couldn't be resolved
+bool gemini_resolve_hostname(const char *gemini_url, struct sockaddr_storage *address, socklen_t *address_length);
+
+// Same as gemini_request_start_with_allocator, but the address was already looked up (e.g. it's cached)
+// A NULL address means that the hostname couldn't be resolved, the request then fails right away
+void gemini_request_start_with_address(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                       const dyn_array_allocator_t *allocator,
+                                       const struct sockaddr_storage *address, socklen_t address_length);
+
+/*
+ * Same as above, but the socket is neither connected nor ever touched by the request
+ * Meant for event loops that move the bytes themselves (e.g. through io_uring): they connect the socket to the
+ * address, and the TLS records are read from and written to the memory BIOs of the SSL object instead
+ * The ClientHello is already waiting to be sent, and gemini_request_connected must be called once it's connected
+ */
+void gemini_request_start_detached(gemini_request_t *request, SSL_CTX *ctx, char *gemini_url,
+                                   const dyn_array_allocator_t *allocator, const struct sockaddr_storage *address);
+void gemini_request_connected(gemini_request_t *request);
+
+// Gives up on the request (or completes it, if the error is GEMINI_OK), the connection is left open
+void gemini_request_finish(gemini_request_t *request, gemini_error_e error);
+
+// Advances the request as much as possible until the socket would block
+// Returns true once the request has been completed, either successfully or not
+bool gemini_request_advance(gemini_request_t *request);
+
+// Returns whether the request is waiting to read (POLLIN) or to write (POLLOUT)
+short gemini_request_get_poll_events(gemini_request_t *request);
+
+// Blocks until the request has at least reached the given phase, or until its deadline (if there is one)
+// The progress callback of the request (if there is one) gets to run in the meantime
+void gemini_request_wait(gemini_request_t *request, gemini_request_phase_e phase);
+
+void gemini_request_get_timings(gemini_request_t *request, gemini_timings_t *timings);
+
+// Closes the connection if it's still open, the collected content is left untouched
+void gemini_request_close(gemini_request_t *request);
+void gemini_request_destroy(gemini_request_t *request);
+
 // Initializes and populates a gemini document by accessing the provided server using the Gemini protocol
-gemini_document_t* gemini_fetch_document(SSL_CTX *ctx, char *gemini_url, gemini_input_callback_t input_callback);
+// Every response along the way (redirections included) is recorded into the archive, if there is one
+gemini_document_t* gemini_fetch_document(SSL_CTX *ctx, char *gemini_url, gemini_input_callback_t input_callback,
+                                         archive_t *archive);
+gemini_document_t* gemini_fetch_document_with_allocator(SSL_CTX *ctx, char *gemini_url,
+                                                        gemini_input_callback_t input_callback, archive_t *archive,
+                                                        const dyn_array_allocator_t *allocator);
+
+// Same as above, but the progress callback is called throughout every request (redirections included)
+gemini_document_t* gemini_fetch_document_with_progress(SSL_CTX *ctx, char *gemini_url,
+                                                       gemini_input_callback_t input_callback, archive_t *archive,
+                                                       const dyn_array_allocator_t *allocator,
+                                                       gemini_progress_callback_t progress_callback);
+
+/*
+ * Same as above, but the host of the first request was already looked up (see gemini_resolve_hostname)
+ * A NULL address means that it couldn't be resolved, the document then carries GEMINI_IP_RESOLVE_FAILURE
+ * The lookup still counts as part of the request, it started at the given monotonic timestamp
+ */
+gemini_document_t* gemini_fetch_document_with_address(SSL_CTX *ctx, char *gemini_url,
+                                                      gemini_input_callback_t input_callback, archive_t *archive,
+                                                      const dyn_array_allocator_t *allocator,
+                                                      gemini_progress_callback_t progress_callback,
+                                                      const struct sockaddr_storage *address, socklen_t address_length,
+                                                      uint64_t started_at);
+
+// Creates an empty document, without any content or elements
+gemini_document_t* gemini_document_create(char *gemini_url);
+
+// Turns the response of a request into a parsed document, the content is taken away from the request
+// Redirections and input requests are not followed, that's up to the caller
+gemini_document_t* gemini_document_from_request(gemini_request_t *request);
+
+// Same as above, but the content is left unparsed, e.g. so that it can be compared with an older version first
+gemini_document_t* gemini_document_receive(gemini_request_t *request);
+
 void gemini_document_parse_gemtext(gemini_document_t *document);
+
+// Plain text becomes a series of preformatted elements, one per line
+void gemini_document_parse_text(gemini_document_t *document);
+
+// Picks the right parser out of the two above
+void gemini_document_parse(gemini_document_t *document);
+
+/*
+ * Same as above, but stops at the first line boundary after the deadline (in monotonic microseconds)
+ * The elements that are already there can be used in the meantime, a later call continues from there
+ * Returns true once the whole content has been parsed
+ */
+bool gemini_document_parse_until(gemini_document_t *document, uint64_t deadline);
+
+// Returns the index of the first link after the given element, wrapping around the end of the document
+// If there are no other links, the starting index is returned
+size_t gemini_document_find_next_link(gemini_document_t *document, size_t start);
+
+/*
+ * Replaces the content of a document with a newer, unparsed version of it (which is destroyed either way)
+ * An unchanged page only costs a comparison of both versions, nothing is parsed at all
+ * Otherwise, only the lines between the common prefix and suffix of both versions are parsed again,
+ * while the rest of the elements are copied over. Returns false if nothing has changed
+ */
+bool gemini_document_update(gemini_document_t *document, gemini_document_t *newer, gemini_document_diff_t *diff);
+
+// Where an element of the old table ended up after the update, elements that changed map to the first change
+size_t gemini_document_diff_translate(const gemini_document_diff_t *diff, size_t index);
+
 void gemini_document_destroy(gemini_document_t *document);
 
+/*
+ * The parsers behind the documents, working on caller supplied buffers without allocating anything
+ * They return the total amount of elements, even if only the first max_elements could be written
+ * A buffer of (new lines + 1) elements is always large enough
+ */
+size_t gemtext_parse_lines(const char *content, size_t length, gemtext_line_t *elements, size_t max_elements);
+
+// For gemtext that comes in pieces split at new lines, whether the last piece ended inside a preformatted block
+// is carried over to the next one (it starts out false)
+size_t gemtext_parse_more_lines(const char *content, size_t length, bool *has_entered_preformatted,
+                                gemtext_line_t *elements, size_t max_elements);
+size_t gemtext_parse_plain_lines(const char *content, size_t length, gemtext_line_t *elements, size_t max_elements);
+
 #endif
@@ -0,0 +1,76 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "idle.h"
+#include "common.h"
+#include <string.h>
+
+void idle_scheduler_create(idle_scheduler_t *scheduler)
+{
+    scheduler->tasks = dyn_array_create(4, sizeof(idle_task_t));
+    scheduler->next_task = 0;
+}
+
+void idle_scheduler_add(idle_scheduler_t *scheduler, idle_task_function_t function, void *data)
+{
+    for (size_t i = 0; i < DYN_ARRAY_LENGTH(scheduler->tasks); i++)
+    {
+        if (scheduler->tasks[i].function == function && scheduler->tasks[i].data == data)
+            return;
+    }
+
+    scheduler->tasks = dyn_array_prepare_new_item(scheduler->tasks);
+    DYN_ARRAY_GET_LAST(scheduler->tasks) = (idle_task_t) {function, data};
+}
+
+bool idle_scheduler_has_tasks(idle_scheduler_t *scheduler)
+{
+    return DYN_ARRAY_LENGTH(scheduler->tasks) > 0;
+}
+
+static void remove_task(idle_scheduler_t *scheduler, size_t index)
+{
+    size_t total_tasks = DYN_ARRAY_LENGTH(scheduler->tasks);
+
+    // The order is kept, so that the turns stay fair
+    memmove(&scheduler->tasks[index], &scheduler->tasks[index + 1], (total_tasks - index - 1) * sizeof(idle_task_t));
+    DYN_ARRAY_LENGTH(scheduler->tasks) = total_tasks - 1;
+}
+
+void idle_scheduler_run(idle_scheduler_t *scheduler, uint64_t slice)
+{
+    uint64_t deadline = get_monotonic_time() + slice;
+
+    while (idle_scheduler_has_tasks(scheduler) && get_monotonic_time() < deadline)
+    {
+        if (scheduler->next_task >= DYN_ARRAY_LENGTH(scheduler->tasks))
+            scheduler->next_task = 0;
+
+        // A task might add other tasks, so it's copied out of the array before it runs
+        idle_task_t task = scheduler->tasks[scheduler->next_task];
+
+        if (task.function(task.data, deadline))
+            remove_task(scheduler, scheduler->next_task);
+        else
+            scheduler->next_task++;
+    }
+}
+
+void idle_scheduler_destroy(idle_scheduler_t *scheduler)
+{
+    dyn_array_destroy(scheduler->tasks);
+}
@@ -0,0 +1,57 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IDLE_H
+#define _IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "dynamic_array.h"
+
+// Does as much as it can before the deadline (in monotonic microseconds), then returns true once it has finished
+// Tasks can't be interrupted, so each step between two checks of the deadline should be tiny
+typedef bool (*idle_task_function_t) (void *data, uint64_t deadline);
+
+typedef struct
+{
+    idle_task_function_t function;
+    void *data;
+} idle_task_t;
+
+/*
+ * Deferred work that only runs while the frontend has nothing better to do, i.e. while it's waiting for a key
+ * The pending tasks take turns in short slices, so a key is never kept waiting for longer than a slice
+ */
+typedef struct
+{
+    DYN_ARRAY(idle_task_t) tasks;
+
+    // Whose turn it is, so that a long task doesn't starve the others
+    size_t next_task;
+} idle_scheduler_t;
+
+void idle_scheduler_create(idle_scheduler_t *scheduler);
+
+// Adding a task that's still pending does nothing, it will run just once
+void idle_scheduler_add(idle_scheduler_t *scheduler, idle_task_function_t function, void *data);
+bool idle_scheduler_has_tasks(idle_scheduler_t *scheduler);
+
+// Runs the pending tasks in turn, until either the slice (in microseconds) is over or all of them have finished
+void idle_scheduler_run(idle_scheduler_t *scheduler, uint64_t slice);
+void idle_scheduler_destroy(idle_scheduler_t *scheduler);
+
+#endif
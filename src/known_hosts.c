@@ -0,0 +1,303 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "known_hosts.h"
+#include "common.h"
+#include "config.h"
+#include <openssl/x509.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// "ASKH" when read as little endian
+#define KNOWN_HOSTS_MAGIC 0x484B5341
+#define KNOWN_HOSTS_VERSION 1
+
+// Always a power of two, the table doubles once it's three quarters full
+#define INITIAL_SLOTS 64
+
+typedef struct known_hosts_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t padding;
+
+    uint64_t total_slots;
+    uint64_t total_hosts;
+} known_hosts_header_t;
+
+static size_t get_file_size(size_t total_slots)
+{
+    return sizeof(known_hosts_header_t) + total_slots * sizeof(known_host_t);
+}
+
+// Zero marks an empty slot, so no host may hash to it
+static uint64_t hash_host(const char *host)
+{
+    uint64_t hash = hash_bytes(host, strlen(host));
+    return hash ? hash : 1;
+}
+
+// Maps a file of the given size, creating it (with an empty table) if it doesn't exist yet
+static bool map_store(known_hosts_t *hosts, const char *path, size_t total_slots, bool should_create)
+{
+    int descriptor = open(path, O_RDWR | (should_create ? O_CREAT | O_TRUNC : 0), 0600);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (should_create && ftruncate(descriptor, get_file_size(total_slots)) != 0))
+    {
+        close(descriptor);
+        return false;
+    }
+
+    size_t size = should_create ? get_file_size(total_slots) : status.st_size;
+    void *mapping = size >= sizeof(known_hosts_header_t) ?
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+
+    // The mapping stays valid without the descriptor
+    close(descriptor);
+
+    if (mapping == MAP_FAILED)
+        return false;
+
+    known_hosts_header_t *header = mapping;
+    if (should_create)
+    {
+        *header = (known_hosts_header_t) {
+            .magic = KNOWN_HOSTS_MAGIC,
+            .version = KNOWN_HOSTS_VERSION,
+            .slot_size = sizeof(known_host_t),
+            .total_slots = total_slots
+        };
+    }
+
+    // Anything else is either corrupted or from an incompatible version
+    bool is_valid = header->magic == KNOWN_HOSTS_MAGIC && header->version == KNOWN_HOSTS_VERSION &&
+        header->slot_size == sizeof(known_host_t) && header->total_slots &&
+        !(header->total_slots & (header->total_slots - 1)) && get_file_size(header->total_slots) == size;
+
+    if (!is_valid)
+    {
+        munmap(mapping, size);
+        return false;
+    }
+
+    hosts->mapping = mapping;
+    hosts->mapping_size = size;
+    hosts->header = header;
+    hosts->slots = (known_host_t*) (header + 1);
+
+    return true;
+}
+
+void known_hosts_open(known_hosts_t *hosts, const char *path)
+{
+    snprintf(hosts->path, sizeof(hosts->path), "%s", path);
+    hosts->mapping = NULL;
+    hosts->header = NULL;
+    hosts->slots = NULL;
+    hosts->is_chain_verified = false;
+
+    // A store that can't be read is started over, losing the pins is better than trusting nobody ever again
+    if (!map_store(hosts, path, 0, false))
+        map_store(hosts, path, INITIAL_SLOTS, true);
+}
+
+// Returns the slot of the host, or the empty one where it would go
+static known_host_t* find_slot(known_host_t *slots, uint64_t total_slots, uint64_t hash, const char *host)
+{
+    uint64_t mask = total_slots - 1;
+
+    for (uint64_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        if (!slots[i].hash || (slots[i].hash == hash && !strcmp(slots[i].host, host)))
+            return &slots[i];
+    }
+}
+
+known_host_t* known_hosts_lookup(known_hosts_t *hosts, const char *host)
+{
+    if (!hosts->header)
+        return NULL;
+
+    known_host_t *slot = find_slot(hosts->slots, hosts->header->total_slots, hash_host(host), host);
+    return slot->hash ? slot : NULL;
+}
+
+/*
+ * The larger table is built in a file of its own, which then replaces the old one
+ * This way, a crash in the middle never leaves a half-moved table behind
+ */
+static bool grow_store(known_hosts_t *hosts)
+{
+    char temporary_path[sizeof(hosts->path) + 4];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.new", hosts->path);
+
+    known_hosts_t grown;
+    if (!map_store(&grown, temporary_path, hosts->header->total_slots * 2, true))
+        return false;
+
+    for (uint64_t i = 0; i < hosts->header->total_slots; i++)
+    {
+        known_host_t *host = &hosts->slots[i];
+        if (!host->hash)
+            continue;
+
+        *find_slot(grown.slots, grown.header->total_slots, host->hash, host->host) = *host;
+        grown.header->total_hosts++;
+    }
+
+    if (rename(temporary_path, hosts->path) != 0)
+    {
+        munmap(grown.mapping, grown.mapping_size);
+        unlink(temporary_path);
+        return false;
+    }
+
+    munmap(hosts->mapping, hosts->mapping_size);
+    hosts->mapping = grown.mapping;
+    hosts->mapping_size = grown.mapping_size;
+    hosts->header = grown.header;
+    hosts->slots = grown.slots;
+
+    return true;
+}
+
+void known_hosts_pin(known_hosts_t *hosts, const char *host, const uint8_t *fingerprint, int64_t expires_at)
+{
+    if (!hosts->header || strlen(host) > KNOWN_HOST_MAX_LENGTH)
+        return;
+
+    uint64_t hash = hash_host(host);
+    known_host_t *slot = find_slot(hosts->slots, hosts->header->total_slots, hash, host);
+
+    if (!slot->hash)
+    {
+        // There always has to be an empty slot left, otherwise looking up a stranger would never end
+        if ((hosts->header->total_hosts + 1) * 4 > hosts->header->total_slots * 3)
+        {
+            if (!grow_store(hosts) && hosts->header->total_hosts + 1 == hosts->header->total_slots)
+                return;
+
+            slot = find_slot(hosts->slots, hosts->header->total_slots, hash, host);
+        }
+
+        hosts->header->total_hosts++;
+        slot->hash = hash;
+        snprintf(slot->host, sizeof(slot->host), "%s", host);
+    }
+
+    memcpy(slot->fingerprint, fingerprint, KNOWN_HOST_FINGERPRINT_SIZE);
+    slot->expires_at = expires_at;
+}
+
+bool known_hosts_forget(known_hosts_t *hosts, const char *host)
+{
+    known_host_t *slot = known_hosts_lookup(hosts, host);
+    if (!slot)
+        return false;
+
+    // Linear probing can't just leave a hole behind, the hosts that were pushed past it are moved back instead
+    uint64_t mask = hosts->header->total_slots - 1;
+    uint64_t hole = slot - hosts->slots;
+
+    for (uint64_t i = (hole + 1) & mask; hosts->slots[i].hash; i = (i + 1) & mask)
+    {
+        uint64_t home = hosts->slots[i].hash & mask;
+
+        // Whether the host's home lies outside of (hole, i], in which case it may move into the hole
+        bool can_move = hole <= i ? (home <= hole || home > i) : (home <= hole && home > i);
+        if (can_move)
+        {
+            hosts->slots[hole] = hosts->slots[i];
+            hole = i;
+        }
+    }
+
+    memset(&hosts->slots[hole], 0, sizeof(known_host_t));
+    hosts->header->total_hosts--;
+
+    return true;
+}
+
+// A pin that expires right away would never be enforced, which is common with self-signed certificates
+static int64_t get_expiry(X509 *certificate)
+{
+    int64_t now = time(NULL);
+    struct tm expiry;
+
+    if (!ASN1_TIME_to_tm(X509_get0_notAfter(certificate), &expiry) || timegm(&expiry) <= now)
+        return now + KNOWN_HOSTS_FALLBACK_TTL;
+
+    return timegm(&expiry);
+}
+
+// Takes the place of OpenSSL's whole chain verification, see known_hosts_verify_context
+static int verify_certificate(X509_STORE_CTX *store, void *data)
+{
+    known_hosts_t *hosts = data;
+    SSL *ssl = X509_STORE_CTX_get_ex_data(store, SSL_get_ex_data_X509_STORE_CTX_idx());
+    const char *host = SSL_get_app_data(ssl);
+    X509 *certificate = X509_STORE_CTX_get0_cert(store);
+
+    uint8_t fingerprint[EVP_MAX_MD_SIZE];
+    unsigned int fingerprint_length;
+
+    if (!host || !certificate || !X509_digest(certificate, EVP_sha256(), fingerprint, &fingerprint_length))
+    {
+        X509_STORE_CTX_set_error(store, X509_V_ERR_UNSPECIFIED);
+        return 0;
+    }
+
+    known_host_t *pin = known_hosts_lookup(hosts, host);
+    if (pin && !memcmp(pin->fingerprint, fingerprint, KNOWN_HOST_FINGERPRINT_SIZE))
+        return 1;
+
+    // A different certificate is fine once the pinned one has expired, it has most likely been renewed
+    if (pin && pin->expires_at > time(NULL))
+    {
+        X509_STORE_CTX_set_error(store, X509_V_ERR_CERT_REJECTED);
+        return 0;
+    }
+
+    if (hosts->is_chain_verified && X509_verify_cert(store) <= 0)
+        return 0;
+
+    known_hosts_pin(hosts, host, fingerprint, get_expiry(certificate));
+    return 1;
+}
+
+void known_hosts_verify_context(known_hosts_t *hosts, SSL_CTX *ctx, bool has_trust_store)
+{
+    hosts->is_chain_verified = has_trust_store;
+
+    SSL_CTX_set_cert_verify_callback(ctx, verify_certificate, hosts);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+}
+
+void known_hosts_close(known_hosts_t *hosts)
+{
+    if (hosts->mapping)
+        munmap(hosts->mapping, hosts->mapping_size);
+}
@@ -0,0 +1,83 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KNOWN_HOSTS_H
+#define _KNOWN_HOSTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <openssl/ssl.h>
+
+#define KNOWN_HOST_FINGERPRINT_SIZE 32
+#define KNOWN_HOST_MAX_LENGTH 255
+
+// A single slot of the table, exactly as it's laid out in the file
+typedef struct
+{
+    // Zero if the slot is empty
+    uint64_t hash;
+
+    // The certificate's notAfter as a UNIX timestamp, a different certificate is only accepted after it
+    int64_t expires_at;
+    uint8_t fingerprint[KNOWN_HOST_FINGERPRINT_SIZE];
+    char host[KNOWN_HOST_MAX_LENGTH + 1];
+} known_host_t;
+
+/*
+ * Trust on first use: the SHA-256 fingerprint of the first certificate that a host presents is pinned,
+ * and every later handshake has to present the same one until it expires
+ * The pins live in an open addressing hash table that's mapped straight from the file, so looking a host up
+ * never reads or parses the whole store. Pinning writes into the mapping and the kernel takes care of the rest
+ */
+typedef struct
+{
+    char path[512];
+
+    void *mapping;
+    size_t mapping_size;
+
+    // Both point inside the mapping, NULL if the store couldn't be opened (every host is a stranger then)
+    struct known_hosts_header_t *header;
+    known_host_t *slots;
+
+    // Whether strangers have to pass the usual verification against a trust store before they're pinned
+    bool is_chain_verified;
+} known_hosts_t;
+
+void known_hosts_open(known_hosts_t *hosts, const char *path);
+
+// Returns NULL if the host was never pinned
+known_host_t* known_hosts_lookup(known_hosts_t *hosts, const char *host);
+
+// Replaces the previous pin of the host, if there was one
+void known_hosts_pin(known_hosts_t *hosts, const char *host, const uint8_t *fingerprint, int64_t expires_at);
+
+// Returns false if the host was never pinned
+bool known_hosts_forget(known_hosts_t *hosts, const char *host);
+
+/*
+ * Makes every handshake of the context go through the store instead of building the certificate chain
+ * Pinned hosts only need their fingerprint to match. Other hosts are pinned on the spot, once they've passed
+ * the usual verification if the context has a trust store, or straight away if it doesn't
+ * The certificates are pinned to the host that the SSL object's app data points to (see gemini_request_t.host)
+ */
+void known_hosts_verify_context(known_hosts_t *hosts, SSL_CTX *ctx, bool has_trust_store);
+
+void known_hosts_close(known_hosts_t *hosts);
+
+#endif
@@ -0,0 +1,77 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "latency.h"
+#include "common.h"
+#include "config.h"
+#include <stdio.h>
+
+static const char *kind_names[TOTAL_INPUT_KINDS] = {
+    [INPUT_SCROLL] = "scroll",
+    [INPUT_NAVIGATION] = "navigation"
+};
+
+void input_latency_key_received(input_latency_t *latency, input_kind_e kind)
+{
+    latency->pending_kind = kind;
+    latency->key_received_at = kind == INPUT_UNTRACKED ? 0 : get_monotonic_time();
+    latency->painted_at = 0;
+}
+
+void input_latency_frame_painted(input_latency_t *latency)
+{
+    if (latency->key_received_at)
+        latency->painted_at = get_monotonic_time();
+}
+
+uint64_t input_latency_finish_key(input_latency_t *latency)
+{
+    uint64_t sample = 0;
+
+    if (latency->key_received_at && latency->painted_at)
+    {
+        sample = latency->painted_at - latency->key_received_at;
+        stats_rolling_histogram_add(&latency->kinds[latency->pending_kind], sample);
+    }
+
+    latency->key_received_at = latency->painted_at = 0;
+    return sample;
+}
+
+void input_latency_format(input_latency_t *latency, char *buffer, size_t size)
+{
+    size_t length = 0;
+
+    for (int i = 0; i < TOTAL_INPUT_KINDS && length < size; i++)
+    {
+        stats_histogram_t *histogram = &latency->kinds[i].histogram;
+
+        if (!histogram->total_samples)
+        {
+            length += snprintf(buffer + length, size - length, "%s -, ", kind_names[i]);
+            continue;
+        }
+
+        length += snprintf(buffer + length, size - length, "%s %.1f/%.1f/%.1f, ", kind_names[i],
+                           stats_histogram_get_percentile(histogram, 50) / 1000.0,
+                           stats_histogram_get_percentile(histogram, 90) / 1000.0,
+                           stats_histogram_get_percentile(histogram, 99) / 1000.0);
+    }
+
+    if (length < size)
+        snprintf(buffer + length, size - length, "p50/p90/p99 ms, goal p99 < %.1f ms", INPUT_LATENCY_GOAL / 1000.0);
+}
@@ -0,0 +1,63 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "stats.h"
+
+typedef enum
+{
+    INPUT_SCROLL,
+    // Following links, going back, visiting pages, anything that might go over the network
+    INPUT_NAVIGATION,
+    TOTAL_INPUT_KINDS,
+
+    // Keys that aren't measured at all
+    INPUT_UNTRACKED = TOTAL_INPUT_KINDS
+} input_kind_e;
+
+/*
+ * Measures input-to-paint latency: from the moment a key comes out of getch
+ * until the terminal write of the last frame that it caused has completed
+ * Keys that don't paint anything are not counted
+ */
+typedef struct
+{
+    stats_rolling_histogram_t kinds[TOTAL_INPUT_KINDS];
+
+    // Both are zero if no key is being handled, or if nothing has been painted yet
+    uint64_t key_received_at, painted_at;
+    input_kind_e pending_kind;
+} input_latency_t;
+
+// Should be called as soon as getch returns the key
+void input_latency_key_received(input_latency_t *latency, input_kind_e kind);
+
+// Should be called right after every wrefresh
+void input_latency_frame_painted(input_latency_t *latency);
+
+// Records the latency of the pending key, if it painted anything. Returns the latency or zero
+uint64_t input_latency_finish_key(input_latency_t *latency);
+
+// A one line summary of the percentiles of every kind, e.g. for the status bar
+void input_latency_format(input_latency_t *latency, char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,333 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "local.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include "config.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Binary files have NULL bytes early on, text files don't
+#define BINARY_SNIFF_LENGTH 4096
+
+// The most recent mappings that are covered by the guard, older ones just have to fend for themselves
+#define MAX_GUARDED_FILES 64
+
+typedef struct
+{
+    char *start, *end;
+} guarded_range_t;
+
+static guarded_range_t guarded_ranges[MAX_GUARDED_FILES];
+static size_t next_guarded_range;
+static size_t guarded_page_size;
+
+bool local_is_file_url(const char *url)
+{
+    return !strncmp(url, "file://", 7);
+}
+
+// Spaces and such have to be escaped inside links, otherwise the link would end right there
+static void decode_path(const char *url, char *path, size_t size)
+{
+    size_t length = 0;
+
+    for (const char *c = url + 7; *c && length < size - 1; c++)
+    {
+        if (c[0] == '%' && isxdigit(c[1]) && isxdigit(c[2]))
+        {
+            char hex[3] = {c[1], c[2], 0};
+            path[length++] = strtol(hex, NULL, 16);
+            c += 2;
+        }
+        else
+        {
+            path[length++] = *c;
+        }
+    }
+
+    path[length] = 0;
+}
+
+static char* append_escaped_name(char *text, const char *name)
+{
+    for (const char *c = name; *c; c++)
+    {
+        if (isspace(*c) || *c == '%')
+            text = append_format(text, "%%%02X", (unsigned char) *c);
+        else
+            text = append_format(text, "%c", *c);
+    }
+
+    return text;
+}
+
+static int compare_names(const void *first, const void *second)
+{
+    return strcmp(*(char**) first, *(char**) second);
+}
+
+static gemini_document_t* open_directory(gemini_document_t *document, const char *path)
+{
+    DIR *directory = opendir(path);
+    if (!directory)
+    {
+        document->error = GEMINI_LOCAL_FILE_FAILURE;
+        return document;
+    }
+
+    // Relative links only work if the directory itself ends with a slash
+    size_t url_length = strlen(document->url);
+    if (document->url[url_length - 1] != '/')
+    {
+        char *url = join_strings_together(document->url, url_length, "/", 1);
+        free(document->url);
+        document->url = url;
+    }
+
+    DYN_ARRAY(char*) names = dyn_array_create(64, sizeof(char*));
+    struct dirent *entry;
+
+    while ((entry = readdir(directory)))
+    {
+        if (!strcmp(entry->d_name, "."))
+            continue;
+
+        // Directories are told apart by their trailing slash
+        struct stat status;
+        bool is_directory = fstatat(dirfd(directory), entry->d_name, &status, 0) == 0 && S_ISDIR(status.st_mode);
+
+        names = dyn_array_prepare_new_item(names);
+        DYN_ARRAY_GET_LAST(names) = join_strings_together(entry->d_name, strlen(entry->d_name),
+                                                          is_directory ? "/" : "", is_directory);
+    }
+
+    closedir(directory);
+    qsort(names, DYN_ARRAY_LENGTH(names), sizeof(char*), compare_names);
+
+    DYN_ARRAY(char) content = dyn_array_create(4096, sizeof(char));
+    content[0] = 0;
+    // Links to the parent directory pile up, but the heading can at least show where that ends up
+    char heading[PATH_MAX];
+    content = append_format(content, "# %s\n", realpath(path, heading) ? heading : path);
+
+    for (size_t i = 0; i < DYN_ARRAY_LENGTH(names); i++)
+    {
+        content = append_format(content, "=> ");
+        content = append_escaped_name(content, names[i]);
+        content = append_format(content, " %s\n", names[i]);
+
+        free(names[i]);
+    }
+
+    dyn_array_destroy(names);
+    document->content = content;
+    return document;
+}
+
+/*
+ * Touching a page of a mapped file past its end raises SIGBUS, which happens as soon as the file shrinks
+ * Instead, everything from the faulting page to the end of the mapping is replaced with zeros and the access is
+ * retried. The document just looks cut short until it's reloaded, which maps the file again
+ * A range might outlive its document, but the guard only ever does what it does to pages that are already gone
+ */
+static void on_bus_error(int signal, siginfo_t *info, void *context)
+{
+    char *address = info->si_addr;
+
+    for (size_t i = 0; info->si_code == BUS_ADRERR && i < MAX_GUARDED_FILES; i++)
+    {
+        guarded_range_t *range = &guarded_ranges[i];
+        if (address < range->start || address >= range->end)
+            continue;
+
+        char *page = (char*) ((uintptr_t) address & ~(uintptr_t) (guarded_page_size - 1));
+        if (mmap(page, range->end - page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                 -1, 0) != MAP_FAILED)
+            return;
+    }
+
+    // Not one of ours, so the access fails again and takes the default action this time
+    struct sigaction action = {.sa_handler = SIG_DFL};
+    sigaction(SIGBUS, &action, NULL);
+}
+
+static void guard_range(char *start, size_t size)
+{
+    if (!guarded_page_size)
+    {
+        struct sigaction action = {.sa_sigaction = on_bus_error, .sa_flags = SA_SIGINFO};
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, NULL);
+    }
+
+    guarded_page_size = sysconf(_SC_PAGESIZE);
+    guarded_ranges[next_guarded_range] = (guarded_range_t) {start, start + size};
+    next_guarded_range = (next_guarded_range + 1) % MAX_GUARDED_FILES;
+}
+
+// Small files are simply copied, nothing can pull them away from under the parser afterwards
+static size_t read_file(char *destination, int descriptor, size_t file_size)
+{
+    size_t total_read = 0;
+
+    while (total_read < file_size)
+    {
+        ssize_t bytes_read = read(descriptor, destination + total_read, file_size - total_read);
+        if (bytes_read <= 0)
+            break;
+
+        total_read += bytes_read;
+    }
+
+    return total_read;
+}
+
+/*
+ * The content has to look like a dynamic array, so its header goes at the end of a page right before the file
+ * Another page after the file makes sure that it's followed by a NULL byte, even if it fills its last page
+ * The kernel zeroes whatever is left of the file's last page anyway
+ */
+static bool map_file(gemini_document_t *document, int descriptor, size_t file_size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t file_pages = (file_size + page_size - 1) / page_size * page_size;
+    size_t mapping_size = page_size + file_pages + page_size;
+
+    char *mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    // The file might have shrunk in the meantime, in which case only what's left of it is used
+    if (file_size <= LOCAL_COPY_SIZE)
+    {
+        file_size = read_file(mapping + page_size, descriptor, file_size);
+    }
+    // Private, so that nothing could ever end up in the file by accident
+    else if (mmap(mapping + page_size, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                  descriptor, 0) == MAP_FAILED)
+    {
+        munmap(mapping, mapping_size);
+        return false;
+    }
+    else
+    {
+        guard_range(mapping + page_size, file_pages);
+    }
+
+    document->mapping = mapping;
+    document->mapping_size = mapping_size;
+    document->content = mapping + page_size;
+
+    size_t *header = (size_t*) document->content - DYN_ARRAY_HEADER_SIZE;
+    header[DYN_ARRAY_LENGTH] = file_size;
+    header[DYN_ARRAY_CAPACITY] = file_size + 1;
+    header[DYN_ARRAY_ITEM_SIZE] = sizeof(char);
+    header[DYN_ARRAY_ALLOCATOR] = 0;
+
+    return true;
+}
+
+static bool has_extension(const char *path, const char *extension)
+{
+    size_t path_length = strlen(path), extension_length = strlen(extension);
+    return path_length > extension_length && !strcmp(path + path_length - extension_length, extension);
+}
+
+// Only regular files, opening a FIFO would block until someone writes to it and devices have no size to speak of
+// The path might have been replaced since it was checked, so it's opened without blocking and checked once more
+static gemini_document_t* open_file(gemini_document_t *document, const char *path)
+{
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    struct stat status;
+
+    if (descriptor < 0 || fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode) ||
+        !map_file(document, descriptor, status.st_size))
+    {
+        if (descriptor >= 0)
+            close(descriptor);
+
+        document->error = GEMINI_LOCAL_FILE_FAILURE;
+        return document;
+    }
+
+    // The mapping keeps the file around on its own
+    close(descriptor);
+
+    size_t length = DYN_ARRAY_LENGTH(document->content);
+    document->is_plain_text = !has_extension(path, ".gmi") && !has_extension(path, ".gemini");
+
+    if (document->is_plain_text && memchr(document->content, 0, MIN(length, BINARY_SNIFF_LENGTH)))
+    {
+        munmap(document->mapping, document->mapping_size);
+        document->mapping = NULL;
+        document->content = NULL;
+        document->error = GEMINI_NOT_TEXT;
+
+        return document;
+    }
+
+    // Whoever goes through it next (the parser or a comparison) does so from start to end
+    madvise(document->content, length, MADV_SEQUENTIAL);
+    return document;
+}
+
+gemini_document_t* local_document_map(const char *url, const dyn_array_allocator_t *allocator)
+{
+    gemini_document_t *document = gemini_document_create((char*) url);
+    document->allocator = allocator;
+
+    char path[4096];
+    decode_path(url, path, sizeof(path));
+
+    struct stat status;
+    if (stat(path, &status) != 0 || (!S_ISDIR(status.st_mode) && !S_ISREG(status.st_mode)))
+    {
+        document->error = GEMINI_LOCAL_FILE_FAILURE;
+        return document;
+    }
+
+    return S_ISDIR(status.st_mode) ? open_directory(document, path) : open_file(document, path);
+}
+
+gemini_document_t* local_document_open(const char *url, const dyn_array_allocator_t *allocator)
+{
+    gemini_document_t *document = local_document_map(url, allocator);
+
+    // Only the first screens are needed right away, the idle work of the browser parses the rest
+    if (document->content && document->error == GEMINI_OK &&
+        gemini_document_parse_until(document, get_monotonic_time() + LOCAL_PARSE_BUDGET))
+    {
+        document->timings.parsed_at = get_monotonic_time();
+
+        if (document->mapping)
+            madvise(document->content, DYN_ARRAY_LENGTH(document->content), MADV_NORMAL);
+    }
+
+    return document;
+}
@@ -0,0 +1,39 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOCAL_H
+#define _LOCAL_H
+
+#include <stdbool.h>
+#include "gemini.h"
+
+// Whether the URL points to the local file system (file://)
+bool local_is_file_url(const char *url);
+
+/*
+ * Opens a file:// URL without going through the network
+ * Large files are mapped and used as the content directly, nothing is read until the parser gets to it
+ * Only the first lines are parsed right away, the rest is left to gemini_document_parse_until
+ * Anything that ends in .gmi or .gemini is gemtext, everything else is plain text unless it looks binary
+ * Directories become a generated page with a link to each entry, their URL always ends with a slash
+ */
+gemini_document_t* local_document_open(const char *url, const dyn_array_allocator_t *allocator);
+
+// Same as above, but the content is left unparsed (see gemini_document_update)
+gemini_document_t* local_document_map(const char *url, const dyn_array_allocator_t *allocator);
+
+#endif
@@ -17,20 +17,31 @@
 
 #include <stdio.h>
 #include <ncurses.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
 #include "common.h"
 #include "gemini.h"
 #include "browser.h"
+#include "viewer.h"
+#include "proxy.h"
+#include "remote.h"
+#include "convert.h"
+#include "batch.h"
+#include "replay.h"
+#include "archive.h"
+#include "trace.h"
+#include "memory.h"
+#include "latency.h"
+#include "idle.h"
+#include "local.h"
 #include "config.h"
 #include "dynamic_array.h"
 
-enum
-{
-    COLOR_LINK = 1,
-    COLOR_LIST_ITEM
-};
-
 struct
 {
     // This structure will manage all TLS connections and parse the data
@@ -43,6 +54,33 @@ struct
     
     WINDOW *document_viewer;
     int total_elements_on_view;
+
+    // Other instances forward their URLs through this socket
+    int remote_listener;
+
+    // Fires every MEMORY_LOG_INTERVAL seconds, if the memory log is enabled
+    int memory_log_timer;
+
+    // Fires every WATCH_INTERVAL seconds while a page is being watched, empty URL if none is
+    int watch_timer;
+    char watched_url[1025];
+
+    // Set while the user waits for a reload that's happening in the background
+    bool is_reloading;
+
+    input_latency_t input_latency;
+
+    // Work that can wait until the user stops pressing keys
+    idle_scheduler_t idle;
+
+    // The request that's being loaded right now, as it was last shown in the status bar
+    struct
+    {
+        uint64_t started_at, drawn_at;
+        gemini_request_phase_e phase;
+        size_t received_bytes;
+        double bytes_per_second;
+    } progress;
 } globals;
 
 #define CURRENT_BROWSER_PAGE ((gemini_page_t*) globals.browser.pages.head->data)
@@ -50,7 +88,7 @@ struct
 static void set_status(const char *format, ...)
 {
     // Clear the previous value
-    wclear(globals.status_bar);
+    werase(globals.status_bar);
     
     va_list args;
     va_start(args, format);
@@ -58,126 +96,207 @@ static void set_status(const char *format, ...)
     wmove(globals.status_bar, 0, 0);
     vw_printw(globals.status_bar, format, args);
     wrefresh(globals.status_bar);
+    input_latency_frame_painted(&globals.input_latency);
 
     va_end(args);
 }
 
-static int get_element_type_attributes(gemtext_line_e type)
+// ncurses keeps a cell per character for every window, plus a few pointers for every line
+static size_t estimate_window_size(WINDOW *window)
 {
-    switch (type)
-    {
-    case GEMTEXT_HEADING_ONE:
-    case GEMTEXT_HEADING_TWO:
-    case GEMTEXT_HEADING_THREE:
-        return A_BOLD;
-        
-    case GEMTEXT_LINK: return A_ITALIC | COLOR_PAIR(COLOR_LINK);
-    case GEMTEXT_LIST_ITEM: return COLOR_PAIR(COLOR_LIST_ITEM);
-    case GEMTEXT_BLOCKQUOTE: return A_DIM;
+    return getmaxy(window) * (getmaxx(window) * sizeof(chtype) + 3 * sizeof(void*));
+}
 
-    default:
-        // Everything else will just show up as normal text
-        return A_NORMAL;
-    }
+// The virtual screens take as much space as a window that covers the whole terminal
+static void update_ncurses_estimate(void)
+{
+    memory_set_estimate(MEMORY_NCURSES, 3 * estimate_window_size(stdscr) +
+                        estimate_window_size(globals.document_viewer) + estimate_window_size(globals.status_bar));
 }
 
-// Returns the new y_offset of the window after the given xtext buffer has been appended
-static int print_text_with_word_breaks(size_t y_offset, char *buffer, size_t length)
+static void refresh_document_viewer(void)
 {
-    size_t buffer_index = 0;
-    size_t x_offset = 0;
-    size_t width = getmaxx(globals.document_viewer);
-    
-    for (;;)
+    TRACE_SCOPE("refresh_document_viewer");
+
+    // Erasing instead of clearing lets ncurses only send the lines that actually changed
+    werase(globals.document_viewer);
+
+    gemini_page_t *page = CURRENT_BROWSER_PAGE;
+    globals.total_elements_on_view = viewer_render_document(globals.document_viewer, page->document, page->scroll_offset);
+
+    wrefresh(globals.document_viewer);
+    input_latency_frame_painted(&globals.input_latency);
+}
+
+/*
+ * Shows what the request that's being loaded is up to, so that a slow server can be told apart from a dead one
+ * It's called whenever the request advances, but the status bar is only redrawn on a new phase
+ * or after PROGRESS_REFRESH_INTERVAL, drawing should never slow the transfer down
+ */
+static void on_request_progress(gemini_request_t *request)
+{
+    // Nothing can be drawn before the windows have been created
+    if (!globals.status_bar)
+        return;
+
+    uint64_t now = get_monotonic_time();
+    size_t received_bytes = request->content ? DYN_ARRAY_LENGTH(request->content) : 0;
+
+    // Redirections and input prompts start a new request, which starts from scratch
+    if (request->started_at != globals.progress.started_at)
     {
-        // Get the boundary of the next word
-        size_t word_end = buffer_index;
-        while (word_end < length && !isspace(buffer[word_end])) word_end++;
+        globals.progress.started_at = request->started_at;
+        globals.progress.phase = request->phase;
+        globals.progress.drawn_at = 0;
+        globals.progress.received_bytes = received_bytes;
+        globals.progress.bytes_per_second = 0;
+    }
 
-        // Check if the word fits on the current line
-        if (x_offset + (word_end - buffer_index + 1) > width)
-        {
-            x_offset = 0;
-            y_offset++;
-        }
-        
-        mvwprintw(globals.document_viewer, y_offset, x_offset, "%.*s",
-                  word_end - buffer_index + 1, buffer + buffer_index);
+    bool has_changed_phase = request->phase != globals.progress.phase;
+    if (!has_changed_phase && now - globals.progress.drawn_at < PROGRESS_REFRESH_INTERVAL)
+        return;
 
-        x_offset += word_end - buffer_index + 1;
+    // The rate is a moving average, where the last second or so weighs the most
+    if (request->phase == GEMINI_REQUEST_READING_BODY && !has_changed_phase && globals.progress.drawn_at)
+    {
+        double elapsed = now - globals.progress.drawn_at;
+        double rate = (received_bytes - globals.progress.received_bytes) * 1000000.0 / elapsed;
+        double weight = MIN(1.0, elapsed / 1000000.0);
 
-        // Check if the printing is done
-        buffer_index = word_end + 1;
-        if (buffer_index > length - 1)
-            break;
+        globals.progress.bytes_per_second += weight * (rate - globals.progress.bytes_per_second);
     }
 
-    return y_offset;
+    globals.progress.phase = request->phase;
+    globals.progress.drawn_at = now;
+    globals.progress.received_bytes = received_bytes;
+
+    double seconds = (now - request->started_at) / 1000000.0;
+    char received[32], rate[32];
+    format_bytes(received, sizeof(received), received_bytes);
+    format_bytes(rate, sizeof(rate), globals.progress.bytes_per_second);
+
+    switch (request->phase)
+    {
+    case GEMINI_REQUEST_CONNECTING:
+        set_status("{loading} connecting to %s (%.1fs)", request->url, seconds);
+        break;
+
+    case GEMINI_REQUEST_HANDSHAKING:
+        set_status("{loading} handshaking with %s (%.1fs)", request->url, seconds);
+        break;
+
+    case GEMINI_REQUEST_SENDING:
+    case GEMINI_REQUEST_READING_HEADER:
+        set_status("{loading} waiting for %s (%.1fs)", request->url, seconds);
+        break;
+
+    case GEMINI_REQUEST_READING_BODY:
+        set_status("{loading} %s received at %s/s (%.1fs) %s", received, rate, seconds, request->url);
+        break;
+
+    case GEMINI_REQUEST_DONE:
+        set_status("{loading} %s received in %.1fs, rendering %s", received, seconds, request->url);
+        break;
+    }
 }
 
-static void refresh_document_viewer(void)
+// Statistics are written out whenever they change, a crash shouldn't lose a whole session of them
+// Writing the file can't be split up, so it waits for a slice that has at least as much time left as the last one took
+// A save that takes longer than half a slice only waits for one that has just started
+static bool save_statistics(void *data, uint64_t deadline)
 {
-    wclear(globals.document_viewer);
-    globals.total_elements_on_view = 0;
-    
-    // Get whatever ends first, either the screen's limit or the remaining elements
-    gemini_page_t *page = CURRENT_BROWSER_PAGE;
-    gemini_document_t *document = page->document;
-    size_t y_offset = 0;
-    
-    for (size_t i = page->scroll_offset; i < DYN_ARRAY_LENGTH(document->elements); i++)
-    {
-        // Check if we've reached the bottom of the screen
-        if (y_offset >= getmaxy(globals.document_viewer) - 1)
-            break;
+    static uint64_t last_duration = 0;
+    uint64_t now = get_monotonic_time();
 
-        gemtext_line_t *line = &document->elements[i];
-        // Wrap each element on an attribute based on its type
-        int attrs = get_element_type_attributes(line->type);
-        
-        wattron(globals.document_viewer, attrs);
-        // Add one to the offset because each gemini element represents a separate line
-        y_offset = print_text_with_word_breaks(y_offset, document->content + line->start, line->end - line->start + 1) + 1;
-        wattroff(globals.document_viewer, attrs);
+    if (now + MIN(last_duration, IDLE_SLICE / 2) > deadline)
+        return false;
 
-        // Some elements require some extra spacing to improve readability
-        switch (line->type)
-        {
-        case GEMTEXT_PARAGRAPH:
-        case GEMTEXT_HEADING_ONE:
-        case GEMTEXT_HEADING_TWO:
-        case GEMTEXT_HEADING_THREE:
-        case GEMTEXT_BLOCKQUOTE:
-            y_offset++;
-            break;
-
-        case GEMTEXT_LINK:
-        case GEMTEXT_LIST_ITEM:
-        case GEMTEXT_PREFORMATTED:
-            // If this is the element of a chain, add some spacing at the bottom
-            if (i != DYN_ARRAY_LENGTH(document->elements) - 1 &&
-                document->elements[i + 1].type != line->type)
-            {
-                y_offset++;
-            }
-            
-            break;
-        }
+    gemini_stats_save(&globals.browser.stats, STATS_PATH);
+    last_duration = get_monotonic_time() - now;
 
-        globals.total_elements_on_view++;
+    return true;
+}
+
+// Going back to a page should never have to wait for the parser, if there's memory to spare
+static bool rebuild_history(void *data, uint64_t deadline)
+{
+    return gemini_browser_rebuild_history(&globals.browser, deadline);
+}
+
+// Only once the first page is on the screen, and only when there's nothing else to do
+static bool start_warmup(void *data, uint64_t deadline)
+{
+    gemini_browser_start_warmup(&globals.browser);
+    return true;
+}
+
+// Whenever the history changes, so might the statistics and the pages that need parsing
+static void schedule_idle_work(void)
+{
+    idle_scheduler_add(&globals.idle, save_statistics, NULL);
+    idle_scheduler_add(&globals.idle, rebuild_history, NULL);
+}
+
+/*
+ * Shows that the current page has been updated, the offset is the one from before the update
+ * The viewer is only repainted if the changes reach the screen, elements that were only shifted look the same
+ */
+static void show_page_update(size_t old_offset)
+{
+    gemini_document_diff_t *diff = &globals.browser.last_update;
+    bool is_on_screen = diff->first_changed <= old_offset + globals.total_elements_on_view &&
+                        diff->old_unchanged > old_offset;
+
+    set_status("{browsing} %s (updated)", CURRENT_BROWSER_PAGE->document->url);
+    if (is_on_screen)
+        refresh_document_viewer();
+
+    schedule_idle_work();
+}
+
+static void reload_current_page(void)
+{
+    size_t old_offset = CURRENT_BROWSER_PAGE->scroll_offset;
+
+    if (gemini_browser_reload(&globals.browser))
+        show_page_update(old_offset);
+    else if ((globals.is_reloading = globals.browser.is_revalidating))
+        set_status("{reload} checking %s", CURRENT_BROWSER_PAGE->document->url);
+    else
+        set_status("{browsing} %s (unchanged)", CURRENT_BROWSER_PAGE->document->url);
+}
+
+// Only the watched page is reloaded, the timer keeps going while another one is shown
+static void toggle_watch(void)
+{
+    char *url = CURRENT_BROWSER_PAGE->document->url;
+    struct itimerspec interval = {0};
+
+    if (!strcmp(globals.watched_url, url))
+    {
+        globals.watched_url[0] = 0;
+        set_status("{watch} stopped watching %s", url);
+    }
+    else
+    {
+        snprintf(globals.watched_url, sizeof(globals.watched_url), "%s", url);
+        interval.it_value.tv_sec = interval.it_interval.tv_sec = WATCH_INTERVAL;
+        set_status("{watch} reloading %s every %d seconds", url, WATCH_INTERVAL);
     }
 
-    wrefresh(globals.document_viewer);
+    timerfd_settime(globals.watch_timer, 0, &interval, NULL);
 }
 
 // Updates the status bar and navigates to the specified gemini url
 static void navigate_to_url(char *gemini_url)
 {
+    globals.is_reloading = false;
     set_status("{loading}: connecting to %s", gemini_url);
     gemini_browser_load_document(&globals.browser, gemini_url);
 
     set_status("{browsing} %s", CURRENT_BROWSER_PAGE->document->url);
     refresh_document_viewer();
+    schedule_idle_work();
 }
 
 static void follow_link_under_cursor(void)
@@ -188,8 +307,8 @@ static void follow_link_under_cursor(void)
     if (link.scheme == LINK_SCHEME_INVALID)
         return;
 
-    // If it's a gemini site, just follow the link
-    if (link.scheme == LINK_SCHEME_GEMINI)
+    // If it's a gemini site, an internal page or a local file, just follow the link
+    if (link.scheme == LINK_SCHEME_GEMINI || link.scheme == LINK_SCHEME_ABOUT || link.scheme == LINK_SCHEME_FILE)
     {
         navigate_to_url(link.content);
     }
@@ -240,6 +359,7 @@ static void handle_window_resize(void)
     // Refresh needs to be called here, even though the screen will be modified again
     // Otherwise, the window disappears when scaling it down
     refresh();
+    update_ncurses_estimate();
 
     set_status("{browsing} %s", CURRENT_BROWSER_PAGE->document->url);
     refresh_document_viewer();
@@ -257,6 +377,129 @@ static void scroll_to(int new_offset)
     refresh_document_viewer();
 }
 
+static void navigate_to_url(char *gemini_url);
+
+// Internal pages such as about:stats and local files are fine too
+static bool is_valid_url(const char *url)
+{
+    bool has_known_scheme = !strncmp(url, "gemini://", 9) || !strncmp(url, "about:", 6) || local_is_file_url(url);
+    return has_known_scheme && strlen(url) <= 1022;
+}
+
+static void handle_remote_request(void)
+{
+    char url[1025];
+
+    if (!remote_control_receive(globals.remote_listener, url, sizeof(url) - 1))
+        return;
+
+    // Apply the same validation as with the command line arguments
+    if (!is_valid_url(url))
+    {
+        set_status("{error} received an invalid url from another instance");
+        return;
+    }
+
+    navigate_to_url(url);
+}
+
+/*
+ * Waits until a key has been pressed and returns it
+ * Background events (forwarded URLs, revalidations, memory pressure) are handled in the meantime,
+ * but only if it's safe to do so. The same goes for idle work, which runs in slices until a key arrives
+ */
+static int wait_for_key(bool allow_events)
+{
+    for (;;)
+    {
+        // getch will not block, ncurses might have buffered some keys already
+        int c = getch();
+        if (c != ERR)
+            return c;
+
+        // Whatever the last key caused has been painted by now, anything that's painted from here on is background
+        // work (revalidations, the watch timer, idle work) and shouldn't be charged to it
+        input_latency_finish_key(&globals.input_latency);
+
+        gemini_browser_t *browser = &globals.browser;
+        struct pollfd descriptors[6 + WARMUP_CONCURRENCY] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = allow_events ? globals.remote_listener : -1, .events = POLLIN },
+            { .fd = -1 },
+            { .fd = globals.memory_log_timer, .events = POLLIN },
+            { .fd = allow_events ? browser->pressure.trigger : -1, .events = POLLPRI },
+            { .fd = allow_events ? globals.watch_timer : -1, .events = POLLIN }
+        };
+
+        // The warm-up gets the descriptors at the end
+        if (allow_events)
+            warmup_fill_descriptors(&browser->warmup, descriptors + 6);
+        else
+            for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+                descriptors[6 + i].fd = -1;
+
+        if (allow_events && browser->is_revalidating)
+        {
+            descriptors[2].fd = browser->revalidation.connection;
+            descriptors[2].events = gemini_request_get_poll_events(&browser->revalidation);
+        }
+
+        // Negative descriptors are simply ignored
+        // With idle work pending, the descriptors are only checked and the slice runs right after
+        bool has_idle_work = allow_events && idle_scheduler_has_tasks(&globals.idle);
+        poll(descriptors, 6 + WARMUP_CONCURRENCY,
+             has_idle_work ? 0 : allow_events ? warmup_get_timeout(&browser->warmup) : -1);
+
+        if (descriptors[1].revents & POLLIN)
+            handle_remote_request();
+
+        // Events are only allowed once there's a page on the screen
+        size_t old_offset = allow_events ? CURRENT_BROWSER_PAGE->scroll_offset : 0;
+        bool has_changed = descriptors[2].revents && gemini_browser_advance_revalidation(browser);
+        if (has_changed)
+            show_page_update(old_offset);
+
+        // The user asked, so there's an answer even if nothing has changed
+        if (globals.is_reloading && !browser->is_revalidating)
+        {
+            globals.is_reloading = false;
+
+            if (!has_changed)
+                set_status("{browsing} %s (unchanged)", CURRENT_BROWSER_PAGE->document->url);
+        }
+
+        // Nothing is shown if the page hasn't changed, and a slow server is given the time to answer
+        if (descriptors[5].revents & POLLIN)
+        {
+            uint64_t expirations;
+            read(globals.watch_timer, &expirations, sizeof(expirations));
+
+            bool is_watched = !strcmp(globals.watched_url, CURRENT_BROWSER_PAGE->document->url);
+            if (is_watched && !browser->is_revalidating && gemini_browser_reload(browser))
+                show_page_update(old_offset);
+        }
+
+        if (allow_events)
+            gemini_browser_advance_warmup(browser, descriptors + 6);
+
+        // The kernel says that tasks are stalling on memory, there's no need to wait for the next fetch
+        if (descriptors[4].revents & POLLPRI)
+            gemini_browser_relieve_memory_pressure(browser);
+
+#ifdef MEMORY_LOG_PATH
+        if (descriptors[3].revents & POLLIN)
+        {
+            uint64_t expirations;
+            read(globals.memory_log_timer, &expirations, sizeof(expirations));
+            memory_append_to_log(MEMORY_LOG_PATH);
+        }
+#endif
+
+        if (has_idle_work && !(descriptors[0].revents & POLLIN))
+            idle_scheduler_run(&globals.idle, IDLE_SLICE);
+    }
+}
+
 /*
  * Reads URL input using the status bar as a text box. Special characters will be encoded properly
  * Will save string into the buffer and return the total amount of bytes written
@@ -275,7 +518,7 @@ static size_t collect_url_from_user(char *buffer, char *prompt, size_t max_lengt
     size_t max_visible_length = getmaxx(globals.status_bar) - offset_x;
 
     int c;
-    while ((c = getch()) != '\n')
+    while ((c = wait_for_key(false)) != '\n')
     {
         if (c == KEY_BACKSPACE && input_length > 0)
         {
@@ -323,11 +566,19 @@ static void visit_page_of_prompt(void)
     globals.input_length = collect_url_from_user(globals.input_buffer, "insert gemini url", 900);
     globals.input_buffer[globals.input_length] = 0;
     
-    // Check if the user included a gemini scheme
-    if (!strncmp(globals.input_buffer, "gemini://", 9))
+    // Check if the user included a scheme, or if it's one of the internal pages
+    if (!strncmp(globals.input_buffer, "gemini://", 9) || !strncmp(globals.input_buffer, "about:", 6) ||
+        local_is_file_url(globals.input_buffer))
     {
         navigate_to_url(globals.input_buffer);
     }
+    // Absolute paths can only be local files
+    else if (globals.input_buffer[0] == '/')
+    {
+        char *new_url = join_strings_together("file://", 7, globals.input_buffer, globals.input_length);
+        navigate_to_url(new_url);
+        free(new_url);
+    }
     else
     {
         // Otherwise, stick the gemini scheme into the URL manually
@@ -343,22 +594,11 @@ static void visit_page_of_prompt(void)
 void scroll_to_next_link(void)
 {
     size_t start = CURRENT_BROWSER_PAGE->scroll_offset;
-    gemtext_line_t *elements = CURRENT_BROWSER_PAGE->document->elements;
-    size_t index = start + 1;
-    
-    // Start with a forward search
-    while (index != DYN_ARRAY_LENGTH(elements) && elements[index].type != GEMTEXT_LINK) index++;
-    
-    // If nothing was found, wrap around from the start of the document
-    if (index == DYN_ARRAY_LENGTH(elements))
-    {
-        index = 0;
-        while (index != start && elements[index].type != GEMTEXT_LINK) index++;
-        
-        // If neither that worked, quit
-        if (index == start)
-            return;
-    }
+    size_t index = gemini_document_find_next_link(CURRENT_BROWSER_PAGE->document, start);
+
+    // If there are no other links, just stay where we are
+    if (index == start)
+        return;
 
     CURRENT_BROWSER_PAGE->scroll_offset = index;
     refresh_document_viewer();
@@ -371,9 +611,51 @@ void navigate_to_host(void)
     free(host);
 }
 
+// Which of the latency histograms a key ends up in
+static input_kind_e get_input_kind(int key)
+{
+    switch (key)
+    {
+    case GO_TO_START_KEY:
+    case GO_TO_BOTTOM_KEY:
+    case MOVE_UP_KEY:
+    case MOVE_DOWN_KEY:
+    case PAGE_DOWN_KEY:
+    case NEXT_LINK_KEY:
+        return INPUT_SCROLL;
+
+    case FOLLOW_LINK_KEY:
+    case GO_BACK_KEY:
+    case GO_TO_HOST_KEY:
+    case SEARCH_ENGINE_KEY:
+        return INPUT_NAVIGATION;
+    }
+
+    // Bookmarks are navigation too, unless they're being updated
+    return key >= '1' && key <= '9' ? INPUT_NAVIGATION : INPUT_UNTRACKED;
+}
+
+/*
+ * The latency of every key lasts until the browser goes back to waiting, so that it covers every frame it caused
+ * but none of those painted later on by background work (see wait_for_key)
+ * Typing a URL into a prompt is not counted, the user is the one who's slow in that case
+ */
+static int wait_for_next_key(void)
+{
+    input_latency_finish_key(&globals.input_latency);
+
+    int c = wait_for_key(true);
+    input_latency_key_received(&globals.input_latency, get_input_kind(c));
+
+    return c;
+}
+
 // Just a thin wrapper around the user input handler so that there is some extra feedback to the user
 size_t on_server_input(char *buffer, char *prompt, size_t max_length)
 {
+    // Whatever key led here is now waiting on the user, not on the browser
+    input_latency_key_received(&globals.input_latency, INPUT_UNTRACKED);
+
     size_t bytes_written = collect_url_from_user(buffer, prompt, max_length);
     set_status("{loading} the server is handling your input");
 
@@ -382,11 +664,92 @@ size_t on_server_input(char *buffer, char *prompt, size_t max_length)
 
 int main(int argc, char **argv)
 {
+    // Instead of browsing, act as a caching proxy for other gemini clients
+    if (argc == 2 && !strcmp(argv[1], "--serve"))
+        gemini_proxy_run();
+
+    // Converting gemtext files without ever touching the terminal or the network
+    if (argc >= 2 && !strcmp(argv[1], "--convert"))
+        return convert_run(argc - 2, argv + 2);
+
+    // Fetching lots of URLs at once, e.g. for crawling
+    if (argc >= 2 && !strcmp(argv[1], "--fetch"))
+        return batch_run(argc - 2, argv + 2);
+
+    // Same as the proxy, except that every response comes out of an archive instead of the network
+    if (argc >= 3 && !strcmp(argv[1], "--replay"))
+    {
+        static gemini_replay_t replay;
+        gemini_replay_run(&replay, argv[2], argc == 4 && !strcmp(argv[3], "--delays"));
+    }
+
+    // Lets a host present a different certificate, which will then be pinned on the next visit
+    if (argc == 3 && !strcmp(argv[1], "--forget"))
+    {
+        known_hosts_t known_hosts;
+        known_hosts_open(&known_hosts, KNOWN_HOSTS_PATH);
+
+        bool has_forgotten = known_hosts_forget(&known_hosts, argv[2]);
+        known_hosts_close(&known_hosts);
+
+        if (!has_forgotten)
+            exit_with_failure("%s has never been visited", argv[2]);
+
+        return 0;
+    }
+
+    // Every response of this session will be appended to the archive, the rest of the arguments are as usual
+    char *archive_path = NULL;
+    if (argc >= 3 && !strcmp(argv[1], "--record"))
+    {
+        archive_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Paths that exist are opened as local files, the absolute path keeps working from another instance too
+    char local_path[PATH_MAX], local_url[PATH_MAX + 8];
+    if (argc == 2 && !strstr(argv[1], "://") && realpath(argv[1], local_path))
+    {
+        snprintf(local_url, sizeof(local_url), "file://%s", local_path);
+        argv[1] = local_url;
+    }
+
     // Validating user input
-    if (argc == 2 && (strncmp(argv[1], "gemini://", 9) || strlen(argv[1]) > 1022))
-        exit_with_failure("please provide a valid and reasonably sized gemini:// url");
+    if (argc == 2 && !is_valid_url(argv[1]))
+        exit_with_failure("please provide a valid and reasonably sized gemini:// url or an existing path");
+
+    // If another instance is already running, just let it open the page instead
+    // This way, no time is wasted on initializing TLS and ncurses all over again
+    // A recording session needs its own instance, otherwise the pages would end up in someone else's history
+    if (argc == 2 && !archive_path && remote_control_forward(argv[1]))
+        return 0;
+
+    globals.remote_listener = remote_control_listen();
+    globals.memory_log_timer = -1;
+
+    // A server that hangs up right as a request is sent should only fail that request, not the whole client
+    signal(SIGPIPE, SIG_IGN);
+    globals.watch_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    // Has to happen before OpenSSL allocates anything at all
+    memory_track_openssl();
 
-    gemini_browser_create(&globals.browser, on_server_input);
+#ifdef MEMORY_LOG_PATH
+    globals.memory_log_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    struct itimerspec interval = {
+        .it_value.tv_sec = MEMORY_LOG_INTERVAL,
+        .it_interval.tv_sec = MEMORY_LOG_INTERVAL
+    };
+    timerfd_settime(globals.memory_log_timer, 0, &interval, NULL);
+#endif
+
+    gemini_browser_create(&globals.browser, on_server_input, on_request_progress);
+    idle_scheduler_create(&globals.idle);
+
+    if (archive_path && !(globals.browser.archive = archive_open(archive_path)))
+        exit_with_failure("failed to open the archive at %s", archive_path);
 
     /*
      * The program's structure is flexible enough, so a variety of distinct frontends can be built without much work
@@ -414,6 +777,7 @@ int main(int argc, char **argv)
     }
 
     keypad(stdscr, true);
+    nodelay(stdscr, true);
     cbreak();
     curs_set(0);
     noecho();
@@ -429,10 +793,33 @@ int main(int argc, char **argv)
     globals.status_bar = newwin(1, viewer_width, 0, viewer_x);
 
     refresh();
-    navigate_to_url((argc == 2) ? argv[1] : HOME_URL);
+    update_ncurses_estimate();
+    if (argc == 2)
+    {
+        navigate_to_url(argv[1]);
+    }
+    else if (globals.browser.pages.length > 0)
+    {
+        // Paint the page of the previous session before any network I/O takes place
+        // It will be replaced once the background request notices that it has changed
+        bool has_restored_content = CURRENT_BROWSER_PAGE->document->content != NULL;
+        gemini_browser_ensure_page_is_loaded(&globals.browser);
+
+        set_status("{browsing} %s", CURRENT_BROWSER_PAGE->document->url);
+        refresh_document_viewer();
+
+        if (has_restored_content)
+            gemini_browser_revalidate(&globals.browser);
+    }
+    else
+    {
+        navigate_to_url(HOME_URL);
+    }
+
+    idle_scheduler_add(&globals.idle, start_warmup, NULL);
 
     int c;
-    while ((c = getch()) != EXIT_KEY)
+    while ((c = wait_for_next_key()) != EXIT_KEY)
     {
         gemini_page_t *page = CURRENT_BROWSER_PAGE;
 
@@ -460,8 +847,10 @@ int main(int argc, char **argv)
             if (globals.browser.pages.length < 2) continue;
             
             gemini_browser_go_back(&globals.browser);
+            globals.is_reloading = false;
             set_status("{browsing} %s", CURRENT_BROWSER_PAGE->document->url);
             refresh_document_viewer();
+            schedule_idle_work();
             continue;
 
         case VISIT_PAGE_KEY:
@@ -472,6 +861,22 @@ int main(int argc, char **argv)
             scroll_to_next_link();
             continue;
 
+        case RELOAD_KEY:
+            reload_current_page();
+            continue;
+
+        case WATCH_KEY:
+            toggle_watch();
+            continue;
+
+        case SHOW_LATENCY_KEY:
+        {
+            char summary[256];
+            input_latency_format(&globals.input_latency, summary, sizeof(summary));
+            set_status("{latency} %s", summary);
+            continue;
+        }
+
         case GO_TO_HOST_KEY:
             navigate_to_host();
             continue;
@@ -480,6 +885,15 @@ int main(int argc, char **argv)
             // Move and scale the UI accordingly to fit in with the new terminal dimensions
             handle_window_resize();
             continue;
+
+#ifdef WITH_TRACING
+        case DUMP_TRACE_KEY:
+            if (trace_dump(TRACE_PATH))
+                set_status("{trace} written to %s", TRACE_PATH);
+            else
+                set_status("{error} failed to write the trace to %s", TRACE_PATH);
+            continue;
+#endif
         }
 
         // Check if the user is trying to access one of the bookmarks
@@ -510,6 +924,8 @@ int main(int argc, char **argv)
         }
     }
 
+    remote_control_close(globals.remote_listener);
     browser_destroy(&globals.browser);
+    idle_scheduler_destroy(&globals.idle);
     endwin();
 }
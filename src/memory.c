@@ -0,0 +1,186 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "memory.h"
+#include "common.h"
+#include <openssl/crypto.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// OpenSSL might allocate from other threads, so the counters are atomic
+typedef struct
+{
+    atomic_size_t live_bytes, peak_bytes;
+    atomic_size_t total_allocations;
+} memory_counter_t;
+
+// Keeps the blocks aligned just as malloc would
+#define BLOCK_HEADER_SIZE alignof(max_align_t)
+
+static memory_counter_t counters[TOTAL_MEMORY_SUBSYSTEMS];
+
+static const char *subsystem_names[TOTAL_MEMORY_SUBSYSTEMS] = {
+    [MEMORY_DOCUMENTS] = "documents",
+    [MEMORY_OPENSSL] = "openssl",
+    [MEMORY_STATS] = "stats",
+    [MEMORY_NCURSES] = "ncurses"
+};
+
+static void add_bytes(memory_counter_t *counter, size_t bytes)
+{
+    size_t live_bytes = atomic_fetch_add_explicit(&counter->live_bytes, bytes, memory_order_relaxed) + bytes;
+    size_t peak_bytes = atomic_load_explicit(&counter->peak_bytes, memory_order_relaxed);
+
+    while (live_bytes > peak_bytes &&
+           !atomic_compare_exchange_weak_explicit(&counter->peak_bytes, &peak_bytes, live_bytes,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+static void subtract_bytes(memory_counter_t *counter, size_t bytes)
+{
+    atomic_fetch_sub_explicit(&counter->live_bytes, bytes, memory_order_relaxed);
+}
+
+static void* allocate(size_t size, void *userdata)
+{
+    size_t *block = malloc(BLOCK_HEADER_SIZE + size);
+    if (!block)
+        return NULL;
+
+    *block = size;
+    add_bytes(userdata, size);
+    atomic_fetch_add_explicit(&((memory_counter_t*) userdata)->total_allocations, 1, memory_order_relaxed);
+
+    return (char*) block + BLOCK_HEADER_SIZE;
+}
+
+static void* reallocate(void *pointer, size_t size, void *userdata)
+{
+    if (!pointer)
+        return allocate(size, userdata);
+
+    size_t *block = (size_t*) ((char*) pointer - BLOCK_HEADER_SIZE);
+    size_t old_size = *block;
+
+    block = realloc(block, BLOCK_HEADER_SIZE + size);
+    if (!block)
+        return NULL;
+
+    *block = size;
+    subtract_bytes(userdata, old_size);
+    add_bytes(userdata, size);
+
+    return (char*) block + BLOCK_HEADER_SIZE;
+}
+
+static void release(void *pointer, void *userdata)
+{
+    if (!pointer)
+        return;
+
+    size_t *block = (size_t*) ((char*) pointer - BLOCK_HEADER_SIZE);
+    subtract_bytes(userdata, *block);
+    free(block);
+}
+
+static const dyn_array_allocator_t allocators[TOTAL_MEMORY_SUBSYSTEMS] = {
+    [MEMORY_DOCUMENTS] = {allocate, reallocate, release, &counters[MEMORY_DOCUMENTS]},
+    [MEMORY_OPENSSL] = {allocate, reallocate, release, &counters[MEMORY_OPENSSL]},
+    [MEMORY_STATS] = {allocate, reallocate, release, &counters[MEMORY_STATS]}
+};
+
+const dyn_array_allocator_t* memory_get_allocator(memory_subsystem_e subsystem)
+{
+    return allocators[subsystem].allocate ? &allocators[subsystem] : NULL;
+}
+
+// OpenSSL's hooks also pass the file and the line of every call, which aren't needed
+static void* openssl_allocate(size_t size, const char *file, int line)
+{
+    return allocate(size, &counters[MEMORY_OPENSSL]);
+}
+
+static void* openssl_reallocate(void *pointer, size_t size, const char *file, int line)
+{
+    return reallocate(pointer, size, &counters[MEMORY_OPENSSL]);
+}
+
+static void openssl_release(void *pointer, const char *file, int line)
+{
+    release(pointer, &counters[MEMORY_OPENSSL]);
+}
+
+bool memory_track_openssl(void)
+{
+    return CRYPTO_set_mem_functions(openssl_allocate, openssl_reallocate, openssl_release);
+}
+
+void memory_set_estimate(memory_subsystem_e subsystem, size_t bytes)
+{
+    atomic_store_explicit(&counters[subsystem].live_bytes, 0, memory_order_relaxed);
+    add_bytes(&counters[subsystem], bytes);
+}
+
+void memory_get_usage(memory_subsystem_e subsystem, memory_usage_t *usage)
+{
+    usage->live_bytes = atomic_load_explicit(&counters[subsystem].live_bytes, memory_order_relaxed);
+    usage->peak_bytes = atomic_load_explicit(&counters[subsystem].peak_bytes, memory_order_relaxed);
+    usage->total_allocations = atomic_load_explicit(&counters[subsystem].total_allocations, memory_order_relaxed);
+}
+
+const char* memory_get_subsystem_name(memory_subsystem_e subsystem)
+{
+    return subsystem_names[subsystem];
+}
+
+size_t memory_get_resident_bytes(void)
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+
+    size_t total_pages, resident_pages = 0;
+    if (fscanf(statm, "%zu %zu", &total_pages, &resident_pages) != 2)
+        resident_pages = 0;
+
+    fclose(statm);
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+bool memory_append_to_log(const char *path)
+{
+    FILE *log = fopen(path, "a");
+    if (!log)
+        return false;
+
+    fprintf(log, "{\"time\":%ld,\"resident\":%zu", (long) time(NULL), memory_get_resident_bytes());
+
+    for (int i = 0; i < TOTAL_MEMORY_SUBSYSTEMS; i++)
+    {
+        memory_usage_t usage;
+        memory_get_usage(i, &usage);
+
+        fprintf(log, ",\"%s\":{\"live\":%zu,\"peak\":%zu}", subsystem_names[i], usage.live_bytes, usage.peak_bytes);
+    }
+
+    fprintf(log, "}\n");
+    return fclose(log) == 0;
+}
@@ -0,0 +1,64 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMORY_H
+#define _MEMORY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "dynamic_array.h"
+
+typedef enum
+{
+    // Bodies and element tables of every fetched document, whether it's in the history or not
+    MEMORY_DOCUMENTS,
+    MEMORY_OPENSSL,
+    MEMORY_STATS,
+
+    // Can't be hooked into, so it's estimated from the size of the windows instead
+    MEMORY_NCURSES,
+    TOTAL_MEMORY_SUBSYSTEMS
+} memory_subsystem_e;
+
+typedef struct
+{
+    size_t live_bytes, peak_bytes;
+    size_t total_allocations;
+} memory_usage_t;
+
+/*
+ * Every allocation that goes through one of these allocators is counted towards its subsystem
+ * A small header in front of each block remembers its size, so that it can be subtracted once it's released
+ */
+const dyn_array_allocator_t* memory_get_allocator(memory_subsystem_e subsystem);
+
+// Must be called before OpenSSL allocates anything, returns false if it was too late
+bool memory_track_openssl(void);
+
+// For subsystems whose memory can only be estimated
+void memory_set_estimate(memory_subsystem_e subsystem, size_t bytes);
+
+void memory_get_usage(memory_subsystem_e subsystem, memory_usage_t *usage);
+const char* memory_get_subsystem_name(memory_subsystem_e subsystem);
+
+// The resident set size of the whole process, as reported by the kernel
+size_t memory_get_resident_bytes(void);
+
+// Appends a single JSON line with the usage of every subsystem
+bool memory_append_to_log(const char *path);
+
+#endif
@@ -0,0 +1,216 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pressure.h"
+#include "config.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool is_readable(const char *path)
+{
+    return access(path, R_OK) == 0;
+}
+
+// Both files have to exist, otherwise the monitor would be comparing apples to oranges
+// The statistics and the pressure of the cgroup are optional, they're simply left out if they can't be read
+static bool try_cgroup_files(pressure_monitor_t *monitor, const char *directory, const char *limit, const char *usage)
+{
+    snprintf(monitor->limit_path, sizeof(monitor->limit_path), "%s/%s", directory, limit);
+    snprintf(monitor->usage_path, sizeof(monitor->usage_path), "%s/%s", directory, usage);
+    snprintf(monitor->stat_path, sizeof(monitor->stat_path), "%s/memory.stat", directory);
+    snprintf(monitor->pressure_path, sizeof(monitor->pressure_path), "%s/memory.pressure", directory);
+
+    if (!is_readable(monitor->stat_path))
+        monitor->stat_path[0] = 0;
+
+    if (!is_readable(monitor->pressure_path))
+        monitor->pressure_path[0] = 0;
+
+    return is_readable(monitor->limit_path) && is_readable(monitor->usage_path);
+}
+
+/*
+ * /proc/self/cgroup has a "0::/path" line on cgroup v2 and a "N:memory:/path" line on v1
+ * Inside a cgroup namespace the path doesn't always match what's mounted, so the root of the mount is tried as well
+ */
+static void find_cgroup_files(pressure_monitor_t *monitor)
+{
+    monitor->limit_path[0] = monitor->usage_path[0] = monitor->stat_path[0] = monitor->pressure_path[0] = 0;
+
+    FILE *cgroups = fopen("/proc/self/cgroup", "r");
+    if (!cgroups)
+        return;
+
+    char line[512], directory[600];
+    bool has_found = false;
+
+    while (!has_found && fgets(line, sizeof(line), cgroups))
+    {
+        line[strcspn(line, "\n")] = 0;
+
+        if (!strncmp(line, "0::", 3))
+        {
+            snprintf(directory, sizeof(directory), "/sys/fs/cgroup%s", line + 3);
+            has_found = try_cgroup_files(monitor, directory, "memory.max", "memory.current") ||
+                        try_cgroup_files(monitor, "/sys/fs/cgroup", "memory.max", "memory.current");
+        }
+        else if (strstr(line, ":memory:"))
+        {
+            snprintf(directory, sizeof(directory), "/sys/fs/cgroup/memory%s", strstr(line, ":memory:") + 8);
+            has_found = try_cgroup_files(monitor, directory, "memory.limit_in_bytes", "memory.usage_in_bytes") ||
+                        try_cgroup_files(monitor, "/sys/fs/cgroup/memory", "memory.limit_in_bytes",
+                                         "memory.usage_in_bytes");
+        }
+    }
+
+    if (!has_found)
+        monitor->limit_path[0] = monitor->usage_path[0] = monitor->stat_path[0] = monitor->pressure_path[0] = 0;
+
+    // Every cgroup v2 has its own pressure, the whole system's is only a fallback
+    if (!monitor->pressure_path[0])
+        snprintf(monitor->pressure_path, sizeof(monitor->pressure_path), "/proc/pressure/memory");
+
+    fclose(cgroups);
+}
+
+// Returns 0 if the file is missing or says that there's no limit at all
+// cgroup v2 writes "max" in that case, while v1 writes a number that's close to the largest one possible
+static size_t read_size(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    unsigned long long size = 0;
+    if (fscanf(file, "%llu", &size) != 1 || size >= (1ULL << 62))
+        size = 0;
+
+    fclose(file);
+    return size;
+}
+
+// The page cache that hasn't been touched in a while is dropped long before anything is reclaimed for real
+// cgroup v2 calls it inactive_file, v1 has total_inactive_file for the whole hierarchy
+static size_t read_inactive_file(const char *path)
+{
+    FILE *file = path[0] ? fopen(path, "r") : NULL;
+    if (!file)
+        return 0;
+
+    char key[64];
+    unsigned long long value, inactive = 0;
+
+    while (fscanf(file, "%63s %llu", key, &value) == 2)
+    {
+        if (!strcmp(key, "inactive_file") || !strcmp(key, "total_inactive_file"))
+            inactive = value;
+    }
+
+    fclose(file);
+    return inactive;
+}
+
+// Returns -1 if the kernel doesn't support triggers there, or if they can't be set up by this user
+static int open_trigger(const char *path)
+{
+    int trigger = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (trigger < 0)
+        return -1;
+
+    // The kernel only accepts windows between 0.5 and 10 seconds, unprivileged users need multiples of 2 seconds
+    // The threshold is the same share of the window as PRESSURE_MODERATE_STALL is of avg10
+    char description[64];
+    int length = snprintf(description, sizeof(description), "some %d %d",
+                          (int) (PRESSURE_MODERATE_STALL / 100.0 * 2000000), 2000000);
+
+    // The trailing NULL byte has to be written too
+    if (write(trigger, description, length + 1) < 0)
+    {
+        close(trigger);
+        return -1;
+    }
+
+    return trigger;
+}
+
+void pressure_monitor_create(pressure_monitor_t *monitor)
+{
+    find_cgroup_files(monitor);
+    monitor->cgroup_limit = monitor->cgroup_usage = 0;
+    monitor->stall_some = monitor->stall_full = 0;
+
+    // The cgroup's own file might not be writable, the system-wide one is better than nothing then
+    monitor->trigger = open_trigger(monitor->pressure_path);
+    if (monitor->trigger < 0 && strcmp(monitor->pressure_path, "/proc/pressure/memory"))
+        monitor->trigger = open_trigger("/proc/pressure/memory");
+}
+
+static void read_stalls(pressure_monitor_t *monitor)
+{
+    monitor->stall_some = monitor->stall_full = 0;
+
+    FILE *pressure = fopen(monitor->pressure_path, "r");
+    if (!pressure)
+        return;
+
+    char kind[8];
+    double average;
+
+    // Each line looks like "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    while (fscanf(pressure, "%7s avg10=%lf %*[^\n]", kind, &average) == 2)
+    {
+        if (!strcmp(kind, "some"))
+            monitor->stall_some = average;
+        else if (!strcmp(kind, "full"))
+            monitor->stall_full = average;
+    }
+
+    fclose(pressure);
+}
+
+pressure_level_e pressure_monitor_get_level(pressure_monitor_t *monitor)
+{
+    read_stalls(monitor);
+
+    if (monitor->limit_path[0])
+    {
+        monitor->cgroup_limit = read_size(monitor->limit_path);
+        monitor->cgroup_usage = read_size(monitor->usage_path);
+
+        size_t inactive = read_inactive_file(monitor->stat_path);
+        monitor->cgroup_usage = monitor->cgroup_usage > inactive ? monitor->cgroup_usage - inactive : 0;
+    }
+
+    double usage = monitor->cgroup_limit ? 100.0 * monitor->cgroup_usage / monitor->cgroup_limit : 0;
+
+    if (usage >= PRESSURE_CRITICAL_USAGE || monitor->stall_full >= PRESSURE_CRITICAL_STALL)
+        return PRESSURE_CRITICAL;
+
+    if (usage >= PRESSURE_MODERATE_USAGE || monitor->stall_some >= PRESSURE_MODERATE_STALL)
+        return PRESSURE_MODERATE;
+
+    return PRESSURE_NONE;
+}
+
+void pressure_monitor_destroy(pressure_monitor_t *monitor)
+{
+    if (monitor->trigger >= 0)
+        close(monitor->trigger);
+}
@@ -0,0 +1,59 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PRESSURE_H
+#define _PRESSURE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum
+{
+    PRESSURE_NONE,
+    // Whatever can be rebuilt without the network should go
+    PRESSURE_MODERATE,
+    // Anything but the current page should go, even if it has to be fetched again
+    PRESSURE_CRITICAL
+} pressure_level_e;
+
+/*
+ * Keeps an eye on the memory of the cgroup that the process lives in (memory.max and memory.current, or their
+ * cgroup v1 equivalents) and on its pressure stall information (memory.pressure, or /proc/pressure/memory on v1)
+ * The page cache that the kernel can drop right away (inactive_file in memory.stat) doesn't count as usage
+ * Either of them might be missing, in which case it's simply ignored
+ */
+typedef struct
+{
+    char limit_path[512], usage_path[512], stat_path[512], pressure_path[512];
+
+    // Polling it returns POLLPRI whenever tasks have stalled on memory for too long, -1 if unsupported
+    int trigger;
+
+    // Whatever was read the last time the level was checked, for about:memory
+    // The usage is the working set, the inactive page cache has already been taken out of it
+    size_t cgroup_limit, cgroup_usage;
+    double stall_some, stall_full;
+} pressure_monitor_t;
+
+void pressure_monitor_create(pressure_monitor_t *monitor);
+
+// Reads everything again, it's only a few tiny files
+pressure_level_e pressure_monitor_get_level(pressure_monitor_t *monitor);
+
+void pressure_monitor_destroy(pressure_monitor_t *monitor);
+
+#endif
@@ -0,0 +1,466 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "proxy.h"
+#include "common.h"
+#include "config.h"
+#include "workers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What actually gets stored inside the cache
+typedef struct
+{
+    char header[1030];
+    DYN_ARRAY(char) body;
+
+    // Only counted for responses that didn't make it into the cache, the entry does it for the rest
+    size_t references;
+} proxy_response_t;
+
+static void response_deallocator(void *data)
+{
+    proxy_response_t *response = data;
+
+    if (response->body)
+        dyn_array_destroy(response->body);
+
+    free(response);
+}
+
+static void release_response(void *data)
+{
+    proxy_response_t *response = data;
+
+    if (--response->references == 0)
+        response_deallocator(response);
+}
+
+// Just a thin wrapper so that it matches the signature of a generic deallocator
+static void release_cache_entry(void *entry)
+{
+    cache_entry_release(entry);
+}
+
+// The other workers may be reading the counters at any time (see proxy_stats_t)
+static void increment_counter(size_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void publish_counter(size_t *counter, size_t value)
+{
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+// Called after every lookup or insertion, the cache itself only ever gets touched by its own worker
+static void publish_cache_counters(gemini_proxy_t *proxy)
+{
+    publish_counter(&proxy->stats.cache_hits, proxy->cache.hits);
+    publish_counter(&proxy->stats.cache_misses, proxy->cache.misses);
+    publish_counter(&proxy->stats.cache_entries, proxy->cache.length);
+    publish_counter(&proxy->stats.cache_bytes, proxy->cache.total_bytes);
+    publish_counter(&proxy->stats.cache_evictions, proxy->cache.evictions);
+}
+
+static void record_latency(gemini_proxy_t *proxy, server_client_t *client, bool is_hit)
+{
+    uint64_t latency = get_monotonic_time() - client->requested_at;
+    uint64_t *total = is_hit ? &proxy->stats.total_hit_latency : &proxy->stats.total_miss_latency;
+    uint64_t *max = is_hit ? &proxy->stats.max_hit_latency : &proxy->stats.max_miss_latency;
+
+    // Nobody else writes to the maximum, so there's no need for a compare-and-swap
+    __atomic_fetch_add(total, latency, __ATOMIC_RELAXED);
+    if (latency > __atomic_load_n(max, __ATOMIC_RELAXED))
+        __atomic_store_n(max, latency, __ATOMIC_RELAXED);
+}
+
+static void respond_with_cache_entry(gemini_proxy_t *proxy, server_client_t *client, cache_entry_t *entry)
+{
+    proxy_response_t *response = entry->data;
+
+    // The entry must stay alive until the body has been sent, even if it gets evicted in the meantime
+    cache_entry_acquire(entry);
+    gemini_server_respond(&proxy->server, client, response->header,
+                          response->body, response->body ? DYN_ARRAY_LENGTH(response->body) : 0,
+                          release_cache_entry, entry);
+}
+
+// The other workers keep counting while their counters are being read, so the page is only a snapshot
+static size_t read_counter(const size_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static uint64_t read_latency(const uint64_t *latency)
+{
+    return __atomic_load_n(latency, __ATOMIC_RELAXED);
+}
+
+static void respond_with_statistics(gemini_proxy_t *proxy, server_client_t *client)
+{
+    // Every worker only knows about its own hosts, so their counters are added up
+    gemini_cache_t cache = {0};
+    proxy_stats_t stats = {0};
+    size_t total_clients = 0;
+
+    for (size_t i = 0; i < proxy->total_workers; i++)
+    {
+        gemini_proxy_t *worker = &proxy->workers[i];
+
+        cache.hits += read_counter(&worker->stats.cache_hits);
+        cache.misses += read_counter(&worker->stats.cache_misses);
+        cache.length += read_counter(&worker->stats.cache_entries);
+        cache.total_bytes += read_counter(&worker->stats.cache_bytes);
+        cache.evictions += read_counter(&worker->stats.cache_evictions);
+
+        // Set before any of the workers started
+        cache.max_bytes += worker->cache.max_bytes;
+
+        stats.total_requests += read_counter(&worker->stats.total_requests);
+        stats.coalesced_requests += read_counter(&worker->stats.coalesced_requests);
+        stats.upstream_failures += read_counter(&worker->stats.upstream_failures);
+        stats.total_hit_latency += read_latency(&worker->stats.total_hit_latency);
+        stats.total_miss_latency += read_latency(&worker->stats.total_miss_latency);
+        stats.max_hit_latency = MAX(stats.max_hit_latency, read_latency(&worker->stats.max_hit_latency));
+        stats.max_miss_latency = MAX(stats.max_miss_latency, read_latency(&worker->stats.max_miss_latency));
+
+        total_clients += read_counter(&worker->server.total_clients);
+    }
+
+    size_t lookups = cache.hits + cache.misses;
+    char *page = malloc(2048);
+
+    snprintf(page, 2048,
+             "# Astrology Proxy Statistics\n"
+             "## Cache\n"
+             "* Requests: %zu\n"
+             "* Hits: %zu\n"
+             "* Misses: %zu\n"
+             "* Hit ratio: %.1f%%\n"
+             "* Entries: %zu (%zu bytes out of %zu)\n"
+             "* Evictions: %zu\n"
+             "## Latency\n"
+             "* Average hit latency: %.3f ms\n"
+             "* Maximum hit latency: %.3f ms\n"
+             "* Average miss latency: %.3f ms\n"
+             "* Maximum miss latency: %.3f ms\n"
+             "## Upstream\n"
+             "* Coalesced requests: %zu\n"
+             "* Failures: %zu\n"
+             "* Connected clients: %zu\n"
+             "* Workers: %zu\n",
+             stats.total_requests, cache.hits, cache.misses,
+             lookups ? 100.0 * cache.hits / lookups : 0.0,
+             cache.length, cache.total_bytes, cache.max_bytes, cache.evictions,
+             cache.hits ? stats.total_hit_latency / 1000.0 / cache.hits : 0.0,
+             stats.max_hit_latency / 1000.0,
+             cache.misses ? stats.total_miss_latency / 1000.0 / cache.misses : 0.0,
+             stats.max_miss_latency / 1000.0,
+             stats.coalesced_requests, stats.upstream_failures, total_clients, proxy->total_workers);
+
+    gemini_server_respond(&proxy->server, client, "20 text/gemini", page, strlen(page), free, page);
+}
+
+static bool is_addressed_to_proxy(char *url)
+{
+    char *host = get_hostname_with_scheme(url);
+    char own_port[16];
+    snprintf(own_port, sizeof(own_port), ":%d", SERVE_PORT);
+
+    bool is_own_host = false;
+    char *own_hosts[] = { "localhost", "127.0.0.1" };
+
+    for (int i = 0; i < 2; i++)
+    {
+        size_t length = strlen(own_hosts[i]);
+
+        // The port can be omitted only if the proxy is using the default one
+        if (!strncmp(host + 9, own_hosts[i], length) &&
+            ((!host[9 + length] && SERVE_PORT == 1965) || !strcmp(host + 9 + length, own_port)))
+        {
+            is_own_host = true;
+        }
+    }
+
+    free(host);
+    return is_own_host;
+}
+
+static void complete_upstream(gemini_server_t *server, proxy_upstream_t *upstream)
+{
+    gemini_proxy_t *proxy = server->userdata;
+    gemini_request_t *request = &upstream->request;
+
+    // The request has been completed, so it is no longer in flight
+    gemini_server_unwatch(server, request->connection);
+
+    proxy_upstream_t **link = &proxy->upstreams;
+    while (*link != upstream) link = &(*link)->next;
+    *link = upstream->next;
+
+    proxy_response_t *response = malloc(sizeof(proxy_response_t));
+    response->body = NULL;
+
+    // Forward the status and meta exactly as they were received, unless the body never made it
+    // Redirections and input requests are handled by the clients themselves
+    if (request->status[0] && (request->status[0] != '2' || request->error == GEMINI_OK))
+    {
+        snprintf(response->header, sizeof(response->header), "%s %s", request->status, request->meta);
+    }
+    else
+    {
+        // The URL alone may fill the whole header, so it's cut short to leave room for the status
+        int url_length = sizeof(response->header) - sizeof("43 Could not reach ");
+        snprintf(response->header, sizeof(response->header), "43 Could not reach %.*s", url_length, request->url);
+        increment_counter(&proxy->stats.upstream_failures);
+    }
+
+    cache_entry_t *entry = NULL;
+    if (request->status[0] == '2' && request->error == GEMINI_OK)
+    {
+        // The body now belongs to the cache, unless it's larger than the worker's whole share of it
+        response->body = request->content;
+        request->content = NULL;
+
+        entry = gemini_cache_insert(&proxy->cache, request->url, response, DYN_ARRAY_LENGTH(response->body),
+                                    response_deallocator);
+        publish_cache_counters(proxy);
+    }
+
+    // Uncacheable responses are only needed until every waiting client has been sent them
+    size_t total_clients = DYN_ARRAY_LENGTH(upstream->waiting_clients);
+    response->references = total_clients;
+
+    for (size_t i = 0; i < total_clients; i++)
+    {
+        server_client_t *client = upstream->waiting_clients[i];
+        record_latency(proxy, client, false);
+
+        if (entry)
+            respond_with_cache_entry(proxy, client, entry);
+        else
+            gemini_server_respond(server, client, response->header,
+                                  response->body, response->body ? DYN_ARRAY_LENGTH(response->body) : 0,
+                                  release_response, response);
+    }
+
+    if (!entry && !total_clients)
+        response_deallocator(response);
+
+    dyn_array_destroy(upstream->waiting_clients);
+    gemini_request_destroy(request);
+    free(upstream);
+}
+
+static void on_upstream_ready(gemini_server_t *server, void *data)
+{
+    proxy_upstream_t *upstream = data;
+
+    if (gemini_request_advance(&upstream->request))
+        complete_upstream(server, upstream);
+}
+
+// A NULL address means that the host couldn't be resolved, the clients are then told right away
+static void start_upstream(gemini_server_t *server, proxy_upstream_t *upstream, const resolver_address_t *address)
+{
+    gemini_proxy_t *proxy = server->userdata;
+
+    gemini_request_start_with_address(&upstream->request, proxy->client_ctx, upstream->url, NULL,
+                                      address ? &address->address : NULL, address ? address->length : 0);
+    if (upstream->request.phase != GEMINI_REQUEST_DONE)
+        gemini_server_watch(server, upstream->request.connection, &upstream->watcher);
+
+    // Either the connection failed right away or it needs to be driven for the first time
+    on_upstream_ready(server, upstream);
+}
+
+static void on_proxy_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    gemini_proxy_t *proxy = server->userdata;
+
+    // Only gemini is supported, refuse to proxy anything else
+    if (strncmp(url, "gemini://", 9))
+    {
+        increment_counter(&proxy->stats.total_requests);
+        gemini_server_respond(server, client, "53 Only gemini:// URLs can be proxied", NULL, 0, NULL, NULL);
+        return;
+    }
+
+    // Requests that are addressed to the proxy itself, any worker can answer them
+    if (is_addressed_to_proxy(url))
+    {
+        increment_counter(&proxy->stats.total_requests);
+        respond_with_statistics(proxy, client);
+        return;
+    }
+
+    // Every host belongs to a single worker, so that its cache entries and its upstream requests live in one place
+    size_t owner = workers_get_owner(url, proxy->total_workers);
+    if (owner != proxy->index)
+    {
+        gemini_server_hand_over(server, client, &proxy->workers[owner].server);
+        return;
+    }
+
+    increment_counter(&proxy->stats.total_requests);
+
+    cache_entry_t *entry = gemini_cache_lookup(&proxy->cache, url);
+    publish_cache_counters(proxy);
+
+    if (entry)
+    {
+        record_latency(proxy, client, true);
+        respond_with_cache_entry(proxy, client, entry);
+        return;
+    }
+
+    // If someone else has already asked for the same page, just wait for the same response
+    for (proxy_upstream_t *upstream = proxy->upstreams; upstream; upstream = upstream->next)
+    {
+        if (!strcmp(upstream->url, url))
+        {
+            upstream->waiting_clients = dyn_array_prepare_new_item(upstream->waiting_clients);
+            DYN_ARRAY_GET_LAST(upstream->waiting_clients) = client;
+
+            increment_counter(&proxy->stats.coalesced_requests);
+            return;
+        }
+    }
+
+    proxy_upstream_t *upstream = malloc(sizeof(proxy_upstream_t));
+    upstream->waiting_clients = dyn_array_create(4, sizeof(server_client_t*));
+    upstream->waiting_clients = dyn_array_prepare_new_item(upstream->waiting_clients);
+    DYN_ARRAY_GET_LAST(upstream->waiting_clients) = client;
+
+    upstream->next = proxy->upstreams;
+    proxy->upstreams = upstream;
+
+    upstream->watcher.callback = on_upstream_ready;
+    upstream->watcher.data = upstream;
+    upstream->deadline = get_monotonic_time() + PROXY_UPSTREAM_TIMEOUT * 1000000ULL;
+    snprintf(upstream->url, sizeof(upstream->url), "%s", url);
+
+    // Unknown hosts are looked up by the resolver's threads, the request starts once on_resolved hears back
+    const resolver_address_t *address = resolver_lookup(&proxy->resolver, url, &upstream->is_resolving);
+    if (!upstream->is_resolving)
+        start_upstream(server, upstream, address);
+}
+
+// The upstream requests that were waiting for their hosts can be started now
+static void on_resolved(gemini_server_t *server, void *data)
+{
+    gemini_proxy_t *proxy = server->userdata;
+    if (!resolver_collect(&proxy->resolver))
+        return;
+
+    proxy_upstream_t *next;
+    for (proxy_upstream_t *upstream = proxy->upstreams; upstream; upstream = next)
+    {
+        // Starting the request might complete it right away, which takes it out of the list
+        next = upstream->next;
+        if (!upstream->is_resolving)
+            continue;
+
+        const resolver_address_t *address = resolver_lookup(&proxy->resolver, upstream->url, &upstream->is_resolving);
+        if (!upstream->is_resolving)
+            start_upstream(server, upstream, address);
+    }
+}
+
+// Gives up on the capsules that took too long, returns the earliest deadline of the rest (or 0 if there is none)
+static uint64_t expire_upstreams(gemini_server_t *server)
+{
+    gemini_proxy_t *proxy = server->userdata;
+    uint64_t now = get_monotonic_time();
+    uint64_t next_deadline = 0;
+
+    proxy_upstream_t *next;
+    for (proxy_upstream_t *upstream = proxy->upstreams; upstream; upstream = next)
+    {
+        // Completing the request takes it out of the list
+        next = upstream->next;
+
+        if (upstream->deadline > now)
+        {
+            if (!next_deadline || upstream->deadline < next_deadline)
+                next_deadline = upstream->deadline;
+
+            continue;
+        }
+
+        // The lookup goes on without it, whoever asks next might still benefit from it
+        if (upstream->is_resolving)
+        {
+            upstream->is_resolving = false;
+            start_upstream(server, upstream, NULL);
+            continue;
+        }
+
+        gemini_request_finish(&upstream->request, GEMINI_SERVER_CONNECTION_FAILURE);
+        complete_upstream(server, upstream);
+    }
+
+    return next_deadline;
+}
+
+static void run_worker(size_t index, void *data)
+{
+    gemini_proxy_t *workers = data;
+    gemini_server_run(&workers[index].server);
+}
+
+void gemini_proxy_run(void)
+{
+    size_t total_workers = workers_get_total();
+    gemini_proxy_t *workers = calloc(total_workers, sizeof(gemini_proxy_t));
+
+    // Every worker has to exist before any of them starts, since requests can be handed over to any of them
+    for (size_t i = 0; i < total_workers; i++)
+    {
+        gemini_proxy_t *proxy = &workers[i];
+        proxy->workers = workers;
+        proxy->index = i;
+        proxy->total_workers = total_workers;
+
+        proxy->client_ctx = SSL_CTX_new(TLS_client_method());
+        if (!proxy->client_ctx)
+            exit_with_failure("failed to initialize TLS client context");
+
+        // The workers share the memory budget, just like they share the hosts
+        gemini_cache_create(&proxy->cache, PROXY_CACHE_SIZE / total_workers, PROXY_CACHE_LIFETIME * 1000000ULL);
+        resolver_create(&proxy->resolver);
+        proxy->upstreams = NULL;
+
+        if (i == 0)
+            gemini_server_create(&proxy->server, SERVE_PORT, on_proxy_request, proxy);
+        else
+            gemini_server_create_sibling(&proxy->server, &workers[0].server, on_proxy_request, proxy);
+
+        proxy->server.deadline_handler = expire_upstreams;
+        proxy->resolver_watcher.callback = on_resolved;
+        proxy->resolver_watcher.data = NULL;
+        gemini_server_watch(&proxy->server, proxy->resolver.notification, &proxy->resolver_watcher);
+    }
+
+    fprintf(stderr, "{astrology} serving on gemini://localhost:%d/ with %zu workers\n", SERVE_PORT, total_workers);
+
+    // The servers never stop, so neither does this
+    workers_run(total_workers, run_worker, workers);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,91 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROXY_H
+#define _PROXY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/ssl.h>
+#include "server.h"
+#include "cache.h"
+#include "gemini.h"
+#include "resolver.h"
+
+// A request to an origin capsule, shared by every client that asked for the same URL in the meantime
+typedef struct proxy_upstream_t
+{
+    // The request is only started once the host has been resolved, until then only the URL is known
+    char url[1025];
+    bool is_resolving;
+
+    // The waiting clients are told that the capsule couldn't be reached if it hasn't responded by then
+    uint64_t deadline;
+
+    gemini_request_t request;
+    server_watcher_t watcher;
+    DYN_ARRAY(server_client_t*) waiting_clients;
+
+    struct proxy_upstream_t *next;
+} proxy_upstream_t;
+
+/*
+ * Counters that get exposed through the statistics page
+ * Only the worker itself ever writes its own, but any worker may be reading them at the same time, so every access
+ * goes through relaxed atomics. Those of the cache are copied over from it whenever it's been used
+ */
+typedef struct
+{
+    size_t total_requests;
+    size_t coalesced_requests;
+    size_t upstream_failures;
+
+    // Latencies are measured from the moment the request line was received, in microseconds
+    uint64_t total_hit_latency, max_hit_latency;
+    uint64_t total_miss_latency, max_miss_latency;
+
+    size_t cache_hits, cache_misses, cache_entries, cache_bytes, cache_evictions;
+} proxy_stats_t;
+
+// A single worker of the proxy, which owns everything about the hosts that are assigned to it
+typedef struct gemini_proxy_t
+{
+    gemini_server_t server;
+
+    // Used for all of the connections to the origin capsules
+    SSL_CTX *client_ctx;
+    resolver_t resolver;
+    server_watcher_t resolver_watcher;
+
+    gemini_cache_t cache;
+    proxy_upstream_t *upstreams;
+    proxy_stats_t stats;
+
+    // Every worker, this one included
+    struct gemini_proxy_t *workers;
+    size_t index, total_workers;
+} gemini_proxy_t;
+
+/*
+ * Acts as a local gemini server which forwards every request to the origin capsule
+ * Successful responses are cached, so that other clients asking for them are served right away
+ * Requests addressed to the proxy itself (gemini://localhost/) will return the statistics page
+ * One worker runs per core (see workers.h), and a request is always handed over to the worker that owns its host
+ */
+void gemini_proxy_run(void);
+
+#endif
@@ -0,0 +1,210 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Needed for struct ucred
+#define _GNU_SOURCE
+
+#include "remote.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Only a real directory of the current user that nobody else may enter, a symbolic link could point anywhere
+static bool is_private_directory(const char *path)
+{
+    struct stat status;
+    return lstat(path, &status) == 0 && S_ISDIR(status.st_mode) && status.st_uid == getuid() &&
+        !(status.st_mode & (S_IRWXG | S_IRWXO));
+}
+
+/*
+ * The socket is private to the current user, so it lives inside the runtime directory if there is one
+ * Otherwise it gets a directory of its own in /tmp, where anyone could have created the path first
+ * Returns false if the directory (or a socket that's already there) belongs to someone else
+ */
+static bool get_socket_address(struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    // Leaving room for the name of the socket, a directory that doesn't fit can't be used at all
+    char directory[sizeof(address->sun_path) - sizeof("/astrology.sock") + 1];
+    char *runtime_directory = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_directory && runtime_directory[0])
+    {
+        if (snprintf(directory, sizeof(directory), "%s", runtime_directory) >= sizeof(directory))
+            return false;
+    }
+    else
+    {
+        snprintf(directory, sizeof(directory), "/tmp/astrology-%d", (int) getuid());
+        mkdir(directory, 0700);
+    }
+
+    if (!is_private_directory(directory))
+        return false;
+
+    snprintf(address->sun_path, sizeof(address->sun_path), "%s/astrology.sock", directory);
+
+    struct stat status;
+    return lstat(address->sun_path, &status) != 0 || status.st_uid == getuid();
+}
+
+// Whoever is on the other end of the socket has to be the current user too
+static bool is_peer_trusted(int connection)
+{
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+
+    return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+        credentials.uid == getuid();
+}
+
+// Returns the connected socket or -1 if nobody (trusted) is listening
+static int connect_to_running_instance(struct sockaddr_un *address)
+{
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return -1;
+
+    if (connect(connection, (struct sockaddr*) address, sizeof(struct sockaddr_un)) != 0 ||
+        !is_peer_trusted(connection))
+    {
+        close(connection);
+        return -1;
+    }
+
+    return connection;
+}
+
+bool remote_control_forward(char *gemini_url)
+{
+    struct sockaddr_un address;
+    if (!get_socket_address(&address))
+        return false;
+
+    int connection = connect_to_running_instance(&address);
+    if (connection < 0)
+        return false;
+
+    // The URL and the new line are sent all at once, there's no need for a reply
+    size_t url_length = strlen(gemini_url);
+    char message[1025];
+    snprintf(message, sizeof(message), "%s\n", gemini_url);
+
+    bool has_succeeded = write(connection, message, url_length + 1) == url_length + 1;
+    close(connection);
+
+    return has_succeeded;
+}
+
+int remote_control_listen(void)
+{
+    struct sockaddr_un address;
+    if (!get_socket_address(&address))
+        return -1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0)
+        return -1;
+
+    // Nobody should be able to talk to this instance, apart from the current user
+    mode_t previous_mask = umask(0077);
+    int result = bind(listener, (struct sockaddr*) &address, sizeof(address));
+
+    // If the socket already exists but nobody answers, it was left behind by an instance that crashed
+    if (result != 0 && errno == EADDRINUSE)
+    {
+        int connection = connect_to_running_instance(&address);
+
+        if (connection < 0)
+        {
+            unlink(address.sun_path);
+            result = bind(listener, (struct sockaddr*) &address, sizeof(address));
+        }
+        else
+            close(connection);
+    }
+
+    umask(previous_mask);
+
+    if (result != 0 || listen(listener, 8) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+bool remote_control_receive(int listener, char *buffer, size_t max_length)
+{
+    int connection = accept(listener, NULL, NULL);
+    if (connection < 0)
+        return false;
+
+    if (!is_peer_trusted(connection))
+    {
+        close(connection);
+        return false;
+    }
+
+    // The sender writes everything right after connecting, so never wait for too long
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    size_t length = 0;
+    for (;;)
+    {
+        ssize_t bytes_read = read(connection, buffer + length, max_length - length);
+        if (bytes_read <= 0)
+            break;
+
+        length += bytes_read;
+
+        if (buffer[length - 1] == '\n' || length == max_length)
+            break;
+    }
+
+    close(connection);
+
+    // Only accept messages that have been terminated properly
+    if (length == 0 || buffer[length - 1] != '\n')
+        return false;
+
+    buffer[length - 1] = 0;
+    return true;
+}
+
+void remote_control_close(int listener)
+{
+    if (listener < 0)
+        return;
+
+    struct sockaddr_un address;
+    close(listener);
+
+    if (get_socket_address(&address))
+        unlink(address.sun_path);
+}
@@ -0,0 +1,42 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REMOTE_H
+#define _REMOTE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * A tiny protocol so that only a single interactive instance needs to run
+ * Every other invocation just sends its URL (terminated by a new line) over a Unix domain socket and quits
+ */
+
+// Returns true if a running instance has accepted the URL
+bool remote_control_forward(char *gemini_url);
+
+// Returns the listening socket or -1 if it could not be created
+// Sockets left behind by instances that crashed will be replaced
+int remote_control_listen(void);
+
+// Reads a single URL from a pending connection
+// Returns false if the connection did not deliver anything useful
+bool remote_control_receive(int listener, char *buffer, size_t max_length);
+
+void remote_control_close(int listener);
+
+#endif
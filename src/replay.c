@@ -0,0 +1,115 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "replay.h"
+#include "common.h"
+#include "config.h"
+#include <sys/timerfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A response that is held back until the recorded delay has passed
+typedef struct
+{
+    server_watcher_t watcher;
+    int timer;
+    server_client_t *client;
+    archive_record_t record;
+} delayed_response_t;
+
+static void respond_with_record(gemini_server_t *server, server_client_t *client, archive_record_t *record)
+{
+    // The header isn't NULL terminated inside the archive
+    char header[1030];
+    snprintf(header, sizeof(header), "%.*s", (int) record->header_length, record->header);
+
+    // The body is sent straight out of the mapping
+    gemini_server_respond(server, client, header, record->body, record->body_length, NULL, NULL);
+}
+
+static void on_delay_expired(gemini_server_t *server, void *data)
+{
+    delayed_response_t *response = data;
+
+    gemini_server_unwatch(server, response->timer);
+    close(response->timer);
+
+    respond_with_record(server, response->client, &response->record);
+    free(response);
+}
+
+// The connection and the handshake have already taken place for real
+// So only the time the origin capsule needed to start responding is waited for
+static uint64_t get_recorded_delay(archive_record_t *record)
+{
+    if (!record->header_received_after || record->header_received_after < record->handshaked_after)
+        return 0;
+
+    return record->header_received_after - record->handshaked_after;
+}
+
+static void on_replay_request(gemini_server_t *server, server_client_t *client, char *url)
+{
+    gemini_replay_t *replay = server->userdata;
+    archive_record_t record;
+
+    if (!archive_reader_lookup(&replay->reader, url, &record))
+    {
+        gemini_server_respond(server, client, "51 Not found in the archive", NULL, 0, NULL, NULL);
+        return;
+    }
+
+    uint64_t delay = replay->with_delays ? get_recorded_delay(&record) : 0;
+    int timer = delay ? timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) : -1;
+
+    if (timer < 0)
+    {
+        respond_with_record(server, client, &record);
+        return;
+    }
+
+    struct itimerspec expiration = {
+        .it_value.tv_sec = delay / 1000000,
+        .it_value.tv_nsec = (delay % 1000000) * 1000
+    };
+    timerfd_settime(timer, 0, &expiration, NULL);
+
+    delayed_response_t *response = malloc(sizeof(delayed_response_t));
+    response->timer = timer;
+    response->client = client;
+    response->record = record;
+    response->watcher.callback = on_delay_expired;
+    response->watcher.data = response;
+
+    // Clients waiting for the handler are never closed by the server, so the client will still be around
+    gemini_server_watch(server, timer, &response->watcher);
+}
+
+void gemini_replay_run(gemini_replay_t *replay, const char *archive_path, bool with_delays)
+{
+    if (!archive_reader_open(&replay->reader, archive_path))
+        exit_with_failure("failed to open the archive at %s", archive_path);
+
+    replay->with_delays = with_delays;
+
+    gemini_server_create(&replay->server, REPLAY_PORT, on_replay_request, replay);
+    fprintf(stderr, "{astrology} replaying %zu responses on gemini://localhost:%d/\n",
+            replay->reader.total_records, REPLAY_PORT);
+
+    gemini_server_run(&replay->server);
+}
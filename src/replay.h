@@ -0,0 +1,41 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <stdbool.h>
+#include "server.h"
+#include "archive.h"
+
+typedef struct
+{
+    gemini_server_t server;
+    archive_reader_t reader;
+
+    // Whether to wait as long as the origin capsule took to respond, before sending the response
+    bool with_delays;
+} gemini_replay_t;
+
+/*
+ * Serves the responses of an archive on REPLAY_PORT, just like a proxy would (the request line is the full URL)
+ * The same request always gets the same response, so benchmarks and offline browsing don't need the internet
+ * Unknown URLs get a 51 (not found) response
+ */
+void gemini_replay_run(gemini_replay_t *replay, const char *archive_path, bool with_delays);
+
+#endif
@@ -0,0 +1,259 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "resolver.h"
+#include "gemini.h"
+#include "common.h"
+#include "config.h"
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct resolver_job_t
+{
+    // The hostname with its scheme and port, the path doesn't matter
+    char key[1024];
+    resolver_address_t address;
+
+    // Jobs move from the queue to the helper threads and then to the completed ones
+    struct resolver_job_t *next;
+    // Only the owner goes through these
+    struct resolver_job_t *next_pending;
+};
+
+// Whatever the helper threads share with the owner, it's only freed once the last one of them lets go
+struct resolver_queue_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t has_jobs;
+
+    resolver_job_t *queued, *last_queued, *completed;
+    size_t total_threads, idle_threads, references;
+    bool is_closing;
+
+    int notification;
+};
+
+static void release_queue(resolver_queue_t *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool is_last = --queue->references == 0;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (!is_last)
+        return;
+
+    resolver_job_t *lists[] = {queue->queued, queue->completed};
+    for (int i = 0; i < 2; i++)
+    {
+        while (lists[i])
+        {
+            resolver_job_t *job = lists[i];
+            lists[i] = job->next;
+            free(job);
+        }
+    }
+
+    close(queue->notification);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->has_jobs);
+    free(queue);
+}
+
+// The lock must be held, the owner then finds out through the notification
+static void complete_job(resolver_queue_t *queue, resolver_job_t *job)
+{
+    job->next = queue->completed;
+    queue->completed = job;
+
+    uint64_t one = 1;
+    write(queue->notification, &one, sizeof(one));
+}
+
+static void resolve_job(resolver_job_t *job)
+{
+    if (!gemini_resolve_hostname(job->key, &job->address.address, &job->address.length))
+        job->address.length = 0;
+}
+
+static void* run_helper(void *data)
+{
+    resolver_queue_t *queue = data;
+    pthread_mutex_lock(&queue->lock);
+
+    for (;;)
+    {
+        while (!queue->queued && !queue->is_closing)
+        {
+            queue->idle_threads++;
+            pthread_cond_wait(&queue->has_jobs, &queue->lock);
+            queue->idle_threads--;
+        }
+
+        if (queue->is_closing)
+            break;
+
+        resolver_job_t *job = queue->queued;
+        queue->queued = job->next;
+        pthread_mutex_unlock(&queue->lock);
+
+        resolve_job(job);
+
+        pthread_mutex_lock(&queue->lock);
+        complete_job(queue, job);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    release_queue(queue);
+    return NULL;
+}
+
+void resolver_create(resolver_t *resolver)
+{
+    gemini_cache_create(&resolver->cache, RESOLVER_CACHE_SIZE, RESOLVER_LIFETIME * 1000000ULL);
+
+    resolver_queue_t *queue = calloc(1, sizeof(resolver_queue_t));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->has_jobs, NULL);
+    queue->references = 1;
+    queue->notification = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    resolver->queue = queue;
+    resolver->notification = queue->notification;
+    resolver->pending = NULL;
+}
+
+// Helper threads are only started once they're needed, and they stay around until the resolver is destroyed
+static void queue_job(resolver_t *resolver, resolver_job_t *job)
+{
+    resolver_queue_t *queue = resolver->queue;
+    pthread_mutex_lock(&queue->lock);
+
+    if (!queue->idle_threads && queue->total_threads < RESOLVER_THREADS)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, run_helper, queue) == 0)
+        {
+            pthread_detach(thread);
+            queue->total_threads++;
+            queue->references++;
+        }
+    }
+
+    // Without a single thread there's nobody else to do it, so it blocks after all
+    if (!queue->total_threads)
+    {
+        resolve_job(job);
+        complete_job(queue, job);
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+
+    job->next = NULL;
+    if (queue->queued)
+        queue->last_queued->next = job;
+    else
+        queue->queued = job;
+
+    queue->last_queued = job;
+    pthread_cond_signal(&queue->has_jobs);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+const resolver_address_t* resolver_lookup(resolver_t *resolver, const char *gemini_url, bool *is_pending)
+{
+    char key[1024];
+    snprintf(key, sizeof(key), "%.*s", get_hostname_length((char*) gemini_url), gemini_url);
+    *is_pending = false;
+
+    cache_entry_t *entry = gemini_cache_lookup(&resolver->cache, key);
+    if (entry)
+    {
+        resolver_address_t *address = entry->data;
+        return address->length ? address : NULL;
+    }
+
+    *is_pending = true;
+    for (resolver_job_t *job = resolver->pending; job; job = job->next_pending)
+        if (!strcmp(job->key, key))
+            return NULL;
+
+    resolver_job_t *job = malloc(sizeof(resolver_job_t));
+    strcpy(job->key, key);
+
+    job->next_pending = resolver->pending;
+    resolver->pending = job;
+
+    queue_job(resolver, job);
+    return NULL;
+}
+
+bool resolver_collect(resolver_t *resolver)
+{
+    uint64_t total_completed;
+    read(resolver->notification, &total_completed, sizeof(total_completed));
+
+    pthread_mutex_lock(&resolver->queue->lock);
+    resolver_job_t *completed = resolver->queue->completed;
+    resolver->queue->completed = NULL;
+    pthread_mutex_unlock(&resolver->queue->lock);
+
+    bool has_collected = completed != NULL;
+
+    while (completed)
+    {
+        resolver_job_t *job = completed;
+        completed = job->next;
+
+        resolver_job_t **link = &resolver->pending;
+        while (*link != job) link = &(*link)->next_pending;
+        *link = job->next_pending;
+
+        resolver_address_t *address = malloc(sizeof(resolver_address_t));
+        *address = job->address;
+
+        cache_entry_t *entry = gemini_cache_insert(&resolver->cache, job->key, address,
+                                                   sizeof(resolver_address_t), free);
+
+        // A host that's down might well be back soon, so failures are only remembered for a short while
+        if (!entry)
+            free(address);
+        else if (!address->length)
+            entry->expires_at = get_monotonic_time() + RESOLVER_FAILURE_LIFETIME * 1000000ULL;
+
+        free(job);
+    }
+
+    return has_collected;
+}
+
+void resolver_destroy(resolver_t *resolver)
+{
+    resolver_queue_t *queue = resolver->queue;
+
+    // Whatever is still queued will be freed along with the queue, the rest is owned by the helpers
+    pthread_mutex_lock(&queue->lock);
+    queue->is_closing = true;
+    pthread_cond_broadcast(&queue->has_jobs);
+    pthread_mutex_unlock(&queue->lock);
+
+    release_queue(queue);
+    gemini_cache_destroy(&resolver->cache);
+}
@@ -0,0 +1,67 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "cache.h"
+
+typedef struct
+{
+    struct sockaddr_storage address;
+    // Zero if the host couldn't be resolved
+    socklen_t length;
+} resolver_address_t;
+
+// A host that's being looked up, see resolver.c
+typedef struct resolver_job_t resolver_job_t;
+typedef struct resolver_queue_t resolver_queue_t;
+
+/*
+ * Remembers the addresses of the hosts that were looked up for RESOLVER_LIFETIME seconds
+ * Lookups block, so they're left to up to RESOLVER_THREADS helper threads, and the event loop never waits for them
+ * Otherwise it's not thread-safe on purpose: every worker keeps its own, and only ever sees the hosts it's assigned
+ */
+typedef struct
+{
+    gemini_cache_t cache;
+
+    // Becomes readable once some lookups have completed, resolver_collect must be called then
+    int notification;
+
+    // Every host that's still being looked up, so that it's never looked up twice at the same time
+    resolver_job_t *pending;
+    resolver_queue_t *queue;
+} resolver_t;
+
+void resolver_create(resolver_t *resolver);
+
+/*
+ * Returns the address of the URL's host if it's known, or NULL if it's not known yet or couldn't be resolved
+ * The two are told apart by is_pending, in which case it's being looked up and the notification will tell when
+ * The address only stays valid until the next call to resolver_collect
+ */
+const resolver_address_t* resolver_lookup(resolver_t *resolver, const char *gemini_url, bool *is_pending);
+
+// Remembers the lookups that have completed since the last time, returns false if there were none
+bool resolver_collect(resolver_t *resolver);
+
+// Lookups that are still running are left to finish on their own, nobody waits for them
+void resolver_destroy(resolver_t *resolver);
+
+#endif
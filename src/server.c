@@ -0,0 +1,621 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Needed for accept4
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "common.h"
+#include "config.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Creates a self-signed certificate for localhost, valid for ten years
+static void generate_server_certificate(EVP_PKEY **key, X509 **certificate)
+{
+    // Elliptic curve keys are tiny and way faster to generate than RSA ones
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    *key = NULL;
+
+    if (!key_ctx || EVP_PKEY_keygen_init(key_ctx) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(key_ctx, key) <= 0)
+    {
+        exit_with_failure("failed to generate the server's private key");
+    }
+
+    EVP_PKEY_CTX_free(key_ctx);
+
+    *certificate = X509_new();
+    X509_set_version(*certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(*certificate), (long) time(NULL));
+    X509_gmtime_adj(X509_getm_notBefore(*certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(*certificate), 10L * 365 * 24 * 60 * 60);
+    X509_set_pubkey(*certificate, *key);
+
+    // The certificate is signed by itself, so the subject is also the issuer
+    X509_NAME *name = X509_get_subject_name(*certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*) "localhost", -1, -1, 0);
+    X509_set_issuer_name(*certificate, name);
+
+    if (!X509_sign(*certificate, *key, EVP_sha256()))
+        exit_with_failure("failed to sign the server's certificate");
+}
+
+// Loads the certificate from the disk, it will be generated first if it doesn't exist yet
+static void load_server_certificate(SSL_CTX *ctx)
+{
+    EVP_PKEY *key = NULL;
+    X509 *certificate = NULL;
+
+    FILE *certificate_file = fopen(SERVER_CERTIFICATE_PATH, "r");
+    if (certificate_file)
+    {
+        key = PEM_read_PrivateKey(certificate_file, NULL, NULL, NULL);
+        certificate = PEM_read_X509(certificate_file, NULL, NULL, NULL);
+        fclose(certificate_file);
+    }
+
+    if (!key || !certificate)
+    {
+        EVP_PKEY_free(key);
+        X509_free(certificate);
+        generate_server_certificate(&key, &certificate);
+
+        // Storing it so that the clients will see the same certificate next time
+        certificate_file = fopen(SERVER_CERTIFICATE_PATH, "w");
+        if (!certificate_file)
+            exit_with_failure("failed to store the server's certificate at %s", SERVER_CERTIFICATE_PATH);
+
+        PEM_write_PrivateKey(certificate_file, key, NULL, NULL, 0, NULL, NULL);
+        PEM_write_X509(certificate_file, certificate);
+        fclose(certificate_file);
+    }
+
+    if (SSL_CTX_use_certificate(ctx, certificate) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1)
+        exit_with_failure("failed to use the server's certificate");
+
+    EVP_PKEY_free(key);
+    X509_free(certificate);
+}
+
+void gemini_server_watch(gemini_server_t *server, int fd, server_watcher_t *watcher)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = watcher
+    };
+
+    epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event);
+}
+
+void gemini_server_unwatch(gemini_server_t *server, int fd)
+{
+    epoll_ctl(server->epoll, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Other threads (e.g. the proxy's statistics) may be reading the amount while it changes
+static void count_clients(gemini_server_t *server, int change)
+{
+    __atomic_fetch_add(&server->total_clients, (size_t) change, __ATOMIC_RELAXED);
+}
+
+static void link_client(gemini_server_t *server, server_client_t *client)
+{
+    client->previous = NULL;
+    client->next = server->clients;
+
+    if (server->clients)
+        server->clients->previous = client;
+
+    server->clients = client;
+}
+
+static void unlink_client(gemini_server_t *server, server_client_t *client)
+{
+    if (client->previous)
+        client->previous->next = client->next;
+    else
+        server->clients = client->next;
+
+    if (client->next)
+        client->next->previous = client->previous;
+}
+
+// Gives the client another SERVE_CLIENT_TIMEOUT seconds, or no deadline at all while the handler is working
+static void set_deadline(gemini_server_t *server, server_client_t *client, bool has_deadline)
+{
+    client->deadline = has_deadline ? get_monotonic_time() + SERVE_CLIENT_TIMEOUT * 1000000ULL : 0;
+
+    if (client->deadline && (!server->next_deadline || client->deadline < server->next_deadline))
+        server->next_deadline = client->deadline;
+}
+
+static void close_client(gemini_server_t *server, server_client_t *client)
+{
+    gemini_server_unwatch(server, client->connection);
+    unlink_client(server, client);
+
+    if (client->state == SERVER_CLIENT_WRITING_RESPONSE)
+        SSL_shutdown(client->ssl);
+
+    if (client->release)
+        client->release(client->release_data);
+
+    SSL_free(client->ssl);
+    close(client->connection);
+
+    client->is_closed = true;
+    client->next_closed = server->closed_clients;
+    server->closed_clients = client;
+    count_clients(server, -1);
+}
+
+// Returns true if the TLS operation just needs to be retried once the socket is ready
+static bool should_retry_ssl_operation(server_client_t *client, int result)
+{
+    int error = SSL_get_error(client->ssl, result);
+    return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+}
+
+// Returns false if the client has been closed
+static bool write_response(gemini_server_t *server, server_client_t *client)
+{
+    size_t total_length = client->header_length + client->body_length;
+    size_t bytes_sent_before = client->bytes_sent;
+
+    while (client->bytes_sent < total_length)
+    {
+        // The header and the body are sent separately, so that the body never needs to be copied
+        const char *chunk;
+        size_t chunk_length;
+
+        if (client->bytes_sent < client->header_length)
+        {
+            chunk = client->header + client->bytes_sent;
+            chunk_length = client->header_length - client->bytes_sent;
+        }
+        else
+        {
+            chunk = client->body + client->bytes_sent - client->header_length;
+            chunk_length = total_length - client->bytes_sent;
+        }
+
+        int bytes_written = SSL_write(client->ssl, chunk, MIN(chunk_length, 1 << 30));
+        if (bytes_written <= 0)
+        {
+            if (should_retry_ssl_operation(client, bytes_written))
+            {
+                // Only a client that doesn't read anything at all is given up on, not a slow one
+                if (client->bytes_sent > bytes_sent_before)
+                    set_deadline(server, client, true);
+
+                return true;
+            }
+
+            break;
+        }
+
+        client->bytes_sent += bytes_written;
+    }
+
+    // Wait for the rest of the body, it's not up to the client when that arrives
+    if (client->is_streaming && client->bytes_sent == total_length)
+    {
+        set_deadline(server, client, false);
+        return true;
+    }
+
+    close_client(server, client);
+    return false;
+}
+
+static void on_client_ready(gemini_server_t *server, void *data)
+{
+    server_client_t *client = data;
+    if (client->is_closed)
+        return;
+
+    switch (client->state)
+    {
+    case SERVER_CLIENT_HANDSHAKING:
+    {
+        int result = SSL_accept(client->ssl);
+        if (result != 1)
+        {
+            if (!should_retry_ssl_operation(client, result))
+                close_client(server, client);
+
+            return;
+        }
+
+        client->state = SERVER_CLIENT_READING_REQUEST;
+    }
+    // Fall through
+
+    case SERVER_CLIENT_READING_REQUEST:
+        for (;;)
+        {
+            int bytes_read = SSL_read(client->ssl, client->request + client->request_length,
+                                      sizeof(client->request) - 1 - client->request_length);
+            if (bytes_read <= 0)
+            {
+                if (!should_retry_ssl_operation(client, bytes_read))
+                    close_client(server, client);
+
+                return;
+            }
+
+            client->request_length += bytes_read;
+            client->request[client->request_length] = 0;
+
+            char *request_end = strstr(client->request, "\r\n");
+            if (request_end)
+            {
+                *request_end = 0;
+                break;
+            }
+
+            // The request line is too long, just tell the client off
+            if (client->request_length >= sizeof(client->request) - 1)
+            {
+                gemini_server_respond(server, client, "59 Request is too long", NULL, 0, NULL, NULL);
+                return;
+            }
+        }
+
+        client->requested_at = get_monotonic_time();
+        client->state = SERVER_CLIENT_WAITING_FOR_HANDLER;
+        set_deadline(server, client, false);
+        server->handler(server, client, client->request);
+        return;
+
+    case SERVER_CLIENT_WAITING_FOR_HANDLER:
+    {
+        // Nothing to do until the handler responds
+        // Still, notice when the client hangs up so that the response isn't even written
+        // The handler might still be holding on to the client, so it's only closed once the response arrives
+        char byte;
+        ERR_clear_error();
+
+        int result = SSL_peek(client->ssl, &byte, 1);
+        if (result <= 0 && !should_retry_ssl_operation(client, result))
+            client->has_hung_up = true;
+
+        return;
+    }
+
+    case SERVER_CLIENT_WRITING_RESPONSE:
+        write_response(server, client);
+        return;
+    }
+}
+
+static void start_response(gemini_server_t *server, server_client_t *client, const char *header,
+                           const char *body, size_t body_length,
+                           item_deallocator_t release, void *release_data, bool is_streaming)
+{
+    client->is_streaming = is_streaming;
+    client->header_length = snprintf(client->header, sizeof(client->header), "%s\r\n", header);
+    client->header_length = MIN(client->header_length, sizeof(client->header) - 1);
+
+    client->body = body;
+    client->body_length = body_length;
+    client->bytes_sent = 0;
+    client->release = release;
+    client->release_data = release_data;
+
+    if (client->has_hung_up)
+    {
+        close_client(server, client);
+        return;
+    }
+
+    client->state = SERVER_CLIENT_WRITING_RESPONSE;
+    set_deadline(server, client, true);
+
+    // Most responses fit into the socket's buffer right away
+    write_response(server, client);
+}
+
+void gemini_server_respond(gemini_server_t *server, server_client_t *client, const char *header,
+                           const char *body, size_t body_length,
+                           item_deallocator_t release, void *release_data)
+{
+    start_response(server, client, header, body, body_length, release, release_data, false);
+}
+
+void gemini_server_respond_streaming(gemini_server_t *server, server_client_t *client, const char *header,
+                                     const char *body, size_t body_length,
+                                     item_deallocator_t release, void *release_data)
+{
+    start_response(server, client, header, body, body_length, release, release_data, true);
+}
+
+void gemini_server_stream_body(gemini_server_t *server, server_client_t *client,
+                               const char *body, size_t body_length, bool is_complete)
+{
+    if (client->is_closed)
+        return;
+
+    client->body = body;
+    client->body_length = body_length;
+    client->is_streaming = !is_complete;
+
+    // Whatever is left is now up to the client again
+    set_deadline(server, client, true);
+    write_response(server, client);
+}
+
+static void on_new_connection(gemini_server_t *server, void *data)
+{
+    // Accept everyone that's waiting, the listener is edge-triggered
+    int connection;
+    while ((connection = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        // Responses are written as soon as they're ready, small writes should never wait for an ACK
+        int enabled = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+
+        server_client_t *client = calloc(1, sizeof(server_client_t));
+        client->connection = connection;
+        client->state = SERVER_CLIENT_HANDSHAKING;
+
+        client->ssl = SSL_new(server->ssl_ctx);
+        SSL_set_fd(client->ssl, connection);
+
+        client->watcher.callback = on_client_ready;
+        client->watcher.data = client;
+        gemini_server_watch(server, connection, &client->watcher);
+
+        // Both the handshake and the request line have to be done by then
+        link_client(server, client);
+        set_deadline(server, client, true);
+
+        count_clients(server, 1);
+    }
+}
+
+// Adopts the clients that other servers have handed over
+static void on_handoff(gemini_server_t *server, void *data)
+{
+    server_client_t *clients[64];
+    ssize_t bytes_read;
+
+    // Every pointer was written at once, so they can only ever be read whole
+    while ((bytes_read = read(server->handoff[0], clients, sizeof(clients))) > 0)
+    {
+        for (size_t i = 0; i < bytes_read / sizeof(server_client_t*); i++)
+        {
+            server_client_t *client = clients[i];
+            count_clients(server, 1);
+            link_client(server, client);
+
+            gemini_server_watch(server, client->connection, &client->watcher);
+            server->handler(server, client, client->request);
+        }
+    }
+}
+
+// Only one of the servers that share a listener gets woken up for every connection
+static void watch_listener(gemini_server_t *server)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE,
+        .data.ptr = &server->listener_watcher
+    };
+
+    epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->listener, &event);
+}
+
+// Everything but the listener
+static void initialize_server(gemini_server_t *server, server_request_handler_t handler, void *userdata)
+{
+    // Clients hanging up early should never bring the whole server down
+    signal(SIGPIPE, SIG_IGN);
+
+    server->ssl_ctx = SSL_CTX_new(TLS_server_method());
+    if (!server->ssl_ctx)
+        exit_with_failure("failed to initialize TLS server context");
+
+    // The response body might be moved around while partially written
+    SSL_CTX_set_mode(server->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    load_server_certificate(server->ssl_ctx);
+
+    server->epoll = epoll_create1(0);
+    if (server->epoll < 0)
+        exit_with_failure("failed to create the event loop");
+
+    if (pipe2(server->handoff, O_NONBLOCK | O_CLOEXEC) != 0)
+        exit_with_failure("failed to create the event loop");
+
+    server->handoff_watcher.callback = on_handoff;
+    server->handoff_watcher.data = NULL;
+    gemini_server_watch(server, server->handoff[0], &server->handoff_watcher);
+
+    server->listener_watcher.callback = on_new_connection;
+    server->listener_watcher.data = NULL;
+
+    server->handler = handler;
+    server->userdata = userdata;
+    server->deadline_handler = NULL;
+    server->clients = NULL;
+    server->next_deadline = 0;
+    server->total_clients = 0;
+    server->closed_clients = NULL;
+    server->handed_over_clients = NULL;
+}
+
+void gemini_server_create(gemini_server_t *server, int port, server_request_handler_t handler, void *userdata)
+{
+    initialize_server(server, handler, userdata);
+
+    server->listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    if (server->listener < 0)
+        exit_with_failure("failed to initialize TCP socket");
+
+    int enabled = 1;
+    setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+
+    // Only listening on the loopback interface, this is not meant to be exposed to the world
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+
+    if (bind(server->listener, (struct sockaddr*) &address, sizeof(address)) != 0)
+        exit_with_failure("failed to bind to port %d, is it already in use?", port);
+
+    if (listen(server->listener, SOMAXCONN) != 0)
+        exit_with_failure("failed to listen on port %d", port);
+
+    watch_listener(server);
+}
+
+void gemini_server_create_sibling(gemini_server_t *server, const gemini_server_t *first,
+                                  server_request_handler_t handler, void *userdata)
+{
+    initialize_server(server, handler, userdata);
+
+    // Both servers accept from the very same socket, each one through a descriptor of its own
+    server->listener = dup(first->listener);
+    if (server->listener < 0)
+        exit_with_failure("failed to share the listening socket");
+
+    watch_listener(server);
+}
+
+void gemini_server_hand_over(gemini_server_t *server, server_client_t *client, gemini_server_t *target)
+{
+    // Events of the current batch might still point to the client, so it only leaves once they've been handled
+    gemini_server_unwatch(server, client->connection);
+    unlink_client(server, client);
+    count_clients(server, -1);
+
+    client->new_owner = target;
+    client->next_handed_over = server->handed_over_clients;
+    server->handed_over_clients = client;
+}
+
+// Sends the clients that were handed over to their new servers
+static void send_handed_over_clients(gemini_server_t *server)
+{
+    while (server->handed_over_clients)
+    {
+        server_client_t *client = server->handed_over_clients;
+        server->handed_over_clients = client->next_handed_over;
+
+        if (write(client->new_owner->handoff[1], &client, sizeof(client)) == sizeof(client))
+            continue;
+
+        // The other server is swamped, tell the client to come back later instead of waiting on it
+        count_clients(server, 1);
+        link_client(server, client);
+        gemini_server_watch(server, client->connection, &client->watcher);
+        gemini_server_respond(server, client, "44 The server is busy, please try again later", NULL, 0, NULL, NULL);
+    }
+}
+
+// Drops the clients that are past their deadline, nothing is done until the earliest one has passed
+static void expire_clients(gemini_server_t *server)
+{
+    uint64_t now = get_monotonic_time();
+    if (!server->next_deadline || server->next_deadline > now)
+        return;
+
+    server->next_deadline = 0;
+    server_client_t *next;
+
+    for (server_client_t *client = server->clients; client; client = next)
+    {
+        // Closing the client takes it out of the list
+        next = client->next;
+
+        if (client->deadline && client->deadline <= now)
+            close_client(server, client);
+        else if (client->deadline && (!server->next_deadline || client->deadline < server->next_deadline))
+            server->next_deadline = client->deadline;
+    }
+}
+
+// How long the loop may sleep before a deadline passes (in milliseconds), -1 if there is none
+static int get_timeout(uint64_t first_deadline, uint64_t second_deadline)
+{
+    uint64_t deadline = !first_deadline ? second_deadline :
+        !second_deadline ? first_deadline : MIN(first_deadline, second_deadline);
+
+    if (!deadline)
+        return -1;
+
+    // Rounded up, so that the loop doesn't spin for the last millisecond before a deadline
+    uint64_t now = get_monotonic_time();
+    return deadline > now ? (deadline - now + 999) / 1000 : 0;
+}
+
+void gemini_server_run(gemini_server_t *server)
+{
+    struct epoll_event events[64];
+    uint64_t handler_deadline = 0;
+
+    for (;;)
+    {
+        int total_events = epoll_wait(server->epoll, events, 64, get_timeout(server->next_deadline, handler_deadline));
+
+        for (int i = 0; i < total_events; i++)
+        {
+            server_watcher_t *watcher = events[i].data.ptr;
+            watcher->callback(server, watcher->data);
+        }
+
+        expire_clients(server);
+        if (server->deadline_handler)
+            handler_deadline = server->deadline_handler(server);
+
+        // It's now safe to let go of the clients that were handed over and to get rid of the ones that were closed
+        send_handed_over_clients(server);
+
+        while (server->closed_clients)
+        {
+            server_client_t *client = server->closed_clients;
+            server->closed_clients = client->next_closed;
+            free(client);
+        }
+    }
+}
+
+void gemini_server_destroy(gemini_server_t *server)
+{
+    close(server->handoff[0]);
+    close(server->handoff[1]);
+    close(server->epoll);
+    close(server->listener);
+    SSL_CTX_free(server->ssl_ctx);
+}
@@ -0,0 +1,179 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <openssl/ssl.h>
+#include "doubly_linked.h"
+
+typedef struct gemini_server_t gemini_server_t;
+
+// Gets called whenever a watched file descriptor becomes ready
+typedef void (*server_watch_callback_t) (gemini_server_t *server, void *data);
+
+// Every file descriptor of the event loop is associated with one of these
+typedef struct
+{
+    server_watch_callback_t callback;
+    void *data;
+} server_watcher_t;
+
+typedef enum
+{
+    SERVER_CLIENT_HANDSHAKING,
+    SERVER_CLIENT_READING_REQUEST,
+    SERVER_CLIENT_WAITING_FOR_HANDLER,
+    SERVER_CLIENT_WRITING_RESPONSE
+} server_client_state_e;
+
+typedef struct server_client_t
+{
+    SSL *ssl;
+    int connection;
+    server_watcher_t watcher;
+    server_client_state_e state;
+
+    // Closed clients are only freed once the current batch of events has been handled
+    // Otherwise, a later event of the same batch could end up pointing to freed memory
+    bool is_closed;
+    struct server_client_t *next_closed;
+
+    // Clients that are handed over to another server only leave once the current batch has been handled too
+    gemini_server_t *new_owner;
+    struct server_client_t *next_handed_over;
+
+    // A request line is at most 1024 bytes long, plus \r\n and a NULL byte
+    char request[1027];
+    size_t request_length;
+
+    // The response header is copied, but the body is borrowed
+    char header[1030];
+    size_t header_length;
+    const char *body;
+    size_t body_length;
+    size_t bytes_sent;
+
+    item_deallocator_t release;
+    void *release_data;
+
+    // The body may still be growing, so the connection is kept open even once everything has been sent
+    bool is_streaming;
+
+    // The client went away while the handler was still working on its response, which is then just dropped
+    bool has_hung_up;
+
+    // Monotonic timestamp of when the request line was fully received
+    uint64_t requested_at;
+
+    // The client is dropped if it hasn't made any progress by then, zero while it's the handler that is working
+    uint64_t deadline;
+
+    // Every client that belongs to the server, so that the ones past their deadline can be found
+    struct server_client_t *previous, *next;
+
+    // Free for the request handler to use
+    void *userdata;
+} server_client_t;
+
+// Gets called once the request line of a client has been received
+// The handler must eventually reply by calling gemini_server_respond, either right away or later on
+typedef void (*server_request_handler_t) (gemini_server_t *server, server_client_t *client, char *url);
+
+// Gets called after every batch of events, to give up on whatever the handler has been waiting on for too long
+// Returns the earliest deadline of whatever is left (or 0 if there is none), the loop wakes up by then at the latest
+typedef uint64_t (*server_deadline_handler_t) (gemini_server_t *server);
+
+struct gemini_server_t
+{
+    SSL_CTX *ssl_ctx;
+    int listener;
+    int epoll;
+
+    server_watcher_t listener_watcher;
+    server_request_handler_t handler;
+    void *userdata;
+
+    // Optional, can be set right after the server has been created
+    server_deadline_handler_t deadline_handler;
+
+    // Never later than the earliest deadline of the clients, or 0 if none of them has one
+    server_client_t *clients;
+    uint64_t next_deadline;
+
+    // Only ever changed through relaxed atomics, so that other threads can read it
+    size_t total_clients;
+    server_client_t *closed_clients;
+
+    // Other servers (on other threads) hand their clients over by writing pointers to them into this pipe
+    int handoff[2];
+    server_watcher_t handoff_watcher;
+    server_client_t *handed_over_clients;
+};
+
+/*
+ * Starts listening for TLS connections on the given loopback port
+ * The certificate is generated once and then stored at SERVER_CERTIFICATE_PATH, so clients can pin it
+ */
+void gemini_server_create(gemini_server_t *server, int port, server_request_handler_t handler, void *userdata);
+
+/*
+ * Another server on the same port, with a context and an event loop of its own, meant to run on another thread
+ * Every new connection is accepted by only one of the servers that share the port, whichever is woken up
+ */
+void gemini_server_create_sibling(gemini_server_t *server, const gemini_server_t *first,
+                                  server_request_handler_t handler, void *userdata);
+
+/*
+ * Moves a client whose request line has been received over to another server, which runs on another thread
+ * The other server's handler is then called with the same request line, from that server's own thread
+ * The client must not be touched anymore after this
+ */
+void gemini_server_hand_over(gemini_server_t *server, server_client_t *client, gemini_server_t *target);
+
+// Makes the event loop wait on an external file descriptor (e.g. an upstream connection)
+// The descriptor is edge-triggered for both reading and writing, so always drain it completely
+void gemini_server_watch(gemini_server_t *server, int fd, server_watcher_t *watcher);
+void gemini_server_unwatch(gemini_server_t *server, int fd);
+
+/*
+ * Queues the response and closes the connection once it has been sent
+ * The body is not copied, it's only borrowed until the release callback is called (if there is one)
+ */
+void gemini_server_respond(gemini_server_t *server, server_client_t *client, const char *header,
+                           const char *body, size_t body_length,
+                           item_deallocator_t release, void *release_data);
+
+/*
+ * Same as gemini_server_respond, but the body is allowed to grow (or move) later on
+ * Every time more of it becomes available, gemini_server_stream_body must be called with its new location
+ * The connection is only closed once the body is complete and has been sent
+ */
+void gemini_server_respond_streaming(gemini_server_t *server, server_client_t *client, const char *header,
+                                     const char *body, size_t body_length,
+                                     item_deallocator_t release, void *release_data);
+void gemini_server_stream_body(gemini_server_t *server, server_client_t *client,
+                               const char *body, size_t body_length, bool is_complete);
+
+// Runs the event loop forever
+void gemini_server_run(gemini_server_t *server);
+void gemini_server_destroy(gemini_server_t *server);
+
+#endif
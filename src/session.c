@@ -0,0 +1,270 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "session.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// "ASTS" when read as little endian
+#define SESSION_MAGIC 0x53545341
+#define SESSION_VERSION 3
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_pages;
+
+    // Snapshots from machines with a different word size cannot be mapped directly
+    uint32_t word_size;
+
+    // The stored elements of a text/plain page must not be treated as gemtext once restored
+    uint32_t is_plain_text;
+
+    // Both are zero if the current page had no content
+    uint64_t content_offset;
+    uint64_t elements_offset;
+} session_header_t;
+
+// Followed by the URL itself, without a NULL byte
+typedef struct
+{
+    uint32_t url_length;
+    int32_t scroll_offset;
+} session_page_t;
+
+// Pads the file with zeros so that the arrays end up properly aligned inside the mapping
+static uint64_t align_file_offset(FILE *file)
+{
+    long offset = ftell(file);
+
+    while (offset % sizeof(size_t))
+    {
+        fputc(0, file);
+        offset++;
+    }
+
+    return offset;
+}
+
+// Writes the array along with its header, so it looks exactly as it would on the heap
+static void write_dynamic_array(FILE *file, dyn_array_t array, size_t extra_items)
+{
+    size_t item_size = *DYN_ARRAY_GET_ATTRIBUTE(array, DYN_ARRAY_ITEM_SIZE);
+    size_t header[DYN_ARRAY_HEADER_SIZE] = {
+        [DYN_ARRAY_LENGTH] = DYN_ARRAY_LENGTH(array),
+        [DYN_ARRAY_CAPACITY] = DYN_ARRAY_LENGTH(array) + extra_items,
+        [DYN_ARRAY_ITEM_SIZE] = item_size,
+        [DYN_ARRAY_ALLOCATOR] = 0
+    };
+
+    fwrite(header, sizeof(size_t), DYN_ARRAY_HEADER_SIZE, file);
+    fwrite(array, item_size, DYN_ARRAY_LENGTH(array) + extra_items, file);
+}
+
+void session_save(gemini_browser_t *browser, const char *path)
+{
+    // The previous snapshot might still be mapped, so it must never be overwritten in place
+    char temporary_path[1024];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    FILE *session_file = fopen(temporary_path, "wb");
+    if (!session_file)
+        return;
+
+    session_header_t header = {
+        .magic = SESSION_MAGIC,
+        .version = SESSION_VERSION,
+        .total_pages = browser->pages.length,
+        .word_size = sizeof(size_t)
+    };
+
+    // The header is written again at the end, once the offsets are known
+    fwrite(&header, sizeof(header), 1, session_file);
+
+    // Start from the oldest page, so that the history can be rebuilt by just inserting the pages in order
+    for (doubly_node_t *node = browser->pages.tail; node; node = node->next)
+    {
+        gemini_page_t *page = node->data;
+        session_page_t record = {
+            .url_length = strlen(page->document->url),
+            .scroll_offset = page->scroll_offset
+        };
+
+        fwrite(&record, sizeof(record), 1, session_file);
+        fwrite(page->document->url, sizeof(char), record.url_length, session_file);
+    }
+
+    gemini_page_t *current_page = browser->pages.head ? browser->pages.head->data : NULL;
+
+    // A page that's still being parsed is simply opened again, there's no table to store yet
+    if (current_page && current_page->document->content && current_page->document->elements &&
+        !current_page->document->is_partially_parsed)
+    {
+        // The terminating NULL byte is also stored
+        header.is_plain_text = current_page->document->is_plain_text;
+        header.content_offset = align_file_offset(session_file);
+        write_dynamic_array(session_file, current_page->document->content, 1);
+
+        header.elements_offset = align_file_offset(session_file);
+        write_dynamic_array(session_file, current_page->document->elements, 0);
+    }
+
+    fseek(session_file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, session_file);
+
+    bool has_failed = ferror(session_file);
+    fclose(session_file);
+
+    if (has_failed)
+        unlink(temporary_path);
+    else
+        rename(temporary_path, path);
+}
+
+// Returns a pointer to the array's data, or NULL if the array doesn't fit inside the mapping
+static dyn_array_t map_dynamic_array(char *mapping, size_t mapping_size, uint64_t offset, size_t item_size)
+{
+    size_t header_size = DYN_ARRAY_HEADER_SIZE * sizeof(size_t);
+
+    if (offset % sizeof(size_t) || offset + header_size > mapping_size)
+        return NULL;
+
+    size_t *header = (size_t*) (mapping + offset);
+    if (header[DYN_ARRAY_ITEM_SIZE] != item_size || header[DYN_ARRAY_ALLOCATOR] != 0 ||
+        header[DYN_ARRAY_CAPACITY] < header[DYN_ARRAY_LENGTH] ||
+        header[DYN_ARRAY_CAPACITY] > (mapping_size - offset - header_size) / item_size)
+    {
+        return NULL;
+    }
+
+    return header + DYN_ARRAY_HEADER_SIZE;
+}
+
+// Makes sure that a corrupted snapshot cannot make the viewer read out of bounds
+static bool validate_mapped_document(gemini_document_t *document)
+{
+    size_t content_length = DYN_ARRAY_LENGTH(document->content);
+
+    if (*DYN_ARRAY_GET_ATTRIBUTE(document->content, DYN_ARRAY_CAPACITY) != content_length + 1 ||
+        document->content[content_length] != 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < DYN_ARRAY_LENGTH(document->elements); i++)
+    {
+        gemtext_line_t *element = &document->elements[i];
+
+        if (element->start > element->end + 1 || element->end > content_length)
+            return false;
+    }
+
+    return true;
+}
+
+bool session_restore(gemini_browser_t *browser, const char *path)
+{
+    int session_file = open(path, O_RDONLY);
+    if (session_file < 0)
+        return false;
+
+    struct stat file_info;
+    if (fstat(session_file, &file_info) != 0 || file_info.st_size < sizeof(session_header_t))
+    {
+        close(session_file);
+        return false;
+    }
+
+    // A private mapping, only the pages that are actually touched will be read from the disk
+    size_t mapping_size = file_info.st_size;
+    char *mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, session_file, 0);
+    close(session_file);
+
+    if (mapping == MAP_FAILED)
+        return false;
+
+    session_header_t *header = (session_header_t*) mapping;
+    if (header->magic != SESSION_MAGIC || header->version != SESSION_VERSION ||
+        header->word_size != sizeof(size_t) || header->total_pages == 0)
+    {
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    size_t offset = sizeof(session_header_t);
+    gemini_page_t *page = NULL;
+
+    for (uint32_t i = 0; i < header->total_pages; i++)
+    {
+        session_page_t record;
+        if (offset + sizeof(record) > mapping_size)
+            break;
+
+        memcpy(&record, mapping + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (record.url_length > mapping_size - offset || record.url_length > 1023)
+            break;
+
+        // The pages will only keep their URL until they are visited again
+        char url[1024];
+        memcpy(url, mapping + offset, record.url_length);
+        url[record.url_length] = 0;
+        offset += record.url_length;
+
+        page = malloc(sizeof(gemini_page_t));
+        page->document = gemini_document_create(url);
+        page->scroll_offset = MAX(record.scroll_offset, 0);
+
+        doubly_linked_insert_first(&browser->pages, page);
+    }
+
+    // The body of the current page can be used straight out of the mapping, without any copies
+    if (page && header->content_offset && header->elements_offset)
+    {
+        gemini_document_t *document = page->document;
+        document->content = map_dynamic_array(mapping, mapping_size, header->content_offset, sizeof(char));
+        document->elements = map_dynamic_array(mapping, mapping_size, header->elements_offset, sizeof(gemtext_line_t));
+
+        if (document->content && document->elements && validate_mapped_document(document))
+        {
+            document->mapping = mapping;
+            document->mapping_size = mapping_size;
+            document->is_plain_text = header->is_plain_text;
+
+            size_t total_elements = DYN_ARRAY_LENGTH(document->elements);
+            page->scroll_offset = MIN(page->scroll_offset, total_elements ? total_elements - 1 : 0);
+
+            return true;
+        }
+
+        document->content = NULL;
+        document->elements = NULL;
+    }
+
+    munmap(mapping, mapping_size);
+    return false;
+}
@@ -0,0 +1,35 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <stdbool.h>
+#include "browser.h"
+
+/*
+ * The session is stored as a compact binary snapshot:
+ * <header> <page records, oldest first> <padding> <content array> <elements array>
+ * Both arrays are written with their dynamic array headers, so they can be used straight out of the mapping
+ * Only the current page keeps its body, the rest of the history is reloaded once it's visited
+ */
+void session_save(gemini_browser_t *browser, const char *path);
+
+// Returns true if a session was found and the current page could be restored
+bool session_restore(gemini_browser_t *browser, const char *path);
+
+#endif
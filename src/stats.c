@@ -0,0 +1,292 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "common.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// "ASTH" when read as little endian
+#define STATS_MAGIC 0x48545341
+#define STATS_VERSION 1
+
+// Followed by the host records themselves, exactly as they are in memory
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_hosts;
+
+    // Files written with a different histogram layout are simply ignored
+    uint32_t host_size;
+} stats_file_header_t;
+
+static const char *phase_names[TOTAL_STATS_PHASES] = {
+    [STATS_RESOLVE] = "resolve",
+    [STATS_CONNECT] = "connect",
+    [STATS_HANDSHAKE] = "handshake",
+    [STATS_TTFB] = "ttfb",
+    [STATS_TRANSFER] = "transfer",
+    [STATS_PARSE] = "parse"
+};
+
+/*
+ * The first two powers of two get a bucket per value, every following one is split into STATS_SUB_BUCKETS
+ * The index ends up being the amount of discarded bits followed by the remaining top bits of the value
+ */
+static size_t get_bucket_index(uint64_t value)
+{
+    value = MIN(value, STATS_MAX_VALUE);
+
+    int highest_bit = value ? 63 - __builtin_clzll(value) : 0;
+    int shift = MAX(highest_bit - STATS_SUB_BUCKET_BITS, 0);
+
+    return shift * STATS_SUB_BUCKETS + (value >> shift);
+}
+
+// Returns the middle of the range of values that fall into the bucket
+static uint64_t get_bucket_value(size_t index)
+{
+    int shift = index < 2 * STATS_SUB_BUCKETS ? 0 : index / STATS_SUB_BUCKETS - 1;
+    uint64_t lowest_value = (uint64_t) (index - shift * STATS_SUB_BUCKETS) << shift;
+
+    return lowest_value + ((1ull << shift) >> 1);
+}
+
+void stats_histogram_add(stats_histogram_t *histogram, uint64_t value)
+{
+    histogram->buckets[get_bucket_index(value)]++;
+    histogram->total_samples++;
+}
+
+void stats_rolling_histogram_add(stats_rolling_histogram_t *rolling, uint64_t value)
+{
+    uint32_t *sample = &rolling->samples[rolling->total_samples % STATS_ROLLING_WINDOW];
+    stats_histogram_t *histogram = &rolling->histogram;
+
+    if (rolling->total_samples >= STATS_ROLLING_WINDOW)
+    {
+        histogram->buckets[get_bucket_index(*sample)]--;
+        histogram->total_samples--;
+    }
+
+    *sample = MIN(value, STATS_MAX_VALUE);
+    stats_histogram_add(histogram, *sample);
+    rolling->total_samples++;
+}
+
+uint64_t stats_histogram_get_percentile(stats_histogram_t *histogram, double percentile)
+{
+    if (!histogram->total_samples)
+        return 0;
+
+    // The smallest value that at least this many samples are less than or equal to
+    uint64_t rank = MAX((uint64_t) (percentile / 100 * histogram->total_samples + 0.5), 1);
+    uint64_t total_samples = 0;
+
+    for (size_t i = 0; i < STATS_TOTAL_BUCKETS; i++)
+    {
+        total_samples += histogram->buckets[i];
+        if (total_samples >= rank)
+            return get_bucket_value(i);
+    }
+
+    return get_bucket_value(STATS_TOTAL_BUCKETS - 1);
+}
+
+void gemini_stats_create(gemini_stats_t *stats, const char *path)
+{
+    stats->hosts = dyn_array_create_with_allocator(4, sizeof(stats_host_t), memory_get_allocator(MEMORY_STATS));
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return;
+
+    stats_file_header_t header;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == STATS_MAGIC &&
+        header.version == STATS_VERSION && header.host_size == sizeof(stats_host_t))
+    {
+        stats->hosts = dyn_array_resize_to_fit(stats->hosts, header.total_hosts);
+
+        // A truncated file still keeps whatever hosts were read in full
+        DYN_ARRAY_LENGTH(stats->hosts) = fread(stats->hosts, sizeof(stats_host_t), header.total_hosts, file);
+
+        for (size_t i = 0; i < DYN_ARRAY_LENGTH(stats->hosts); i++)
+            stats->hosts[i].hostname[sizeof(stats->hosts[i].hostname) - 1] = 0;
+    }
+
+    fclose(file);
+}
+
+void gemini_stats_save(gemini_stats_t *stats, const char *path)
+{
+    char temporary_path[1024];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    FILE *file = fopen(temporary_path, "wb");
+    if (!file)
+        return;
+
+    stats_file_header_t header = {
+        .magic = STATS_MAGIC,
+        .version = STATS_VERSION,
+        .total_hosts = DYN_ARRAY_LENGTH(stats->hosts),
+        .host_size = sizeof(stats_host_t)
+    };
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(stats->hosts, sizeof(stats_host_t), DYN_ARRAY_LENGTH(stats->hosts), file);
+
+    bool has_failed = ferror(file);
+    fclose(file);
+
+    if (has_failed)
+        unlink(temporary_path);
+    else
+        rename(temporary_path, path);
+}
+
+// Creates the host if it's the first time it's been seen, returns NULL for anything but gemini URLs
+static stats_host_t* get_host(gemini_stats_t *stats, const char *url)
+{
+    if (strncmp(url, "gemini://", 9))
+        return NULL;
+
+    char hostname[256];
+    size_t hostname_length = MIN(get_hostname_length((char*) url), sizeof(hostname) - 1);
+
+    memcpy(hostname, url, hostname_length);
+    hostname[hostname_length] = 0;
+
+    uint64_t hash = hash_bytes(hostname, hostname_length);
+
+    // There are only ever a few dozen hosts, so a linear search is more than fine
+    for (size_t i = 0; i < DYN_ARRAY_LENGTH(stats->hosts); i++)
+    {
+        if (stats->hosts[i].hash == hash && !strcmp(stats->hosts[i].hostname, hostname))
+            return &stats->hosts[i];
+    }
+
+    stats->hosts = dyn_array_prepare_new_item(stats->hosts);
+    stats_host_t *host = &DYN_ARRAY_GET_LAST(stats->hosts);
+
+    memset(host, 0, sizeof(stats_host_t));
+    memcpy(host->hostname, hostname, hostname_length + 1);
+    host->hash = hash;
+
+    return host;
+}
+
+// Phases that were never reached (e.g. after a failed lookup) are skipped
+static void add_phase(stats_host_t *host, stats_phase_e phase, uint64_t start, uint64_t end)
+{
+    if (start && end >= start)
+        stats_histogram_add(&host->phases[phase], end - start);
+}
+
+void gemini_stats_record_fetch(gemini_stats_t *stats, const char *url, gemini_timings_t *timings)
+{
+    stats_host_t *host = get_host(stats, url);
+    if (!host)
+        return;
+
+    add_phase(host, STATS_RESOLVE, timings->started_at, timings->resolved_at);
+    add_phase(host, STATS_CONNECT, timings->resolved_at, timings->connected_at);
+    add_phase(host, STATS_HANDSHAKE, timings->connected_at, timings->handshaked_at);
+    add_phase(host, STATS_TTFB, timings->started_at, timings->header_received_at);
+    add_phase(host, STATS_TRANSFER, timings->header_received_at, timings->finished_at);
+    add_phase(host, STATS_PARSE, timings->finished_at, timings->parsed_at);
+
+    host->misses++;
+}
+
+void gemini_stats_record_hit(gemini_stats_t *stats, const char *url)
+{
+    stats_host_t *host = get_host(stats, url);
+    if (host)
+        host->hits++;
+}
+
+static int compare_hosts_by_visits(const void *first, const void *second)
+{
+    const stats_host_t *a = *(const stats_host_t**) first, *b = *(const stats_host_t**) second;
+    uint64_t a_visits = a->hits + a->misses, b_visits = b->hits + b->misses;
+
+    return a_visits < b_visits ? 1 : a_visits > b_visits ? -1 : strcmp(a->hostname, b->hostname);
+}
+
+// A percentile in milliseconds, or a dash if nothing was ever measured
+static DYN_ARRAY(char) append_percentile(DYN_ARRAY(char) page, stats_histogram_t *histogram, double percentile)
+{
+    if (!histogram->total_samples)
+        return append_format(page, "%10s", "-");
+
+    return append_format(page, "%10.1f", stats_histogram_get_percentile(histogram, percentile) / 1000.0);
+}
+
+DYN_ARRAY(char) gemini_stats_create_page(gemini_stats_t *stats)
+{
+    DYN_ARRAY(char) page = dyn_array_create(4096, sizeof(char));
+    page = append_format(page, "# Statistics\n"
+                         "Every fetch since the statistics were first collected, per host. "
+                         "Latencies are in milliseconds, hits are pages that were shown straight out of the history\n");
+
+    size_t total_hosts = DYN_ARRAY_LENGTH(stats->hosts);
+    if (!total_hosts)
+        return append_format(page, "\nNothing has been fetched yet.\n");
+
+    stats_host_t **hosts = malloc(total_hosts * sizeof(stats_host_t*));
+    for (size_t i = 0; i < total_hosts; i++)
+        hosts[i] = &stats->hosts[i];
+
+    qsort(hosts, total_hosts, sizeof(stats_host_t*), compare_hosts_by_visits);
+
+    for (size_t i = 0; i < total_hosts; i++)
+    {
+        stats_host_t *host = hosts[i];
+        uint64_t visits = host->hits + host->misses;
+
+        page = append_format(page, "\n## %s\n", host->hostname + 9);
+        page = append_format(page, "%lu fetches and %lu hits, a %.0f%% hit rate\n",
+                             host->misses, host->hits, visits ? 100.0 * host->hits / visits : 0.0);
+
+        page = append_format(page, "```\n%-10s%10s%10s%10s%10s\n", "phase", "samples", "p50", "p90", "p99");
+        for (int j = 0; j < TOTAL_STATS_PHASES; j++)
+        {
+            stats_histogram_t *histogram = &host->phases[j];
+
+            page = append_format(page, "%-10s%10lu", phase_names[j], histogram->total_samples);
+            page = append_percentile(page, histogram, 50);
+            page = append_percentile(page, histogram, 90);
+            page = append_percentile(page, histogram, 99);
+            page = append_format(page, "\n");
+        }
+
+        page = append_format(page, "```\n=> %s/ Visit %s\n", host->hostname, host->hostname + 9);
+    }
+
+    free(hosts);
+    return page;
+}
+
+void gemini_stats_destroy(gemini_stats_t *stats)
+{
+    dyn_array_destroy(stats->hosts);
+}
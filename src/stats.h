@@ -0,0 +1,102 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gemini.h"
+#include "dynamic_array.h"
+
+typedef enum
+{
+    STATS_RESOLVE,
+    STATS_CONNECT,
+    STATS_HANDSHAKE,
+    // From the start of the request until the header arrives, so it includes the three phases above
+    STATS_TTFB,
+    STATS_TRANSFER,
+    STATS_PARSE,
+    TOTAL_STATS_PHASES
+} stats_phase_e;
+
+/*
+ * A log-linear histogram, much like an HDR histogram
+ * Every power of two is split into STATS_SUB_BUCKETS equal buckets, so a value is never off by more than ~6%
+ * Values are in microseconds and anything above STATS_MAX_VALUE (about 71 minutes) is clamped
+ */
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_MAX_VALUE UINT32_MAX
+#define STATS_TOTAL_BUCKETS ((32 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef struct
+{
+    uint64_t total_samples;
+    uint32_t buckets[STATS_TOTAL_BUCKETS];
+} stats_histogram_t;
+
+// Only the latest STATS_ROLLING_WINDOW samples are counted, the oldest one is taken out as a new one comes in
+#define STATS_ROLLING_WINDOW 1024
+
+typedef struct
+{
+    stats_histogram_t histogram;
+    uint32_t samples[STATS_ROLLING_WINDOW];
+    size_t total_samples;
+} stats_rolling_histogram_t;
+
+typedef struct
+{
+    // Along with the scheme and the port, e.g. gemini://example.org:1966
+    char hostname[256];
+    uint64_t hash;
+
+    stats_histogram_t phases[TOTAL_STATS_PHASES];
+
+    // Pages that were shown straight out of the history versus those that had to be fetched
+    uint64_t hits, misses;
+} stats_host_t;
+
+typedef struct
+{
+    DYN_ARRAY(stats_host_t) hosts;
+} gemini_stats_t;
+
+// The statistics of previous sessions are loaded from the file, if it exists
+void gemini_stats_create(gemini_stats_t *stats, const char *path);
+void gemini_stats_save(gemini_stats_t *stats, const char *path);
+
+// Records every phase that was reached, the fetch counts as a miss
+void gemini_stats_record_fetch(gemini_stats_t *stats, const char *url, gemini_timings_t *timings);
+void gemini_stats_record_hit(gemini_stats_t *stats, const char *url);
+
+// Returns a gemtext page with the percentiles and the hit rate of every host, most visited first
+DYN_ARRAY(char) gemini_stats_create_page(gemini_stats_t *stats);
+
+void gemini_stats_destroy(gemini_stats_t *stats);
+
+void stats_histogram_add(stats_histogram_t *histogram, uint64_t value);
+
+// The percentile is between 0 and 100, returns zero if the histogram is empty
+uint64_t stats_histogram_get_percentile(stats_histogram_t *histogram, double percentile);
+
+void stats_rolling_histogram_add(stats_rolling_histogram_t *rolling, uint64_t value);
+
+#endif
@@ -0,0 +1,117 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "trace.h"
+
+#ifdef WITH_TRACING
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+    const char *name;
+    uint64_t start, end;
+} trace_event_t;
+
+// Only its own thread ever writes into a buffer, so adding an event never takes a lock
+// Once full, the oldest events get overwritten
+typedef struct trace_buffer_t
+{
+    struct trace_buffer_t *next;
+    pid_t thread_id;
+
+    // Keeps growing, the actual position is this modulo TRACE_BUFFER_SIZE
+    atomic_size_t total_events;
+    trace_event_t events[TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+// Buffers are pushed onto this list once and never removed, so they can be dumped even after their thread exits
+static _Atomic(trace_buffer_t*) buffers = NULL;
+static __thread trace_buffer_t *thread_buffer = NULL;
+
+static trace_buffer_t* create_thread_buffer(void)
+{
+    trace_buffer_t *buffer = calloc(1, sizeof(trace_buffer_t));
+    if (!buffer)
+        return NULL;
+
+    buffer->thread_id = gettid();
+    atomic_init(&buffer->total_events, 0);
+
+    buffer->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer));
+
+    return buffer;
+}
+
+void trace_add_event(const char *name, uint64_t start, uint64_t end)
+{
+    if (!thread_buffer && !(thread_buffer = create_thread_buffer()))
+        return;
+
+    size_t index = atomic_load_explicit(&thread_buffer->total_events, memory_order_relaxed);
+    trace_event_t *event = &thread_buffer->events[index % TRACE_BUFFER_SIZE];
+
+    event->name = name;
+    event->start = start;
+    event->end = end;
+
+    // Publishes the event to whoever is dumping the buffers
+    atomic_store_explicit(&thread_buffer->total_events, index + 1, memory_order_release);
+}
+
+void trace_scope_end(trace_scope_t *scope)
+{
+    trace_add_event(scope->name, scope->start, get_monotonic_time());
+}
+
+bool trace_dump(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\"traceEvents\":[");
+    bool is_first = true;
+
+    for (trace_buffer_t *buffer = atomic_load(&buffers); buffer; buffer = buffer->next)
+    {
+        size_t total_events = atomic_load_explicit(&buffer->total_events, memory_order_acquire);
+        size_t first_event = total_events > TRACE_BUFFER_SIZE ? total_events - TRACE_BUFFER_SIZE : 0;
+
+        // The owner might still be adding events while they're written, in which case
+        // the very oldest ones could be replaced halfway through. That's fine for a trace
+        for (size_t i = first_event; i < total_events; i++)
+        {
+            trace_event_t *event = &buffer->events[i % TRACE_BUFFER_SIZE];
+
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":%d,\"tid\":%d}",
+                    is_first ? "" : ",", event->name, event->start, event->end - event->start,
+                    getpid(), buffer->thread_id);
+            is_first = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif
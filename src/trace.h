@@ -0,0 +1,62 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "config.h"
+
+/*
+ * Trace scopes measure how long a block takes and record it into a buffer that belongs to the current thread
+ * The buffers can then be written out as Chrome trace events, which both chrome://tracing and Perfetto can open
+ * Without WITH_TRACING, TRACE_SCOPE expands to nothing at all, so the scopes can stay in the hot paths
+ */
+#ifdef WITH_TRACING
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "common.h"
+
+typedef struct
+{
+    const char *name;
+    uint64_t start;
+} trace_scope_t;
+
+// Called automatically once the scope's variable goes out of scope
+void trace_scope_end(trace_scope_t *scope);
+
+// The timestamps are in microseconds, as returned by get_monotonic_time
+void trace_add_event(const char *name, uint64_t start, uint64_t end);
+
+// Writes everything that's still inside the buffers of every thread, returns false if the file couldn't be written
+bool trace_dump(const char *path);
+
+#define TRACE_CONCATENATE(a, b) a##b
+#define TRACE_VARIABLE(line) TRACE_CONCATENATE(trace_scope_, line)
+
+// Lasts until the end of the enclosing block, early returns included
+#define TRACE_SCOPE(name) \
+    trace_scope_t TRACE_VARIABLE(__LINE__) __attribute__((cleanup(trace_scope_end))) = {name, get_monotonic_time()}
+
+#else
+
+#define TRACE_SCOPE(name)
+
+#endif
+
+#endif
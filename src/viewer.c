@@ -0,0 +1,133 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "viewer.h"
+#include "dynamic_array.h"
+#include "common.h"
+#include <ctype.h>
+
+int viewer_get_element_attributes(gemtext_line_e type)
+{
+    switch (type)
+    {
+    case GEMTEXT_HEADING_ONE:
+    case GEMTEXT_HEADING_TWO:
+    case GEMTEXT_HEADING_THREE:
+        return A_BOLD;
+        
+    case GEMTEXT_LINK: return A_ITALIC | COLOR_PAIR(COLOR_LINK);
+    case GEMTEXT_LIST_ITEM: return COLOR_PAIR(COLOR_LIST_ITEM);
+    case GEMTEXT_BLOCKQUOTE: return A_DIM;
+
+    default:
+        // Everything else will just show up as normal text
+        return A_NORMAL;
+    }
+}
+
+int viewer_print_text_with_word_breaks(WINDOW *window, size_t y_offset, char *buffer, size_t length)
+{
+    size_t buffer_index = 0;
+    size_t x_offset = 0;
+    size_t width = getmaxx(window);
+    size_t height = getmaxy(window);
+
+    if (!width)
+        return y_offset;
+    
+    // Nothing below the bottom of the window is visible, so there's no point in laying it out
+    // Otherwise a huge paragraph would cost as much as its length on every single frame
+    while (buffer_index < length && y_offset < height)
+    {
+        // Get the boundary of the next word, a word can't be any wider than the window anyway
+        size_t word_end = buffer_index;
+        size_t search_end = MIN(length, buffer_index + width);
+        while (word_end < search_end && !isspace(buffer[word_end])) word_end++;
+
+        // The word is printed along with the whitespace that follows it
+        size_t word_length = MIN(word_end + 1, length) - buffer_index;
+
+        // Check if the word fits on the current line
+        if (x_offset && x_offset + word_length > width)
+        {
+            x_offset = 0;
+            y_offset++;
+            continue;
+        }
+
+        // Words that are wider than the whole window are broken wherever the line ends
+        size_t printed_length = MIN(word_length, width - x_offset);
+        mvwaddnstr(window, y_offset, x_offset, buffer + buffer_index, printed_length);
+
+        x_offset += printed_length;
+        buffer_index += printed_length;
+    }
+
+    return y_offset;
+}
+
+int viewer_render_document(WINDOW *window, gemini_document_t *document, size_t scroll_offset)
+{
+    int total_elements_on_view = 0;
+    size_t y_offset = 0;
+    
+    // Get whatever ends first, either the screen's limit or the remaining elements
+    for (size_t i = scroll_offset; i < DYN_ARRAY_LENGTH(document->elements); i++)
+    {
+        // Check if we've reached the bottom of the screen
+        if (y_offset >= getmaxy(window) - 1)
+            break;
+
+        gemtext_line_t *line = &document->elements[i];
+        // Wrap each element on an attribute based on its type
+        int attrs = viewer_get_element_attributes(line->type);
+        
+        wattron(window, attrs);
+        // Add one to the offset because each gemini element represents a separate line
+        y_offset = viewer_print_text_with_word_breaks(window, y_offset, document->content + line->start,
+                                                      line->end - line->start + 1) + 1;
+        wattroff(window, attrs);
+
+        // Some elements require some extra spacing to improve readability
+        switch (line->type)
+        {
+        case GEMTEXT_PARAGRAPH:
+        case GEMTEXT_HEADING_ONE:
+        case GEMTEXT_HEADING_TWO:
+        case GEMTEXT_HEADING_THREE:
+        case GEMTEXT_BLOCKQUOTE:
+            y_offset++;
+            break;
+
+        case GEMTEXT_LINK:
+        case GEMTEXT_LIST_ITEM:
+        case GEMTEXT_PREFORMATTED:
+            // If this is the element of a chain, add some spacing at the bottom
+            if (i != DYN_ARRAY_LENGTH(document->elements) - 1 &&
+                document->elements[i + 1].type != line->type)
+            {
+                y_offset++;
+            }
+            
+            break;
+        }
+
+        total_elements_on_view++;
+    }
+
+    return total_elements_on_view;
+}
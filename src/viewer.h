@@ -0,0 +1,45 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VIEWER_H
+#define _VIEWER_H
+
+/*
+ * Draws documents onto ncurses windows
+ * It doesn't depend on any of the frontend's state, so the benchmarks can render into windows of their own
+ */
+
+#include <stddef.h>
+#include <ncurses.h>
+#include "gemini.h"
+
+enum
+{
+    COLOR_LINK = 1,
+    COLOR_LIST_ITEM
+};
+
+int viewer_get_element_attributes(gemtext_line_e type);
+
+// Returns the new y_offset of the window after the given text buffer has been appended
+int viewer_print_text_with_word_breaks(WINDOW *window, size_t y_offset, char *buffer, size_t length);
+
+// Draws the elements starting from the given one, until the window is full
+// Returns the amount of elements that were drawn. The window is neither cleared nor refreshed
+int viewer_render_document(WINDOW *window, gemini_document_t *document, size_t scroll_offset);
+
+#endif
@@ -0,0 +1,311 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "warmup.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every hop is another full request, bookmarks rarely need more than one
+#define MAX_REDIRECTS 3
+
+static char *metered_interfaces[] = {WARMUP_METERED_INTERFACES};
+
+static void release_document(void *data)
+{
+    // Taken documents leave an empty entry behind
+    if (data)
+        gemini_document_destroy(data);
+}
+
+void warmup_create(warmup_t *warmup)
+{
+    memset(warmup->is_active, 0, sizeof(warmup->is_active));
+    memset(warmup->is_resolving, 0, sizeof(warmup->is_resolving));
+    warmup->total_urls = warmup->next_url = 0;
+    warmup->ctx = NULL;
+    warmup->allocator = NULL;
+
+    gemini_cache_create(&warmup->pages, WARMUP_CACHE_SIZE, WARMUP_LIFETIME * 1000000ULL);
+    resolver_create(&warmup->resolver);
+}
+
+void warmup_add(warmup_t *warmup, const char *url)
+{
+    if (warmup->total_urls == WARMUP_MAX_URLS || strncmp(url, "gemini://", 9) || strlen(url) > 1022)
+        return;
+
+    for (size_t i = 0; i < warmup->total_urls; i++)
+        if (!strcmp(warmup->urls[i], url))
+            return;
+
+    strcpy(warmup->urls[warmup->total_urls++], url);
+}
+
+/*
+ * Whatever the default route goes through decides: without one there's no network to speak of,
+ * while mobile broadband and tethering are usually paid for by the byte
+ */
+static bool is_network_suitable(void)
+{
+    FILE *routes = fopen("/proc/net/route", "r");
+    if (!routes)
+        return false;
+
+    char line[256], interface[64];
+    unsigned long destination, mask;
+    bool is_suitable = false;
+
+    // The first line holds the column names
+    fgets(line, sizeof(line), routes);
+
+    while (fgets(line, sizeof(line), routes))
+    {
+        if (sscanf(line, "%63s %lx %*x %*x %*d %*d %*d %lx", interface, &destination, &mask) != 3 ||
+            destination || mask)
+            continue;
+
+        is_suitable = true;
+        for (size_t i = 0; i < sizeof(metered_interfaces) / sizeof(metered_interfaces[0]); i++)
+            if (!strncmp(interface, metered_interfaces[i], strlen(metered_interfaces[i])))
+                is_suitable = false;
+
+        break;
+    }
+
+    fclose(routes);
+    return is_suitable;
+}
+
+static void finish_request(warmup_t *warmup, int slot);
+
+// Requests whose host couldn't be resolved are done before they've had a descriptor to wait on
+static void connect_request(warmup_t *warmup, int slot, const resolver_address_t *address)
+{
+    gemini_request_start_with_address(&warmup->requests[slot], warmup->ctx, warmup->targets[slot], warmup->allocator,
+                                      address ? &address->address : NULL, address ? address->length : 0);
+    warmup->requests[slot].max_content_length = WARMUP_CACHE_SIZE;
+
+    if (warmup->requests[slot].phase == GEMINI_REQUEST_DONE)
+        finish_request(warmup, slot);
+}
+
+// Never waits for the host, if it's not known yet the request is started once the resolver has found it
+static void launch_request(warmup_t *warmup, int slot, char *url)
+{
+    snprintf(warmup->targets[slot], sizeof(warmup->targets[slot]), "%s", url);
+
+    const resolver_address_t *address = resolver_lookup(&warmup->resolver, url, &warmup->is_resolving[slot]);
+    if (!warmup->is_resolving[slot])
+        connect_request(warmup, slot, address);
+}
+
+static void start_next_request(warmup_t *warmup, int slot)
+{
+    char *url = warmup->urls[warmup->next_url++];
+
+    strcpy(warmup->origins[slot], url);
+    warmup->total_redirects[slot] = 0;
+    warmup->deadlines[slot] = get_monotonic_time() + WARMUP_TIMEOUT * 1000000ULL;
+    warmup->is_active[slot] = true;
+
+    launch_request(warmup, slot, url);
+}
+
+bool warmup_start(warmup_t *warmup, SSL_CTX *ctx, const dyn_array_allocator_t *allocator)
+{
+    if (!warmup->total_urls || !is_network_suitable())
+        return false;
+
+    warmup->ctx = ctx;
+    warmup->allocator = allocator;
+
+    for (int i = 0; i < WARMUP_CONCURRENCY && warmup->next_url < warmup->total_urls; i++)
+        start_next_request(warmup, i);
+
+    return true;
+}
+
+void warmup_fill_descriptors(warmup_t *warmup, struct pollfd *descriptors)
+{
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+    {
+        descriptors[i].fd = warmup->is_active[i] ? warmup->requests[i].connection : -1;
+        descriptors[i].events = warmup->is_active[i] ? gemini_request_get_poll_events(&warmup->requests[i]) : 0;
+        descriptors[i].revents = 0;
+
+        if (warmup->is_active[i] && warmup->is_resolving[i])
+        {
+            descriptors[i].fd = warmup->resolver.notification;
+            descriptors[i].events = POLLIN;
+        }
+    }
+}
+
+int warmup_get_timeout(warmup_t *warmup)
+{
+    uint64_t next_deadline = 0;
+
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+        if (warmup->is_active[i] && (!next_deadline || warmup->deadlines[i] < next_deadline))
+            next_deadline = warmup->deadlines[i];
+
+    if (!next_deadline)
+        return -1;
+
+    // Rounded up, so that the loop doesn't spin for the last millisecond before a deadline
+    uint64_t now = get_monotonic_time();
+    return next_deadline > now ? (next_deadline - now + 999) / 1000 : 0;
+}
+
+// Only successful text responses are kept, input prompts and errors are left for when the user gets there
+static void finish_request(warmup_t *warmup, int slot)
+{
+    gemini_request_t *request = &warmup->requests[slot];
+    warmup->is_resolving[slot] = false;
+
+    if (request->status[0] == '3' && request->error == GEMINI_OK && request->meta &&
+        warmup->total_redirects[slot] < MAX_REDIRECTS)
+    {
+        char *new_url = has_protocol_scheme(request->meta) ? strdup(request->meta) :
+            join_relative_link_to_url(request->url, request->meta);
+
+        gemini_request_destroy(request);
+        warmup->total_redirects[slot]++;
+
+        launch_request(warmup, slot, new_url);
+        free(new_url);
+        return;
+    }
+
+    if (request->status[0] == '2' && request->error == GEMINI_OK && request->content)
+    {
+        gemini_document_t *document = gemini_document_from_request(request);
+        size_t size = document->content ? DYN_ARRAY_LENGTH(document->content) : 0;
+
+        if (document->error != GEMINI_OK || !document->content ||
+            !gemini_cache_insert(&warmup->pages, warmup->origins[slot], document, size, release_document))
+            gemini_document_destroy(document);
+    }
+
+    gemini_request_destroy(request);
+    warmup->is_active[slot] = false;
+
+    if (warmup->next_url < warmup->total_urls)
+        start_next_request(warmup, slot);
+}
+
+void warmup_advance(warmup_t *warmup, struct pollfd *descriptors,
+                    void (*on_fetch) (void *data, const char *url, gemini_timings_t *timings), void *data)
+{
+    bool has_lookups = false;
+
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+        if (warmup->is_active[i] && warmup->is_resolving[i] && descriptors[i].revents)
+            has_lookups = true;
+
+    // The slots that were waiting for their hosts connect now, they'll be advanced once their own socket is ready
+    if (has_lookups && resolver_collect(&warmup->resolver))
+    {
+        for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+        {
+            if (!warmup->is_active[i] || !warmup->is_resolving[i])
+                continue;
+
+            const resolver_address_t *address = resolver_lookup(&warmup->resolver, warmup->targets[i],
+                                                                &warmup->is_resolving[i]);
+            if (!warmup->is_resolving[i])
+                connect_request(warmup, i, address);
+
+            descriptors[i].revents = 0;
+        }
+    }
+
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+    {
+        gemini_request_t *request = &warmup->requests[i];
+        if (!warmup->is_active[i] || warmup->is_resolving[i] || !descriptors[i].revents)
+            continue;
+
+        if (gemini_request_advance(request))
+        {
+            gemini_timings_t timings;
+            gemini_request_get_timings(request, &timings);
+            on_fetch(data, request->url, &timings);
+
+            finish_request(warmup, i);
+        }
+        // It could never be kept anyway, so there's no point in downloading the rest
+        else if (request->content && DYN_ARRAY_LENGTH(request->content) >= WARMUP_CACHE_SIZE)
+        {
+            gemini_request_finish(request, GEMINI_SERVER_CONNECTION_FAILURE);
+            finish_request(warmup, i);
+        }
+    }
+
+    // Whatever took too long is dropped without a trace, the user will find out when they visit it
+    uint64_t now = get_monotonic_time();
+
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+    {
+        if (!warmup->is_active[i] || warmup->deadlines[i] > now)
+            continue;
+
+        // The lookup goes on without it, the resolver will have it ready for when the user gets there
+        if (warmup->is_resolving[i])
+        {
+            warmup->is_resolving[i] = false;
+            connect_request(warmup, i, NULL);
+            continue;
+        }
+
+        gemini_request_finish(&warmup->requests[i], GEMINI_SERVER_CONNECTION_FAILURE);
+        finish_request(warmup, i);
+    }
+}
+
+gemini_document_t* warmup_take(warmup_t *warmup, const char *url)
+{
+    cache_entry_t *entry = gemini_cache_lookup(&warmup->pages, url);
+    if (!entry)
+        return NULL;
+
+    // Every document is only ever shown once, afterwards it lives in the history
+    gemini_document_t *document = entry->data;
+    entry->data = NULL;
+    gemini_cache_remove(&warmup->pages, url);
+
+    return document;
+}
+
+void warmup_clear(warmup_t *warmup)
+{
+    while (warmup->pages.oldest)
+        gemini_cache_remove(&warmup->pages, warmup->pages.oldest->key);
+}
+
+void warmup_destroy(warmup_t *warmup)
+{
+    for (int i = 0; i < WARMUP_CONCURRENCY; i++)
+        if (warmup->is_active[i] && !warmup->is_resolving[i])
+            gemini_request_destroy(&warmup->requests[i]);
+
+    gemini_cache_destroy(&warmup->pages);
+    resolver_destroy(&warmup->resolver);
+}
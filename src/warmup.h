@@ -0,0 +1,92 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARMUP_H
+#define _WARMUP_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include "gemini.h"
+#include "cache.h"
+#include "resolver.h"
+#include "config.h"
+
+// The bookmarks and the home page
+#define WARMUP_MAX_URLS 10
+
+/*
+ * Fetches the pages that are opened the most (the bookmarks and the home page) in the background after start-up
+ * At most WARMUP_CONCURRENCY requests are in flight at once, they never block and are advanced by the frontend's
+ * event loop, just like revalidations. Parsed documents are kept until they're visited or expire
+ * Hosts are looked up by the resolver's threads, a request only starts once the address of its host is known
+ */
+typedef struct
+{
+    gemini_request_t requests[WARMUP_CONCURRENCY];
+    bool is_active[WARMUP_CONCURRENCY];
+
+    // Documents are found by the URL that was asked for, which might have redirected somewhere else
+    char origins[WARMUP_CONCURRENCY][1024];
+    int total_redirects[WARMUP_CONCURRENCY];
+
+    // Stalling hosts would otherwise keep their slots (and every bookmark after them) forever
+    uint64_t deadlines[WARMUP_CONCURRENCY];
+
+    // Slots whose host is still being looked up wait on the resolver's notification, with the URL they'll fetch
+    bool is_resolving[WARMUP_CONCURRENCY];
+    char targets[WARMUP_CONCURRENCY][1024];
+    resolver_t resolver;
+
+    char urls[WARMUP_MAX_URLS][1024];
+    size_t total_urls, next_url;
+
+    SSL_CTX *ctx;
+    const dyn_array_allocator_t *allocator;
+    gemini_cache_t pages;
+} warmup_t;
+
+void warmup_create(warmup_t *warmup);
+
+// Duplicates and URLs that aren't gemini:// are ignored
+void warmup_add(warmup_t *warmup, const char *url);
+
+/*
+ * Starts fetching the URLs that were added, unless the network is down or metered (see WARMUP_METERED_INTERFACES)
+ * Returns false if nothing was started
+ */
+bool warmup_start(warmup_t *warmup, SSL_CTX *ctx, const dyn_array_allocator_t *allocator);
+
+// Fills WARMUP_CONCURRENCY descriptors, inactive requests are left negative so that poll ignores them
+void warmup_fill_descriptors(warmup_t *warmup, struct pollfd *descriptors);
+
+// How long poll may wait before warmup_advance has to give up on a request (in milliseconds), -1 if there is none
+int warmup_get_timeout(warmup_t *warmup);
+
+// Advances every request whose descriptor is ready, and gives up on the ones that are past their deadline
+// Returns a completed request's timings through the callback
+void warmup_advance(warmup_t *warmup, struct pollfd *descriptors,
+                    void (*on_fetch) (void *data, const char *url, gemini_timings_t *timings), void *data);
+
+// Hands a warmed-up document over to the caller, or returns NULL if there is none
+gemini_document_t* warmup_take(warmup_t *warmup, const char *url);
+
+// Lets go of every document that's still waiting to be visited
+void warmup_clear(warmup_t *warmup);
+
+void warmup_destroy(warmup_t *warmup);
+
+#endif
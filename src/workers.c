@@ -0,0 +1,117 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// Needed for sched_setaffinity and the CPU_* macros
+#define _GNU_SOURCE
+
+#include "workers.h"
+#include "common.h"
+#include "config.h"
+#include <sched.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    pthread_t thread;
+    size_t index;
+    int cpu;
+
+    worker_function_t function;
+    void *data;
+} worker_t;
+
+size_t workers_get_total(void)
+{
+    if (WORKER_THREADS > 0)
+        return WORKER_THREADS;
+
+    // Cores that were taken away (e.g. by taskset or a cgroup) would only be contended for
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 1;
+
+    return MAX(CPU_COUNT(&set), 1);
+}
+
+size_t workers_get_owner(const char *gemini_url, size_t total_workers)
+{
+    // FNV-1a over the hostname (and port), names are case-insensitive
+    uint64_t hash = 14695981039346656037ULL;
+    int hostname_length = get_hostname_length((char*) gemini_url);
+
+    for (int i = 0; i < hostname_length; i++)
+    {
+        hash ^= (unsigned char) tolower(gemini_url[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash % total_workers;
+}
+
+static void* run_worker(void *data)
+{
+    worker_t *worker = data;
+
+    // Staying on the same core keeps the worker's connections and caches warm
+    if (worker->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    worker->function(worker->index, worker->data);
+    return NULL;
+}
+
+void workers_run(size_t total_workers, worker_function_t function, void *data)
+{
+    worker_t *workers = calloc(total_workers, sizeof(worker_t));
+
+    // Workers are spread over the cores that the process is allowed to run on, in order
+    cpu_set_t allowed;
+    size_t total_cpus = 0;
+    int cpus[CPU_SETSIZE];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus[total_cpus++] = cpu;
+    }
+
+    for (size_t i = 0; i < total_workers; i++)
+    {
+        workers[i] = (worker_t) {
+            .index = i,
+            .cpu = total_cpus ? cpus[i % total_cpus] : -1,
+            .function = function,
+            .data = data
+        };
+
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+
+    for (size_t i = 0; i < total_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    free(workers);
+}
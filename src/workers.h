@@ -0,0 +1,40 @@
+/* Astrology
+ * Copyright (C) 2024 Petros Katiforis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+#include <stddef.h>
+
+/*
+ * Shared-nothing event loops for the non-interactive modes (astrology --fetch and --serve)
+ * Every worker runs its own loop on its own thread, pinned to its own core, with its own TLS context, DNS cache,
+ * connections and caches. Hosts are assigned to workers by the hash of their name, so that a host's state
+ * only ever lives in a single place and nothing has to be locked
+ */
+
+typedef void (*worker_function_t) (size_t index, void *data);
+
+// WORKER_THREADS, or one worker per core that the process is allowed to run on
+size_t workers_get_total(void);
+
+// Returns the index of the worker that's responsible for the host of the URL
+size_t workers_get_owner(const char *gemini_url, size_t total_workers);
+
+// Runs the function once per worker, each on a thread of its own, and waits for all of them to return
+void workers_run(size_t total_workers, worker_function_t function, void *data);
+
+#endif